@@ -134,6 +134,18 @@ namespace luafxbuilder
     NUM_GENERERATORS,
   };
 
+  enum GeneratorLimits {
+    GENERATOR_UBO_MAXGROUPS = 32,   // array size of indexed uniformbuffer groups, fxenums.limits.ubomaxgroups
+  };
+
+  enum FreezeFlags {
+    FREEZE_SNAPSHOT   = 0,        // native metadata only, lua data untouched
+    FREEZE_COLLECT    = 1 << 0,   // full garbage collection
+    FREEZE_STOPGC     = 1 << 1,   // collects, then stops the collector until unfreeze
+    FREEZE_DROPFILES  = 1 << 2,   // FILE sources cached for codegen, read again on use
+    FREEZE_RELEASELUA = 1 << 3,   // closes the lua state, only cached code can be generated
+  };
+
   //typedef int GeneratorType;
   //typedef int StorageType;
 
@@ -145,7 +157,13 @@ namespace luafxbuilder
   typedef struct Group_*    GroupID;
   typedef struct Tech_*     TechID;
   typedef struct Enum_*     EnumID;
+  typedef struct Name_*     NameID;
+  typedef struct Step_*     StepID;
+  typedef struct LightConfig_* LightConfigID;
   typedef bool              error;
+  typedef unsigned long long CodeHash;
+  // lua_Alloc compatible, see PoolAllocator
+  typedef void* (*AllocFunc)(void* ud, void* ptr, size_t osize, size_t nsize);
 
   struct ParameterStorage {
     size_t  size;           // size within struct
@@ -155,6 +173,63 @@ namespace luafxbuilder
     size_t  align;
   };
 
+  struct CodeCacheStats {
+    size_t  hits;
+    size_t  misses;
+    size_t  entries;
+    size_t  bytes;          // generated characters held by the cache
+    size_t  unique;         // distinct code strings, identical outputs are stored once
+    size_t  uniqueBytes;
+  };
+
+  struct CodeOutput {
+    TechID          tech;
+    GeneratorType   gentype;
+    int             codeidx;
+  };
+
+  struct ProgramCode {
+    GeneratorType   gentype;
+    int             codeidx;
+    const char*     code;           // zero terminated, held by the code cache
+    size_t          codesize;
+    CodeHash        hash;
+  };
+
+  // generated code as ordered segments, matches glShaderSource arguments
+  struct SegmentedCode {
+    int                 count;
+    const char* const*  strings;    // zero terminated, shared with other outputs
+    const int*          lengths;
+    size_t              size;       // sum of lengths
+    CodeHash            hash;       // as techniqueGenerateCodeHash
+  };
+
+  struct FileCacheStats {
+    size_t  reads;          // FILE sources loaded from disk
+    size_t  hits;
+    size_t  entries;
+    size_t  bytes;          // content held by the cache
+  };
+
+  // cumulative since init or resetStats, timers in nanoseconds
+  struct SystemStats {
+    size_t              libraryLoads;       // addLibraryFile/String, reloadLibraryFile
+    unsigned long long  libraryTime;
+    size_t              codegenCalls[NUM_GENERERATORS];  // fxcodegen, cache misses
+    unsigned long long  codegenTime[NUM_GENERERATORS];
+    size_t              codegenBytes;
+    size_t              groupStoreCalls;    // fxgroupstore, layouts not computed natively
+    unsigned long long  groupStoreTime;
+    size_t              luaErrors;          // failed pcalls
+    size_t              luaHeapBytes;       // current size, not affected by reset
+  };
+
+  struct LibraryFileStats {
+    size_t              loads;              // parses through addLibraryFile or reloadLibraryFile
+    unsigned long long  time;
+  };
+
   struct ParameterInfo {
     ParameterType   type;
     int             arraySize;
@@ -166,11 +241,38 @@ namespace luafxbuilder
     };
   };
 
+  struct Snapshot;
+  struct SnapshotOption;
+  struct SnapshotParameter;
+  class  NameTable;
+  class  CodeCache;
+  class  SegmentCache;
+  struct CodeBlob;
+  struct GenerateStep;
+  struct LightConfig;
+  class  LightSets;
+  class  DefaultBlockCache;
+  struct PoolWorker;
+
   class System {
+    friend struct PoolWorker;
+
   private:
     LuaState      m_luaState;
     char*         m_lastError;
     size_t        m_lastErrorSize;
+    Snapshot*     m_frozen;
+    NameTable*    m_names;
+    CodeCache*    m_codeCache;
+    SegmentCache* m_segmentCache;
+    DefaultBlockCache* m_defaultBlocks;
+    LightSets*    m_lightSets;
+    unsigned int  m_lightsSerial;
+    SystemStats   m_stats;
+    bool          m_gcStopped;
+    GenerateStep* m_steps;
+    GenerateStep* m_stepRunning;
+    LightConfig*  m_lightConfigs;
 
   public:
     size_t        getLastErrorString(char* buffer, size_t buffersize);
@@ -178,11 +280,63 @@ namespace luafxbuilder
     std::string   getLastErrorString();
 #endif
     error         init(const char* processorFile);
+      // lua state allocates through alloc(allocud,...) which must outlive deinit
+    error         init(const char* processorFile, AllocFunc alloc, void* allocud);
     void          deinit();
 
     error         addLibraryFile    (const char* filename); // returns true on error
     error         addLibraryString  (const char* buffer, size_t buffersize);  // returns true on error
 
+      // parses all library files depending on filename again, which is a file
+      // loaded by addLibraryFile, a FILE source or a dofile include. Redefined
+      // effects keep the ids of their previous definition, groups and techniques
+      // are matched by name. Drops the snapshot, generated code is only
+      // invalidated for the affected techniques. Returns true on error.
+    error         reloadLibraryFile (const char* filename);
+      // sorted ids of the techniques affected by the last reload
+    int           getReloadedTechniqueCount();
+    TechID        getReloadedTechnique(int i);
+      // every file the loaded libraries depend on
+    int           getLibraryFileCount();
+    size_t        getLibraryFileName (int i, char* buffer, size_t buffersize);
+#if LUAFXBUILDER_USESTRING
+    std::string   getLibraryFileName (int i);
+#endif
+      // parse time spent on the file, reloads count towards the file passed
+      // to reloadLibraryFile
+    void          getLibraryFileStats(int i, LibraryFileStats* stats);
+
+      // where time goes: parsing, layouts, codegen, also lua heap and errors.
+      // reset to sample per frame or level load
+    void          getStats      (SystemStats* stats);
+    void          resetStats    ();
+
+      // walks all loaded effects once and keeps a native copy of the metadata,
+      // all following read-only queries are served without the lua state.
+      // adding libraries drops the snapshot, call freeze again afterwards.
+    error         freeze();
+      // FreezeFlags release what the remaining consumers do not need. With a
+      // stopped collector, code generation grows the heap until collectGarbage
+      // or unfreeze. Releasing lua makes the System behave like initFromImage.
+      // reclaimed (can be NULL) receives the lua heap bytes freed.
+    error         freeze(unsigned int flags, size_t* reclaimed);
+    void          unfreeze();
+    bool          isFrozen();
+      // full collection, also while stopped by freeze, returns bytes freed
+    size_t        collectGarbage();
+
+      // writes the frozen metadata including the storage of all generators
+      // into a binary image, freezes if required.
+    error         saveImage(const char* filename);
+      // alternative to init, metadata queries are served from the image
+      // without a lua state, the System stays frozen. Code generation and
+      // adding libraries are not possible.
+    error         initFromImage(const char* imageFile);
+
+      // interned names stay valid for the lifetime of the System, the NameID
+      // overloads below resolve by binary search in the frozen state.
+    NameID        internName(const char* name);
+
     //error       registerGenerator   (GeneratorType type, const char* filename, const char* name );
     //error       registerStorageType (StorageType type, const char* name);
 
@@ -215,11 +369,15 @@ namespace luafxbuilder
     GroupID       effectGetGroup          (EffectID effect, int i);
     GroupID       effectGetGroup          (EffectID effect, const char* name);
     int           effectGetGroupIndex     (EffectID effect, const char* name);
+    GroupID       effectGetGroup          (EffectID effect, NameID name);
+    int           effectGetGroupIndex     (EffectID effect, NameID name);
 
     int           effectGetTechniqueCount (EffectID effect);
     TechID        effectGetTechnique      (EffectID effect, int i);
     TechID        effectGetTechnique      (EffectID effect, const char* name);
     int           effectGetTechniqueIndex (EffectID effect, const char* name);
+    TechID        effectGetTechnique      (EffectID effect, NameID name);
+    int           effectGetTechniqueIndex (EffectID effect, NameID name);
 
     size_t        groupGetName            (GroupID group, char* buffer, size_t buffersize);
 #if LUAFXBUILDER_USESTRING
@@ -228,6 +386,7 @@ namespace luafxbuilder
     GroupType     groupGetType            (GroupID group);
     EffectID      groupGetEffect          (GroupID group);
     int           groupGetParameterIndex  (GroupID group, const char* name);
+    int           groupGetParameterIndex  (GroupID group, NameID name);
     int           groupGetParameterCount  (GroupID group);
     size_t        groupGetParameterName   (GroupID group, int i, char* buffer, size_t buffersize);
 #if LUAFXBUILDER_USESTRING
@@ -250,31 +409,115 @@ namespace luafxbuilder
     bool          techniqueGetOptionBool    (TechID tech, const char* name);
     int           techniqueGetOptionInteger (TechID tech, const char* name);
     float         techniqueGetOptionFloat   (TechID tech, const char* name);
+    bool          techniqueHasOption        (TechID tech, NameID name);
+    size_t        techniqueGetOptionString  (TechID tech, NameID name, char* buffer, size_t buffersize);
+#if LUAFXBUILDER_USESTRING
+    std::string   techniqueGetOptionString  (TechID tech, NameID name);
+#endif
+    bool          techniqueGetOptionBool    (TechID tech, NameID name);
+    int           techniqueGetOptionInteger (TechID tech, NameID name);
+    float         techniqueGetOptionFloat   (TechID tech, NameID name);
     int           techniqueGetCodeCount     (TechID tech);
     int           techniqueGetCodeIndex     (TechID tech, const char* name);
+    int           techniqueGetCodeIndex     (TechID tech, NameID name);
     size_t        techniqueGetCodeName      (TechID tech, int codeidx, char* buffer, size_t buffersize);
 #if LUAFXBUILDER_USESTRING
     std::string   techniqueGetCodeName      (TechID tech, int codeidx);
 #endif
     // code generation related
     //////////////////////////
+      // code of the last 4 light sets stays cached, older sets are dropped
+      // unless a light configuration uses them
     error         setGeneratorLights        (int numLights, EffectID* lights, int *lightsMax);
+      // light sets kept side by side, e.g. one per render pass, each with its
+      // own LIGHTGROUP text. Passed to the generate calls below, NULL stands
+      // for setGeneratorLights. Configurations of the same lights share
+      // cached code. Returns NULL on error, steps begun with a configuration
+      // must end before it is destroyed. Destroying the last configuration
+      // of a light set drops its cached code, unless setGeneratorLights
+      // used the set recently.
+    LightConfigID createLightConfig         (int numLights, EffectID* lights, int *lightsMax);
+    void          destroyLightConfig        (LightConfigID config);
 
       // returns true on error
+      // results are cached per tech, codeidx, gentype and the current lights
+      // (for techniques with lighting), adding libraries clears the cache
     error         techniqueGenerateCode (TechID tech, GeneratorType gentype, int codeidx, char* buffer, size_t buffersize, size_t* outsize); 
 #if LUAFXBUILDER_USESTRING                             
     error         techniqueGenerateCode (TechID tech, GeneratorType gentype, int codeidx, std::string& buffer); 
 #endif
+      // zero-copy access to the cached code, string is zero terminated and
+      // stays valid until the cache is cleared (clearCodeCache, addLibrary, deinit)
+    error         techniqueGenerateCodeView (TechID tech, GeneratorType gentype, int codeidx, const char** code, size_t* codesize);
+    error         techniqueGenerateCodeView (TechID tech, GeneratorType gentype, int codeidx, LightConfigID lights, const char** code, size_t* codesize);
+      // 64-bit content hash of the generated code, stable across runs and
+      // platforms. canonical (can be NULL) receives the first output that
+      // generated identical code, all outputs with the same hash share its string
+    error         techniqueGenerateCodeHash (TechID tech, GeneratorType gentype, int codeidx, CodeHash* hash, CodeOutput* canonical);
+    error         techniqueGenerateCodeHash (TechID tech, GeneratorType gentype, int codeidx, LightConfigID lights, CodeHash* hash, CodeOutput* canonical);
+      // all codes of the technique for several generators in one lua call,
+      // group structs, defines and enums are generated once and shared.
+      // gentypes must be distinct, outputs must hold numGenerators *
+      // techniqueGetCodeCount entries, ordered by generator then code.
+      // Strings stay valid as for techniqueGenerateCodeView, cached codes
+      // are not generated again.
+    error         techniqueGenerateProgram  (TechID tech, int numGenerators, const GeneratorType* gentypes, ProgramCode* outputs);
+    error         techniqueGenerateProgram  (TechID tech, LightConfigID lights, int numGenerators, const GeneratorType* gentypes, ProgramCode* outputs);
+      // resumable generation, spreads one output over several calls with a
+      // bounded cost each. generateStep resumes it until the code is cached or
+      // budgetMicroseconds ran out (checked between code blocks and lights),
+      // then done is set and the code is served by techniqueGenerateCodeView.
+      // Steps restart when their technique is reloaded or the lights change.
+    StepID        techniqueGenerateBegin(TechID tech, GeneratorType gentype, int codeidx);
+    StepID        techniqueGenerateBegin(TechID tech, GeneratorType gentype, int codeidx, LightConfigID lights);
+    error         generateStep          (StepID step, unsigned int budgetMicroseconds, bool* done);
+    void          generateEnd           (StepID step);
+      // the code split into the blocks of the generator (header, FILE
+      // sources, lights, uniforms). Identical segments of all outputs are
+      // stored once, the arrays stay valid as for techniqueGenerateCodeView.
+      // Kept apart from the string cache, stats in getSegmentCacheStats
+      // (unique counts segments).
+    error         techniqueGenerateSegments (TechID tech, GeneratorType gentype, int codeidx, SegmentedCode* code);
+    error         techniqueGenerateSegments (TechID tech, GeneratorType gentype, int codeidx, LightConfigID lights, SegmentedCode* code);
+    void          getSegmentCacheStats  (CodeCacheStats* stats);
+    void          getCodeCacheStats     (CodeCacheStats* stats);
+    void          resetCodeCacheStats   ();
+    void          clearCodeCache        ();
+      // FILE sources are read once and shared by all generators, the cache
+      // validates them by size and modification time
+    void          getFileCacheStats     (FileCacheStats* stats);
+    void          resetFileCacheStats   ();
+      // code generated so far that used the file (library file, include, FILE
+      // source or generator script) or effect (own techniques, GlobalGroup users,
+      // lit techniques for lights). Sorted by tech, codeidx and gentype,
+      // returns the number of outputs, pass NULL to query it.
+    int           getDependentCode      (const char* filename, int maxoutputs, CodeOutput* outputs);
+    int           getDependentCode      (EffectID effect, int maxoutputs, CodeOutput* outputs);
     // must hold parameters+1 storage entries, last is for entire struct
     StorageType   groupGenerateStorage    (GroupID group, GeneratorType gentype, int bufferelements, ParameterStorage* buffer);
+      // same through the lua layout rules, for cross-checking the native ones
+    StorageType   groupGenerateStorageLua (GroupID group, GeneratorType gentype, int bufferelements, ParameterStorage* buffer);
     size_t        groupGenerateStorageName(GroupID group, GeneratorType gentype, char* buffer, size_t buffersize);
 #if LUAFXBUILDER_USESTRING
     std::string   groupGenerateStorageName(GroupID group, GeneratorType gentyp);
 #endif
+      // all default values of the group in the storage layout of the generator,
+      // ready for upload. Texture handles are left zero. Returns the block size,
+      // pass NULL to query it. Blocks are cached per group and generator.
+    size_t        groupBuildDefaultBlock  (GroupID group, GeneratorType gentype, size_t buffersize, void* buffer);
 
   private:
     bool        addLibrary(const char* funcname, const char* buffer, size_t buffersize);
     void        updateError();
+    void        setError(const char* msg);
+    void        restartSteps(const size_t* techs, size_t numTechs); // NULL for all
+    void        addLibraryTime(const char* filename, unsigned long long time);
+    bool        pushLights(int numLights, EffectID* lights, int* lightsMax, unsigned int* serial);
+    unsigned int getLightsKey(TechID tech, const LightConfig* lights);
+    void        releaseLights(unsigned int serial);
+    const CodeBlob* generateBlob(TechID tech, GeneratorType gentype, int codeidx, const LightConfig* lights);
+    bool        generateCode(TechID tech, GeneratorType gentype, int codeidx, const LightConfig* lights, const char** str, size_t* size, CodeHash* hash);
+    int         getDependents(int maxoutputs, CodeOutput* outputs);
 
     size_t      getID();
     int         idGetCount  (size_t id, const char* what);
@@ -292,6 +535,12 @@ namespace luafxbuilder
 #if LUAFXBUILDER_USESTRING
     std::string idGetSubName(size_t id, const char* what, int i);
 #endif
+    size_t      nameGet     (unsigned int name, char* buffer, size_t buffersize);
+#if LUAFXBUILDER_USESTRING
+    std::string nameGet     (unsigned int name);
+#endif
+    const SnapshotOption*     findOption    (TechID tech, unsigned int name);
+    const SnapshotParameter&  findParameter (GroupID group, int i);
   };
 }
 
@@ -0,0 +1,75 @@
+/*
+    Copyright (c) 2012, NVIDIA CORPORATION. All rights reserved.
+    Copyright (c) 2012, Christoph Kubisch. All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions
+    are met:
+     * Redistributions of source code must retain the above copyright
+       notice, this list of conditions and the following disclaimer.
+     * Neither the name of NVIDIA CORPORATION nor the names of its
+       contributors may be used to endorse or promote products derived
+       from this software without specific prior written permission.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ``AS IS'' AND ANY
+    EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+    PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+    CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+    EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+    PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+    PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+    OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+    (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+    OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+    Contact: Christoph Kubisch ckubisch@nvidia.com 
+*/
+
+#ifndef LUAFXBUILDER_ALLOC_H_
+#define LUAFXBUILDER_ALLOC_H_
+
+#include <luafxbuilder/luafxbuilder.h>
+
+namespace luafxbuilder
+{
+  struct AllocatorStats {
+    size_t  allocs;         // new blocks
+    size_t  frees;
+    size_t  reallocs;       // resizes of existing blocks
+    size_t  failures;       // requests denied by the limit or malloc
+    size_t  current;        // bytes requested by lua
+    size_t  peak;
+    size_t  reserved;       // bytes held by size class pages
+    size_t  large;          // live blocks above the largest size class
+  };
+
+  struct AllocState;
+
+  // Allocator for the lua state of a System, pass PoolAllocator::alloc and
+  // the allocator to System::init. Small blocks (tables, strings, closures)
+  // come from free lists per size class, larger ones from malloc. Pages are
+  // kept for reuse across library reloads until deinit, which must follow
+  // System::deinit. Not thread-safe, use one allocator per System.
+  class PoolAllocator {
+  private:
+    AllocState*   m_state;
+
+  public:
+      // limit of current bytes, 0 for none, lua raises memory errors beyond.
+      // Without pools every block goes to malloc, only accounting is done,
+      // for comparisons against the system allocator.
+    error         init(size_t limit, bool pooled);
+    void          deinit();
+
+    void          setLimit(size_t limit);
+    void          getStats(AllocatorStats* stats);
+      // counters and peak, current and reserved bytes stay
+    void          resetStats();
+
+      // lua_Alloc compatible, ud is the PoolAllocator
+    static void*  alloc(void* ud, void* ptr, size_t osize, size_t nsize);
+  };
+}
+
+#endif
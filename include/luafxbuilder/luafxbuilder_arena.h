@@ -0,0 +1,107 @@
+/*
+    Copyright (c) 2012, NVIDIA CORPORATION. All rights reserved.
+    Copyright (c) 2012, Christoph Kubisch. All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions
+    are met:
+     * Redistributions of source code must retain the above copyright
+       notice, this list of conditions and the following disclaimer.
+     * Neither the name of NVIDIA CORPORATION nor the names of its
+       contributors may be used to endorse or promote products derived
+       from this software without specific prior written permission.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ``AS IS'' AND ANY
+    EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+    PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+    CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+    EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+    PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+    PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+    OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+    (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+    OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+    Contact: Christoph Kubisch ckubisch@nvidia.com 
+*/
+
+#ifndef LUAFXBUILDER_ARENA_H_
+#define LUAFXBUILDER_ARENA_H_
+
+#include <luafxbuilder/luafxbuilder.h>
+
+#include <vector>
+
+namespace luafxbuilder
+{
+  struct UploadRange {
+    size_t  offset;         // bytes into getData()
+    size_t  size;
+  };
+
+  // Holds instances of a group in the storage layout of a generator, e.g.
+  // for STORAGE_UNIFORMBUFFER_INDEXED. Indices stay stable until freed,
+  // modified bytes are tracked per instance and merged into upload ranges.
+  // The System is only used during init.
+  class InstanceArena {
+  private:
+    struct Dirty {
+      size_t  begin;
+      size_t  end;
+    };
+
+    StorageType                   m_storageType;
+    size_t                        m_stride;
+    int                           m_capacity;
+    int                           m_count;
+    bool                          m_grown;
+    std::vector<ParameterStorage> m_storage;
+    std::vector<unsigned char>    m_defaults;
+    std::vector<unsigned char>    m_data;
+    std::vector<int>              m_free;
+    std::vector<unsigned char>    m_used;
+    std::vector<Dirty>            m_dirty;      // per instance, begin == end if clean
+    std::vector<int>              m_dirtyList;
+
+    void  grow(int capacity);
+
+  public:
+      // returns true on error, the group must be stored in one of the
+      // *_INDEXED storages by the generator (instanced groups)
+    error         init(System& system, GroupID group, GeneratorType gentype, int capacity);
+    void          deinit();
+
+    StorageType   getStorageType();
+    size_t        getStride();                  // bytes per instance
+    int           getParameterCount();
+    int           getCapacity();
+    int           getCount();
+
+      // returns index of new instance initialized with default values,
+      // -1 if the arena is not initialized
+    int           allocInstance();
+    void          freeInstance(int instance);
+
+      // data as returned by groupGetParameterValue, tightly packed
+    void          setParameter(int instance, int param, const void* data, size_t datasize);
+      // direct access, call markDirty for the modified bytes
+    void*         getInstanceData(int instance);
+    void          markDirty(int instance, size_t offset, size_t size);
+
+    const void*   getData();
+    size_t        getDataSize();
+
+      // true if storage was reallocated since the last clearDirty,
+      // the buffer needs to be resized and fully uploaded
+    bool          hasGrown();
+      // sorted, non-overlapping ranges of modified bytes, ranges closer than
+      // mergeGap bytes are merged. Returns the number of ranges, pass NULL
+      // to query it.
+    int           getUploadRanges(UploadRange* ranges, int maxranges, size_t mergeGap);
+    void          clearDirty();
+  };
+}
+
+#endif
+
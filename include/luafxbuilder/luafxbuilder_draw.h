@@ -0,0 +1,201 @@
+/*
+    Copyright (c) 2012, NVIDIA CORPORATION. All rights reserved.
+    Copyright (c) 2012, Christoph Kubisch. All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions
+    are met:
+     * Redistributions of source code must retain the above copyright
+       notice, this list of conditions and the following disclaimer.
+     * Neither the name of NVIDIA CORPORATION nor the names of its
+       contributors may be used to endorse or promote products derived
+       from this software without specific prior written permission.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ``AS IS'' AND ANY
+    EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+    PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+    CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+    EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+    PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+    PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+    OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+    (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+    OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+    Contact: Christoph Kubisch ckubisch@nvidia.com 
+*/
+
+#ifndef LUAFXBUILDER_DRAW_H_
+#define LUAFXBUILDER_DRAW_H_
+
+#include <luafxbuilder/luafxbuilder.h>
+
+#include <vector>
+
+namespace luafxbuilder
+{
+  enum {
+    DRAW_MAXGROUPS = 4,     // instanced groups per effect
+  };
+
+  typedef unsigned long long SortKey;
+
+  // fields of SortKey from the most significant bits, sorting by key groups
+  // by the buffers of instanced groups, then programs, then shared bindings
+  enum SortKeyLayout {
+    SORTKEY_STORAGE_SHIFT = 56,   // bit per StorageType of the instanced groups
+    SORTKEY_PROGRAM_SHIFT = 32,   // techniques generating identical code share it
+    SORTKEY_BINDING_SHIFT = 8,    // shared groups with identical storage names
+    SORTKEY_USER_BITS     = 8,    // free for the application, e.g. depth
+  };
+
+  // Assigns a SortKey to techniques per generator. Program and binding ids
+  // are dense in order of first use. Keys are cached, init again after
+  // libraries or generator lights changed.
+  class SortKeyTable {
+  private:
+    System*                         m_system;
+    std::vector<SortKey>            m_keys[NUM_GENERERATORS]; // by TechID
+    std::vector<unsigned long long> m_programs;   // hash tables of content hashes
+    std::vector<unsigned int>       m_programIds;
+    unsigned int                    m_numPrograms;
+    std::vector<unsigned long long> m_bindings;
+    std::vector<unsigned int>       m_bindingIds;
+    unsigned int                    m_numBindings;
+
+  public:
+    error         init(System& system);
+    void          deinit();
+
+      // generates the code of the technique for the program id (see
+      // techniqueGenerateCodeHash). Returns true on error or when ids
+      // exceed their bits.
+    error         getKey(TechID tech, GeneratorType gentype, SortKey* key);
+
+    int           getProgramCount();
+    int           getBindingCount();
+  };
+
+  // Stable LSD radix sort over 8 bit digits, digits all keys share are
+  // skipped. Buffers are reused between sorts.
+  class RadixSorter {
+  private:
+    std::vector<SortKey>        m_keys;
+    std::vector<SortKey>        m_keysTemp;
+    std::vector<unsigned int>   m_order;
+    std::vector<unsigned int>   m_orderTemp;
+
+  public:
+    void                sort(const SortKey* keys, int count);
+    void                deinit();
+
+    int                 getCount();
+    const SortKey*      getKeys();    // ascending
+    const unsigned int* getOrder();   // input index of each sorted key
+  };
+
+  struct DrawInput {
+    TechID        geometry;     // technique of a geometry effect
+    TechID        material;     // technique of a material effect
+    int           world;        // sys_World
+      // instances (e.g. InstanceArena) of the instanced groups of each
+      // effect, in group order
+    int           geometryInstances[DRAW_MAXGROUPS];
+    int           materialInstances[DRAW_MAXGROUPS];
+      // index range of the object
+    unsigned int  count;
+    unsigned int  firstIndex;
+    int           baseVertex;
+  };
+
+  // DrawElementsIndirectCommand
+  struct DrawCommand {
+    unsigned int  count;
+    unsigned int  instanceCount;
+    unsigned int  firstIndex;
+    int           baseVertex;
+    unsigned int  baseInstance;   // row in the index stream
+  };
+
+  // per draw vertex stream with divisor 1: sys_World at location 13,
+  // sys_geometryGroups at 14 and sys_materialGroups at 15 (GRP ivec2)
+  struct DrawIndices {
+    int           world;
+    int           geometryGroups[2];
+    int           materialGroups[2];
+  };
+
+  // draws sharing program and bindings, one multi draw indirect call
+  struct DrawBatch {
+    TechID        geometry;
+    TechID        material;
+    int           firstCommand;   // also first row in the index stream
+    int           numCommands;
+      // per instanced group: the first instance of the bound range for
+      // indexed uniform buffers, the instance itself for groups stored as
+      // uniforms, 0 for buffers indexed directly
+    int           geometryBase[DRAW_MAXGROUPS];
+    int           materialBase[DRAW_MAXGROUPS];
+    int           world;          // generators with world matrix uniforms, else -1
+  };
+
+  // cached per technique and generator, instances are masked to get the
+  // bases of the batch and the GRP components of the draw
+  struct DrawTechInfo {
+    bool          valid;
+    bool          bound;                      // needs bindings per batch
+    int           baseMasks[DRAW_MAXGROUPS];
+    int           streamGroups[2];
+    int           streamMasks[2];
+  };
+
+  // Sorts draws into batches that can be submitted with one multi draw
+  // indirect call for the storage the generator picks for every instanced
+  // group. Draws keep their relative order within a batch. Buffers are
+  // reused between builds, freeze the System for cheap technique queries.
+  // Techniques are cached, init again after libraries changed.
+  class DrawBatcher {
+  private:
+    System*                     m_system;
+    GeneratorType               m_gentype;
+    std::vector<DrawTechInfo>   m_techs;        // by TechID
+    std::vector<unsigned long long> m_programs; // hash table of technique pairs
+    std::vector<unsigned int>   m_programIds;
+    unsigned int                m_numPrograms;
+    std::vector<int>            m_tuples;       // bindings of batches
+    std::vector<unsigned int>   m_tupleSlots;   // hash table into m_tuples
+    std::vector<unsigned int>   m_programBatches;
+    std::vector<unsigned int>   m_drawBatches;  // batch of every draw
+    std::vector<unsigned int>   m_batchFirst;   // first draw of batch
+    std::vector<unsigned int>   m_batchOffsets;
+    std::vector<SortKey>        m_keys;         // program and batch
+    RadixSorter                 m_sorter;
+    std::vector<DrawCommand>    m_commands;
+    std::vector<DrawIndices>    m_indices;
+    std::vector<DrawBatch>      m_batches;
+
+    bool          isPrepared(TechID tech);
+    error         prepareTech(TechID tech);
+    unsigned int  getProgram(TechID geometry, TechID material);
+    unsigned int  getBatch(const int* tuple, unsigned int draw);
+    unsigned int  addBatch(unsigned int program, unsigned int draw);
+
+  public:
+    error         init(System& system, GeneratorType gentype);
+    void          deinit();
+
+      // instances of the instanced groups must not be negative, the rest
+      // are ignored. Returns true on error, e.g. unknown techniques or more than two
+      // instanced groups of an effect stored in indexed buffers
+    error         build(const DrawInput* draws, int numDraws);
+
+    int                 getBatchCount();
+    const DrawBatch*    getBatches();
+    int                 getCommandCount();
+    const DrawCommand*  getCommands();
+    const DrawIndices*  getIndices();
+  };
+}
+
+#endif
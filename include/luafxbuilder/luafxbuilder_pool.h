@@ -0,0 +1,87 @@
+/*
+    Copyright (c) 2012, NVIDIA CORPORATION. All rights reserved.
+    Copyright (c) 2012, Christoph Kubisch. All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions
+    are met:
+     * Redistributions of source code must retain the above copyright
+       notice, this list of conditions and the following disclaimer.
+     * Neither the name of NVIDIA CORPORATION nor the names of its
+       contributors may be used to endorse or promote products derived
+       from this software without specific prior written permission.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ``AS IS'' AND ANY
+    EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+    PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+    CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+    EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+    PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+    PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+    OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+    (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+    OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+    Contact: Christoph Kubisch ckubisch@nvidia.com 
+*/
+
+#ifndef LUAFXBUILDER_POOL_H_
+#define LUAFXBUILDER_POOL_H_
+
+#include <luafxbuilder/luafxbuilder.h>
+
+namespace luafxbuilder
+{
+  struct CodeJob {
+    TechID          tech;
+    GeneratorType   gentype;
+    int             codeidx;
+
+    // filled by SystemPool::generate
+    error           failed;
+    const char*     code;       // owned by the pool, valid until libraries change or deinit
+    size_t          codeSize;
+    CodeHash        hash;       // identical code of one generate call shares the hash and the string
+  };
+
+  struct PoolWorker;
+
+  // Several Systems loading the same processor and libraries, code generation
+  // jobs are spread over one thread per System. Ids are assigned in load order,
+  // so ids queried from getSystem() are valid in every worker and the results
+  // do not depend on the number of workers.
+  class SystemPool {
+  private:
+    PoolWorker*   m_workers;
+    int           m_numWorkers;
+    char*         m_lastError;
+    size_t        m_lastErrorSize;
+
+    void          setError(const char* str, size_t size);
+    error         setSystemError(System& sys);
+
+  public:
+    size_t        getLastErrorString(char* buffer, size_t buffersize);
+#if LUAFXBUILDER_USESTRING
+    std::string   getLastErrorString();
+#endif
+    error         init(const char* processorFile, int numWorkers);
+    void          deinit();
+
+    error         addLibraryFile    (const char* filename); // returns true on error
+    error         addLibraryString  (const char* buffer, size_t buffersize);  // returns true on error
+    error         setGeneratorLights(int numLights, EffectID* lights, int *lightsMax);
+
+      // first worker, use for all queries, must not be used during generate
+    System*       getSystem();
+    int           getWorkerCount();
+
+      // returns true if any job failed, the error string is the one of the 
+      // first failed job
+    error         generate(CodeJob* jobs, int numJobs);
+  };
+}
+
+#endif
+
@@ -0,0 +1,98 @@
+/*
+    Copyright (c) 2012, NVIDIA CORPORATION. All rights reserved.
+    Copyright (c) 2012, Christoph Kubisch. All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions
+    are met:
+     * Redistributions of source code must retain the above copyright
+       notice, this list of conditions and the following disclaimer.
+     * Neither the name of NVIDIA CORPORATION nor the names of its
+       contributors may be used to endorse or promote products derived
+       from this software without specific prior written permission.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ``AS IS'' AND ANY
+    EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+    PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+    CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+    EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+    PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+    PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+    OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+    (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+    OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+    Contact: Christoph Kubisch ckubisch@nvidia.com 
+*/
+
+#ifndef LUAFXBUILDER_SERVICE_H_
+#define LUAFXBUILDER_SERVICE_H_
+
+#include <luafxbuilder/luafxbuilder.h>
+
+namespace luafxbuilder
+{
+  enum RequestStatus {
+    REQUEST_PENDING,
+    REQUEST_RUNNING,
+    REQUEST_DONE,
+    REQUEST_FAILED,
+    REQUEST_CANCELLED,
+  };
+
+  struct CodeRequest;
+  struct ServiceWorker;
+
+    // called on the generator thread once the request is done or failed
+  typedef void (*CodeCallback)(CodeRequest* request, void* userdata);
+
+  // Code generation on a dedicated thread owning a System. Any thread can
+  // add requests to a lock-free queue and poll, wait for or cancel them,
+  // e.g. a render thread that draws with fallback programs meanwhile.
+  // Higher priorities are generated first, equal ones in request order.
+  // The System loads the same processor and libraries as the one used for
+  // queries, so ids of both match (see SystemPool).
+  class CodeService {
+  private:
+    ServiceWorker*  m_worker;
+
+  public:
+    error         init(const char* processorFile);
+    void          deinit();
+
+      // for setup (libraries, lights, freeze), only while stopped
+    System*       getSystem();
+
+      // stop cancels pending requests and waits for the running one
+    error         start();
+    void          stop();
+    bool          isRunning();
+
+      // thread safe, requests added while stopped wait for start.
+      // The request stays valid until released.
+    CodeRequest*  request(TechID tech, GeneratorType gentype, int codeidx, int priority, CodeCallback callback, void* userdata);
+      // returns true if the request was cancelled before it ran
+    bool          cancel(CodeRequest* request);
+    void          release(CodeRequest* request);
+
+    RequestStatus getStatus(CodeRequest* request);
+      // returns the final status once the callback returned, waits for start if stopped
+    RequestStatus wait(CodeRequest* request);
+    int           getPendingCount();
+
+      // results of REQUEST_DONE, code is owned by the service's System and
+      // valid until libraries change or deinit
+    const char*   getCode(CodeRequest* request, size_t* size);
+    CodeHash      getHash(CodeRequest* request);
+      // error of REQUEST_FAILED
+    size_t        getError(CodeRequest* request, char* buffer, size_t buffersize);
+
+    TechID        getTechnique(CodeRequest* request);
+    GeneratorType getGenerator(CodeRequest* request);
+    int           getCodeIndex(CodeRequest* request);
+    int           getPriority(CodeRequest* request);
+  };
+}
+
+#endif
@@ -0,0 +1,67 @@
+/*
+    Copyright (c) 2012, NVIDIA CORPORATION. All rights reserved.
+    Copyright (c) 2012, Christoph Kubisch. All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions
+    are met:
+     * Redistributions of source code must retain the above copyright
+       notice, this list of conditions and the following disclaimer.
+     * Neither the name of NVIDIA CORPORATION nor the names of its
+       contributors may be used to endorse or promote products derived
+       from this software without specific prior written permission.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ``AS IS'' AND ANY
+    EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+    PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+    CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+    EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+    PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+    PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+    OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+    (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+    OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+    Contact: Christoph Kubisch ckubisch@nvidia.com 
+*/
+
+#ifndef LUAFXBUILDER_WATCH_H_
+#define LUAFXBUILDER_WATCH_H_
+
+#include <luafxbuilder/luafxbuilder.h>
+
+#include <vector>
+
+namespace luafxbuilder
+{
+  struct WatchState;
+
+  // Reloads the libraries of a System when one of their files changes, see
+  // System::reloadLibraryFile. Uses inotify on linux, otherwise (or when
+  // polling is forced) the modification time of every file is compared.
+  class LibraryWatcher {
+  private:
+    System*             m_system;
+    WatchState*         m_state;
+    std::vector<TechID> m_changed;
+
+    void          updateFiles();
+
+  public:
+    error         init(System& system, bool forcePolling);
+    void          deinit();
+    bool          isPolling();
+
+      // non-blocking, reloads the libraries of every modified file.
+      // Returns true on error, see System::getLastErrorString, the failed
+      // file is retried once it changes again.
+    error         poll(int* numReloaded);
+
+      // sorted ids of the techniques affected by the last poll
+    int           getChangedTechniqueCount();
+    TechID        getChangedTechnique(int i);
+  };
+}
+
+#endif
@@ -295,8 +295,8 @@ do
     return grpeffect.class.."_"..grpeffect.name.."_"..group.name
   end
   
-  function groupParameters(group,ignoreclass,entry,hints)
-    local content = ""
+  local function buildParameters(group,ignoreclass,entry,hints)
+    local content = {}
     for n,p in ipairs(group.parameter) do
       if not (ignoreclass and ignoreclass[p.typeclass.class]) then
         local ph    = hints and hints[p.name] or {}
@@ -305,11 +305,31 @@ do
               param = param:gsub(" enum "," int ")
               param = param:gsub(" ushort "," uint ")
         
-        content = content..param..eol
+        content[#content+1] = param..eol
       end
     end
     
-    return content
+    return table.concat(content)
+  end
+  
+  -- text only depends on the arguments, fxprogramgen shares it between all
+  -- codes and generators of a program
+  function groupParameters(group,ignoreclass,entry,hints)
+    local shared = fxprogram and not ignoreclass and fxprogram.parameters
+    if (not shared) then
+      return buildParameters(group,ignoreclass,entry,hints)
+    end
+    
+    local entries = shared[group] or {}
+    shared[group] = entries
+    local results = entries[entry] or {}
+    entries[entry] = results
+    local str = results[hints or false]
+    if (not str) then
+      str = buildParameters(group,nil,entry,hints)
+      results[hints or false] = str
+    end
+    return str
   end
   
   function groupStruct(group,ignoreclass,name,hints)
@@ -330,27 +350,59 @@ do
   end
   
   function perLight(pattern)
-    local str = ""
+    local str = {}
     for i,light in ipairs(fxlights.effects) do
-      str = str..(pattern:gsub("$LIGHT",   light.name):gsub("$MAXLIGHTS",fxlights.max[i]))
+      str[#str+1] = (pattern:gsub("$LIGHT",   light.name):gsub("$MAXLIGHTS",fxlights.max[i]))
     end
-    return str
+    return table.concat(str)
   end
  
+  -- LIGHTGROUP block with the structs of the instanced light groups followed
+  -- by arrays(). Only depends on the lights, kept per light configuration.
+  function exportLightGroup(genclass,hints,arrays)
+    local cache = fxlights.cache[genclass]
+    if (not cache) then
+      cache = setmetatable({},{__mode = "k"})
+      fxlights.cache[genclass] = cache
+    end
+    local str = cache[hints or false]
+    if (str) then
+      return str
+    end
+    
+    local out = { "/* LIGHTGROUP BEGIN */"..eol }
+    for i,light in ipairs(fxlights.effects) do
+      assert(countEffectTypeClasses(light,{sampler = true, image = true},"instanced") == 0, "only scalars supported in instanced light groups")
+      
+      local group = getEffectGroup(light,"instanced",1)
+      if (group) then
+        local structclass = light.class.."_"..light.name.."_s"
+        
+        out[#out+1] =
+              groupStruct(group,nil,structclass,hints)..eol
+      end
+    end
+    out[#out+1] = arrays()
+    
+    str = table.concat(out)
+    cache[hints or false] = str
+    return str
+  end
+  
   function resolveLightLoops(str,env)
     str = str:gsub('SYS_LIGHT_LOOP%s*%(%s*"([%w_%s]+)"%s*%)%s*(%b{})',
       function(codekey,ctx)
         assert(env.lights[codekey], "Light loop definition for: "..codekey.." not found")
         
-        local out = ""
+        local out = {}
         local lights = env.lights[codekey].lights
         for i,light in ipairs(lights) do
-              out = out..
+              out[#out+1] =
                     "for (int sys_Light = 0; sys_Light < sys_num_lights_"..light.name .."; sys_Light++)"..
                     ctx:gsub("SYS_LIGHT%s*%(","light_"..light.name.."(sys_Light, ")
         end
         
-        return out
+        return table.concat(out)
       end
     )
     return str
@@ -363,59 +415,69 @@ do
     local function genlightuniforms(obj,code,effect,env,groups)
       local prefix = prefix or ""
       
-      local unis      = ""
-      local defs      = ""
-      local undefs    = ""
+      local unis      = {}
+      local defs      = {}
+      local undefs    = {}
       
       for i,group in ipairs(groups or effect.group) do
         if (group.mode == "instanced") then
           local access = prefix.."sys_lights_"..effect.name.."[sys_Light]."
-          defs    = defs..
+          defs[#defs+1]     =
                     groupDefine(group,nil, access)
-          undefs  = undefs..
+          undefs[#undefs+1] =
                     groupUndefine(group,nil)
         else
           -- fall back to regular uniform generator
           local default = genuniforms(obj,code,effect,env,{group})
-          unis    = unis..default.unis
-          defs    = defs..default.defs
-          undefs  = undefs..default.undefs
+          unis[#unis+1]     = default.unis
+          defs[#defs+1]     = default.defs
+          undefs[#undefs+1] = default.undefs
         end
       end
 
-      return { unis = unis, defs = defs, undefs = undefs }
+      return { unis = table.concat(unis), defs = table.concat(defs), undefs = table.concat(undefs) }
     end
     
-    out = "/* LIGHT CODE "..genlight.technique.." "..genlight.code.." BEGIN */"..eol
+    local out = { "/* LIGHT CODE "..genlight.technique.." "..genlight.code.." BEGIN */"..eol }
           -- code 
           for i,light in ipairs(fxlights.effects) do
+            fxyieldpoint()
+            fxdependencyeffect(light)
             local tech = light.technique[genlight.technique]
             if (tech and tech.code[genlight.code]) then
               table.insert(outlights,light)
               
-              out = out..
+              out[#out+1] =
                 (genclass:MakeCode(tech.code[genlight.code],light,env,genlightuniforms))..eol
             end
           end
-    out = out..
+    out[#out+1] =
           "/* LIGHT CODE "..genlight.technique.." "..genlight.code.." END */"
     
-    return out
+    return table.concat(out)
   end
   
   function exportEnums()
-        out = "    /* ENUMS BEGIN */"..eol
+    fxdependency("enums")
+    if (fxprogram and fxprogram.enums) then
+      return fxprogram.enums
+    end
+    local out = { "    /* ENUMS BEGIN */"..eol }
     for i,enum in ipairs(fxuserenums.enums) do
-        out = out..
+        out[#out+1] =
               "    /* "..enum.name.." */"..eol
       for n,v in ipairs(enum.content) do
-        out = out..
+        out[#out+1] =
               "      #define "..v.name.." "..v.value..eol
       end
     end
-        out = out..
+        out[#out+1] =
               "    /* ENUMS END */"..eol
     
+    out = table.concat(out)
+    if (fxprogram) then
+      fxprogram.enums = out
+    end
     return out
   end
 
@@ -442,12 +504,8 @@ do
   end
   
   function generator:genfile(obj,code,effect,env)
-    local f = io.open(obj.filename,"rb")
-    assert(f, "file not found:"..obj.filename)
-    local tx = f:read("*a")
-    f:close()
-    f = nil
-    return "  /* FILE "..obj.filename.." */"..eol..tx
+    fxdependency("file:"..obj.filename)
+    return "  /* FILE "..obj.filename.." */"..eol..fxfileread(obj.filename)
   end
   
   function generator:genparameterhints(obj,code,effect,env)
@@ -456,41 +514,49 @@ do
     return ""
   end
   
-  function generator:MakeCode(code,effect,env,genuniforms)
+  -- list of strings, each generated block is its own segment so identical
+  -- blocks (header, FILE content, lights) can be shared between outputs
+  function generator:MakeSegments(code,effect,env,genuniforms)
     local env   = env or { uniforms = {}, }
-    local out   = "/* "..effect.class..  " "..effect.name.." */"..eol..
-                  "/* "..code.host.name.." "..  code.name.." */"..eol..
-                  "  /* "..self.name.." */"..eol
+    local out   = { "/* "..effect.class..  " "..effect.name.." */"..eol..
+                    "/* "..code.host.name.." "..  code.name.." */"..eol..
+                    "  /* "..self.name.." */"..eol }
     
     local uniforms
     for i,genobj in ipairs(code.content) do
+      fxyieldpoint()
       local genstr = self[genobj.class](self,genobj,code,effect,env)
       if (genstr) then
         
         if (genobj.uniforms and not uniforms) then
           uniforms = genuniforms and genuniforms(genobj, code, effect, env) or self:genuniforms(genobj, code, effect, env)
-          out = out..uniforms.unis..eol..uniforms.defs..eol
+          out[#out+1] = uniforms.unis..eol..uniforms.defs..eol
         end
         
         if (env.lights) then
           genstr = resolveLightLoops(genstr,env)
         end
         
-          out = out.. 
+          out[#out+1] =
                   "  /* CODE "..genobj.class.." BEGIN */"..eol..
-                  "  /* SRC  "..genobj.info.." */"..eol..
-                  genstr..eol..
+                  "  /* SRC  "..genobj.info.." */"..eol
+          out[#out+1] = genstr
+          out[#out+1] = eol..
                   "  /* CODE "..genobj.class.." END */"..eol..eol
       end
     end
     
     if (uniforms) then
-      out = out..uniforms.undefs..eol 
+      out[#out+1] = uniforms.undefs..eol 
     end
     
     return out
   end
   
+  function generator:MakeCode(code,effect,env,genuniforms)
+    return table.concat(self:MakeSegments(code,effect,env,genuniforms))
+  end
+  
   return generator
 end 
 
@@ -156,12 +156,13 @@ do
   end
 
   function glslnvload:genuniforms(obj, code, effect, env, groups)
-    local unis    = ""
-    local defs    = ""
-    local undefs  = ""
+    local unis    = {}
+    local defs    = {}
+    local undefs  = {}
     
     local batchcnt = 0
     for i,group in ipairs(groups or effect.group) do
+      fxyieldpoint()
       local buffered    = self:canBuffer(group)
       if (buffered) then
         local structclass = groupStructClass(group)
@@ -173,30 +174,30 @@ do
         
         if (not env.uniforms[structclass]) then
           env.uniforms[structclass] = true
-          unis  = unis..
+          unis[#unis+1]  =
                   groupStruct(group,nil,structclass,env.hints)..
                   "uniform "..structclass.."* "..storename..";"..eol
                   ..eol
                   
         end
         
-        defs    = defs..
+        defs[#defs+1]    =
                   groupDefine(group,nil,storename..access..".")
-        undefs  = undefs..
+        undefs[#undefs+1]  =
                   groupUndefine(group,nil)
       else
         local fallback = glsluniform:genuniforms(obj,code,effect,env,{group})
-        unis    = unis..fallback.unis
-        defs    = defs..fallback.defs
-        undefs  = undefs..fallback.undefs
+        unis[#unis+1]    = fallback.unis
+        defs[#defs+1]    = fallback.defs
+        undefs[#undefs+1]  = fallback.undefs
       end
     end
     
-    return { unis = unis, defs = defs, undefs = undefs }
+    return { unis = table.concat(unis), defs = table.concat(defs), undefs = table.concat(undefs) }
   end
   
   function glslnvload:genlights(obj,code,effect,env)
-    local out = ""
+    local out = {}
     
     -- allow light loops for following techniqes
     env.lights = env.lights or {}
@@ -206,43 +207,28 @@ do
     if ( not env.lightGroupExported) then
       env.lightGroupExported = true
       
-        out = out..
-              "/* LIGHTGROUP BEGIN */"..eol
-      
-      -- struct defines
-      for i,light in ipairs(fxlights.effects) do
-        assert(countEffectTypeClasses(light,{sampler = true, image = true},"instanced") == 0, "only scalars supported in instanced light groups")
-        
-        local group = getEffectGroup(light,"instanced",1)
-        if (group) then
-          local structclass = light.class.."_"..light.name.."_s"
-        
-          out = out..
-                groupStruct(group,nil,structclass,env.hints)..eol
-        end
-      end
-      
-      -- arrays
-        out = out..
-              "struct sys_lights_buffer_s {"..eol..
-              perLight(
-              "  int             sys_num_lights_$LIGHT;"..eol
-              )..eol..
-              perLight(
-              "  light_$LIGHT_s  sys_lights_$LIGHT[$MAXLIGHTS];"..eol
-              )..eol..
-              "};"..eol..
-              "uniform sys_lights_buffer_s* sys_lights_buffer;"..eol..
-              eol..
-              perLight(
-              "#define  sys_num_lights_$LIGHT sys_lights_buffer->sys_num_lights_$LIGHT"..eol..
-              "#define  sys_lights_$LIGHT     sys_lights_buffer->sys_lights_$LIGHT"..eol
-              )..eol..
-              "/* LIGHTGROUP END */"..eol..eol
+      out[#out+1] = exportLightGroup(self,env.hints,function()
+        return
+                "struct sys_lights_buffer_s {"..eol..
+                perLight(
+                "  int             sys_num_lights_$LIGHT;"..eol
+                )..eol..
+                perLight(
+                "  light_$LIGHT_s  sys_lights_$LIGHT[$MAXLIGHTS];"..eol
+                )..eol..
+                "};"..eol..
+                "uniform sys_lights_buffer_s* sys_lights_buffer;"..eol..
+                eol..
+                perLight(
+                "#define  sys_num_lights_$LIGHT sys_lights_buffer->sys_num_lights_$LIGHT"..eol..
+                "#define  sys_lights_$LIGHT     sys_lights_buffer->sys_lights_$LIGHT"..eol
+                )..eol..
+                "/* LIGHTGROUP END */"..eol..eol
+      end)
     end
     
     local lights = {}
-    out = out..
+    out[#out+1] =
           exportLights(self,obj,lights,function(...) return self:genuniforms(...) end, "")
   
     env.lights[obj.code] = {
@@ -250,7 +236,7 @@ do
       technique = obj.technique,
     }
   
-    return out
+    return table.concat(out)
   end
 end
 
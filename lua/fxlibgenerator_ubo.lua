@@ -41,7 +41,7 @@ do
     #define GRP   ivec2
 
     #define MAXLIGHTS 8
-    #define MAXGROUPS 32
+    #define MAXGROUPS ]]..fxenums.limits.ubomaxgroups..eol..[[
 
     #ifndef PI
     #define PI 3.14159265358979
@@ -164,12 +164,13 @@ do
   end
   
   function glslubo:genuniforms(obj, code, effect, env, groups)
-    local unis    = ""
-    local defs    = ""
-    local undefs  = ""
+    local unis    = {}
+    local defs    = {}
+    local undefs  = {}
     
     local batchcnt = 0
     for i,group in ipairs(groups or effect.group) do
+      fxyieldpoint()
       local buffered    = self:canBuffer(group)
       if (buffered) then
         local structclass = groupStructClass(group)
@@ -182,30 +183,30 @@ do
         
         if (not env.uniforms[structclass]) then
           env.uniforms[structclass] = true
-          unis  = unis..
+          unis[#unis+1]  =
                   groupStruct(group,nil,structclass,env.hints)..
                   "layout(std140) uniform "..storename.."{"..eol..
                   "  "..structclass.." sys_"..structclass..storage..";"..eol..
                   "};"..eol..eol
         end
         
-        defs    = defs..
+        defs[#defs+1]    =
                   groupDefine(group,nil,"sys_"..structclass..access..".")
-        undefs  = undefs..
+        undefs[#undefs+1]  =
                   groupUndefine(group,nil)
       else
         local fallback = glsluniform:genuniforms(obj,code,effect,env,{group})
-        unis    = unis..fallback.unis
-        defs    = defs..fallback.defs
-        undefs  = undefs..fallback.undefs
+        unis[#unis+1]    = fallback.unis
+        defs[#defs+1]    = fallback.defs
+        undefs[#undefs+1]  = fallback.undefs
       end
     end
     
-    return { unis = unis, defs = defs, undefs = undefs }
+    return { unis = table.concat(unis), defs = table.concat(defs), undefs = table.concat(undefs) }
   end
   
   function glslubo:genlights(obj,code,effect,env)
-    local out = ""
+    local out = {}
     
     -- allow light loops for following techniqes
     env.lights = env.lights or {}
@@ -215,37 +216,22 @@ do
     if ( not env.lightGroupExported) then
       env.lightGroupExported = true
       
-        out = out..
-              "/* LIGHTGROUP BEGIN */"..eol
-      
-      -- struct defines
-      for i,light in ipairs(fxlights.effects) do
-        assert(countEffectTypeClasses(light,{sampler = true, image = true},"instanced") == 0, "only scalars supported in instanced light groups")
-        
-        local group = getEffectGroup(light,"instanced",1)
-        if (group) then
-          local structclass = light.class.."_"..light.name.."_s"
-        
-          out = out..
-                groupStruct(group,nil,structclass,env.hints)..eol
-        end
-      end
-      
-      -- arrays
-        out = out..
-              "layout(std140) uniform sys_lights_buffer {"..eol..
-              perLight(
-              "  int             sys_num_lights_$LIGHT;"..eol
-              )..eol..
-              perLight(
-              "  light_$LIGHT_s  sys_lights_$LIGHT[$MAXLIGHTS];"..eol
-              )..eol..
-              "};"..eol..
-              "/* LIGHTGROUP END */"..eol..eol
+      out[#out+1] = exportLightGroup(self,env.hints,function()
+        return
+                "layout(std140) uniform sys_lights_buffer {"..eol..
+                perLight(
+                "  int             sys_num_lights_$LIGHT;"..eol
+                )..eol..
+                perLight(
+                "  light_$LIGHT_s  sys_lights_$LIGHT[$MAXLIGHTS];"..eol
+                )..eol..
+                "};"..eol..
+                "/* LIGHTGROUP END */"..eol..eol
+      end)
     end
     
     local lights = {}
-    out = out..
+    out[#out+1] =
           exportLights(self,obj,lights,function(...) return self:genuniforms(...) end, "")
   
     env.lights[obj.code] = {
@@ -253,7 +239,7 @@ do
       technique = obj.technique,
     }
   
-    return out
+    return table.concat(out)
   end
 
 end
@@ -165,12 +165,13 @@ do
   end
   
   function glslubossbotex:genuniforms(obj, code, effect, env, groups)
-    local unis    = ""
-    local defs    = ""
-    local undefs  = ""
+    local unis    = {}
+    local defs    = {}
+    local undefs  = {}
     
     local batchcnt = 0
     for i,group in ipairs(groups or effect.group) do
+      fxyieldpoint()
       local buffered    = self:canBuffer(group)
       if (buffered) then
         local structclass = groupStructClass(group)
@@ -183,7 +184,7 @@ do
         
         if (not env.uniforms[structclass]) then
           env.uniforms[structclass] = true
-          unis  = unis..
+          unis[#unis+1]  =
                   groupStruct(group,nil,structclass,env.hints)..
                   (batched and "layout(std430) buffer " or "layout(std140) uniform ")..
                   storename.."{"..eol..
@@ -191,23 +192,23 @@ do
                   "};"..eol..eol
         end
         
-        defs    = defs..
+        defs[#defs+1]    =
                   groupDefine(group,nil,"sys_"..structclass..access..".")
-        undefs  = undefs..
+        undefs[#undefs+1]  =
                   groupUndefine(group,nil)
       else
         local fallback = glsluniform:genuniforms(obj,code,effect,env,{group})
-        unis    = unis..fallback.unis
-        defs    = defs..fallback.defs
-        undefs  = undefs..fallback.undefs
+        unis[#unis+1]    = fallback.unis
+        defs[#defs+1]    = fallback.defs
+        undefs[#undefs+1]  = fallback.undefs
       end
     end
     
-    return { unis = unis, defs = defs, undefs = undefs }
+    return { unis = table.concat(unis), defs = table.concat(defs), undefs = table.concat(undefs) }
   end
   
   function glslubossbotex:genlights(obj,code,effect,env)
-    local out = ""
+    local out = {}
     
     -- allow light loops for following techniqes
     env.lights = env.lights or {}
@@ -217,37 +218,22 @@ do
     if ( not env.lightGroupExported) then
       env.lightGroupExported = true
       
-        out = out..
-              "/* LIGHTGROUP BEGIN */"..eol
-      
-      -- struct defines
-      for i,light in ipairs(fxlights.effects) do
-        assert(countEffectTypeClasses(light,{sampler = true, image = true},"instanced") == 0, "only scalars supported in instanced light groups")
-        
-        local group = getEffectGroup(light,"instanced",1)
-        if (group) then
-          local structclass = light.class.."_"..light.name.."_s"
-        
-          out = out..
-                groupStruct(group,nil,structclass,env.hints)..eol
-        end
-      end
-      
-      -- arrays
-        out = out..
-              "layout(std430) buffer sys_lights_buffer {"..eol..
-              perLight(
-              "  int             sys_num_lights_$LIGHT;"..eol
-              )..eol..
-              perLight(
-              "  light_$LIGHT_s  sys_lights_$LIGHT[$MAXLIGHTS];"..eol
-              )..eol..
-              "};"..eol..
-              "/* LIGHTGROUP END */"..eol..eol
+      out[#out+1] = exportLightGroup(self,env.hints,function()
+        return
+                "layout(std430) buffer sys_lights_buffer {"..eol..
+                perLight(
+                "  int             sys_num_lights_$LIGHT;"..eol
+                )..eol..
+                perLight(
+                "  light_$LIGHT_s  sys_lights_$LIGHT[$MAXLIGHTS];"..eol
+                )..eol..
+                "};"..eol..
+                "/* LIGHTGROUP END */"..eol..eol
+      end)
     end
     
     local lights = {}
-    out = out..
+    out[#out+1] =
           exportLights(self,obj,lights,function(...) return self:genuniforms(...) end, "")
   
     env.lights[obj.code] = {
@@ -255,7 +241,7 @@ do
       technique = obj.technique,
     }
   
-    return out
+    return table.concat(out)
   end
 
 end
@@ -72,30 +72,31 @@ do
   end
   
   function glsluniform:genuniforms(obj, code, effect, env, groups)
-    local unis    = ""
-    local defs    = ""
-    local undefs  = ""
+    local unis    = {}
+    local defs    = {}
+    local undefs  = {}
     
     for i,group in ipairs(groups or effect.group) do
+      fxyieldpoint()
       local structclass = groupStructClass(group)
       local storename   = self:MakeStorageName(group)
       if (not env.uniforms[structclass]) then
         env.uniforms[structclass] = true
-        unis  = unis..
+        unis[#unis+1]  =
                 groupStruct(group,nil,structclass,env.hints)..
                 "uniform "..structclass.." "..storename..";"..eol..eol
       end
-      defs    = defs..
+      defs[#defs+1]    =
                 groupDefine(group,nil,storename..".")
-      undefs  = undefs..
+      undefs[#undefs+1]  =
                 groupUndefine(group,nil)
     end
     
-    return {unis = unis, defs = defs, undefs = undefs }
+    return { unis = table.concat(unis), defs = table.concat(defs), undefs = table.concat(undefs) }
   end
   
   function glsluniform:genlights(obj,code,effect,env)
-    local out = ""
+    local out = {}
     
     -- allow light loops for following techniqes
     env.lights = env.lights or {}
@@ -105,37 +106,22 @@ do
     if ( not env.lightGroupExported) then
       env.lightGroupExported = true
       
-        out = out..
-              "/* LIGHTGROUP BEGIN */"..eol
-      
-      -- struct defines
-      for i,light in ipairs(fxlights.effects) do
-        assert(countEffectTypeClasses(light,{sampler = true, image = true},"instanced") == 0, "only scalars supported in instanced light groups")
-        
-        local group = getEffectGroup(light,"instanced",1)
-        if group then
-          local structclass = light.class.."_"..light.name.."_s"
-        
-          out = out..
-                groupStruct(group,nil,structclass,env.hints)..eol
-        end
-      end
-      
-      -- light arrays
-        out = out..
-              "layout(std140) uniform sys_lights_buffer {"..eol..
-              perLight(
-              "  int             sys_num_lights_$LIGHT;"..eol
-              )..eol..
-              perLight(
-              "  light_$LIGHT_s  sys_lights_$LIGHT[$MAXLIGHTS];"..eol
-              )..eol..
-              "};"..eol..
-              "/* LIGHTGROUP END */"..eol..eol
+      out[#out+1] = exportLightGroup(self,env.hints,function()
+        return
+                "layout(std140) uniform sys_lights_buffer {"..eol..
+                perLight(
+                "  int             sys_num_lights_$LIGHT;"..eol
+                )..eol..
+                perLight(
+                "  light_$LIGHT_s  sys_lights_$LIGHT[$MAXLIGHTS];"..eol
+                )..eol..
+                "};"..eol..
+                "/* LIGHTGROUP END */"..eol..eol
+      end)
     end
     
     local lights = {}
-    out = out..
+    out[#out+1] =
           exportLights(self,obj,lights,function(...) return self:genuniforms(...) end, "")
   
     env.lights[obj.code] = {
@@ -143,7 +129,7 @@ do
       technique = obj.technique,
     }
   
-    return out
+    return table.concat(out)
   end
    
 end
@@ -158,17 +158,125 @@ end
 ---------------------------------------------------------
 -- Main Classes
 
+-- library file currently parsed by fxfile or fxreloadfile, nil for strings
+-- {filename = name, pending = {effects...} only while reloading}
+local loading
+
+local function watchFile(filename)
+  local entry = fxfiles.entries[filename]
+  if (not entry) then
+    entry = {
+      libraries  = {}, -- [libfile] = true, libraries to parse again on change
+      techniques = {}, -- [techid]  = true, techniques reading the file during generation
+    }
+    fxfiles.entries[filename] = entry
+    table.insert(fxfiles.list,filename)
+  end
+  return entry
+end
+
+local function trackEffect(effect)
+  if (not loading) then return end
+  effect.file = loading.filename
+  table.insert(fxfiles.libraries[loading.filename],effect)
+  
+  for i,tech in ipairs(effect.technique) do
+    for n,code in ipairs(tech.code) do
+      for k,v in ipairs(code.content) do
+        if (v.class == "genfile") then
+          watchFile(v.filename).techniques[fxids[tech]] = true
+        end
+      end
+    end
+  end
+end
+
+local function transferId(old,new)
+  local id = rawget(fxids,old)
+  if (id) then
+    rawset(fxids,old,nil)
+    rawset(fxids,id,new)
+    rawset(fxids,new,id)
+  end
+end
+
+-- fxlights and the sets of all light configurations
+local function getLightSets()
+  local sets = {fxlights}
+  for i,config in pairs(fxlightconfigs) do
+    if (type(config) == "table") then
+      table.insert(sets,config)
+    end
+  end
+  return sets
+end
+
 local function newLib(class)
   local lib = {
     effects = {}, -- indexable by unique idx and name
     count = 0,      
   }
   function lib:Register(name,effect)
+    if (loading and loading.pending) then
+      -- reloads are committed once the whole file parsed
+      local key = class.."::"..name
+      assert(not loading.names[key], "Effect already defined:"..class.." "..name)
+      loading.names[key] = effect
+      table.insert(loading.pending,effect)
+      return
+    end
     assert(not self.effects[name], "Effect already defined:"..class.." "..name)
     local idx   = self.count + 1
     self.count  = idx
     self.effects[name]  = effect
     self.effects[idx]   = effect
+    effect.idx = idx
+    
+    -- assign ids in load order, every state loading the same
+    -- files ends up with the same ids
+    local id = fxids[effect]
+    for i,v in ipairs(effect.group) do
+      id = fxids[v]
+    end
+    for i,v in ipairs(effect.technique) do
+      id = fxids[v]
+    end
+    trackEffect(effect)
+  end
+  
+  -- takes over the slot and ids of the previous definition, 
+  -- groups and techniques are matched by name
+  function lib:Replace(old,effect)
+    local idx = old.idx
+    effect.idx = idx
+    self.effects[old.name] = effect
+    self.effects[idx]      = effect
+    
+    transferId(old,effect)
+    for i,v in ipairs(effect.group) do
+      local prev = old.group[v.name]
+      if (prev and prev ~= v and prev.host == old and v.host == effect) then
+        transferId(prev,v)
+      end
+      local id = fxids[v]
+    end
+    for i,v in ipairs(effect.technique) do
+      local prev = old.technique[v.name]
+      if (prev) then
+        transferId(prev,v)
+      end
+      local id = fxids[v]
+    end
+    
+    for n,lights in ipairs(getLightSets()) do
+      for i,v in ipairs(lights.effects) do
+        if (v == old) then
+          lights.effects[i] = effect
+          lights.cache = {}
+        end
+      end
+    end
+    trackEffect(effect)
   end
   return lib
 end
@@ -367,6 +475,10 @@ do
       nvloadbuffer          = "nvloadbuffer",
       nvloadbuffer_indexed  = "nvloadbuffer_indexed",
     },
+    limits      = {
+      -- for debug purposes preset, the C backend owns these
+      ubomaxgroups          = 32,
+    },
   }
 end
 
@@ -381,6 +493,16 @@ do
     values  = {},
     count   = 0,
   }
+  
+  -- files the libraries were loaded from, for hot reload
+  fxfiles = {
+    list      = {}, -- all files in load order, including FILE and dofile dependencies
+    entries   = {}, -- [filename] = {libraries, techniques}
+    libraries = {}, -- [libfile]  = {effect...} defined by the library file
+  }
+  
+  -- sorted ids of the techniques affected by the last fxreloadfile
+  fxreloaded = {}
  
   for class,v in pairs(effecttypes) do
     fxlib[class] = newLib(class)
@@ -388,15 +510,129 @@ do
   
 end
 
+do
+  -- content of FILE sources, shared by all generators and techniques,
+  -- validated by size and modification time on every use
+  fxfilecache = {
+    entries = {}, -- [filename] = {content, size, time}
+    count   = 0,
+    bytes   = 0,
+    reads   = 0,
+    hits    = 0,
+  }
+  
+  -- replaced by the C backend, plain lua keeps files until they are reloaded
+  function fxfilestat(filename)
+    return 0,0
+  end
+  
+  function fxfileload(filename)
+    local f = io.open(filename,"rb")
+    assert(f, "file not found:"..filename)
+    local content = f:read("*a")
+    f:close()
+    return content,0,0
+  end
+  
+  function fxfiledrop(filename)
+    local cache = fxfilecache
+    local entry = cache.entries[filename]
+    if (entry) then
+      cache.entries[filename] = nil
+      cache.count = cache.count - 1
+      cache.bytes = cache.bytes - #entry.content
+    end
+  end
+  
+  -- drops all content, files are read again on their next use
+  function fxfileclear()
+    local cache = fxfilecache
+    cache.entries = {}
+    cache.count   = 0
+    cache.bytes   = 0
+  end
+  
+  function fxfileread(filename)
+    local cache = fxfilecache
+    local entry = cache.entries[filename]
+    local size,time = fxfilestat(filename)
+    if (entry and entry.size == size and entry.time == time) then
+      cache.hits = cache.hits + 1
+      return entry.content
+    end
+    
+    fxfiledrop(filename)
+    local content,size,time = fxfileload(filename)
+    cache.entries[filename] = {content = content, size = size, time = time}
+    cache.count = cache.count + 1
+    cache.bytes = cache.bytes + #content
+    cache.reads = cache.reads + 1
+    return content
+  end
+end
+
+do
+  -- inputs of every generated code, recorded by fxcodegen
+  -- input keys are "file:"..filename, "effect:"..id or "enums"
+  fxdeps = {
+    outputs = {}, -- [outkey] = {tech = id, code = idx, gen = generator, inputs = {[key] = true}}
+    inputs  = {}, -- [key]    = {[outkey] = true}
+    current = setmetatable({},{__mode = "k"}), -- [coroutine or fxdeps] = output
+  }
+  
+  -- resumable fxcodegen runs interleaved in coroutines, each records its own output
+  local function running()
+    return coroutine.running() or fxdeps
+  end
+  
+  function fxdependency(key)
+    local output = fxdeps.current[running()]
+    if (output and not output.inputs[key]) then
+      output.inputs[key] = true
+      local users = fxdeps.inputs[key]
+      if (not users) then
+        users = {}
+        fxdeps.inputs[key] = users
+      end
+      users[output.key] = true
+    end
+  end
+  
+  function fxdependencyeffect(effect)
+    fxdependency("effect:"..fxids[effect])
+  end
+  
+  -- starts recording, previous inputs of the output are dropped
+  function fxdependencybegin(tech,codeidx,gen)
+    local key = fxids[tech]..":"..codeidx..":"..gen
+    local output = fxdeps.outputs[key]
+    if (output) then
+      for input in pairs(output.inputs) do
+        fxdeps.inputs[input][key] = nil
+      end
+    end
+    output = {key = key, tech = fxids[tech], code = codeidx, gen = gen, inputs = {}}
+    fxdeps.outputs[key] = output
+    fxdeps.current[running()] = output
+  end
+  
+  function fxdependencyend()
+    fxdeps.current[running()] = nil
+  end
+end
+
 do
   -- generators
   fxgenerators = {}
   
-  -- the lights used during code generation
+  -- the lights used during code generation, the C backend points fxlights
+  -- to one of the fxlightconfigs for generation with a LightConfigID
   fxlights = {
     effects = {},
     max     = {},
+    cache   = {},   -- [generator][hints] = LIGHTGROUP text
   }
+  fxlightconfigs = {}
   
   local function newStorage()
     return {
@@ -414,6 +650,11 @@ do
       error("interface not complete, lacks implementation")
     end
     
+    -- a single segment unless the generator splits its code
+    function gen:MakeSegments(code,effect,env,genuniforms)
+      return { self:MakeCode(code,effect,env,genuniforms) }
+    end
+    
     function gen:MakeStorage(group)
       error("interface not complete, lacks implementation")
     end
@@ -427,8 +668,10 @@ do
   
   function fxregistergenerator(str,what)
     local fnmake,err
+    local files = {}
     if (str:sub(-4,-1) == ".lua") then
       fnmake,err = loadfile(str)
+      files[1] = str
     else
       fnmake,err = loadstring(str)
     end
@@ -441,6 +684,7 @@ do
       local f,e = loadfile(name)
       if not f then error(e, 3) end
       setfenv(f, getfenv(3))
+      table.insert(files,name)
       return f
     end
  
@@ -455,7 +699,8 @@ do
     env.loadfile     = function(str) return import(str) end
     
     local generator = setfenv(fnmake,env)()
-    generator.name = what
+    generator.name  = what
+    generator.files = files
     fxgenerators[what] = generator
   end
   
@@ -561,6 +806,7 @@ local function newParser()
         name      = name,
         varname   = varname,
         arraysize = arraycnt,
+        arraycnt  = arraycnt,
         group     = scopeObject.group,
         typeclass = typeclass,
         typename  = typename,
@@ -668,6 +914,22 @@ local function newParser()
     
     local function parseContent(content)
       assert( type(content) == "table", "content missing")
+      
+      local prev = loading and loading.pending and fxuserenums.enums[name]
+      if (prev) then
+        -- enum values are baked into every header, they cannot change on reload
+        local same = #content == prev.count
+        for i,v in ipairs(content) do
+          same = same and prev.content[i].name == v
+        end
+        assert( same, "enum class:"..name.." changed, reloading requires a new System")
+        scopeLeave("enum")
+        return
+      end
+      if (loading and loading.pending) then
+        loading.enums = true
+      end
+      
       for i,v in ipairs(content) do
         assert( type(v) == "string", "string required")
         local enumvalue = fxuserenums.values[v]
@@ -691,6 +953,8 @@ local function newParser()
       
       fxuserenums.enums[enum.idx]  = enum
       fxuserenums.enums[enum.name] = enum
+      enum.file = loading and loading.filename
+      local id = fxids[enum]
       
       addParameterParser(enumParser,"enum",nil,nil,nil,enum)
 
@@ -754,7 +1018,8 @@ local function newParser()
   local function parseGlobalGroup(effectname)
     assert(scopeTest("effect"), "used inside wrong scope")
     assert(type(effectname) == "string", "invalid name value")
-    local effect      = fxlib.global.effects[effectname]
+    local effect      = loading and loading.pending and loading.names["global::"..effectname] or
+                        fxlib.global.effects[effectname]
     assert(effect, "global effect not found:"..effectname)
     
     local function parseGroupName(groupname)
@@ -994,6 +1259,9 @@ local function newParser()
     local f,e = loadfile(name)
     if not f then error(e, 3) end
     setfenv(f, getfenv(3))
+    if (loading) then
+      watchFile(name).libraries[loading.filename] = true
+    end
     return f
   end
   
@@ -1073,21 +1341,163 @@ local parser = newParser()
 ---------------------------------------------------------
 -- Public API
 
+local function loadLibrary(fn,state)
+  local previous = loading
+  loading = state
+  local ok,err = pcall(parser.Load,parser,fn)
+  loading = previous
+  if (not ok) then
+    error(err,0)
+  end
+end
+
+local function addTechniques(effect,changed)
+  for i,v in ipairs(effect.technique) do
+    changed[fxids[v]] = true
+  end
+end
+
+local function reloadLibrary(filename,changed)
+  local fn,err = loadfile(filename)
+  assert( not err, err)
+  
+  local state = {filename = filename, pending = {}, names = {}}
+  loadLibrary(fn,state)
+  
+  -- validate first, so a failed reload leaves the library untouched
+  for i,effect in ipairs(state.pending) do
+    local prev = fxlib[effect.class].effects[effect.name]
+    assert(not prev or prev.file == filename, "Effect already defined:"..effect.class.." "..effect.name)
+  end
+  
+  -- effects no longer defined by the file stay registered, so their ids remain valid
+  local previous = fxfiles.libraries[filename]
+  local kept = {}
+  for i,effect in ipairs(previous) do
+    if (not state.names[effect.class.."::"..effect.name]) then
+      table.insert(kept,effect)
+    end
+  end
+  fxfiles.libraries[filename] = kept
+  
+  local groups = {}
+  local lights = false
+  local prevloading = loading
+  loading = {filename = filename}
+  for i,effect in ipairs(state.pending) do
+    local lib  = fxlib[effect.class]
+    local prev = lib.effects[effect.name]
+    if (prev) then
+      addTechniques(prev,changed)
+      lib:Replace(prev,effect)
+      for n,g in ipairs(prev.group) do
+        local new = effect.group[g.name]
+        if (g.host == prev and new and new ~= g) then
+          groups[g] = new
+        end
+      end
+    else
+      lib:Register(effect.name,effect)
+    end
+    addTechniques(effect,changed)
+    lights = lights or effect.class == "light"
+  end
+  loading = prevloading
+  
+  -- used lights may pull a replaced group in through GlobalGroup, their
+  -- LIGHTGROUP structs are memoized per light set
+  local sets = getLightSets()
+  for s,set in ipairs(sets) do
+    for i,light in ipairs(set.effects) do
+      for n,g in ipairs(light.group) do
+        lights = lights or groups[g] ~= nil
+      end
+    end
+  end
+  if (lights) then
+    for s,set in ipairs(sets) do
+      set.cache = {}
+    end
+  end
+  
+  -- other effects may use the replaced groups through GlobalGroup,
+  -- light code is pulled into every technique with lighting,
+  -- new enums end up in every header
+  if (next(groups) or lights or state.enums) then
+    for class in pairs(effecttypes) do
+      local lib = fxlib[class]
+      for n=1,lib.count do
+        local effect = lib.effects[n]
+        for i,g in ipairs(effect.group) do
+          local new = groups[g]
+          if (new) then
+            effect.group[i] = new
+            effect.group[g.name] = new
+            addTechniques(effect,changed)
+          end
+        end
+        if (lights or state.enums) then
+          for i,tech in ipairs(effect.technique) do
+            if (tech.lighting or state.enums) then
+              changed[fxids[tech]] = true
+            end
+          end
+        end
+      end
+    end
+  end
+end
+
 function fxfile(filename)
   local fn,err = loadfile(filename)
   assert( not err, err)
   
-  parser:Load(fn)
+  assert( not fxfiles.libraries[filename], "library already loaded: "..filename)
+  fxfiles.libraries[filename] = {}
+  watchFile(filename).libraries[filename] = true
+  
+  loadLibrary(fn,{filename = filename})
 end
 
 function fxstring(content)
   local fn,err = loadstring(content)
   assert( not err, err)
   
-  parser:Load(fn)
+  loadLibrary(fn,nil)
 end
 
-function fxcodegen(tech,codeid,gen)
+-- parses the library files depending on filename again, effects keep their ids.
+-- Returns the sorted ids of all techniques that need to be generated again.
+function fxreloadfile(filename)
+  local entry = fxfiles.entries[filename]
+  assert( entry, "file was not loaded: "..filename)
+  
+  fxfiledrop(filename)
+  
+  local changed = {}
+  for id in pairs(entry.techniques) do
+    changed[id] = true
+  end
+  for libfile in pairs(entry.libraries) do
+    reloadLibrary(libfile,changed)
+  end
+  
+  fxreloaded = {}
+  for id in pairs(changed) do
+    table.insert(fxreloaded,id)
+  end
+  table.sort(fxreloaded)
+  return fxreloaded
+end
+
+-- replaced by the C backend, yields the coroutine of a System::generateStep
+-- once its budget is used up. Must not be called across C boundaries (gsub
+-- callbacks, pcall, metamethods).
+function fxyieldpoint()
+end
+
+-- segmented returns the list of MakeSegments instead of a single string
+function fxcodegen(tech,codeid,gen,segmented)
   local gen = type(gen) == "number" and fxenums.generator[gen] or gen
   local generator = fxgenerators[gen]
   local effect    = tech.host
@@ -1095,7 +1505,78 @@ function fxcodegen(tech,codeid,gen)
   assert(generator,"missing generator")
   assert(effect,"missing effect")
   assert(code,"missing code")
-  return generator:MakeCode(code,effect)
+  
+  -- the generators add FILE sources, lights and enums they use
+  fxdependencybegin(tech,tech.codeidx[code.name],fxenums.generator[gen] or gen)
+  fxdependencyeffect(effect)
+  for i,group in ipairs(effect.group) do
+    if (group.host ~= effect) then
+      fxdependencyeffect(group.host)
+    end
+  end
+  if (effect.file) then
+    fxdependency("file:"..effect.file)
+  end
+  for i,file in ipairs(generator.files) do
+    fxdependency("file:"..file)
+  end
+  
+  local result = segmented and generator:MakeSegments(code,effect) or generator:MakeCode(code,effect)
+  fxdependencyend()
+  return result
+end
+
+-- several outputs of one technique, codeids[i] is generated with gens[i].
+-- Group text and enums are shared through fxprogram during the call, the
+-- C backend resets it on errors.
+function fxprogramgen(tech,codeids,gens)
+  fxprogram = {
+    parameters = {},  -- [group][entry][hints] = text
+    enums      = nil,
+  }
+  local results = {}
+  for i,codeid in ipairs(codeids) do
+    results[i] = fxcodegen(tech,codeid,gens[i])
+  end
+  fxprogram = nil
+  return results
+end
+
+-- sorted outputs {tech = id, code = idx, gen = generator} depending on a file or effect.
+-- Files cover library files, their includes, FILE sources and generator scripts.
+function fxdependents(input)
+  local keys = {}
+  if (type(input) == "string") then
+    keys["file:"..input] = true
+    local entry = fxfiles.entries[input]
+    for libfile in pairs(entry and entry.libraries or {}) do
+      keys["file:"..libfile] = true
+      for i,enum in ipairs(fxuserenums.enums) do
+        if (enum.file == libfile) then
+          keys.enums = true
+        end
+      end
+    end
+  else
+    keys["effect:"..fxids[input]] = true
+  end
+  
+  local found = {}
+  local result = {}
+  for key in pairs(keys) do
+    for outkey in pairs(fxdeps.inputs[key] or {}) do
+      if (not found[outkey]) then
+        found[outkey] = true
+        table.insert(result,fxdeps.outputs[outkey])
+      end
+    end
+  end
+  table.sort(result, function(a,b)
+    if (a.tech ~= b.tech) then return a.tech < b.tech end
+    if (a.code ~= b.code) then return a.code < b.code end
+    return tostring(a.gen) < tostring(b.gen)
+  end)
+  return result
 end
 
 function fxgroupstore(group,gen)
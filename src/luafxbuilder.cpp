@@ -27,17 +27,35 @@
 */
 
 #define FXBUILDER_USEVECTORCHECK 1
+#ifndef FXBUILDER_USESTORAGECHECK
+#define FXBUILDER_USESTORAGECHECK 0
+#endif
 
 #include <luafxbuilder/luafxbuilder.h>
 
-#if FXBUILDER_USEVECTORCHECK
 #include <vector>
-#endif
+#include <algorithm>
 
 #include <lua.hpp>
 #include <assert.h>
 #include <string.h>
 #include <stdlib.h>
+#include <stdio.h>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#endif
 
 namespace luafxbuilder
 {
@@ -331,281 +349,3300 @@ namespace luafxbuilder
 
   };
 
-  extern "C" {
-    int LuaStatePanicHandler(LuaState L){
-      // when this happens typically everything is too late
-      // and too messy to recover (albeit possible through
-      // use of longjump)
-      // the lua threads stack will be fully cleared
-      // only leftover is the error message
-      const char* error = lua_tostring(L,-1);
-      assert(0 && error);
-      return 0;
+
+  //////////////////////////////////////////////////////////////////////////
+  // Snapshot
+  //
+  // Flat native copy of the library metadata, built once by System::freeze.
+  // Objects are stored in per-kind tables, references between them are plain
+  // indices and all names are interned into a NameTable, so accessors become
+  // array reads. The fxids integer of an object maps to its table entry.
+
+  class NameTable {
+    friend class SnapshotImage;
+
+  public:
+    enum {
+      INVALID = 0,
+    };
+
+    NameTable()
+    {
+      // id 0 is reserved as "no name"
+      m_pool.push_back(0);
+      m_offsets.push_back(0);
+      m_lengths.push_back(0);
+      m_buckets.resize(64,INVALID);
     }
-  }
 
+    unsigned int find(const char* str, size_t len) const
+    {
+      size_t mask = m_buckets.size() - 1;
+      size_t slot = hash(str,len) & mask;
+      while (m_buckets[slot] != INVALID){
+        unsigned int id = m_buckets[slot];
+        if (m_lengths[id] == len && memcmp(&m_pool[m_offsets[id]],str,len) == 0){
+          return id;
+        }
+        slot = (slot + 1) & mask;
+      }
+      return INVALID;
+    }
 
+    unsigned int find(const char* str) const
+    {
+      return find(str,strlen(str));
+    }
 
-  static inline size_t outputString(const char* data, size_t datasize, char* buffer, size_t buffersize)
-  {
-    if (buffer) {
-      size_t written = buffersize > datasize ? datasize : buffersize;
-      memcpy(buffer,data,written);
-      return written;
+    unsigned int intern(const char* str, size_t len)
+    {
+      unsigned int id = find(str,len);
+      if (id != INVALID){
+        return id;
+      }
+
+      id = (unsigned int)m_offsets.size();
+      m_offsets.push_back((unsigned int)m_pool.size());
+      m_lengths.push_back((unsigned int)len);
+      m_pool.insert(m_pool.end(),str,str + len);
+      m_pool.push_back(0);
+
+      // keep load factor below 1/2
+      if (m_offsets.size() * 2 > m_buckets.size()){
+        rehash(m_buckets.size() * 2);
+      }
+      else{
+        insertBucket(id);
+      }
+      return id;
     }
-    else{
-      return datasize;
+
+    const char*   getString(unsigned int id) const  { return &m_pool[m_offsets[id]]; }
+    size_t        getLength(unsigned int id) const  { return m_lengths[id]; }
+    unsigned int  getCount() const                  { return (unsigned int)m_offsets.size(); }
+
+  private:
+    std::vector<char>           m_pool;
+    std::vector<unsigned int>   m_offsets;
+    std::vector<unsigned int>   m_lengths;
+    std::vector<unsigned int>   m_buckets;
+
+    static size_t hash(const char* str, size_t len)
+    {
+      // FNV-1a
+      unsigned int h = 2166136261u;
+      for (size_t i = 0; i < len; i++){
+        h ^= (unsigned char)str[i];
+        h *= 16777619u;
+      }
+      return h;
     }
-  }
 
-  size_t System::getLastErrorString(char* buffer, size_t buffersize)
-  {
-    return outputString(m_lastError, m_lastErrorSize, buffer, buffersize);
-  }
+    void insertBucket(unsigned int id)
+    {
+      size_t mask = m_buckets.size() - 1;
+      size_t slot = hash(getString(id),m_lengths[id]) & mask;
+      while (m_buckets[slot] != INVALID){
+        slot = (slot + 1) & mask;
+      }
+      m_buckets[slot] = id;
+    }
 
-  std::string System::getLastErrorString()
-  {
-    return std::string(m_lastError);
-  }
+    void rehash(size_t size)
+    {
+      m_buckets.clear();
+      m_buckets.resize(size,INVALID);
+      for (unsigned int i = 1; i < getCount(); i++){
+        insertBucket(i);
+      }
+    }
+  };
 
-  void System::updateError()
-  {
-    LuaState L = m_luaState;
-    const char* errormsg = lua_tolstring(L,-1,&m_lastErrorSize);
-    assert(errormsg);
+  enum SnapshotKind {
+    SNAPSHOT_NONE,
+    SNAPSHOT_EFFECT,
+    SNAPSHOT_GROUP,
+    SNAPSHOT_TECHNIQUE,
+    SNAPSHOT_ENUM,
+  };
 
-    m_lastError = (char*) realloc(m_lastError,m_lastErrorSize);
-    memcpy(m_lastError,errormsg,m_lastErrorSize);
+  struct SnapshotID {
+    unsigned int  kind;
+    unsigned int  index;
+  };
 
-    lua_pop(L,1);
-  }
+  struct SnapshotEffect {
+    unsigned int  name;
+    unsigned int  type;
+    unsigned int  groupFirst;     // into groupRefs
+    unsigned int  groupCount;
+    unsigned int  techniqueFirst; // into techniques
+    unsigned int  techniqueCount;
+  };
 
-  static inline void registerEnum(LuaState L, const char* name, int enumvalue )
-  {
-    // tab[name]=value
-    lua_pushstring  (L,name);
-    lua_pushinteger (L,enumvalue);
-    lua_rawset      (L,-3);
+  struct SnapshotGroup {
+    unsigned int  name;
+    unsigned int  type;
+    unsigned int  effect;         // fxid of host
+    unsigned int  parameterFirst;
+    unsigned int  parameterCount;
+  };
 
-    // tab[value]=name
-    lua_pushinteger (L,enumvalue);
-    lua_pushstring  (L,name);
-    lua_rawset      (L,-3);
-  }
+  struct SnapshotParameter {
+    unsigned int  name;
+    unsigned int  type;
+    int           arraySize;
+    unsigned int  reference;      // fxid or 0
+    unsigned int  defaultConv;
+    unsigned int  defaultCount;
+    unsigned int  valueOffset;    // into values
+    unsigned int  valueSize;
+  };
 
-  error System::init(const char* processorFile)
-  {
-    m_lastError = NULL;
-    m_lastErrorSize = 0;
+  struct SnapshotTechnique {
+    unsigned int  name;
+    unsigned int  effect;         // fxid of host
+    unsigned int  lighting;
+    unsigned int  optionFirst;
+    unsigned int  optionCount;
+    unsigned int  codeFirst;      // into codes
+    unsigned int  codeCount;
+  };
 
-    LuaState L = luaL_newstate();
-    m_luaState = L;
-    lua_atpanic(L,LuaStatePanicHandler);
+  struct SnapshotOption {
+    unsigned int  name;
+    unsigned int  type;           // lua type
+    unsigned int  string;         // interned name for strings
+    unsigned int  boolean;
+    double        number;
+  };
 
-#ifdef _DEBUG
-    /* more verbose error messages, including full stack info */
-    lua_pushboolean(L,1);
-    lua_setglobal(L,"fxdebug");
-#endif
+  struct SnapshotEnum {
+    unsigned int  name;
+    unsigned int  valueFirst;
+    unsigned int  valueCount;
+  };
 
-    luaL_openlibs(L);
-    if (luaL_dofile(L, processorFile)){
-      updateError();
-      return true;
-    }
-    // prepare the stack for fast access to frequent tables
-    lua_getglobal(L,"fxenums");
-    assert(lua_type(L,-1) == LUA_TTABLE);
-    assert(lua_gettop(L)  == FXENUMS);
-    lua_getglobal(L,"fxlib");
-    assert(lua_type(L,-1) == LUA_TTABLE);
-    assert(lua_gettop(L)  == FXBUILDER);
-    lua_getglobal(L,"fxids");
-    assert(lua_type(L,-1) == LUA_TTABLE);
-    assert(lua_gettop(L)  == FXIDS);
-    lua_getglobal(L,"fxerror");
-    assert(lua_type(L,-1) == LUA_TFUNCTION);
-    assert(lua_gettop(L)  == FXERROR);
-    lua_getglobal(L,"fxlights");
-    assert(lua_type(L,-1) == LUA_TTABLE);
-    assert(lua_gettop(L)  == FXLIGHTS);
-    lua_getglobal(L,"fxuserenums");
-    assert(lua_type(L,-1) == LUA_TTABLE);
-    assert(lua_gettop(L)  == FXUSERENUMS);
-    
+  struct SnapshotEnumValue {
+    unsigned int  name;
+    int           value;
+  };
 
-    // initialize enum table
-    lua_getfield(L,FXENUMS,"effect");
-    for (int i = 0; i < NUM_EFFECTS; i++){
-      registerEnum(L,EffectType_toString((EffectType)i),i);
-    }
-    lua_pop(L,1);
+  struct SnapshotStorage {
+    unsigned int  type;           // StorageType
+    unsigned int  name;           // interned storage name
+    unsigned int  entryFirst;     // into storageEntries
+    unsigned int  entryCount;
+  };
 
-    lua_getfield(L,FXENUMS,"parameter");
-    for (int i = 0; i < NUM_PARAMETERS; i++){
-      registerEnum(L,ParameterType_toString((ParameterType)i),i);
+  struct SnapshotStorageEntry {
+    unsigned int  size;
+    unsigned int  offset;
+    unsigned int  stride;
+    unsigned int  element;
+    unsigned int  align;
+  };
+
+  struct SnapshotLookup {
+    unsigned int  name;
+    unsigned int  index;
+
+    bool operator < (const SnapshotLookup& other) const {
+      return name < other.name;
     }
-    lua_pop(L,1);
+  };
 
-    lua_getfield(L,FXENUMS,"generator");
-    for (int i = 0; i < NUM_GENERERATORS; i++){
-      registerEnum(L,GeneratorType_toString((GeneratorType)i),i);
+  struct Snapshot {
+    std::vector<SnapshotID>         ids;
+    std::vector<SnapshotEffect>     effects;
+    std::vector<unsigned int>       groupRefs;
+    std::vector<SnapshotGroup>      groups;
+    std::vector<SnapshotParameter>  parameters;
+    std::vector<unsigned char>      values;
+    std::vector<SnapshotTechnique>  techniques;
+    std::vector<unsigned int>       codes;
+    std::vector<SnapshotOption>     options;
+    std::vector<SnapshotEnum>       enums;
+    std::vector<SnapshotEnumValue>  enumValues;
+      // NUM_GENERERATORS per group
+    std::vector<SnapshotStorage>      storages;
+    std::vector<SnapshotStorageEntry> storageEntries;
+      // sorted by name for binary search
+    std::vector<SnapshotLookup>     effectLookup[NUM_EFFECTS];
+    std::vector<SnapshotLookup>     enumLookup;
+    std::vector<SnapshotLookup>     enumValueLookup;
+      // parallel to the per-object ranges of groupRefs, techniques,
+      // parameters, options and codes, each range sorted by name
+    std::vector<SnapshotLookup>     groupRefLookup;
+    std::vector<SnapshotLookup>     techniqueLookup;
+    std::vector<SnapshotLookup>     parameterLookup;
+    std::vector<SnapshotLookup>     optionLookup;
+    std::vector<SnapshotLookup>     codeLookup;
+      // effects are stored contiguous per type
+    unsigned int                    effectFirst[NUM_EFFECTS];
+    unsigned int                    effectCount[NUM_EFFECTS];
+    std::vector<unsigned int>       effectIDs;
+    std::vector<unsigned int>       groupIDs;
+    std::vector<unsigned int>       techniqueIDs;
+    std::vector<unsigned int>       enumIDs;
+
+    inline unsigned int getIndex(size_t id, SnapshotKind kind) const {
+      assert(id < ids.size() && ids[id].kind == kind && "illegal id");
+      return ids[id].index;
     }
-    lua_pop(L,1);
 
-    lua_getfield(L,FXENUMS,"dataconvert");
-    for (int i = 0; i < NUM_DATACONVERTS; i++){
-      registerEnum(L,DataConvert_toString((DataConvert)i),i);
+    inline const SnapshotEffect&    getEffect(EffectID effect) const  { return effects[getIndex((size_t)effect,SNAPSHOT_EFFECT)]; }
+    inline const SnapshotGroup&     getGroup(GroupID group) const     { return groups[getIndex((size_t)group,SNAPSHOT_GROUP)]; }
+    inline const SnapshotTechnique& getTechnique(TechID tech) const   { return techniques[getIndex((size_t)tech,SNAPSHOT_TECHNIQUE)]; }
+    inline const SnapshotEnum&      getEnum(EnumID enumtype) const    { return enums[getIndex((size_t)enumtype,SNAPSHOT_ENUM)]; }
+    inline const SnapshotStorage&   getStorage(GroupID group, GeneratorType gentype) const {
+      return storages[getIndex((size_t)group,SNAPSHOT_GROUP) * NUM_GENERERATORS + gentype];
     }
-    lua_pop(L,1);
 
-    lua_getfield(L,FXENUMS,"group");
-    for (int i = 0; i < NUM_GROUPS; i++){
-      registerEnum(L,GroupType_toString((GroupType)i),i);
+    static int lookup(const std::vector<SnapshotLookup>& table, unsigned int name)
+    {
+      if (name == NameTable::INVALID || table.empty()) return -1;
+      SnapshotLookup key;
+      key.name  = name;
+      key.index = 0;
+      std::vector<SnapshotLookup>::const_iterator it = std::lower_bound(table.begin(),table.end(),key);
+      if (it == table.end() || it->name != name) return -1;
+      return (int)it->index;
     }
-    lua_pop(L,1);
 
-    lua_getfield(L,FXENUMS,"storage");
-    for (int i = 0; i < NUM_STORAGES; i++){
-      registerEnum(L,StorageType_toString((StorageType)i),i);
+    static int lookup(const std::vector<SnapshotLookup>& table, unsigned int first, unsigned int count, unsigned int name)
+    {
+      if (name == NameTable::INVALID || !count) return -1;
+      SnapshotLookup key;
+      key.name  = name;
+      key.index = 0;
+      const SnapshotLookup* begin = &table[first];
+      const SnapshotLookup* end   = begin + count;
+      const SnapshotLookup* it    = std::lower_bound(begin,end,key);
+      if (it == end || it->name != name) return -1;
+      return (int)it->index;
     }
-    lua_pop(L,1);
 
-    // make effectlib enum indexable
-    for (int i = 0; i < NUM_EFFECTS; i++){
-      lua_getfield(L,FXBUILDER, EffectType_toString((EffectType)i) );
-      assert(lua_type(L,-1) == LUA_TTABLE);
-      lua_rawseti (L,FXBUILDER, i );
+    void setID(size_t id, SnapshotKind kind, unsigned int index)
+    {
+      if (id >= ids.size()){
+        SnapshotID none = {SNAPSHOT_NONE,0};
+        ids.resize(id + 1,none);
+      }
+      ids[id].kind  = kind;
+      ids[id].index = index;
     }
 
-    // make generatorlib enum indexable
-    lua_getglobal(L,"fxgenerators");
-    assert(lua_type(L,-1) == LUA_TTABLE);
-    for (int i = 0; i < NUM_GENERERATORS; i++){
-      lua_getfield(L,-1, GeneratorType_toString((GeneratorType)i) );
-      assert(lua_type(L,-1) == LUA_TTABLE);
-      lua_rawseti (L,-2, i );
+    bool hasID(size_t id, SnapshotKind kind) const
+    {
+      return id < ids.size() && ids[id].kind == kind;
     }
-    lua_pop(L,1);
+  };
 
-    return false;
-  }
 
-  void System::deinit()
-  {
-    lua_close(m_luaState);
-    m_luaState = NULL;
-  }
+  //////////////////////////////////////////////////////////////////////////
+  // CodeHash
+  //
+  // murmur3 style mixing of 8 byte little endian words, stable across runs
+  // and platforms, computed once when code enters the cache.
 
-  error System::addLibrary(const char* funcname, const char* buffer, size_t buffersize)
+  static inline unsigned long long rotl64(unsigned long long x, int r)
   {
-    LuaState L = m_luaState;
-    LuaStatePreserve preserve(L);
-    lua_getglobal(L,funcname);
-    lua_pushlstring(L,buffer,buffersize);
-    if (lua_pcall(L,1,0,FXERROR)){
-      updateError();
-      return true;
-    }
-    return false;
+    return (x << r) | (x >> (64 - r));
   }
 
-  error System::addLibraryFile( const char* filename )
+  static inline unsigned long long fmix64(unsigned long long k)
   {
-    return addLibrary("fxfile",filename,strlen(filename));
+    k ^= k >> 33;
+    k *= 0xff51afd7ed558ccdULL;
+    k ^= k >> 33;
+    k *= 0xc4ceb9fe1a85ec53ULL;
+    k ^= k >> 33;
+    return k;
   }
 
-  error System::addLibraryString( const char* buffer, size_t buffersize )
+  static CodeHash hashCode(const char* str, size_t size)
   {
-    return addLibrary("fxstring",buffer, buffersize);
-  }
+    const unsigned long long c1 = 0x87c37b91114253d5ULL;
+    const unsigned long long c2 = 0x4cf5ad432745937fULL;
+    const unsigned char* bytes = (const unsigned char*)str;
+
+    unsigned long long h = 0x9e3779b97f4a7c15ULL ^ (unsigned long long)size;
+    size_t blocks = size / 8;
+    for (size_t i = 0; i < blocks; i++, bytes += 8){
+      unsigned long long k = 
+        ((unsigned long long)bytes[0]      ) | ((unsigned long long)bytes[1] <<  8) |
+        ((unsigned long long)bytes[2] << 16) | ((unsigned long long)bytes[3] << 24) |
+        ((unsigned long long)bytes[4] << 32) | ((unsigned long long)bytes[5] << 40) |
+        ((unsigned long long)bytes[6] << 48) | ((unsigned long long)bytes[7] << 56);
+      k *= c1;
+      k  = rotl64(k,31);
+      k *= c2;
+      h ^= k;
+      h  = rotl64(h,27) * 5 + 0x52dce729;
+    }
 
-  int System::getEffectCount( EffectType effecttype )
-  {
-    LuaState L = m_luaState;
-    LuaStatePreserve preserve(L);
-    lua_rawgeti(L,FXBUILDER, effecttype);
-    lua_getfield(L,-1,"count");
-    int count = (int)lua_tointeger(L,-1);
-    return count;
+    size_t tail = size & 7;
+    if (tail){
+      unsigned long long k = 0;
+      for (size_t i = 0; i < tail; i++){
+        k |= (unsigned long long)bytes[i] << (i * 8);
+      }
+      k *= c1;
+      k  = rotl64(k,31);
+      k *= c2;
+      h ^= k;
+    }
+    return (CodeHash)fmix64(h);
   }
 
-  inline size_t System::getID()
+  //////////////////////////////////////////////////////////////////////////
+  // CodeCache
+  //
+  // Generated code strings keyed by technique, code, generator and the
+  // serial of the light set that was active. Identical code of several keys is stored
+  // once in a CodeBlob, found by its content hash. Blobs are heap allocated
+  // so their strings stay put while the tables grow.
+
+  struct CodeCacheKey {
+    size_t        tech;
+    int           codeidx;
+    int           gentype;
+    unsigned int  lights;       // LightSets serial, 0 for unlit techniques
+
+    bool operator == (const CodeCacheKey& other) const {
+      return tech == other.tech && codeidx == other.codeidx &&
+             gentype == other.gentype && lights == other.lights;
+    }
+  };
+
+  static size_t hashCacheKey(const CodeCacheKey& key)
   {
-    LuaState L = m_luaState;    // 0 obj
-    lua_gettable(L,FXIDS);      // 0 id = fxids[obj]
-    int id = (int)lua_tointeger(L,-1);
-    return id;
+    size_t h = key.tech * 2654435761u;
+    h = (h ^ (size_t)key.codeidx) * 16777619u;
+    h = (h ^ (size_t)key.gentype) * 16777619u;
+    h = (h ^ (size_t)key.lights) * 16777619u;
+    return h ^ (h >> 15);
   }
 
-  EffectID System::getEffect( EffectType effecttype, int i )
+  // erase criteria of the caches, the techniques (sorted ascending) or,
+  // if NULL, the light set
+  static inline bool matchErase(const CodeCacheKey& key, const std::vector<size_t>* techs, unsigned int lights)
   {
-    LuaState L = m_luaState;
-    LuaStatePreserve preserve(L);
-    lua_rawgeti (L,FXBUILDER, effecttype);
-    lua_getfield(L,-1,"effects");
-    lua_rawgeti (L,-1,i + 1);
-
-    assert(lua_istable(L,-1) && "illegal index");
+    return techs ? std::binary_search(techs->begin(),techs->end(),key.tech) : key.lights == lights;
+  }
 
-    EffectID id = (EffectID)getID();
+  struct CodeBlob {
+    std::string   code;
+    CodeHash      hash;
+    CodeCacheKey  canonical;    // first key that generated the code
+    int           refs;
+    bool          orphaned;     // canonical key was dropped
+  };
 
-    return id;
-  }
+  class CodeCache {
+  private:
+    struct Entry {
+      CodeCacheKey  key;
+      size_t        hash;
+      CodeBlob*     blob;
+    };
 
-  EffectID System::getEffect( EffectType effecttype, const char* name )
-  {
-    LuaState L = m_luaState;
-    LuaStatePreserve preserve(L);
-    lua_rawgeti (L,FXBUILDER, effecttype );
-    lua_getfield(L,-1,"effects");
-    lua_getfield(L,-1,name);
+    std::vector<Entry*>     m_buckets;
+    std::vector<CodeBlob*>  m_blobs;
+    CodeCacheStats          m_stats;
 
-    if (!lua_istable(L,-1)){
-      return 0;
+    static size_t hash(const CodeCacheKey& key)
+    {
+      return hashCacheKey(key);
     }
 
-    EffectID id = (EffectID)getID();
+    size_t findSlot(const CodeCacheKey& key, size_t h) const
+    {
+      size_t mask = m_buckets.size() - 1;
+      size_t slot = h & mask;
+      while (m_buckets[slot] && !(m_buckets[slot]->hash == h && m_buckets[slot]->key == key)){
+        slot = (slot + 1) & mask;
+      }
+      return slot;
+    }
 
-    return id;
-  }
+    void rehash(size_t size)
+    {
+      std::vector<Entry*> old;
+      old.swap(m_buckets);
+      m_buckets.resize(size,NULL);
+      for (size_t i = 0; i < old.size(); i++){
+        if (old[i]){
+          m_buckets[findSlot(old[i]->key,old[i]->hash)] = old[i];
+        }
+      }
+    }
+
+    size_t blobSlot(CodeHash h) const
+    {
+      return (size_t)(h ^ (h >> 32)) & (m_blobs.size() - 1);
+    }
+
+    void insertBlob(CodeBlob* blob)
+    {
+      size_t mask = m_blobs.size() - 1;
+      size_t slot = blobSlot(blob->hash);
+      while (m_blobs[slot]){
+        slot = (slot + 1) & mask;
+      }
+      m_blobs[slot] = blob;
+    }
+
+    CodeBlob* acquireBlob(const CodeCacheKey& key, const char* str, size_t size)
+    {
+      CodeHash h = hashCode(str,size);
+      size_t mask = m_blobs.size() - 1;
+      for (size_t slot = blobSlot(h); m_blobs[slot]; slot = (slot + 1) & mask){
+        CodeBlob* blob = m_blobs[slot];
+        if (blob->hash == h && blob->code.size() == size && memcmp(blob->code.data(),str,size) == 0){
+          blob->refs++;
+          return blob;
+        }
+      }
+
+      CodeBlob* blob = new CodeBlob;
+      blob->code.assign(str,size);
+      blob->hash      = h;
+      blob->canonical = key;
+      blob->refs      = 1;
+      blob->orphaned  = false;
+      m_stats.unique++;
+      m_stats.uniqueBytes += size;
+
+      if ((m_stats.unique + 1) * 2 > m_blobs.size()){
+        std::vector<CodeBlob*> old;
+        old.swap(m_blobs);
+        m_blobs.resize(old.size() * 2,NULL);
+        for (size_t i = 0; i < old.size(); i++){
+          if (old[i]) insertBlob(old[i]);
+        }
+      }
+      insertBlob(blob);
+      return blob;
+    }
+
+    void releaseBlob(CodeBlob* blob, const CodeCacheKey& key)
+    {
+      if (--blob->refs){
+        blob->orphaned |= blob->canonical == key;
+        return;
+      }
+
+      size_t mask = m_blobs.size() - 1;
+      size_t slot = blobSlot(blob->hash);
+      while (m_blobs[slot] != blob){
+        slot = (slot + 1) & mask;
+      }
+      // linear probing, reinsert the rest of the cluster
+      m_blobs[slot] = NULL;
+      for (slot = (slot + 1) & mask; m_blobs[slot]; slot = (slot + 1) & mask){
+        CodeBlob* moved = m_blobs[slot];
+        m_blobs[slot] = NULL;
+        insertBlob(moved);
+      }
+
+      m_stats.unique--;
+      m_stats.uniqueBytes -= blob->code.size();
+      delete blob;
+    }
+
+    void deleteEntry(Entry* entry)
+    {
+      m_stats.entries--;
+      m_stats.bytes -= entry->blob->code.size();
+      releaseBlob(entry->blob,entry->key);
+      delete entry;
+    }
+
+  public:
+    CodeCache()
+    {
+      m_buckets.resize(64,NULL);
+      m_blobs.resize(64,NULL);
+      memset(&m_stats,0,sizeof(m_stats));
+    }
+
+    ~CodeCache()
+    {
+      clear();
+    }
+
+    const CodeBlob* find(const CodeCacheKey& key)
+    {
+      Entry* entry = m_buckets[findSlot(key,hash(key))];
+      if (entry){
+        m_stats.hits++;
+        return entry->blob;
+      }
+      m_stats.misses++;
+      return NULL;
+    }
+
+    // lookup without counting a hit or miss
+    const CodeBlob* probe(const CodeCacheKey& key) const
+    {
+      Entry* entry = m_buckets[findSlot(key,hash(key))];
+      return entry ? entry->blob : NULL;
+    }
+
+    const CodeBlob* insert(const CodeCacheKey& key, const char* str, size_t size)
+    {
+      size_t h = hash(key);
+      size_t slot = findSlot(key,h);
+      Entry* entry = m_buckets[slot];
+      if (!entry){
+        entry = new Entry;
+        entry->key  = key;
+        entry->hash = h;
+        m_buckets[slot] = entry;
+        m_stats.entries++;
+        entry->blob = acquireBlob(key,str,size);
+      }
+      else{
+        CodeBlob* old = entry->blob;
+        bool shared = old->refs > 1;
+        m_stats.bytes -= old->code.size();
+        releaseBlob(old,key);
+        entry->blob = acquireBlob(key,str,size);
+        // same code keeps its canonical key, else another user takes over
+        if (shared && old->orphaned){
+          if (entry->blob == old){
+            old->orphaned = false;
+          }
+          else{
+            adoptOrphans();
+          }
+        }
+      }
+      m_stats.bytes += size;
+
+      if (m_stats.entries * 2 > m_buckets.size()){
+        rehash(m_buckets.size() * 2);
+      }
+      return entry->blob;
+    }
+
+    void clear()
+    {
+      for (size_t i = 0; i < m_buckets.size(); i++){
+        if (m_buckets[i]){
+          deleteEntry(m_buckets[i]);
+          m_buckets[i] = NULL;
+        }
+      }
+    }
+
+  private:
+    // shared code whose canonical key was dropped picks a remaining one
+    void adoptOrphans()
+    {
+      for (size_t i = 0; i < m_buckets.size(); i++){
+        Entry* entry = m_buckets[i];
+        if (entry && entry->blob->orphaned){
+          entry->blob->canonical = entry->key;
+          entry->blob->orphaned  = false;
+        }
+      }
+    }
+
+    void eraseMatching(const std::vector<size_t>* techs, unsigned int lights)
+    {
+      bool orphans = false;
+      bool erased  = false;
+      for (size_t i = 0; i < m_buckets.size(); i++){
+        Entry* entry = m_buckets[i];
+        if (entry && matchErase(entry->key,techs,lights)){
+          orphans |= entry->blob->refs > 1 && entry->blob->canonical == entry->key;
+          deleteEntry(entry);
+          m_buckets[i] = NULL;
+          erased = true;
+        }
+      }
+      if (!erased){
+        return;
+      }
+      // open addressing, reinsert the survivors
+      rehash(m_buckets.size());
+      if (orphans){
+        adoptOrphans();
+      }
+    }
+
+  public:
+    // drops all entries of the techniques, sorted ascending
+    void erase(const std::vector<size_t>& techs)
+    {
+      if (!techs.empty()){
+        eraseMatching(&techs,0);
+      }
+    }
+
+    // drops all entries generated with the light set
+    void eraseLights(unsigned int lights)
+    {
+      eraseMatching(NULL,lights);
+    }
+
+    void resetStats()
+    {
+      m_stats.hits   = 0;
+      m_stats.misses = 0;
+    }
+
+    const CodeCacheStats& getStats() const
+    {
+      return m_stats;
+    }
+  };
+
+  //////////////////////////////////////////////////////////////////////////
+  // SegmentCache
+  //
+  // Segmented code keyed like the CodeCache. Segments are interned by content
+  // with a reference count, so a header or FILE block used by thousands of
+  // outputs is stored once. Each output keeps parallel string and length
+  // arrays that can be passed on without copying. Both tables are chained.
+
+  class SegmentCache {
+  private:
+    struct Segment {
+      Segment*      next;
+      std::string   str;
+      CodeHash      hash;
+      int           refs;
+    };
+
+    struct Entry {
+      Entry*        next;
+      CodeCacheKey  key;
+      std::vector<Segment*>     segments;
+      std::vector<const char*>  strings;
+      std::vector<int>          lengths;
+      size_t        size;
+      CodeHash      hash;
+    };
+
+    std::vector<Entry*>     m_entries;
+    std::vector<Segment*>   m_segments;
+    std::string             m_scratch;  // whole code for the hash
+    CodeCacheStats          m_stats;
+
+    static size_t segmentSlot(CodeHash h, size_t size)
+    {
+      return (size_t)(h ^ (h >> 32)) & (size - 1);
+    }
+
+    Entry** findEntry(const CodeCacheKey& key)
+    {
+      Entry** link = &m_entries[hashCacheKey(key) & (m_entries.size() - 1)];
+      while (*link && !((*link)->key == key)){
+        link = &(*link)->next;
+      }
+      return link;
+    }
+
+    Segment* acquireSegment(const char* str, size_t size)
+    {
+      CodeHash h = hashCode(str,size);
+      for (Segment* seg = m_segments[segmentSlot(h,m_segments.size())]; seg; seg = seg->next){
+        if (seg->hash == h && seg->str.size() == size && memcmp(seg->str.data(),str,size) == 0){
+          seg->refs++;
+          return seg;
+        }
+      }
+
+      if (m_stats.unique + 1 > m_segments.size()){
+        std::vector<Segment*> old;
+        old.swap(m_segments);
+        m_segments.resize(old.size() * 2,NULL);
+        for (size_t i = 0; i < old.size(); i++){
+          while (old[i]){
+            Segment* moved = old[i];
+            old[i] = moved->next;
+            Segment*& head = m_segments[segmentSlot(moved->hash,m_segments.size())];
+            moved->next = head;
+            head = moved;
+          }
+        }
+      }
+
+      Segment* seg = new Segment;
+      Segment*& head = m_segments[segmentSlot(h,m_segments.size())];
+      seg->next = head;
+      seg->str.assign(str,size);
+      seg->hash = h;
+      seg->refs = 1;
+      head = seg;
+      m_stats.unique++;
+      m_stats.uniqueBytes += size;
+      return seg;
+    }
+
+    void releaseSegment(Segment* seg)
+    {
+      if (--seg->refs){
+        return;
+      }
+      Segment** link = &m_segments[segmentSlot(seg->hash,m_segments.size())];
+      while (*link != seg){
+        link = &(*link)->next;
+      }
+      *link = seg->next;
+      m_stats.unique--;
+      m_stats.uniqueBytes -= seg->str.size();
+      delete seg;
+    }
+
+    void deleteEntry(Entry* entry)
+    {
+      for (size_t i = 0; i < entry->segments.size(); i++){
+        releaseSegment(entry->segments[i]);
+      }
+      m_stats.entries--;
+      m_stats.bytes -= entry->size;
+      delete entry;
+    }
+
+    static void fill(const Entry* entry, SegmentedCode* code)
+    {
+      code->count   = (int)entry->strings.size();
+      code->strings = entry->strings.empty() ? NULL : &entry->strings[0];
+      code->lengths = entry->lengths.empty() ? NULL : &entry->lengths[0];
+      code->size    = entry->size;
+      code->hash    = entry->hash;
+    }
+
+  public:
+    SegmentCache()
+    {
+      m_entries.resize(64,NULL);
+      m_segments.resize(64,NULL);
+      memset(&m_stats,0,sizeof(m_stats));
+    }
+
+    ~SegmentCache()
+    {
+      clear();
+    }
+
+    bool find(const CodeCacheKey& key, SegmentedCode* code)
+    {
+      Entry* entry = *findEntry(key);
+      if (entry){
+        m_stats.hits++;
+        fill(entry,code);
+        return true;
+      }
+      m_stats.misses++;
+      return false;
+    }
+
+    // key must not be cached yet, empty segments are skipped
+    void insert(const CodeCacheKey& key, int count, const char** strs, const size_t* sizes, SegmentedCode* code)
+    {
+      Entry* entry = new Entry;
+      entry->key  = key;
+      entry->size = 0;
+      m_scratch.clear();
+      for (int i = 0; i < count; i++){
+        if (!sizes[i]){
+          continue;
+        }
+        Segment* seg = acquireSegment(strs[i],sizes[i]);
+        entry->segments.push_back(seg);
+        entry->strings.push_back(seg->str.c_str());
+        entry->lengths.push_back((int)sizes[i]);
+        entry->size += sizes[i];
+        m_scratch.append(strs[i],sizes[i]);
+      }
+      entry->hash = hashCode(m_scratch.data(),m_scratch.size());
+      m_stats.entries++;
+      m_stats.bytes += entry->size;
+
+      if (m_stats.entries > m_entries.size()){
+        std::vector<Entry*> old;
+        old.swap(m_entries);
+        m_entries.resize(old.size() * 2,NULL);
+        for (size_t i = 0; i < old.size(); i++){
+          while (old[i]){
+            Entry* moved = old[i];
+            old[i] = moved->next;
+            Entry*& head = m_entries[hashCacheKey(moved->key) & (m_entries.size() - 1)];
+            moved->next = head;
+            head = moved;
+          }
+        }
+      }
+      Entry** link = findEntry(key);
+      assert(!*link);
+      entry->next = NULL;
+      *link = entry;
+
+      fill(entry,code);
+    }
+
+    void clear()
+    {
+      for (size_t i = 0; i < m_entries.size(); i++){
+        while (m_entries[i]){
+          Entry* entry = m_entries[i];
+          m_entries[i] = entry->next;
+          deleteEntry(entry);
+        }
+      }
+    }
+
+    // drops all entries of the techniques, sorted ascending
+    void erase(const std::vector<size_t>& techs)
+    {
+      if (!techs.empty()){
+        eraseMatching(&techs,0);
+      }
+    }
+
+    // drops all entries generated with the light set
+    void eraseLights(unsigned int lights)
+    {
+      eraseMatching(NULL,lights);
+    }
+
+  private:
+    void eraseMatching(const std::vector<size_t>* techs, unsigned int lights)
+    {
+      for (size_t i = 0; i < m_entries.size(); i++){
+        Entry** link = &m_entries[i];
+        while (*link){
+          Entry* entry = *link;
+          if (matchErase(entry->key,techs,lights)){
+            *link = entry->next;
+            deleteEntry(entry);
+          }
+          else{
+            link = &entry->next;
+          }
+        }
+      }
+    }
+
+  public:
+    void resetStats()
+    {
+      m_stats.hits   = 0;
+      m_stats.misses = 0;
+    }
+
+    const CodeCacheStats& getStats() const
+    {
+      return m_stats;
+    }
+  };
+
+  //////////////////////////////////////////////////////////////////////////
+  // LightSets
+  //
+  // Interns light sets by their full content. The serial, starting at 1,
+  // identifies a set in the code cache key, equal sets share a serial and
+  // different sets never do. Light configurations and the recent sets of
+  // setGeneratorLights hold a reference, the slot of an unused set is
+  // reused once its code was dropped. Also caches the lighting flag of the
+  // techniques, the part of the key that would need lua.
+
+  enum {
+    LIGHTSETS_RECENT = 4,
+  };
+
+  class LightSets {
+  private:
+    struct Set {
+      unsigned int          hash;
+      std::vector<size_t>   content;    // effect id and max interleaved
+      int                   refs;       // 0 when the slot is free
+    };
+
+    enum Lit {
+      LIT_UNKNOWN,
+      LIT_NO,
+      LIT_YES,
+    };
+
+    std::vector<Set>            m_sets;
+    std::vector<unsigned int>   m_recent;   // of setGeneratorLights, latest first
+    std::vector<unsigned char>  m_lit;      // Lit by technique id
+
+  public:
+    // returns true if the set is no longer used, its code must be dropped
+    bool release(unsigned int serial)
+    {
+      Set& set = m_sets[serial - 1];
+      assert(set.refs > 0);
+      if (--set.refs){
+        return false;
+      }
+      std::vector<size_t>().swap(set.content);
+      return true;
+    }
+
+    // takes over the reference of serial, returns the serial whose
+    // reference the caller must release, 0 if none
+    unsigned int makeRecent(unsigned int serial)
+    {
+      size_t i = 0;
+      while (i < m_recent.size() && m_recent[i] != serial){
+        i++;
+      }
+      unsigned int released = 0;
+      if (i < m_recent.size()){
+        released = serial;
+      }
+      else if (m_recent.size() == LIGHTSETS_RECENT){
+        i = m_recent.size() - 1;
+        released = m_recent[i];
+      }
+      else{
+        m_recent.push_back(0);
+      }
+      for (; i > 0; i--){
+        m_recent[i] = m_recent[i - 1];
+      }
+      m_recent[0] = serial;
+      return released;
+    }
+
+    // returns the serial with one more reference
+    unsigned int intern(int numLights, const EffectID* lights, const int* lightsMax)
+    {
+      // FNV-1a, only to skip most of the compares
+      unsigned int hash = 2166136261u;
+      for (int i = 0; i < numLights; i++){
+        hash = (hash ^ (unsigned int)(size_t)lights[i]) * 16777619u;
+        hash = (hash ^ (unsigned int)lightsMax[i]) * 16777619u;
+      }
+
+      size_t slot = m_sets.size();
+      for (size_t s = 0; s < m_sets.size(); s++){
+        Set& set = m_sets[s];
+        if (!set.refs){
+          slot = std::min(slot,s);
+          continue;
+        }
+        if (set.hash != hash || set.content.size() != (size_t)numLights * 2){
+          continue;
+        }
+        bool equal = true;
+        for (int i = 0; i < numLights && equal; i++){
+          equal = set.content[i*2]   == (size_t)lights[i] &&
+                  set.content[i*2+1] == (size_t)lightsMax[i];
+        }
+        if (equal){
+          set.refs++;
+          return (unsigned int)s + 1;
+        }
+      }
+
+      if (slot == m_sets.size()){
+        m_sets.push_back(Set());
+      }
+      Set& set = m_sets[slot];
+      set.hash    = hash;
+      set.refs    = 1;
+      set.content.resize((size_t)numLights * 2);
+      for (int i = 0; i < numLights; i++){
+        set.content[i*2]   = (size_t)lights[i];
+        set.content[i*2+1] = (size_t)lightsMax[i];
+      }
+      return (unsigned int)slot + 1;
+    }
+
+    // returns -1 if the lighting flag of the technique is not cached
+    int getLighting(size_t tech) const
+    {
+      int lit = tech < m_lit.size() ? m_lit[tech] : (int)LIT_UNKNOWN;
+      return lit == LIT_UNKNOWN ? -1 : lit == LIT_YES;
+    }
+
+    void setLighting(size_t tech, bool lighting)
+    {
+      if (tech >= m_lit.size()){
+        m_lit.resize(tech + 1,LIT_UNKNOWN);
+      }
+      m_lit[tech] = lighting ? LIT_YES : LIT_NO;
+    }
+
+    // techniques that were reloaded, NULL for all
+    void forgetLighting(const size_t* techs, size_t numTechs)
+    {
+      if (!techs){
+        m_lit.clear();
+      }
+      for (size_t i = 0; i < numTechs; i++){
+        if (techs[i] < m_lit.size()){
+          m_lit[techs[i]] = LIT_UNKNOWN;
+        }
+      }
+    }
+  };
+
+  //////////////////////////////////////////////////////////////////////////
+  // LightConfig
+  //
+  // A light set created by createLightConfig. The lua side lives in
+  // fxlightconfigs[ref] as {effects, max, cache}, the serial is part of the
+  // code cache key like the one of setGeneratorLights.
+
+  struct LightConfig {
+    LightConfig*  next;
+    unsigned int  serial;
+    int           ref;        // LUA_NOREF without lua state
+  };
+
+  // generators read the global fxlights, points it to a configuration and
+  // back to the setGeneratorLights table
+  class LightsScope
+  {
+  private:
+    LuaState  m_state;
+    bool      m_active;
+
+  public:
+    inline LightsScope(LuaState L, const LightConfig* lights) : m_state(L) {
+      m_active = lights && lights->ref != LUA_NOREF;
+      if (m_active){
+        lua_getglobal (L,"fxlightconfigs");
+        lua_rawgeti   (L,-1,lights->ref);
+        lua_setglobal (L,"fxlights");
+        lua_pop       (L,1);
+      }
+    }
+
+    inline ~LightsScope(){
+      if (m_active){
+        lua_pushvalue (m_state,FXLIGHTS);
+        lua_setglobal (m_state,"fxlights");
+      }
+    }
+  };
+
+  //////////////////////////////////////////////////////////////////////////
+  // DefaultBlockCache
+  //
+  // Default values of a group baked into the storage layout of a generator,
+  // indexed by group id and generator.
+
+  class DefaultBlockCache {
+  private:
+    std::vector< std::vector<unsigned char>* >  m_blocks;
+
+  public:
+    ~DefaultBlockCache()
+    {
+      clear();
+    }
+
+    const std::vector<unsigned char>* find(size_t group, GeneratorType gentype) const
+    {
+      size_t idx = group * NUM_GENERERATORS + gentype;
+      return idx < m_blocks.size() ? m_blocks[idx] : NULL;
+    }
+
+    std::vector<unsigned char>* insert(size_t group, GeneratorType gentype)
+    {
+      size_t idx = group * NUM_GENERERATORS + gentype;
+      if (idx >= m_blocks.size()){
+        m_blocks.resize(idx + 1,NULL);
+      }
+      if (!m_blocks[idx]){
+        m_blocks[idx] = new std::vector<unsigned char>;
+      }
+      return m_blocks[idx];
+    }
+
+    void clear()
+    {
+      for (size_t i = 0; i < m_blocks.size(); i++){
+        delete m_blocks[i];
+      }
+      m_blocks.clear();
+    }
+  };
+
+  //////////////////////////////////////////////////////////////////////////
+  // Layout
+  //
+  // Native version of the memory layout rules in fxlibgenerator.lua
+  // (uniformlayout, std140layout, std430layout, nvloadlayout) and of the
+  // storage choice in each generator's MakeStorage. Storage queries no
+  // longer need a lua round trip, the lua version remains for types not
+  // covered here and for cross-checking.
+
+  enum LayoutType {
+    LAYOUT_UNIFORM,
+    LAYOUT_STD140,
+    LAYOUT_STD430,
+    LAYOUT_NVLOAD,
+  };
+
+  enum LayoutClass {
+    LAYOUTCLASS_NONE,     // not handled natively
+    LAYOUTCLASS_SCALAR,
+    LAYOUTCLASS_SAMPLER,
+    LAYOUTCLASS_IMAGE,
+  };
+
+  struct LayoutTypeInfo {
+    unsigned char typeclass;
+    unsigned char size;     // datatypes[].size
+    unsigned char row;      // typerow, 0 if nil
+    unsigned char col;      // typecol, 0 if nil
+  };
+
+  struct LayoutParameter {
+    ParameterType type;
+    int           arraySize;
+  };
+
+  static const LayoutTypeInfo layoutTypeInfo[NUM_PARAMETERS] = {
+    {LAYOUTCLASS_NONE,    0,0,0}, // PARAMETER_NONE
+    {LAYOUTCLASS_SCALAR,  4,0,0}, // PARAMETER_BOOL
+    {LAYOUTCLASS_SCALAR,  4,2,0}, // PARAMETER_BVEC2
+    {LAYOUTCLASS_SCALAR,  4,3,0}, // PARAMETER_BVEC3
+    {LAYOUTCLASS_SCALAR,  4,4,0}, // PARAMETER_BVEC4
+    {LAYOUTCLASS_SCALAR,  4,0,0}, // PARAMETER_INT
+    {LAYOUTCLASS_SCALAR,  4,2,0}, // PARAMETER_IVEC2
+    {LAYOUTCLASS_SCALAR,  4,3,0}, // PARAMETER_IVEC3
+    {LAYOUTCLASS_SCALAR,  4,4,0}, // PARAMETER_IVEC4
+    {LAYOUTCLASS_SCALAR,  4,0,0}, // PARAMETER_UINT
+    {LAYOUTCLASS_SCALAR,  4,2,0}, // PARAMETER_UVEC2
+    {LAYOUTCLASS_SCALAR,  4,3,0}, // PARAMETER_UVEC3
+    {LAYOUTCLASS_SCALAR,  4,4,0}, // PARAMETER_UVEC4
+    {LAYOUTCLASS_SCALAR,  4,0,0}, // PARAMETER_FLOAT
+    {LAYOUTCLASS_SCALAR,  4,2,0}, // PARAMETER_VEC2
+    {LAYOUTCLASS_SCALAR,  4,3,0}, // PARAMETER_VEC3
+    {LAYOUTCLASS_SCALAR,  4,4,0}, // PARAMETER_VEC4
+    {LAYOUTCLASS_SCALAR,  4,2,2}, // PARAMETER_MAT2X2
+    {LAYOUTCLASS_SCALAR,  4,3,2}, // PARAMETER_MAT2X3
+    {LAYOUTCLASS_SCALAR,  4,4,2}, // PARAMETER_MAT2X4
+    {LAYOUTCLASS_SCALAR,  4,2,3}, // PARAMETER_MAT3X2
+    {LAYOUTCLASS_SCALAR,  4,3,3}, // PARAMETER_MAT3X3
+    {LAYOUTCLASS_SCALAR,  4,4,3}, // PARAMETER_MAT3X4
+    {LAYOUTCLASS_SCALAR,  4,2,4}, // PARAMETER_MAT4X2
+    {LAYOUTCLASS_SCALAR,  4,3,4}, // PARAMETER_MAT4X3
+    {LAYOUTCLASS_SCALAR,  4,4,4}, // PARAMETER_MAT4X4
+    {LAYOUTCLASS_SAMPLER, 8,0,0}, // PARAMETER_SAMPLER_1D
+    {LAYOUTCLASS_SAMPLER, 8,0,0}, // PARAMETER_SAMPLER_2D
+    {LAYOUTCLASS_SAMPLER, 8,0,0}, // PARAMETER_SAMPLER_2DRECT
+    {LAYOUTCLASS_SAMPLER, 8,0,0}, // PARAMETER_SAMPLER_3D
+    {LAYOUTCLASS_SAMPLER, 8,0,0}, // PARAMETER_SAMPLER_CUBE
+    {LAYOUTCLASS_SAMPLER, 8,0,0}, // PARAMETER_SAMPLER_1D_ARRAY
+    {LAYOUTCLASS_SAMPLER, 8,0,0}, // PARAMETER_SAMPLER_2D_ARRAY
+    {LAYOUTCLASS_SAMPLER, 8,0,0}, // PARAMETER_SAMPLER_CUBE_ARRAY
+    {LAYOUTCLASS_SAMPLER, 8,0,0}, // PARAMETER_SAMPLER_2DMS
+    {LAYOUTCLASS_SAMPLER, 8,0,0}, // PARAMETER_SAMPLER_2DMS_ARRAY
+    {LAYOUTCLASS_SAMPLER, 8,0,0}, // PARAMETER_SAMPLER_BUFFER
+    {LAYOUTCLASS_IMAGE,   8,0,0}, // PARAMETER_IMAGE_1D
+    {LAYOUTCLASS_IMAGE,   8,0,0}, // PARAMETER_IMAGE_2D
+    {LAYOUTCLASS_IMAGE,   8,0,0}, // PARAMETER_IMAGE_2DRECT
+    {LAYOUTCLASS_IMAGE,   8,0,0}, // PARAMETER_IMAGE_3D
+    {LAYOUTCLASS_IMAGE,   8,0,0}, // PARAMETER_IMAGE_CUBE
+    {LAYOUTCLASS_IMAGE,   8,0,0}, // PARAMETER_IMAGE_1D_ARRAY
+    {LAYOUTCLASS_IMAGE,   8,0,0}, // PARAMETER_IMAGE_2D_ARRAY
+    {LAYOUTCLASS_IMAGE,   8,0,0}, // PARAMETER_IMAGE_CUBE_ARRAY
+    {LAYOUTCLASS_IMAGE,   8,0,0}, // PARAMETER_IMAGE_2DMS
+    {LAYOUTCLASS_IMAGE,   8,0,0}, // PARAMETER_IMAGE_2DMS_ARRAY
+    {LAYOUTCLASS_IMAGE,   8,0,0}, // PARAMETER_IMAGE_BUFFER
+    {LAYOUTCLASS_SCALAR,  4,0,0}, // PARAMETER_ENUM
+  };
+
+  static inline size_t layoutBase(size_t v, size_t b)
+  {
+    return ((v + b - 1) / b) * b;
+  }
+
+  static void layoutParameter(LayoutType layout, const LayoutParameter& param, ParameterStorage& storage)
+  {
+    const LayoutTypeInfo& info = layoutTypeInfo[param.type];
+    storage.align   = 1;
+    storage.size    = 0;
+    storage.offset  = 0;
+    storage.stride  = 0;
+    storage.element = 0;
+
+    bool   isarray  = param.arraySize > 0;
+    size_t typesize = info.size;
+    size_t row      = info.row ? info.row : 1;
+    size_t cols     = info.col ? info.col : 1;
+    size_t count    = isarray ? param.arraySize : 1;
+    size_t align;
+    size_t stride;
+
+    switch (layout)
+    {
+    case LAYOUT_UNIFORM:
+      if (info.typeclass != LAYOUTCLASS_SCALAR) return;
+      align   = typesize;
+      stride  = row * typesize;
+      break;
+    case LAYOUT_STD140:
+      if (info.typeclass != LAYOUTCLASS_SCALAR) return;
+      align   = (info.col || isarray) ? 4 : row;
+      align   = (align == 3 ? 4 : align) * typesize;
+      stride  = ((info.col || isarray) ? 4 : row) * typesize;
+      break;
+    default: // LAYOUT_STD430, LAYOUT_NVLOAD
+      align   = (row == 3 ? 4 : row) * typesize;
+      stride  = ((row == 3 && (isarray || info.col)) ? 4 : row) * typesize;
+      break;
+    }
+
+    storage.align   = align;
+    storage.size    = stride * cols * count;
+    storage.stride  = stride;
+    storage.element = row * typesize;
+  }
+
+  static void layoutStruct(LayoutType layout, ParameterStorage* vars, int count, ParameterStorage& storage)
+  {
+    size_t offset   = 0;
+    size_t maxalign = 0;
+    for (int i = 0; i < count; i++){
+      vars[i].offset  = layoutBase(offset, vars[i].align);
+      offset          = vars[i].offset + vars[i].size;
+      maxalign        = std::max(maxalign, vars[i].align);
+    }
+    size_t align    = layout == LAYOUT_STD140 ? 16 : maxalign;
+    storage.align   = align;
+    storage.offset  = 0;
+    storage.size    = layoutBase(offset, align);
+    storage.element = storage.size;
+    storage.stride  = storage.size;
+  }
+
+  // returns true if the group is not covered by the native rules
+  static bool layoutGenerateStorage(GeneratorType gentype, GroupType grouptype, const LayoutParameter* params, int count, StorageType& stype, std::vector<ParameterStorage>& storage)
+  {
+    // an empty struct fails in lua as well
+    if (!count){
+      return true;
+    }
+
+    bool textures = false;
+    for (int i = 0; i < count; i++){
+      if (params[i].type < 0 || params[i].type >= NUM_PARAMETERS) return true;
+      unsigned char typeclass = layoutTypeInfo[params[i].type].typeclass;
+      if (typeclass == LAYOUTCLASS_NONE) return true;
+      textures |= typeclass != LAYOUTCLASS_SCALAR;
+    }
+
+    // see MakeStorage of the generators
+    bool instanced = grouptype == GROUP_INSTANCED;
+    LayoutType layout;
+    switch (gentype)
+    {
+    case GENERATOR_GLSL_UNIFORM:
+      stype   = STORAGE_UNIFORM;
+      layout  = LAYOUT_UNIFORM;
+      break;
+    case GENERATOR_GLSL_UBO:
+      stype   = textures ? STORAGE_UNIFORM : (instanced ? STORAGE_UNIFORMBUFFER_INDEXED : STORAGE_UNIFORMBUFFER);
+      layout  = textures ? LAYOUT_UNIFORM  : LAYOUT_STD140;
+      break;
+    case GENERATOR_GLSL_NVLOAD:
+      stype   = textures ? STORAGE_UNIFORM : (instanced ? STORAGE_NVLOADBUFFER_INDEXED : STORAGE_NVLOADBUFFER);
+      layout  = textures ? LAYOUT_UNIFORM  : LAYOUT_NVLOAD;
+      break;
+    case GENERATOR_GLSL_NVLOADTEX:
+      stype   = instanced ? STORAGE_NVLOADBUFFER_INDEXED : STORAGE_NVLOADBUFFER;
+      layout  = LAYOUT_NVLOAD;
+      break;
+    case GENERATOR_GLSL_UBOSSBOTEX:
+      stype   = instanced ? STORAGE_STORAGEBUFFER_INDEXED : STORAGE_UNIFORMBUFFER;
+      layout  = instanced ? LAYOUT_STD430 : LAYOUT_STD140;
+      break;
+    default:
+      return true;
+    }
+
+    storage.resize(count + 1);
+    for (int i = 0; i < count; i++){
+      layoutParameter(layout,params[i],storage[i]);
+    }
+    layoutStruct(layout,&storage[0],count,storage[count]);
+    return false;
+  }
+
+  extern "C" {
+    int LuaStatePanicHandler(LuaState L){
+      // when this happens typically everything is too late
+      // and too messy to recover (albeit possible through
+      // use of longjump)
+      // the lua threads stack will be fully cleared
+      // only leftover is the error message
+      const char* error = lua_tostring(L,-1);
+      assert(0 && error);
+      return 0;
+    }
+  }
+
+
+
+  static inline size_t outputString(const char* data, size_t datasize, char* buffer, size_t buffersize)
+  {
+    if (buffer) {
+      size_t written = buffersize > datasize ? datasize : buffersize;
+      memcpy(buffer,data,written);
+      return written;
+    }
+    else{
+      return datasize;
+    }
+  }
+
+  static unsigned long long getNanoseconds()
+  {
+#ifdef _WIN32
+    static LARGE_INTEGER frequency;
+    if (!frequency.QuadPart){
+      QueryPerformanceFrequency(&frequency);
+    }
+    LARGE_INTEGER counter;
+    QueryPerformanceCounter(&counter);
+    return (unsigned long long)(double(counter.QuadPart) * 1000000000.0 / double(frequency.QuadPart));
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC,&ts);
+    return (unsigned long long)ts.tv_sec * 1000000000ULL + (unsigned long long)ts.tv_nsec;
+#endif
+  }
+
+  size_t System::getLastErrorString(char* buffer, size_t buffersize)
+  {
+    return outputString(m_lastError, m_lastErrorSize, buffer, buffersize);
+  }
+
+  std::string System::getLastErrorString()
+  {
+    return std::string(m_lastError);
+  }
+
+  void System::updateError()
+  {
+    LuaState L = m_luaState;
+    const char* errormsg = lua_tolstring(L,-1,&m_lastErrorSize);
+    assert(errormsg);
+
+    // lua strings are zero terminated, keep it for getLastErrorString()
+    m_lastError = (char*) realloc(m_lastError,m_lastErrorSize + 1);
+    memcpy(m_lastError,errormsg,m_lastErrorSize + 1);
+    m_stats.luaErrors++;
+
+    lua_pop(L,1);
+  }
+
+  void System::setError(const char* msg)
+  {
+    m_lastErrorSize = strlen(msg);
+    m_lastError = (char*) realloc(m_lastError,m_lastErrorSize + 1);
+    memcpy(m_lastError,msg,m_lastErrorSize + 1);
+  }
+
+  static inline void registerEnum(LuaState L, const char* name, int enumvalue )
+  {
+    // tab[name]=value
+    lua_pushstring  (L,name);
+    lua_pushinteger (L,enumvalue);
+    lua_rawset      (L,-3);
+
+    // tab[value]=name
+    lua_pushinteger (L,enumvalue);
+    lua_pushstring  (L,name);
+    lua_rawset      (L,-3);
+  }
+
+  static int luaFileStat(LuaState L);
+  static int luaFileLoad(LuaState L);
+  static int luaYieldPoint(LuaState L);
+
+  error System::init(const char* processorFile)
+  {
+    return init(processorFile,NULL,NULL);
+  }
+
+  error System::init(const char* processorFile, AllocFunc alloc, void* allocud)
+  {
+    m_lastError = NULL;
+    m_lastErrorSize = 0;
+    m_frozen = NULL;
+    m_names = new NameTable;
+    m_codeCache = new CodeCache;
+    m_segmentCache = new SegmentCache;
+    m_defaultBlocks = new DefaultBlockCache;
+    m_lightSets = new LightSets;
+    m_lightsSerial = m_lightSets->intern(0,NULL,NULL);
+    m_lightSets->makeRecent(m_lightsSerial);
+    m_gcStopped = false;
+    m_steps = NULL;
+    m_stepRunning = NULL;
+    m_lightConfigs = NULL;
+    memset(&m_stats,0,sizeof(m_stats));
+
+    LuaState L = alloc ? lua_newstate(alloc,allocud) : luaL_newstate();
+    m_luaState = L;
+    if (!L){
+      setError("could not create lua state");
+      return true;
+    }
+    lua_atpanic(L,LuaStatePanicHandler);
+
+#ifdef _DEBUG
+    /* more verbose error messages, including full stack info */
+    lua_pushboolean(L,1);
+    lua_setglobal(L,"fxdebug");
+#endif
+
+    luaL_openlibs(L);
+    if (luaL_dofile(L, processorFile)){
+      updateError();
+      return true;
+    }
+    // FILE sources are mapped natively, see fxfileread
+    lua_register(L,"fxfilestat",luaFileStat);
+    lua_register(L,"fxfileload",luaFileLoad);
+    // generateStep yields at these
+    lua_pushlightuserdata(L,&m_stepRunning);
+    lua_pushcclosure(L,luaYieldPoint,1);
+    lua_setglobal(L,"fxyieldpoint");
+
+    // prepare the stack for fast access to frequent tables
+    lua_getglobal(L,"fxenums");
+    assert(lua_type(L,-1) == LUA_TTABLE);
+    assert(lua_gettop(L)  == FXENUMS);
+    lua_getglobal(L,"fxlib");
+    assert(lua_type(L,-1) == LUA_TTABLE);
+    assert(lua_gettop(L)  == FXBUILDER);
+    lua_getglobal(L,"fxids");
+    assert(lua_type(L,-1) == LUA_TTABLE);
+    assert(lua_gettop(L)  == FXIDS);
+    lua_getglobal(L,"fxerror");
+    assert(lua_type(L,-1) == LUA_TFUNCTION);
+    assert(lua_gettop(L)  == FXERROR);
+    lua_getglobal(L,"fxlights");
+    assert(lua_type(L,-1) == LUA_TTABLE);
+    assert(lua_gettop(L)  == FXLIGHTS);
+    lua_getglobal(L,"fxuserenums");
+    assert(lua_type(L,-1) == LUA_TTABLE);
+    assert(lua_gettop(L)  == FXUSERENUMS);
+    
+
+    // initialize enum table
+    lua_getfield(L,FXENUMS,"effect");
+    for (int i = 0; i < NUM_EFFECTS; i++){
+      registerEnum(L,EffectType_toString((EffectType)i),i);
+    }
+    lua_pop(L,1);
+
+    lua_getfield(L,FXENUMS,"parameter");
+    for (int i = 0; i < NUM_PARAMETERS; i++){
+      registerEnum(L,ParameterType_toString((ParameterType)i),i);
+    }
+    lua_pop(L,1);
+
+    lua_getfield(L,FXENUMS,"generator");
+    for (int i = 0; i < NUM_GENERERATORS; i++){
+      registerEnum(L,GeneratorType_toString((GeneratorType)i),i);
+    }
+    lua_pop(L,1);
+
+    lua_getfield(L,FXENUMS,"dataconvert");
+    for (int i = 0; i < NUM_DATACONVERTS; i++){
+      registerEnum(L,DataConvert_toString((DataConvert)i),i);
+    }
+    lua_pop(L,1);
+
+    lua_getfield(L,FXENUMS,"group");
+    for (int i = 0; i < NUM_GROUPS; i++){
+      registerEnum(L,GroupType_toString((GroupType)i),i);
+    }
+    lua_pop(L,1);
+
+    lua_getfield(L,FXENUMS,"storage");
+    for (int i = 0; i < NUM_STORAGES; i++){
+      registerEnum(L,StorageType_toString((StorageType)i),i);
+    }
+    lua_pop(L,1);
+
+    lua_getfield(L,FXENUMS,"limits");
+    lua_pushinteger(L,GENERATOR_UBO_MAXGROUPS);
+    lua_setfield(L,-2,"ubomaxgroups");
+    lua_pop(L,1);
+
+    // make effectlib enum indexable
+    for (int i = 0; i < NUM_EFFECTS; i++){
+      lua_getfield(L,FXBUILDER, EffectType_toString((EffectType)i) );
+      assert(lua_type(L,-1) == LUA_TTABLE);
+      lua_rawseti (L,FXBUILDER, i );
+    }
+
+    // make generatorlib enum indexable
+    lua_getglobal(L,"fxgenerators");
+    assert(lua_type(L,-1) == LUA_TTABLE);
+    for (int i = 0; i < NUM_GENERERATORS; i++){
+      lua_getfield(L,-1, GeneratorType_toString((GeneratorType)i) );
+      assert(lua_type(L,-1) == LUA_TTABLE);
+      lua_rawseti (L,-2, i );
+    }
+    lua_pop(L,1);
+
+    return false;
+  }
+
+  void System::deinit()
+  {
+    while (m_steps){
+      generateEnd((StepID)m_steps);
+    }
+    while (m_lightConfigs){
+      destroyLightConfig((LightConfigID)m_lightConfigs);
+    }
+    delete m_frozen;
+    m_frozen = NULL;
+    delete m_names;
+    m_names = NULL;
+    delete m_codeCache;
+    m_codeCache = NULL;
+    delete m_segmentCache;
+    m_segmentCache = NULL;
+    delete m_lightSets;
+    m_lightSets = NULL;
+    delete m_defaultBlocks;
+    m_defaultBlocks = NULL;
+
+    if (m_luaState){
+      lua_close(m_luaState);
+    }
+    m_luaState = NULL;
+  }
+
+  error System::addLibrary(const char* funcname, const char* buffer, size_t buffersize)
+  {
+    if (!m_luaState){
+      setError("no lua state (image or released by freeze), cannot add libraries");
+      return true;
+    }
+
+    // new enums end up in every header
+    unfreeze();
+    clearCodeCache();
+    m_defaultBlocks->clear();
+
+    LuaState L = m_luaState;
+    LuaStatePreserve preserve(L);
+    lua_getglobal(L,funcname);
+    lua_pushlstring(L,buffer,buffersize);
+    unsigned long long begin = getNanoseconds();
+    int status = lua_pcall(L,1,0,FXERROR);
+    m_stats.libraryLoads++;
+    m_stats.libraryTime += getNanoseconds() - begin;
+    if (status){
+      updateError();
+      return true;
+    }
+    return false;
+  }
+
+  void System::addLibraryTime( const char* filename, unsigned long long time )
+  {
+    LuaState L = m_luaState;
+    LuaStatePreserve preserve(L);
+    lua_getglobal(L,"fxfiles");
+    lua_getfield(L,-1,"entries");
+    lua_getfield(L,-1,filename);
+    if (!lua_istable(L,-1)){
+      return;
+    }
+    lua_getfield(L,-1,"loads");
+    lua_pushinteger(L,lua_tointeger(L,-1) + 1);
+    lua_setfield(L,-3,"loads");
+    lua_getfield(L,-2,"time");
+    lua_pushnumber(L,lua_tonumber(L,-1) + (lua_Number)time);
+    lua_setfield(L,-4,"time");
+  }
+
+  error System::addLibraryFile( const char* filename )
+  {
+    unsigned long long begin = getNanoseconds();
+    if (addLibrary("fxfile",filename,strlen(filename))){
+      return true;
+    }
+    addLibraryTime(filename,getNanoseconds() - begin);
+    return false;
+  }
+
+  error System::addLibraryString( const char* buffer, size_t buffersize )
+  {
+    return addLibrary("fxstring",buffer, buffersize);
+  }
+
+  error System::reloadLibraryFile( const char* filename )
+  {
+    if (!m_luaState){
+      setError("no lua state (image or released by freeze), cannot reload libraries");
+      return true;
+    }
+
+    unfreeze();
+    m_defaultBlocks->clear();
+
+    LuaState L = m_luaState;
+    LuaStatePreserve preserve(L);
+    lua_getglobal(L,"fxreloadfile");
+    lua_pushstring(L,filename);
+    unsigned long long begin = getNanoseconds();
+    int status = lua_pcall(L,1,1,FXERROR);
+    unsigned long long time = getNanoseconds() - begin;
+    m_stats.libraryLoads++;
+    m_stats.libraryTime += time;
+    if (status){
+      // earlier libraries depending on the file may have been replaced
+      clearCodeCache();
+      updateError();
+      return true;
+    }
+    addLibraryTime(filename,time);
+
+    std::vector<size_t> techs;
+    int cnt = (int)lua_objlen(L,-1);
+    for (int i = 0; i < cnt; i++){
+      lua_rawgeti(L,-1,i + 1);
+      techs.push_back((size_t)lua_tointeger(L,-1));
+      lua_pop(L,1);
+    }
+    m_codeCache->erase(techs);
+    m_segmentCache->erase(techs);
+    if (!techs.empty()){
+      m_lightSets->forgetLighting(&techs[0],techs.size());
+      restartSteps(&techs[0],techs.size());
+    }
+
+    return false;
+  }
+
+  int System::getReloadedTechniqueCount()
+  {
+    if (!m_luaState){
+      return 0;
+    }
+
+    LuaState L = m_luaState;
+    LuaStatePreserve preserve(L);
+    lua_getglobal(L,"fxreloaded");
+    return (int)lua_objlen(L,-1);
+  }
+
+  TechID System::getReloadedTechnique( int i )
+  {
+    LuaState L = m_luaState;
+    LuaStatePreserve preserve(L);
+    lua_getglobal(L,"fxreloaded");
+    lua_rawgeti(L,-1,i + 1);
+    assert(lua_isnumber(L,-1) && "illegal index");
+    return (TechID)(size_t)lua_tointeger(L,-1);
+  }
+
+  int System::getLibraryFileCount()
+  {
+    if (!m_luaState){
+      return 0;
+    }
+
+    LuaState L = m_luaState;
+    LuaStatePreserve preserve(L);
+    lua_getglobal(L,"fxfiles");
+    lua_getfield(L,-1,"list");
+    return (int)lua_objlen(L,-1);
+  }
+
+  size_t System::getLibraryFileName( int i, char* buffer, size_t buffersize )
+  {
+    LuaState L = m_luaState;
+    LuaStatePreserve preserve(L);
+    lua_getglobal(L,"fxfiles");
+    lua_getfield(L,-1,"list");
+    lua_rawgeti(L,-1,i + 1);
+    assert(lua_isstring(L,-1) && "illegal index");
+
+    size_t sz;
+    const char* str = lua_tolstring(L,-1,&sz);
+    return outputString(str,sz,buffer,buffersize);
+  }
+
+#if LUAFXBUILDER_USESTRING
+  std::string System::getLibraryFileName( int i )
+  {
+    LuaState L = m_luaState;
+    LuaStatePreserve preserve(L);
+    lua_getglobal(L,"fxfiles");
+    lua_getfield(L,-1,"list");
+    lua_rawgeti(L,-1,i + 1);
+    assert(lua_isstring(L,-1) && "illegal index");
+
+    size_t sz;
+    const char* str = lua_tolstring(L,-1,&sz);
+    return std::string(str,sz);
+  }
+#endif
+
+  //////////////////////////////////////////////////////////////////////////
+
+  class SnapshotBuilder {
+  private:
+    LuaState    m_L;
+    Snapshot&   m_snap;
+    NameTable&  m_names;
+    SystemStats& m_stats;
+
+    unsigned int getName(int idx, const char* field)
+    {
+      LuaState L = m_L;
+      lua_getfield(L,idx,field);
+      size_t sz;
+      const char* str = lua_tolstring(L,-1,&sz);
+      unsigned int name = str ? m_names.intern(str,sz) : (unsigned int)NameTable::INVALID;
+      lua_pop(L,1);
+      return name;
+    }
+
+    int getInteger(int idx, const char* field)
+    {
+      LuaState L = m_L;
+      lua_getfield(L,idx,field);
+      int value = (int)lua_tointeger(L,-1);
+      lua_pop(L,1);
+      return value;
+    }
+
+    unsigned int getID(int idx)
+    {
+      LuaState L = m_L;
+      lua_pushvalue(L,idx);
+      lua_gettable(L,FXIDS);
+      unsigned int id = (unsigned int)lua_tointeger(L,-1);
+      lua_pop(L,1);
+      return id;
+    }
+
+    void addValues(int idx, SnapshotParameter& param)
+    {
+      LuaState L = m_L;
+      std::vector<unsigned char>& values = m_snap.values;
+
+      // keep doubles naturally aligned
+      while (values.size() % sizeof(double)){
+        values.push_back(0);
+      }
+
+      size_t elemsize = dataConvertSize[param.defaultConv % NUM_DATACONVERTS];
+      param.valueOffset = (unsigned int)values.size();
+      param.valueSize   = (unsigned int)(elemsize * param.defaultCount);
+      values.resize(values.size() + param.valueSize, 0);
+      if (!param.valueSize){
+        return;
+      }
+
+      lua_getfield(L,idx,"defaultvalue");
+      if (!lua_istable(L,-1)){
+        lua_pop(L,1);
+        return;
+      }
+
+      unsigned char* data = &values[param.valueOffset];
+      for (unsigned int i = 0; i < param.defaultCount; i++){
+        lua_rawgeti(L,-1,i + 1);
+        switch (param.defaultConv)
+        {
+        case DATACONVERT_FLOAT:
+          ((float*)data)[i]   = (float)lua_tonumber(L,-1);
+          break;
+        case DATACONVERT_DOUBLE:
+          ((double*)data)[i]  = (double)lua_tonumber(L,-1);
+          break;
+        case DATACONVERT_INTEGER:
+          ((int*)data)[i]     = (int)lua_tointeger(L,-1);
+          break;
+        case DATACONVERT_BOOLEAN:
+          ((int*)data)[i]     = lua_toboolean(L,-1);
+          break;
+        case DATACONVERT_STRING:
+          if (i == 0){
+            size_t sz;
+            const char* str = lua_tolstring(L,-1,&sz);
+            memcpy(data,str,sz < param.valueSize ? sz : param.valueSize);
+          }
+          break;
+        }
+        lua_pop(L,1);
+      }
+      lua_pop(L,1);
+    }
+
+    void addParameter(int idx)
+    {
+      LuaState L = m_L;
+      SnapshotParameter param;
+      param.name          = getName(idx,"name");
+      param.type          = getInteger(idx,"typeenum");
+      param.arraySize     = getInteger(idx,"arraysize");
+      param.defaultConv   = getInteger(idx,"defaultconv");
+      param.defaultCount  = getInteger(idx,"defaultcnt");
+      lua_getfield(L,idx,"reference");
+      param.reference     = lua_istable(L,-1) ? getID(lua_gettop(L)) : 0;
+      lua_pop(L,1);
+      addValues(idx,param);
+
+      m_snap.parameters.push_back(param);
+    }
+
+    void addGroup(int idx, unsigned int id)
+    {
+      LuaState L = m_L;
+      SnapshotGroup group;
+      group.name  = getName(idx,"name");
+      group.type  = getInteger(idx,"modetype");
+      lua_getfield(L,idx,"host");
+      group.effect = getID(lua_gettop(L));
+      lua_pop(L,1);
+
+      group.parameterFirst = (unsigned int)m_snap.parameters.size();
+      group.parameterCount = getInteger(idx,"parameterCount");
+      lua_getfield(L,idx,"parameter");
+      for (unsigned int i = 0; i < group.parameterCount; i++){
+        lua_rawgeti(L,-1,i + 1);
+        addParameter(lua_gettop(L));
+        lua_pop(L,1);
+      }
+      lua_pop(L,1);
+
+      m_snap.setID(id,SNAPSHOT_GROUP,(unsigned int)m_snap.groups.size());
+      m_snap.groupIDs.push_back(id);
+      m_snap.groups.push_back(group);
+
+      std::vector<LayoutParameter> params(group.parameterCount);
+      for (unsigned int i = 0; i < group.parameterCount; i++){
+        const SnapshotParameter& param = m_snap.parameters[group.parameterFirst + i];
+        params[i].type      = (ParameterType)param.type;
+        params[i].arraySize = param.arraySize;
+      }
+      for (int g = 0; g < NUM_GENERERATORS; g++){
+        addStorage(idx,(GeneratorType)g,(GroupType)group.type,params);
+      }
+    }
+
+    void addStorage(int idx, GeneratorType gentype, GroupType grouptype, const std::vector<LayoutParameter>& params)
+    {
+      LuaState L = m_L;
+      SnapshotStorage storage;
+      storage.type        = STORAGE_NONE;
+      storage.name        = NameTable::INVALID;
+      storage.entryFirst  = (unsigned int)m_snap.storageEntries.size();
+      storage.entryCount  = 0;
+
+      StorageType stype;
+      std::vector<ParameterStorage> native;
+      if (!layoutGenerateStorage(gentype,grouptype,params.empty() ? NULL : &params[0],(int)params.size(),stype,native)){
+        storage.type        = stype;
+        storage.entryCount  = (unsigned int)native.size();
+        for (size_t i = 0; i < native.size(); i++){
+          SnapshotStorageEntry entry;
+          entry.size    = (unsigned int)native[i].size;
+          entry.offset  = (unsigned int)native[i].offset;
+          entry.stride  = (unsigned int)native[i].stride;
+          entry.element = (unsigned int)native[i].element;
+          entry.align   = (unsigned int)native[i].align;
+          m_snap.storageEntries.push_back(entry);
+        }
+      }
+      else{
+        addStorageLua(idx,gentype,storage);
+      }
+
+      lua_getglobal   (L,"fxgroupstorename");
+      lua_pushvalue   (L,idx);
+      lua_pushinteger (L,gentype);
+      int status = lua_pcall(L,2,1,FXERROR);
+      if (status){
+        m_stats.luaErrors++;
+      }
+      else if (lua_isstring(L,-1)){
+        size_t sz;
+        const char* str = lua_tolstring(L,-1,&sz);
+        storage.name = m_names.intern(str,sz);
+      }
+      lua_pop(L,1);
+
+      m_snap.storages.push_back(storage);
+    }
+
+    void addStorageLua(int idx, GeneratorType gentype, SnapshotStorage& storage)
+    {
+      LuaState L = m_L;
+      lua_getglobal   (L,"fxgroupstore");
+      lua_pushvalue   (L,idx);
+      lua_pushinteger (L,gentype);
+      unsigned long long begin = getNanoseconds();
+      int status = lua_pcall(L,2,3,FXERROR);
+      m_stats.groupStoreCalls++;
+      m_stats.groupStoreTime += getNanoseconds() - begin;
+      if (status){
+        m_stats.luaErrors++;
+        lua_pop(L,1);
+      }
+      else{
+        if (lua_isnumber(L,-3) && lua_isnumber(L,-2) && lua_istable(L,-1)){
+          storage.type        = (unsigned int)lua_tointeger(L,-3);
+          storage.entryCount  = (unsigned int)lua_tointeger(L,-2);
+          for (unsigned int i = 0; i < storage.entryCount; i++){
+            lua_rawgeti(L,-1,i + 1);
+            int entryidx = lua_gettop(L);
+            SnapshotStorageEntry entry;
+            entry.size    = getInteger(entryidx,"size");
+            entry.offset  = getInteger(entryidx,"offset");
+            entry.stride  = getInteger(entryidx,"stride");
+            entry.element = getInteger(entryidx,"element");
+            entry.align   = getInteger(entryidx,"align");
+            m_snap.storageEntries.push_back(entry);
+            lua_pop(L,1);
+          }
+        }
+        lua_pop(L,3);
+      }
+    }
+
+    void addOptions(int idx, SnapshotTechnique& tech)
+    {
+      LuaState L = m_L;
+      tech.optionFirst = (unsigned int)m_snap.options.size();
+      tech.optionCount = 0;
+
+      lua_getfield(L,idx,"option");
+      if (!lua_istable(L,-1)){
+        lua_pop(L,1);
+        return;
+      }
+      int tab = lua_gettop(L);
+      lua_pushnil(L);
+      while (lua_next(L,tab)){
+        // key -2, value -1
+        if (lua_type(L,-2) == LUA_TSTRING){
+          SnapshotOption option;
+          size_t sz;
+          const char* str = lua_tolstring(L,-2,&sz);
+          option.name     = m_names.intern(str,sz);
+          option.type     = lua_type(L,-1);
+          option.string   = NameTable::INVALID;
+          option.boolean  = lua_toboolean(L,-1) ? 1 : 0;
+          option.number   = option.type == LUA_TNUMBER ? lua_tonumber(L,-1) : 0.0;
+          if (option.type == LUA_TSTRING){
+            str = lua_tolstring(L,-1,&sz);
+            option.string = m_names.intern(str,sz);
+          }
+          m_snap.options.push_back(option);
+          tech.optionCount++;
+        }
+        lua_pop(L,1);
+      }
+      lua_pop(L,1);
+    }
+
+    void addTechnique(int idx, unsigned int effect)
+    {
+      LuaState L = m_L;
+      unsigned int id = getID(idx);
+      SnapshotTechnique tech;
+      tech.name     = getName(idx,"name");
+      tech.effect   = effect;
+      lua_getfield(L,idx,"lighting");
+      tech.lighting = lua_toboolean(L,-1) ? 1 : 0;
+      lua_pop(L,1);
+      addOptions(idx,tech);
+
+      tech.codeFirst = (unsigned int)m_snap.codes.size();
+      tech.codeCount = getInteger(idx,"codeCount");
+      lua_getfield(L,idx,"code");
+      for (unsigned int i = 0; i < tech.codeCount; i++){
+        lua_rawgeti(L,-1,i + 1);
+        m_snap.codes.push_back(getName(lua_gettop(L),"name"));
+        lua_pop(L,1);
+      }
+      lua_pop(L,1);
+
+      m_snap.setID(id,SNAPSHOT_TECHNIQUE,(unsigned int)m_snap.techniques.size());
+      m_snap.techniqueIDs.push_back(id);
+      m_snap.techniques.push_back(tech);
+    }
+
+    void addEffect(int idx, EffectType type)
+    {
+      LuaState L = m_L;
+      unsigned int id = getID(idx);
+      SnapshotEffect effect;
+      effect.name = getName(idx,"name");
+      effect.type = type;
+
+      // groups may be shared through GlobalGroup
+      std::vector<unsigned int> refs;
+      int count = getInteger(idx,"groupCount");
+      lua_getfield(L,idx,"group");
+      for (int i = 0; i < count; i++){
+        lua_rawgeti(L,-1,i + 1);
+        unsigned int gid = getID(lua_gettop(L));
+        if (!m_snap.hasID(gid,SNAPSHOT_GROUP)){
+          addGroup(lua_gettop(L),gid);
+        }
+        refs.push_back(m_snap.ids[gid].index);
+        lua_pop(L,1);
+      }
+      lua_pop(L,1);
+      effect.groupFirst = (unsigned int)m_snap.groupRefs.size();
+      effect.groupCount = (unsigned int)refs.size();
+      m_snap.groupRefs.insert(m_snap.groupRefs.end(),refs.begin(),refs.end());
+
+      effect.techniqueFirst = (unsigned int)m_snap.techniques.size();
+      effect.techniqueCount = getInteger(idx,"techniqueCount");
+      lua_getfield(L,idx,"technique");
+      for (unsigned int i = 0; i < effect.techniqueCount; i++){
+        lua_rawgeti(L,-1,i + 1);
+        addTechnique(lua_gettop(L),id);
+        lua_pop(L,1);
+      }
+      lua_pop(L,1);
+
+      SnapshotLookup lookup = {effect.name, (unsigned int)m_snap.effects.size()};
+      m_snap.effectLookup[type].push_back(lookup);
+      m_snap.setID(id,SNAPSHOT_EFFECT,(unsigned int)m_snap.effects.size());
+      m_snap.effectIDs.push_back(id);
+      m_snap.effects.push_back(effect);
+    }
+
+    void addEnum(int idx)
+    {
+      LuaState L = m_L;
+      unsigned int id = getID(idx);
+      unsigned int index = (unsigned int)m_snap.enums.size();
+      SnapshotEnum enumtype;
+      enumtype.name       = getName(idx,"name");
+      enumtype.valueFirst = (unsigned int)m_snap.enumValues.size();
+      enumtype.valueCount = getInteger(idx,"count");
+      lua_getfield(L,idx,"content");
+      for (unsigned int i = 0; i < enumtype.valueCount; i++){
+        lua_rawgeti(L,-1,i + 1);
+        SnapshotEnumValue value;
+        value.name  = getName(lua_gettop(L),"name");
+        value.value = getInteger(lua_gettop(L),"value");
+        m_snap.enumValues.push_back(value);
+
+        SnapshotLookup lookup = {value.name, index};
+        m_snap.enumValueLookup.push_back(lookup);
+        lua_pop(L,1);
+      }
+      lua_pop(L,1);
+
+      SnapshotLookup lookup = {enumtype.name, index};
+      m_snap.enumLookup.push_back(lookup);
+      m_snap.setID(id,SNAPSHOT_ENUM,index);
+      m_snap.enumIDs.push_back(id);
+      m_snap.enums.push_back(enumtype);
+    }
+
+    static void addLookup(std::vector<SnapshotLookup>& table, unsigned int name, unsigned int index)
+    {
+      SnapshotLookup lookup = {name, index};
+      table.push_back(lookup);
+    }
+
+    static void sortLookups(std::vector<SnapshotLookup>& table, unsigned int first)
+    {
+      std::sort(table.begin() + first,table.end());
+    }
+
+    void buildLookups()
+    {
+      Snapshot& snap = m_snap;
+      for (size_t e = 0; e < snap.effects.size(); e++){
+        const SnapshotEffect& effect = snap.effects[e];
+        for (unsigned int i = 0; i < effect.groupCount; i++){
+          addLookup(snap.groupRefLookup,snap.groups[snap.groupRefs[effect.groupFirst + i]].name,i);
+        }
+        sortLookups(snap.groupRefLookup,effect.groupFirst);
+        for (unsigned int i = 0; i < effect.techniqueCount; i++){
+          addLookup(snap.techniqueLookup,snap.techniques[effect.techniqueFirst + i].name,i);
+        }
+        sortLookups(snap.techniqueLookup,effect.techniqueFirst);
+      }
+      for (size_t g = 0; g < snap.groups.size(); g++){
+        const SnapshotGroup& group = snap.groups[g];
+        for (unsigned int i = 0; i < group.parameterCount; i++){
+          addLookup(snap.parameterLookup,snap.parameters[group.parameterFirst + i].name,i);
+        }
+        sortLookups(snap.parameterLookup,group.parameterFirst);
+      }
+      for (size_t t = 0; t < snap.techniques.size(); t++){
+        const SnapshotTechnique& tech = snap.techniques[t];
+        for (unsigned int i = 0; i < tech.optionCount; i++){
+          addLookup(snap.optionLookup,snap.options[tech.optionFirst + i].name,i);
+        }
+        sortLookups(snap.optionLookup,tech.optionFirst);
+        for (unsigned int i = 0; i < tech.codeCount; i++){
+          addLookup(snap.codeLookup,snap.codes[tech.codeFirst + i],i);
+        }
+        sortLookups(snap.codeLookup,tech.codeFirst);
+      }
+    }
+
+  public:
+    SnapshotBuilder(LuaState L, Snapshot& snap, NameTable& names, SystemStats& stats)
+      : m_L(L), m_snap(snap), m_names(names), m_stats(stats)
+    {
+    }
+
+    void build()
+    {
+      LuaState L = m_L;
+      LuaStatePreserve preserve(L);
+
+      lua_getfield(L,FXUSERENUMS,"count");
+      int count = (int)lua_tointeger(L,-1);
+      lua_getfield(L,FXUSERENUMS,"enums");
+      for (int i = 0; i < count; i++){
+        lua_rawgeti(L,-1,i + 1);
+        addEnum(lua_gettop(L));
+        lua_pop(L,1);
+      }
+      lua_pop(L,2);
+
+      for (int t = 0; t < NUM_EFFECTS; t++){
+        lua_rawgeti (L,FXBUILDER,t);
+        lua_getfield(L,-1,"count");
+        count = (int)lua_tointeger(L,-1);
+        lua_getfield(L,-2,"effects");
+
+        m_snap.effectFirst[t] = (unsigned int)m_snap.effects.size();
+        m_snap.effectCount[t] = count;
+        for (int e = 0; e < count; e++){
+          lua_rawgeti(L,-1,e + 1);
+          addEffect(lua_gettop(L),(EffectType)t);
+          lua_pop(L,1);
+        }
+        lua_pop(L,3);
+        std::sort(m_snap.effectLookup[t].begin(),m_snap.effectLookup[t].end());
+      }
+
+      std::sort(m_snap.enumLookup.begin(),m_snap.enumLookup.end());
+      std::sort(m_snap.enumValueLookup.begin(),m_snap.enumValueLookup.end());
+
+      buildLookups();
+    }
+  };
+
+  static size_t getLuaHeapBytes(LuaState L)
+  {
+    return (size_t)lua_gc(L,LUA_GCCOUNT,0) * 1024 + (size_t)lua_gc(L,LUA_GCCOUNTB,0);
+  }
+
+  error System::freeze()
+  {
+    return freeze(FREEZE_SNAPSHOT,NULL);
+  }
+
+  error System::freeze( unsigned int flags, size_t* reclaimed )
+  {
+    if (reclaimed){
+      *reclaimed = 0;
+    }
+    if (!m_luaState){
+      // loaded from image or released, always frozen
+      return false;
+    }
+    unfreeze();
+
+    Snapshot* snap = new Snapshot;
+    SnapshotBuilder builder(m_luaState,*snap,*m_names,m_stats);
+    builder.build();
+
+    m_frozen = snap;
+
+    LuaState L = m_luaState;
+    size_t before = getLuaHeapBytes(L);
+    size_t after  = 0;
+
+    if (flags & FREEZE_DROPFILES){
+      LuaStatePreserve preserve(L);
+      lua_getglobal(L,"fxfileclear");
+      if (lua_pcall(L,0,0,FXERROR)){
+        updateError();
+        return true;
+      }
+    }
+
+    if (flags & FREEZE_RELEASELUA){
+      // the snapshot is self-contained, as for images
+      restartSteps(NULL,0);
+      for (LightConfig* config = m_lightConfigs; config; config = config->next){
+        config->ref = LUA_NOREF;
+      }
+      lua_close(L);
+      m_luaState  = NULL;
+      m_gcStopped = false;
+    }
+    else{
+      if (flags & (FREEZE_COLLECT | FREEZE_STOPGC)){
+        lua_gc(L,LUA_GCCOLLECT,0);
+      }
+      if (flags & FREEZE_STOPGC){
+        lua_gc(L,LUA_GCSTOP,0);
+        m_gcStopped = true;
+      }
+      after = getLuaHeapBytes(L);
+    }
+
+    if (reclaimed){
+      *reclaimed = before > after ? before - after : 0;
+    }
+    return false;
+  }
+
+  void System::unfreeze()
+  {
+    if (!m_luaState){
+      return;
+    }
+    delete m_frozen;
+    m_frozen = NULL;
+
+    if (m_gcStopped){
+      lua_gc(m_luaState,LUA_GCRESTART,0);
+      m_gcStopped = false;
+    }
+  }
+
+  size_t System::collectGarbage()
+  {
+    if (!m_luaState){
+      return 0;
+    }
+
+    LuaState L = m_luaState;
+    size_t before = getLuaHeapBytes(L);
+    lua_gc(L,LUA_GCCOLLECT,0);
+    if (m_gcStopped){
+      // a full collection sets a new threshold, which restarts the collector
+      lua_gc(L,LUA_GCSTOP,0);
+    }
+    size_t after = getLuaHeapBytes(L);
+    return before > after ? before - after : 0;
+  }
+
+  bool System::isFrozen()
+  {
+    return m_frozen != NULL;
+  }
+
+  //////////////////////////////////////////////////////////////////////////
+  // Snapshot image
+  //
+  // Binary form of a Snapshot and its NameTable for offline use. A header
+  // lists offset, count and element size of every table, the tables follow
+  // raw and 8 byte aligned. Name ids, hash buckets and sorted lookups are
+  // stored as is, so loading is a mapping plus one copy per table.
+
+  enum ImageSection {
+    IMAGE_IDS,
+    IMAGE_EFFECTS,
+    IMAGE_GROUPREFS,
+    IMAGE_GROUPS,
+    IMAGE_PARAMETERS,
+    IMAGE_VALUES,
+    IMAGE_TECHNIQUES,
+    IMAGE_CODES,
+    IMAGE_OPTIONS,
+    IMAGE_ENUMS,
+    IMAGE_ENUMVALUES,
+    IMAGE_STORAGES,
+    IMAGE_STORAGEENTRIES,
+    IMAGE_EFFECTLOOKUP,
+    IMAGE_ENUMLOOKUP = IMAGE_EFFECTLOOKUP + NUM_EFFECTS,
+    IMAGE_ENUMVALUELOOKUP,
+    IMAGE_EFFECTIDS,
+    IMAGE_GROUPIDS,
+    IMAGE_TECHNIQUEIDS,
+    IMAGE_ENUMIDS,
+    IMAGE_GROUPREFLOOKUP,
+    IMAGE_TECHNIQUELOOKUP,
+    IMAGE_PARAMETERLOOKUP,
+    IMAGE_OPTIONLOOKUP,
+    IMAGE_CODELOOKUP,
+    IMAGE_NAMEPOOL,
+    IMAGE_NAMEOFFSETS,
+    IMAGE_NAMELENGTHS,
+    IMAGE_NAMEBUCKETS,
+    NUM_IMAGESECTIONS,
+  };
+
+  static const char         imageMagic[8]   = {'L','U','A','F','X','I','M','G'};
+  static const unsigned int imageVersion    = 2;
+  static const unsigned int imageByteOrder  = 0x01020304;
+
+  struct ImageSectionInfo {
+    unsigned int  offset;
+    unsigned int  count;
+    unsigned int  elemsize;
+    unsigned int  reserved;
+  };
+
+  struct ImageHeader {
+    char              magic[8];
+    unsigned int      version;
+    unsigned int      byteorder;
+    unsigned int      size;
+    unsigned int      numSections;
+    unsigned int      effectFirst[NUM_EFFECTS];
+    unsigned int      effectCount[NUM_EFFECTS];
+    ImageSectionInfo  sections[NUM_IMAGESECTIONS];
+  };
+
+  class MappedFile {
+  private:
+#ifdef _WIN32
+    HANDLE                m_file;
+    HANDLE                m_mapping;
+#else
+    int                   m_file;
+#endif
+    const unsigned char*  m_data;
+    size_t                m_size;
+
+  public:
+    MappedFile() : m_data(NULL), m_size(0)
+    {
+#ifdef _WIN32
+      m_file    = INVALID_HANDLE_VALUE;
+      m_mapping = NULL;
+#else
+      m_file    = -1;
+#endif
+    }
+
+    ~MappedFile()
+    {
+      close();
+    }
+
+    // returns true on error
+    bool open(const char* filename)
+    {
+#ifdef _WIN32
+      m_file = CreateFileA(filename,GENERIC_READ,FILE_SHARE_READ,NULL,OPEN_EXISTING,FILE_ATTRIBUTE_NORMAL,NULL);
+      if (m_file == INVALID_HANDLE_VALUE) return true;
+      LARGE_INTEGER size;
+      if (!GetFileSizeEx(m_file,&size) || !size.QuadPart) return true;
+      m_size    = (size_t)size.QuadPart;
+      m_mapping = CreateFileMappingA(m_file,NULL,PAGE_READONLY,0,0,NULL);
+      if (!m_mapping) return true;
+      m_data    = (const unsigned char*)MapViewOfFile(m_mapping,FILE_MAP_READ,0,0,0);
+#else
+      m_file = ::open(filename,O_RDONLY);
+      if (m_file < 0) return true;
+      struct stat st;
+      if (fstat(m_file,&st) || !st.st_size) return true;
+      m_size    = (size_t)st.st_size;
+      void* data = mmap(NULL,m_size,PROT_READ,MAP_PRIVATE,m_file,0);
+      m_data    = data == MAP_FAILED ? NULL : (const unsigned char*)data;
+#endif
+      return m_data == NULL;
+    }
+
+    void close()
+    {
+#ifdef _WIN32
+      if (m_data)     UnmapViewOfFile(m_data);
+      if (m_mapping)  CloseHandle(m_mapping);
+      if (m_file != INVALID_HANDLE_VALUE) CloseHandle(m_file);
+      m_file    = INVALID_HANDLE_VALUE;
+      m_mapping = NULL;
+#else
+      if (m_data)     munmap((void*)m_data,m_size);
+      if (m_file >= 0) ::close(m_file);
+      m_file    = -1;
+#endif
+      m_data = NULL;
+      m_size = 0;
+    }
+
+    const unsigned char*  getData() const { return m_data; }
+    size_t                getSize() const { return m_size; }
+  };
+
+  //////////////////////////////////////////////////////////////////////////
+  // FILE sources
+  //
+  // The lua side (fxfileread) keeps the content per filename and only calls
+  // fxfileload when size or modification time reported by fxfilestat differ.
+
+  // returns true on error
+  static bool getFileStamp(const char* filename, lua_Number* size, lua_Number* time)
+  {
+#ifdef _WIN32
+    struct _stat64 st;
+    if (_stat64(filename,&st)) return true;
+    *time = (lua_Number)st.st_mtime;
+#else
+    struct stat st;
+    if (stat(filename,&st)) return true;
+#ifdef __linux__
+    *time = (lua_Number)st.st_mtim.tv_sec + (lua_Number)st.st_mtim.tv_nsec * 1.0e-9;
+#else
+    *time = (lua_Number)st.st_mtime;
+#endif
+#endif
+    *size = (lua_Number)st.st_size;
+    return false;
+  }
+
+  // size,time = fxfilestat(filename), nothing if missing
+  static int luaFileStat(LuaState L)
+  {
+    lua_Number size;
+    lua_Number time;
+    if (getFileStamp(luaL_checkstring(L,1),&size,&time)){
+      return 0;
+    }
+    lua_pushnumber(L,size);
+    lua_pushnumber(L,time);
+    return 2;
+  }
+
+  // content,size,time = fxfileload(filename)
+  static int luaFileLoad(LuaState L)
+  {
+    const char* filename = luaL_checkstring(L,1);
+    lua_Number size;
+    lua_Number time;
+    if (getFileStamp(filename,&size,&time)){
+      return luaL_error(L,"file not found:%s",filename);
+    }
+
+    MappedFile file;
+    if (size == 0){
+      lua_pushliteral(L,"");
+    }
+    else if (file.open(filename)){
+      return luaL_error(L,"file not found:%s",filename);
+    }
+    else{
+      lua_pushlstring(L,(const char*)file.getData(),file.getSize());
+    }
+    lua_pushnumber(L,size);
+    lua_pushnumber(L,time);
+    return 3;
+  }
+
+  class SnapshotImage {
+  private:
+    std::vector<unsigned char>  m_data;
+    ImageHeader*                m_header;
+    const unsigned char*        m_read;
+    size_t                      m_readSize;
+
+    template <class T>
+    void put(ImageSection section, const std::vector<T>& table)
+    {
+      while (m_data.size() % 8){
+        m_data.push_back(0);
+      }
+      ImageSectionInfo& info = ((ImageHeader*)&m_data[0])->sections[section];
+      info.offset   = (unsigned int)m_data.size();
+      info.count    = (unsigned int)table.size();
+      info.elemsize = (unsigned int)sizeof(T);
+      if (!table.empty()){
+        const unsigned char* raw = (const unsigned char*)&table[0];
+        m_data.insert(m_data.end(),raw,raw + sizeof(T) * table.size());
+      }
+    }
+
+    // returns true on error
+    template <class T>
+    bool get(ImageSection section, std::vector<T>& table)
+    {
+      const ImageSectionInfo& info = m_header->sections[section];
+      if (info.elemsize != sizeof(T) || info.offset % 8 ||
+          info.offset > m_readSize || 
+          (size_t)info.count > (m_readSize - info.offset) / sizeof(T))
+      {
+        return true;
+      }
+      const T* first = (const T*)(m_read + info.offset);
+      table.assign(first,first + info.count);
+      return false;
+    }
+
+    static bool badRange(unsigned int first, unsigned int count, size_t size)
+    {
+      return first > size || count > size - first;
+    }
+
+    // lookups of a range index into the range
+    static bool badLookups(const std::vector<SnapshotLookup>& table, unsigned int first, unsigned int count)
+    {
+      for (unsigned int i = 0; i < count; i++){
+        if (table[first + i].index >= count) return true;
+      }
+      return false;
+    }
+
+    static bool badLookups(const std::vector<SnapshotLookup>& table, size_t size)
+    {
+      for (size_t i = 0; i < table.size(); i++){
+        if (table[i].index >= size) return true;
+      }
+      return false;
+    }
+
+    // the handles of a table must map back to their entry
+    static bool badIDs(const Snapshot& snap, const std::vector<unsigned int>& handles, size_t size, SnapshotKind kind)
+    {
+      if (handles.size() != size) return true;
+      for (size_t i = 0; i < size; i++){
+        if (!snap.hasID(handles[i],kind) || snap.ids[handles[i]].index != i) return true;
+      }
+      return false;
+    }
+
+    // returns true if an index or range of the loaded tables is out of bounds,
+    // the accessors of a frozen System do not check them
+    static bool validate(const Snapshot& snap, const NameTable& names)
+    {
+      unsigned int numNames = names.getCount();
+      for (unsigned int i = 0; i < numNames; i++){
+        if (badRange(names.m_offsets[i],names.m_lengths[i],names.m_pool.size()) ||
+            names.m_offsets[i] + names.m_lengths[i] == names.m_pool.size() ||
+            names.m_pool[names.m_offsets[i] + names.m_lengths[i]] != 0)
+        {
+          return true;
+        }
+      }
+      // probing needs a free bucket
+      if (names.m_buckets.size() < (size_t)numNames * 2) return true;
+      for (size_t i = 0; i < names.m_buckets.size(); i++){
+        if (names.m_buckets[i] >= numNames) return true;
+      }
+
+      for (size_t i = 0; i < snap.ids.size(); i++){
+        const SnapshotID& id = snap.ids[i];
+        size_t size = 0;
+        switch (id.kind){
+        case SNAPSHOT_NONE:       continue;
+        case SNAPSHOT_EFFECT:     size = snap.effects.size();     break;
+        case SNAPSHOT_GROUP:      size = snap.groups.size();      break;
+        case SNAPSHOT_TECHNIQUE:  size = snap.techniques.size();  break;
+        case SNAPSHOT_ENUM:       size = snap.enums.size();       break;
+        default:                  return true;
+        }
+        if (id.index >= size) return true;
+      }
+      if (badIDs(snap,snap.effectIDs,   snap.effects.size(),    SNAPSHOT_EFFECT)    ||
+          badIDs(snap,snap.groupIDs,    snap.groups.size(),     SNAPSHOT_GROUP)     ||
+          badIDs(snap,snap.techniqueIDs,snap.techniques.size(), SNAPSHOT_TECHNIQUE) ||
+          badIDs(snap,snap.enumIDs,     snap.enums.size(),      SNAPSHOT_ENUM))
+      {
+        return true;
+      }
+      for (int t = 0; t < NUM_EFFECTS; t++){
+        if (badRange(snap.effectFirst[t],snap.effectCount[t],snap.effects.size()) ||
+            badLookups(snap.effectLookup[t],snap.effects.size()))
+        {
+          return true;
+        }
+      }
+      if (badLookups(snap.enumLookup,snap.enums.size()) ||
+          badLookups(snap.enumValueLookup,snap.enums.size()))
+      {
+        return true;
+      }
+
+      for (size_t i = 0; i < snap.effects.size(); i++){
+        const SnapshotEffect& effect = snap.effects[i];
+        if (effect.name >= numNames || effect.type >= NUM_EFFECTS ||
+            badRange(effect.groupFirst,effect.groupCount,snap.groupRefs.size()) ||
+            badRange(effect.techniqueFirst,effect.techniqueCount,snap.techniques.size()) ||
+            badLookups(snap.groupRefLookup,effect.groupFirst,effect.groupCount) ||
+            badLookups(snap.techniqueLookup,effect.techniqueFirst,effect.techniqueCount))
+        {
+          return true;
+        }
+      }
+      for (size_t i = 0; i < snap.groupRefs.size(); i++){
+        if (snap.groupRefs[i] >= snap.groups.size()) return true;
+      }
+      for (size_t i = 0; i < snap.groups.size(); i++){
+        const SnapshotGroup& group = snap.groups[i];
+        if (group.name >= numNames || (group.effect && !snap.hasID(group.effect,SNAPSHOT_EFFECT)) ||
+            badRange(group.parameterFirst,group.parameterCount,snap.parameters.size()) ||
+            badLookups(snap.parameterLookup,group.parameterFirst,group.parameterCount))
+        {
+          return true;
+        }
+      }
+      for (size_t i = 0; i < snap.parameters.size(); i++){
+        const SnapshotParameter& param = snap.parameters[i];
+        if (param.name >= numNames ||
+            badRange(param.valueOffset,param.valueSize,snap.values.size()))
+        {
+          return true;
+        }
+      }
+      for (size_t i = 0; i < snap.techniques.size(); i++){
+        const SnapshotTechnique& tech = snap.techniques[i];
+        if (tech.name >= numNames || !snap.hasID(tech.effect,SNAPSHOT_EFFECT) ||
+            badRange(tech.optionFirst,tech.optionCount,snap.options.size()) ||
+            badRange(tech.codeFirst,tech.codeCount,snap.codes.size()) ||
+            badLookups(snap.optionLookup,tech.optionFirst,tech.optionCount) ||
+            badLookups(snap.codeLookup,tech.codeFirst,tech.codeCount))
+        {
+          return true;
+        }
+      }
+      for (size_t i = 0; i < snap.codes.size(); i++){
+        if (snap.codes[i] >= numNames) return true;
+      }
+      for (size_t i = 0; i < snap.options.size(); i++){
+        const SnapshotOption& option = snap.options[i];
+        if (option.name >= numNames || option.string >= numNames || option.type > LUA_TTHREAD) return true;
+      }
+      for (size_t i = 0; i < snap.enums.size(); i++){
+        const SnapshotEnum& enumtype = snap.enums[i];
+        if (enumtype.name >= numNames ||
+            badRange(enumtype.valueFirst,enumtype.valueCount,snap.enumValues.size()))
+        {
+          return true;
+        }
+      }
+      for (size_t i = 0; i < snap.enumValues.size(); i++){
+        if (snap.enumValues[i].name >= numNames) return true;
+      }
+      for (size_t i = 0; i < snap.storages.size(); i++){
+        const SnapshotStorage& storage = snap.storages[i];
+        if (storage.name >= numNames ||
+            badRange(storage.entryFirst,storage.entryCount,snap.storageEntries.size()))
+        {
+          return true;
+        }
+      }
+      return false;
+    }
+
+  public:
+    // returns true on error
+    bool save(const Snapshot& snap, const NameTable& names, const char* filename)
+    {
+      m_data.clear();
+      m_data.resize(sizeof(ImageHeader),0);
+
+      put(IMAGE_IDS,              snap.ids);
+      put(IMAGE_EFFECTS,          snap.effects);
+      put(IMAGE_GROUPREFS,        snap.groupRefs);
+      put(IMAGE_GROUPS,           snap.groups);
+      put(IMAGE_PARAMETERS,       snap.parameters);
+      put(IMAGE_VALUES,           snap.values);
+      put(IMAGE_TECHNIQUES,       snap.techniques);
+      put(IMAGE_CODES,            snap.codes);
+      put(IMAGE_OPTIONS,          snap.options);
+      put(IMAGE_ENUMS,            snap.enums);
+      put(IMAGE_ENUMVALUES,       snap.enumValues);
+      put(IMAGE_STORAGES,         snap.storages);
+      put(IMAGE_STORAGEENTRIES,   snap.storageEntries);
+      for (int t = 0; t < NUM_EFFECTS; t++){
+        put((ImageSection)(IMAGE_EFFECTLOOKUP + t), snap.effectLookup[t]);
+      }
+      put(IMAGE_ENUMLOOKUP,       snap.enumLookup);
+      put(IMAGE_ENUMVALUELOOKUP,  snap.enumValueLookup);
+      put(IMAGE_EFFECTIDS,        snap.effectIDs);
+      put(IMAGE_GROUPIDS,         snap.groupIDs);
+      put(IMAGE_TECHNIQUEIDS,     snap.techniqueIDs);
+      put(IMAGE_ENUMIDS,          snap.enumIDs);
+      put(IMAGE_GROUPREFLOOKUP,   snap.groupRefLookup);
+      put(IMAGE_TECHNIQUELOOKUP,  snap.techniqueLookup);
+      put(IMAGE_PARAMETERLOOKUP,  snap.parameterLookup);
+      put(IMAGE_OPTIONLOOKUP,     snap.optionLookup);
+      put(IMAGE_CODELOOKUP,       snap.codeLookup);
+      put(IMAGE_NAMEPOOL,         names.m_pool);
+      put(IMAGE_NAMEOFFSETS,      names.m_offsets);
+      put(IMAGE_NAMELENGTHS,      names.m_lengths);
+      put(IMAGE_NAMEBUCKETS,      names.m_buckets);
+
+      ImageHeader* header = (ImageHeader*)&m_data[0];
+      memcpy(header->magic,imageMagic,sizeof(imageMagic));
+      header->version     = imageVersion;
+      header->byteorder   = imageByteOrder;
+      header->size        = (unsigned int)m_data.size();
+      header->numSections = NUM_IMAGESECTIONS;
+      for (int t = 0; t < NUM_EFFECTS; t++){
+        header->effectFirst[t] = snap.effectFirst[t];
+        header->effectCount[t] = snap.effectCount[t];
+      }
+
+      FILE* file = fopen(filename,"wb");
+      if (!file){
+        return true;
+      }
+      bool failed = fwrite(&m_data[0],1,m_data.size(),file) != m_data.size();
+      failed |= fclose(file) != 0;
+      return failed;
+    }
+
+    // returns true on error
+    bool load(Snapshot& snap, NameTable& names, const unsigned char* data, size_t size)
+    {
+      if (size < sizeof(ImageHeader)){
+        return true;
+      }
+      m_header    = (ImageHeader*)data;
+      m_read      = data;
+      m_readSize  = size;
+      if (memcmp(m_header->magic,imageMagic,sizeof(imageMagic)) ||
+          m_header->version     != imageVersion   ||
+          m_header->byteorder   != imageByteOrder ||
+          m_header->size        != size           ||
+          m_header->numSections != NUM_IMAGESECTIONS)
+      {
+        return true;
+      }
+      for (int t = 0; t < NUM_EFFECTS; t++){
+        snap.effectFirst[t] = m_header->effectFirst[t];
+        snap.effectCount[t] = m_header->effectCount[t];
+      }
+
+      bool failed = false;
+      failed |= get(IMAGE_IDS,              snap.ids);
+      failed |= get(IMAGE_EFFECTS,          snap.effects);
+      failed |= get(IMAGE_GROUPREFS,        snap.groupRefs);
+      failed |= get(IMAGE_GROUPS,           snap.groups);
+      failed |= get(IMAGE_PARAMETERS,       snap.parameters);
+      failed |= get(IMAGE_VALUES,           snap.values);
+      failed |= get(IMAGE_TECHNIQUES,       snap.techniques);
+      failed |= get(IMAGE_CODES,            snap.codes);
+      failed |= get(IMAGE_OPTIONS,          snap.options);
+      failed |= get(IMAGE_ENUMS,            snap.enums);
+      failed |= get(IMAGE_ENUMVALUES,       snap.enumValues);
+      failed |= get(IMAGE_STORAGES,         snap.storages);
+      failed |= get(IMAGE_STORAGEENTRIES,   snap.storageEntries);
+      for (int t = 0; t < NUM_EFFECTS; t++){
+        failed |= get((ImageSection)(IMAGE_EFFECTLOOKUP + t), snap.effectLookup[t]);
+      }
+      failed |= get(IMAGE_ENUMLOOKUP,       snap.enumLookup);
+      failed |= get(IMAGE_ENUMVALUELOOKUP,  snap.enumValueLookup);
+      failed |= get(IMAGE_EFFECTIDS,        snap.effectIDs);
+      failed |= get(IMAGE_GROUPIDS,         snap.groupIDs);
+      failed |= get(IMAGE_TECHNIQUEIDS,     snap.techniqueIDs);
+      failed |= get(IMAGE_ENUMIDS,          snap.enumIDs);
+      failed |= get(IMAGE_GROUPREFLOOKUP,   snap.groupRefLookup);
+      failed |= get(IMAGE_TECHNIQUELOOKUP,  snap.techniqueLookup);
+      failed |= get(IMAGE_PARAMETERLOOKUP,  snap.parameterLookup);
+      failed |= get(IMAGE_OPTIONLOOKUP,     snap.optionLookup);
+      failed |= get(IMAGE_CODELOOKUP,       snap.codeLookup);
+      failed |= get(IMAGE_NAMEPOOL,         names.m_pool);
+      failed |= get(IMAGE_NAMEOFFSETS,      names.m_offsets);
+      failed |= get(IMAGE_NAMELENGTHS,      names.m_lengths);
+      failed |= get(IMAGE_NAMEBUCKETS,      names.m_buckets);
+      if (failed){
+        return true;
+      }
+
+      // bucket count must stay a power of two for the probing mask
+      size_t buckets = names.m_buckets.size();
+      return  !buckets || (buckets & (buckets - 1)) || 
+              names.m_offsets.empty() ||
+              names.m_offsets.size() != names.m_lengths.size() ||
+              snap.storages.size() != snap.groups.size() * NUM_GENERERATORS ||
+              snap.groupRefLookup.size()  != snap.groupRefs.size()  ||
+              snap.techniqueLookup.size() != snap.techniques.size() ||
+              snap.parameterLookup.size() != snap.parameters.size() ||
+              snap.optionLookup.size()    != snap.options.size()    ||
+              snap.codeLookup.size()      != snap.codes.size()      ||
+              validate(snap,names);
+    }
+  };
+
+  error System::saveImage( const char* filename )
+  {
+    if (!m_frozen && freeze()){
+      return true;
+    }
+
+    SnapshotImage image;
+    if (image.save(*m_frozen,*m_names,filename)){
+      setError("could not write image file");
+      return true;
+    }
+    return false;
+  }
+
+  error System::initFromImage( const char* filename )
+  {
+    m_luaState = NULL;
+    m_lastError = NULL;
+    m_lastErrorSize = 0;
+    m_frozen = new Snapshot;
+    m_names = new NameTable;
+    m_codeCache = new CodeCache;
+    m_segmentCache = new SegmentCache;
+    m_defaultBlocks = new DefaultBlockCache;
+    m_lightSets = new LightSets;
+    m_lightsSerial = m_lightSets->intern(0,NULL,NULL);
+    m_lightSets->makeRecent(m_lightsSerial);
+    m_gcStopped = false;
+    m_steps = NULL;
+    m_stepRunning = NULL;
+    m_lightConfigs = NULL;
+    memset(&m_stats,0,sizeof(m_stats));
+
+    MappedFile file;
+    if (file.open(filename)){
+      setError("could not open image file");
+      return true;
+    }
+
+    SnapshotImage image;
+    if (image.load(*m_frozen,*m_names,file.getData(),file.getSize())){
+      setError("invalid or incompatible image file");
+      return true;
+    }
+    return false;
+  }
+
+  inline size_t System::nameGet(unsigned int name, char* buffer, size_t buffersize)
+  {
+    return outputString(m_names->getString(name),m_names->getLength(name),buffer,buffersize);
+  }
+
+#if LUAFXBUILDER_USESTRING
+  inline std::string System::nameGet(unsigned int name)
+  {
+    return std::string(m_names->getString(name),m_names->getLength(name));
+  }
+#endif
+
+
+  int System::getEffectCount( EffectType effecttype )
+  {
+    if (m_frozen){
+      return m_frozen->effectCount[effecttype];
+    }
+
+    LuaState L = m_luaState;
+    LuaStatePreserve preserve(L);
+    lua_rawgeti(L,FXBUILDER, effecttype);
+    lua_getfield(L,-1,"count");
+    int count = (int)lua_tointeger(L,-1);
+    return count;
+  }
+
+  inline size_t System::getID()
+  {
+    LuaState L = m_luaState;    // 0 obj
+    lua_gettable(L,FXIDS);      // 0 id = fxids[obj]
+    int id = (int)lua_tointeger(L,-1);
+    return id;
+  }
+
+  EffectID System::getEffect( EffectType effecttype, int i )
+  {
+    if (m_frozen){
+      assert(i >= 0 && i < (int)m_frozen->effectCount[effecttype] && "illegal index");
+      return (EffectID)(size_t)m_frozen->effectIDs[m_frozen->effectFirst[effecttype] + i];
+    }
+
+    LuaState L = m_luaState;
+    LuaStatePreserve preserve(L);
+    lua_rawgeti (L,FXBUILDER, effecttype);
+    lua_getfield(L,-1,"effects");
+    lua_rawgeti (L,-1,i + 1);
+
+    assert(lua_istable(L,-1) && "illegal index");
+
+    EffectID id = (EffectID)getID();
+
+    return id;
+  }
+
+  EffectID System::getEffect( EffectType effecttype, const char* name )
+  {
+    if (m_frozen){
+      int idx = Snapshot::lookup(m_frozen->effectLookup[effecttype],m_names->find(name));
+      return idx < 0 ? 0 : (EffectID)(size_t)m_frozen->effectIDs[idx];
+    }
+
+    LuaState L = m_luaState;
+    LuaStatePreserve preserve(L);
+    lua_rawgeti (L,FXBUILDER, effecttype );
+    lua_getfield(L,-1,"effects");
+    lua_getfield(L,-1,name);
+
+    if (!lua_istable(L,-1)){
+      return 0;
+    }
+
+    EffectID id = (EffectID)getID();
+
+    return id;
+  }
 
 
   inline int System::idGetCount(size_t id, const char* what)
   {
-    LuaState L = m_luaState;
-    LuaStateObjOperation idop(L,id);
-    lua_getfield(L,-1,what);
-    assert(lua_isnumber(L,-1));
-    int cnt = (int)lua_tointeger(L,-1);
-    return cnt;
+    LuaState L = m_luaState;
+    LuaStateObjOperation idop(L,id);
+    lua_getfield(L,-1,what);
+    assert(lua_isnumber(L,-1));
+    int cnt = (int)lua_tointeger(L,-1);
+    return cnt;
+  }
+
+  int System::effectGetGroupCount( EffectID effect )
+  {
+    if (m_frozen){
+      return m_frozen->getEffect(effect).groupCount;
+    }
+    return idGetCount((size_t)effect,"groupCount");
+  }
+  int System::effectGetTechniqueCount( EffectID effect )
+  {
+    if (m_frozen){
+      return m_frozen->getEffect(effect).techniqueCount;
+    }
+    return idGetCount((size_t)effect,"techniqueCount");
+  }
+
+  int System::techniqueGetCodeCount( TechID tech )
+  {
+    if (m_frozen){
+      return m_frozen->getTechnique(tech).codeCount;
+    }
+    return idGetCount((size_t)tech,"codeCount");
+  }
+
+  int System::groupGetParameterCount( GroupID group )
+  {
+    if (m_frozen){
+      return m_frozen->getGroup(group).parameterCount;
+    }
+    return idGetCount((size_t)group,"parameterCount");
+  }
+
+  inline size_t System::idGetName(size_t id, char* buffer, size_t buffersize)
+  {
+    LuaState L = m_luaState;
+    LuaStateObjOperation idop(L,id);
+    lua_getfield(L,-1,"name");
+    assert(lua_isstring(L,-1));
+
+    size_t sz;
+    const char* str = lua_tolstring(L,-1,&sz);
+    sz = outputString(str,sz,buffer,buffersize);
+
+    return sz;
+  }
+
+  size_t System::effectGetName( EffectID effect, char* buffer, size_t buffersize )
+  {
+    if (m_frozen){
+      return nameGet(m_frozen->getEffect(effect).name,buffer,buffersize);
+    }
+    return idGetName((size_t)effect,buffer,buffersize);
+  }
+
+  size_t System::groupGetName( GroupID group, char* buffer, size_t buffersize )
+  {
+    if (m_frozen){
+      return nameGet(m_frozen->getGroup(group).name,buffer,buffersize);
+    }
+    return idGetName((size_t)group,buffer,buffersize);
+  }
+
+  size_t System::techniqueGetName( TechID tech, char* buffer, size_t buffersize )
+  {
+    if (m_frozen){
+      return nameGet(m_frozen->getTechnique(tech).name,buffer,buffersize);
+    }
+    return idGetName((size_t)tech,buffer,buffersize);
+  }
+
+  size_t System::enumGetName( EnumID enumtype, char* buffer, size_t buffersize )
+  {
+    if (m_frozen){
+      return nameGet(m_frozen->getEnum(enumtype).name,buffer,buffersize);
+    }
+    return idGetName((size_t)enumtype,buffer,buffersize);
+  }
+
+#if LUAFXBUILDER_USESTRING
+  inline std::string System::idGetName(size_t id)
+  {
+    LuaState L = m_luaState;
+    LuaStateObjOperation idop(L,id);
+    lua_getfield(L,-1,"name");
+    assert(lua_isstring(L,-1));
+
+    size_t sz;
+    const char* str = lua_tolstring(L,-1,&sz);
+
+    return std::string(str,sz);
+  }
+
+  std::string System::effectGetName( EffectID effect )
+  {
+    if (m_frozen){
+      return nameGet(m_frozen->getEffect(effect).name);
+    }
+    return idGetName((size_t)effect);
+  }
+
+  std::string System::groupGetName( GroupID group )
+  {
+    if (m_frozen){
+      return nameGet(m_frozen->getGroup(group).name);
+    }
+    return idGetName((size_t)group);
+  }
+
+  std::string System::techniqueGetName( TechID tech )
+  {
+    if (m_frozen){
+      return nameGet(m_frozen->getTechnique(tech).name);
+    }
+    return idGetName((size_t)tech);
+  }
+
+  std::string System::enumGetName( EnumID enumtype )
+  {
+    if (m_frozen){
+      return nameGet(m_frozen->getEnum(enumtype).name);
+    }
+    return idGetName((size_t)enumtype);
+  }
+#endif
+
+  inline size_t System::idGetSubID(size_t id, const char* what, int i)
+  {
+    LuaState L = m_luaState;
+    LuaStateObjOperation idop(L,id);
+    lua_getfield(L,-1,what);
+    lua_rawgeti (L,-1,i + 1);
+    assert(lua_istable(L,-1));
+    return getID();
+  }
+
+  GroupID System::effectGetGroup( EffectID effect, int i )
+  {
+    if (m_frozen){
+      const SnapshotEffect& eff = m_frozen->getEffect(effect);
+      assert(i >= 0 && i < (int)eff.groupCount && "illegal index");
+      return (GroupID)(size_t)m_frozen->groupIDs[m_frozen->groupRefs[eff.groupFirst + i]];
+    }
+    return (GroupID)idGetSubID((size_t)effect,"group",i);
+  }
+  TechID System::effectGetTechnique( EffectID effect, int i )
+  {
+    if (m_frozen){
+      const SnapshotEffect& eff = m_frozen->getEffect(effect);
+      assert(i >= 0 && i < (int)eff.techniqueCount && "illegal index");
+      return (TechID)(size_t)m_frozen->techniqueIDs[eff.techniqueFirst + i];
+    }
+    return (TechID)idGetSubID((size_t)effect,"technique",i);
+  }
+
+  inline size_t System::idGetSubID(size_t id, const char* what, const char* name)
+  {
+    LuaState L = m_luaState;
+    LuaStateObjOperation idop(L,id);
+    lua_getfield(L,-1,what);
+    lua_getfield(L,-1,name);
+    if (lua_istable(L,-1))
+    {
+      return getID();
+    }
+    else
+    {
+      return 0;
+    }
+  }
+
+  GroupID System::effectGetGroup( EffectID effect, const char* name )
+  {
+    if (m_frozen){
+      int idx = effectGetGroupIndex(effect,name);
+      return idx < 0 ? 0 : effectGetGroup(effect,idx);
+    }
+    return (GroupID)idGetSubID((size_t)effect,"group", name);
+  }
+
+  TechID System::effectGetTechnique( EffectID effect, const char* name )
+  {
+    if (m_frozen){
+      int idx = effectGetTechniqueIndex(effect,name);
+      return idx < 0 ? 0 : effectGetTechnique(effect,idx);
+    }
+    return (TechID)idGetSubID((size_t)effect,"technique", name);
+  }
+
+  inline size_t System::idGetSubID(size_t id, const char* what)
+  {
+    LuaState L = m_luaState;
+    LuaStateObjOperation idop(L,id);
+    lua_getfield(L,-1,what);
+    if (lua_istable(L,-1))
+    {
+      return getID();
+    }
+    else
+    {
+      return 0;
+    }
+  }
+
+  EffectID System::groupGetEffect( GroupID group )
+  {
+    if (m_frozen){
+      return (EffectID)(size_t)m_frozen->getGroup(group).effect;
+    }
+    return (EffectID)idGetSubID((size_t)group,"host");
+  }
+
+  EffectID System::techniqueGetEffect( TechID tech )
+  {
+    if (m_frozen){
+      return (EffectID)(size_t)m_frozen->getTechnique(tech).effect;
+    }
+    return (EffectID)idGetSubID((size_t)tech,"host");
+  }
+
+  //////////////////////////////////////////////////////////////////////////
+
+  inline int System::idGetSubIdx( size_t id, const char* what, const char *name )
+  {
+    LuaState L = m_luaState;
+    LuaStateObjOperation idop(L,id);
+    lua_getfield(L,-1,what);
+    lua_getfield(L,-1,name);
+    if (lua_isnumber(L,-1)){
+      return (int)lua_tointeger(L,-1) - 1;
+    }
+    return -1;
+  }
+
+
+  int System::effectGetGroupIndex( EffectID effect, const char* name )
+  {
+    if (m_frozen){
+      return effectGetGroupIndex(effect,(NameID)(size_t)m_names->find(name));
+    }
+    return idGetSubIdx((size_t)effect,"groupidx",name);
+  }
+
+  int System::effectGetTechniqueIndex( EffectID effect, const char* name )
+  {
+    if (m_frozen){
+      return effectGetTechniqueIndex(effect,(NameID)(size_t)m_names->find(name));
+    }
+    return idGetSubIdx((size_t)effect,"techniqueidx",name);
+  }
+
+  int System::techniqueGetCodeIndex( TechID tech, const char* name )
+  {
+    if (m_frozen){
+      return techniqueGetCodeIndex(tech,(NameID)(size_t)m_names->find(name));
+    }
+    return idGetSubIdx((size_t)tech,"codeidx",name);
+  }
+
+  int System::groupGetParameterIndex( GroupID group, const char* name )
+  {
+    if (m_frozen){
+      return groupGetParameterIndex(group,(NameID)(size_t)m_names->find(name));
+    }
+    return idGetSubIdx((size_t)group,"parameteridx",name);
+  }
+
+  //////////////////////////////////////////////////////////////////////////
+
+  NameID System::internName( const char* name )
+  {
+    if (!name || !name[0]){
+      return 0;
+    }
+    return (NameID)(size_t)m_names->intern(name,strlen(name));
+  }
+
+  GroupID System::effectGetGroup( EffectID effect, NameID name )
+  {
+    int idx = effectGetGroupIndex(effect,name);
+    return idx < 0 ? 0 : effectGetGroup(effect,idx);
+  }
+
+  TechID System::effectGetTechnique( EffectID effect, NameID name )
+  {
+    int idx = effectGetTechniqueIndex(effect,name);
+    return idx < 0 ? 0 : effectGetTechnique(effect,idx);
   }
 
-  int System::effectGetGroupCount( EffectID effect )
+  int System::effectGetGroupIndex( EffectID effect, NameID name )
   {
-    return idGetCount((size_t)effect,"groupCount");
+    if (m_frozen){
+      const SnapshotEffect& eff = m_frozen->getEffect(effect);
+      return Snapshot::lookup(m_frozen->groupRefLookup,eff.groupFirst,eff.groupCount,(unsigned int)(size_t)name);
+    }
+    return name ? effectGetGroupIndex(effect,m_names->getString((unsigned int)(size_t)name)) : -1;
   }
-  int System::effectGetTechniqueCount( EffectID effect )
+
+  int System::effectGetTechniqueIndex( EffectID effect, NameID name )
   {
-    return idGetCount((size_t)effect,"techniqueCount");
+    if (m_frozen){
+      const SnapshotEffect& eff = m_frozen->getEffect(effect);
+      return Snapshot::lookup(m_frozen->techniqueLookup,eff.techniqueFirst,eff.techniqueCount,(unsigned int)(size_t)name);
+    }
+    return name ? effectGetTechniqueIndex(effect,m_names->getString((unsigned int)(size_t)name)) : -1;
   }
 
-  int System::techniqueGetCodeCount( TechID tech )
+  int System::techniqueGetCodeIndex( TechID tech, NameID name )
   {
-    return idGetCount((size_t)tech,"codeCount");
+    if (m_frozen){
+      const SnapshotTechnique& technique = m_frozen->getTechnique(tech);
+      return Snapshot::lookup(m_frozen->codeLookup,technique.codeFirst,technique.codeCount,(unsigned int)(size_t)name);
+    }
+    return name ? techniqueGetCodeIndex(tech,m_names->getString((unsigned int)(size_t)name)) : -1;
   }
 
-  int System::groupGetParameterCount( GroupID group )
+  int System::groupGetParameterIndex( GroupID group, NameID name )
   {
-    return idGetCount((size_t)group,"parameterCount");
+    if (m_frozen){
+      const SnapshotGroup& grp = m_frozen->getGroup(group);
+      return Snapshot::lookup(m_frozen->parameterLookup,grp.parameterFirst,grp.parameterCount,(unsigned int)(size_t)name);
+    }
+    return name ? groupGetParameterIndex(group,m_names->getString((unsigned int)(size_t)name)) : -1;
   }
 
-  inline size_t System::idGetName(size_t id, char* buffer, size_t buffersize)
+  //////////////////////////////////////////////////////////////////////////
+
+  inline size_t System::idGetSubName( size_t id, const char* what, int i, char* buffer, size_t buffersize )
   {
     LuaState L = m_luaState;
     LuaStateObjOperation idop(L,id);
+    lua_getfield(L,-1,what);
+    lua_rawgeti (L,-1, i + 1);
+    assert(lua_istable(L,-1));
     lua_getfield(L,-1,"name");
-    assert(lua_isstring(L,-1));
 
     size_t sz;
     const char* str = lua_tolstring(L,-1,&sz);
@@ -614,33 +3651,46 @@ namespace luafxbuilder
     return sz;
   }
 
-  size_t System::effectGetName( EffectID effect, char* buffer, size_t buffersize )
-  {
-    return idGetName((size_t)effect,buffer,buffersize);
-  }
-
-  size_t System::groupGetName( GroupID group, char* buffer, size_t buffersize )
+  size_t System::techniqueGetCodeName( TechID tech, int i, char* buffer, size_t buffersize )
   {
-    return idGetName((size_t)group,buffer,buffersize);
+    if (m_frozen){
+      const SnapshotTechnique& technique = m_frozen->getTechnique(tech);
+      assert(i >= 0 && i < (int)technique.codeCount && "illegal index");
+      return nameGet(m_frozen->codes[technique.codeFirst + i],buffer,buffersize);
+    }
+    return idGetSubName((size_t)tech, "code", i, buffer, buffersize);
   }
 
-  size_t System::techniqueGetName( TechID tech, char* buffer, size_t buffersize )
+  size_t System::groupGetParameterName( GroupID group, int i, char* buffer, size_t buffersize )
   {
-    return idGetName((size_t)tech,buffer,buffersize);
+    if (m_frozen){
+      const SnapshotGroup& grp = m_frozen->getGroup(group);
+      assert(i >= 0 && i < (int)grp.parameterCount && "illegal index");
+      return nameGet(m_frozen->parameters[grp.parameterFirst + i].name,buffer,buffersize);
+    }
+    return idGetSubName((size_t)group, "parameter", i, buffer, buffersize);
   }
 
-  size_t System::enumGetName( EnumID enumtype, char* buffer, size_t buffersize )
+  size_t System::enumGetValueName( EnumID enumtype, int i, char* buffer, size_t buffersize )
   {
-    return idGetName((size_t)enumtype,buffer,buffersize);
+    if (m_frozen){
+      const SnapshotEnum& enm = m_frozen->getEnum(enumtype);
+      assert(i >= 0 && i < (int)enm.valueCount && "illegal index");
+      return nameGet(m_frozen->enumValues[enm.valueFirst + i].name,buffer,buffersize);
+    }
+    return idGetSubName((size_t)enumtype, "content", i, buffer, buffersize);
   }
 
 #if LUAFXBUILDER_USESTRING
-  inline std::string System::idGetName(size_t id)
+
+  inline std::string System::idGetSubName( size_t id, const char* what, int i )
   {
     LuaState L = m_luaState;
     LuaStateObjOperation idop(L,id);
+    lua_getfield(L,-1,what);
+    lua_rawgeti (L,-1, i + 1);
+    assert(lua_istable(L,-1));
     lua_getfield(L,-1,"name");
-    assert(lua_isstring(L,-1));
 
     size_t sz;
     const char* str = lua_tolstring(L,-1,&sz);
@@ -648,261 +3698,650 @@ namespace luafxbuilder
     return std::string(str,sz);
   }
 
-  std::string System::effectGetName( EffectID effect )
+  std::string System::techniqueGetCodeName( TechID tech, int i )
   {
-    return idGetName((size_t)effect);
+    if (m_frozen){
+      const SnapshotTechnique& technique = m_frozen->getTechnique(tech);
+      assert(i >= 0 && i < (int)technique.codeCount && "illegal index");
+      return nameGet(m_frozen->codes[technique.codeFirst + i]);
+    }
+    return idGetSubName((size_t)tech, "code", i );
   }
 
-  std::string System::groupGetName( GroupID group )
+  std::string System::groupGetParameterName( GroupID group, int i )
   {
-    return idGetName((size_t)group);
+    if (m_frozen){
+      const SnapshotGroup& grp = m_frozen->getGroup(group);
+      assert(i >= 0 && i < (int)grp.parameterCount && "illegal index");
+      return nameGet(m_frozen->parameters[grp.parameterFirst + i].name);
+    }
+    return idGetSubName((size_t)group, "parameter", i );
   }
 
-  std::string System::techniqueGetName( TechID tech )
+  std::string System::enumGetValueName( EnumID enumtype, int i )
   {
-    return idGetName((size_t)tech);
+    if (m_frozen){
+      const SnapshotEnum& enm = m_frozen->getEnum(enumtype);
+      assert(i >= 0 && i < (int)enm.valueCount && "illegal index");
+      return nameGet(m_frozen->enumValues[enm.valueFirst + i].name);
+    }
+    return idGetSubName((size_t)enumtype, "content", i );
   }
 
-  std::string System::enumGetName( EnumID enumtype )
-  {
-    return idGetName((size_t)enumtype);
-  }
+
 #endif
 
-  inline size_t System::idGetSubID(size_t id, const char* what, int i)
+  //////////////////////////////////////////////////////////////////////////
+  
+
+  EffectType System::effectGetType( EffectID effect )
   {
+    if (m_frozen){
+      return (EffectType)m_frozen->getEffect(effect).type;
+    }
+
     LuaState L = m_luaState;
-    LuaStateObjOperation idop(L,id);
-    lua_getfield(L,-1,what);
-    lua_rawgeti (L,-1,i + 1);
-    assert(lua_istable(L,-1));
-    return getID();
+    LuaStateObjOperation idop(L,(size_t)effect);
+    lua_getfield(L, -1, "classenum");
+    assert( lua_isnumber(L,-1) );
+    return (EffectType)lua_tointeger(L,-1);
   }
 
-  GroupID System::effectGetGroup( EffectID effect, int i )
+  //////////////////////////////////////////////////////////////////////////
+  
+  unsigned int System::getLightsKey( TechID tech, const LightConfig* lights )
   {
-    return (GroupID)idGetSubID((size_t)effect,"group",i);
+    int lighting = m_lightSets->getLighting((size_t)tech);
+    if (lighting < 0){
+      lighting = techniqueHasLighting(tech) ? 1 : 0;
+      m_lightSets->setLighting((size_t)tech,lighting != 0);
+    }
+    if (!lighting){
+      return 0;
+    }
+    return lights ? lights->serial : m_lightsSerial;
   }
-  TechID System::effectGetTechnique( EffectID effect, int i )
+
+  const CodeBlob* System::generateBlob( TechID tech, GeneratorType gentype, int i, const LightConfig* lights )
   {
-    return (TechID)idGetSubID((size_t)effect,"technique",i);
+    CodeCacheKey key;
+    key.tech    = (size_t)tech;
+    key.codeidx = i;
+    key.gentype = gentype;
+    key.lights  = getLightsKey(tech,lights);
+
+    const CodeBlob* code = m_codeCache->find(key);
+    if (!code){
+      if (!m_luaState){
+        setError("no lua state (image or released by freeze), cannot generate code");
+        return NULL;
+      }
+      LuaState L = m_luaState;
+      LuaStateObjOperation idop(L,(size_t)tech);
+      lua_getglobal   (L,    "fxcodegen");
+      lua_pushvalue   (L, -2);      // tech
+      lua_pushinteger (L,i + 1);    // codeidx
+      lua_pushinteger (L, gentype); // gentype
+      LightsScope scope(L,lights);
+      unsigned long long begin = getNanoseconds();
+      int status = lua_pcall(L,3,1,FXERROR);
+      m_stats.codegenCalls[gentype]++;
+      m_stats.codegenTime[gentype] += getNanoseconds() - begin;
+      if (status){
+        updateError();
+        return NULL;
+      }
+      assert(lua_isstring(L,-1));
+
+      size_t sz;
+      const char* luastr = lua_tolstring(L,-1,&sz);
+      m_stats.codegenBytes += sz;
+      code = m_codeCache->insert(key,luastr,sz);
+    }
+
+    return code;
   }
 
-  inline size_t System::idGetSubID(size_t id, const char* what, const char* name)
+  bool System::generateCode( TechID tech, GeneratorType gentype, int i, const LightConfig* lights, const char** str, size_t* size, CodeHash* hash )
   {
-    LuaState L = m_luaState;
-    LuaStateObjOperation idop(L,id);
-    lua_getfield(L,-1,what);
-    lua_getfield(L,-1,name);
-    if (lua_istable(L,-1))
-    {
-      return getID();
+    const CodeBlob* blob = generateBlob(tech,gentype,i,lights);
+    if (!blob){
+      return true;
     }
-    else
-    {
-      return 0;
+    *str  = blob->code.c_str();
+    *size = blob->code.size();
+    if (hash){
+      *hash = blob->hash;
     }
+    return false;
   }
 
-  GroupID System::effectGetGroup( EffectID effect, const char* name )
+  error System::techniqueGenerateCode( TechID tech, GeneratorType gentype, int i, char* buffer, size_t buffersize, size_t* outsize )
   {
-    return (GroupID)idGetSubID((size_t)effect,"group", name);
+    const char* str;
+    size_t sz;
+    if (generateCode(tech,gentype,i,NULL,&str,&sz,NULL)){
+      return true;
+    }
+    *outsize = outputString(str,sz,buffer,buffersize);
+
+    return false;
   }
 
-  TechID System::effectGetTechnique( EffectID effect, const char* name )
+#if LUAFXBUILDER_USESTRING
+  error System::techniqueGenerateCode( TechID tech, GeneratorType gentype, int i, std::string& buffer )
   {
-    return (TechID)idGetSubID((size_t)effect,"technique", name);
+    const char* str;
+    size_t sz;
+    if (generateCode(tech,gentype,i,NULL,&str,&sz,NULL)){
+      return true;
+    }
+    buffer.assign(str,sz);
+
+    return false;
   }
+#endif
 
-  inline size_t System::idGetSubID(size_t id, const char* what)
+  error System::techniqueGenerateCodeView( TechID tech, GeneratorType gentype, int i, const char** code, size_t* codesize )
   {
-    LuaState L = m_luaState;
-    LuaStateObjOperation idop(L,id);
-    lua_getfield(L,-1,what);
-    if (lua_istable(L,-1))
-    {
-      return getID();
+    return generateCode(tech,gentype,i,NULL,code,codesize,NULL);
+  }
+
+  error System::techniqueGenerateCodeView( TechID tech, GeneratorType gentype, int i, LightConfigID lights, const char** code, size_t* codesize )
+  {
+    return generateCode(tech,gentype,i,(const LightConfig*)lights,code,codesize,NULL);
+  }
+
+  error System::techniqueGenerateCodeHash( TechID tech, GeneratorType gentype, int i, CodeHash* hash, CodeOutput* canonical )
+  {
+    return techniqueGenerateCodeHash(tech,gentype,i,NULL,hash,canonical);
+  }
+
+  error System::techniqueGenerateCodeHash( TechID tech, GeneratorType gentype, int i, LightConfigID lights, CodeHash* hash, CodeOutput* canonical )
+  {
+    const CodeBlob* blob = generateBlob(tech,gentype,i,(const LightConfig*)lights);
+    if (!blob){
+      return true;
     }
-    else
-    {
-      return 0;
+    *hash = blob->hash;
+    if (canonical){
+      // erase and insert promote a live key before the code is handed out
+      assert(!blob->orphaned);
+      canonical->tech     = (TechID)blob->canonical.tech;
+      canonical->gentype  = (GeneratorType)blob->canonical.gentype;
+      canonical->codeidx  = blob->canonical.codeidx;
     }
+    return false;
   }
 
-  EffectID System::groupGetEffect( GroupID group )
+  error System::techniqueGenerateProgram( TechID tech, int numGenerators, const GeneratorType* gentypes, ProgramCode* outputs )
   {
-    return (EffectID)idGetSubID((size_t)group,"host");
+    return techniqueGenerateProgram(tech,NULL,numGenerators,gentypes,outputs);
   }
 
-  EffectID System::techniqueGetEffect( TechID tech )
+  error System::techniqueGenerateProgram( TechID tech, LightConfigID config, int numGenerators, const GeneratorType* gentypes, ProgramCode* outputs )
   {
-    return (EffectID)idGetSubID((size_t)tech,"host");
+    int numCodes = techniqueGetCodeCount(tech);
+    unsigned int lights = getLightsKey(tech,(const LightConfig*)config);
+
+    std::vector<int> missing;
+    for (int g = 0; g < numGenerators; g++){
+      for (int i = 0; i < numCodes; i++){
+        CodeCacheKey key;
+        key.tech    = (size_t)tech;
+        key.codeidx = i;
+        key.gentype = gentypes[g];
+        key.lights  = lights;
+
+        ProgramCode& output = outputs[g * numCodes + i];
+        const CodeBlob* blob = m_codeCache->find(key);
+        output.gentype  = gentypes[g];
+        output.codeidx  = i;
+        output.code     = blob ? blob->code.c_str() : NULL;
+        output.codesize = blob ? blob->code.size() : 0;
+        output.hash     = blob ? blob->hash : 0;
+        if (!blob){
+          missing.push_back(g * numCodes + i);
+        }
+      }
+    }
+    if (missing.empty()){
+      return false;
+    }
+    if (!m_luaState){
+      setError("no lua state (image or released by freeze), cannot generate code");
+      return true;
+    }
+
+    LuaState L = m_luaState;
+    LuaStateObjOperation idop(L,(size_t)tech);
+    lua_getglobal   (L, "fxprogramgen");
+    lua_pushvalue   (L, -2);      // tech
+    lua_createtable (L, (int)missing.size(), 0);
+    lua_createtable (L, (int)missing.size(), 0);
+    for (size_t m = 0; m < missing.size(); m++){
+      const ProgramCode& output = outputs[missing[m]];
+      lua_pushinteger (L, output.codeidx + 1);
+      lua_rawseti     (L, -3, (int)m + 1);
+      lua_pushinteger (L, output.gentype);
+      lua_rawseti     (L, -2, (int)m + 1);
+    }
+    LightsScope scope(L,(const LightConfig*)config);
+    unsigned long long begin = getNanoseconds();
+    int status = lua_pcall(L,3,1,FXERROR);
+    unsigned long long time = getNanoseconds() - begin;
+    if (status){
+      lua_pushnil     (L);
+      lua_setglobal   (L, "fxprogram");
+      updateError();
+      return true;
+    }
+    assert(lua_istable(L,-1));
+
+    for (size_t m = 0; m < missing.size(); m++){
+      ProgramCode& output = outputs[missing[m]];
+      // the shared work is spread evenly
+      m_stats.codegenCalls[output.gentype]++;
+      m_stats.codegenTime[output.gentype] += time / missing.size();
+
+      lua_rawgeti(L,-1,(int)m + 1);
+      assert(lua_isstring(L,-1));
+      size_t sz;
+      const char* luastr = lua_tolstring(L,-1,&sz);
+      m_stats.codegenBytes += sz;
+
+      CodeCacheKey key;
+      key.tech    = (size_t)tech;
+      key.codeidx = output.codeidx;
+      key.gentype = output.gentype;
+      key.lights  = lights;
+      const CodeBlob* blob = m_codeCache->insert(key,luastr,sz);
+      output.code     = blob->code.c_str();
+      output.codesize = blob->code.size();
+      output.hash     = blob->hash;
+      lua_pop(L,1);
+    }
+
+    return false;
   }
 
-  //////////////////////////////////////////////////////////////////////////
+  error System::techniqueGenerateSegments( TechID tech, GeneratorType gentype, int i, SegmentedCode* code )
+  {
+    return techniqueGenerateSegments(tech,gentype,i,NULL,code);
+  }
 
-  inline int System::idGetSubIdx( size_t id, const char* what, const char *name )
+  error System::techniqueGenerateSegments( TechID tech, GeneratorType gentype, int i, LightConfigID lights, SegmentedCode* code )
   {
+    CodeCacheKey key;
+    key.tech    = (size_t)tech;
+    key.codeidx = i;
+    key.gentype = gentype;
+    key.lights  = getLightsKey(tech,(const LightConfig*)lights);
+
+    if (m_segmentCache->find(key,code)){
+      return false;
+    }
+    if (!m_luaState){
+      setError("no lua state (image or released by freeze), cannot generate code");
+      return true;
+    }
+
     LuaState L = m_luaState;
-    LuaStateObjOperation idop(L,id);
-    lua_getfield(L,-1,what);
-    lua_getfield(L,-1,name);
-    if (lua_isnumber(L,-1)){
-      return (int)lua_tointeger(L,-1) - 1;
+    LuaStateObjOperation idop(L,(size_t)tech);
+    lua_getglobal   (L, "fxcodegen");
+    lua_pushvalue   (L, -2);      // tech
+    lua_pushinteger (L, i + 1);   // codeidx
+    lua_pushinteger (L, gentype);
+    lua_pushboolean (L, 1);       // segmented
+    LightsScope scope(L,(const LightConfig*)lights);
+    unsigned long long begin = getNanoseconds();
+    int status = lua_pcall(L,4,1,FXERROR);
+    m_stats.codegenCalls[gentype]++;
+    m_stats.codegenTime[gentype] += getNanoseconds() - begin;
+    if (status){
+      updateError();
+      return true;
     }
-    return -1;
-  }
+    assert(lua_istable(L,-1));
 
+    // the lua strings stay alive in the table until the segments are interned
+    int count = (int)lua_objlen(L,-1);
+    std::vector<const char*>  strs(count + 1);
+    std::vector<size_t>       sizes(count + 1);
+    for (int s = 0; s < count; s++){
+      lua_rawgeti(L,-1,s + 1);
+      assert(lua_isstring(L,-1));
+      strs[s] = lua_tolstring(L,-1,&sizes[s]);
+      m_stats.codegenBytes += sizes[s];
+      lua_pop(L,1);
+    }
+    m_segmentCache->insert(key,count,&strs[0],&sizes[0],code);
 
-  int System::effectGetGroupIndex( EffectID effect, const char* name )
+    return false;
+  }
+
+  void System::getCodeCacheStats( CodeCacheStats* stats )
   {
-    return idGetSubIdx((size_t)effect,"groupidx",name);
+    *stats = m_codeCache->getStats();
   }
 
-  int System::effectGetTechniqueIndex( EffectID effect, const char* name )
+  void System::getSegmentCacheStats( CodeCacheStats* stats )
   {
-    return idGetSubIdx((size_t)effect,"techniqueidx",name);
+    *stats = m_segmentCache->getStats();
   }
 
-  int System::techniqueGetCodeIndex( TechID tech, const char* name )
+  void System::resetCodeCacheStats()
   {
-    return idGetSubIdx((size_t)tech,"codeidx",name);
+    m_codeCache->resetStats();
+    m_segmentCache->resetStats();
   }
 
-  int System::groupGetParameterIndex( GroupID group, const char* name )
+  void System::clearCodeCache()
   {
-    return idGetSubIdx((size_t)group,"parameteridx",name);
+    m_codeCache->clear();
+    m_segmentCache->clear();
+    m_lightSets->forgetLighting(NULL,0);
+    restartSteps(NULL,0);
   }
 
   //////////////////////////////////////////////////////////////////////////
+  // GenerateStep
+  //
+  // fxcodegen of one output running in its own coroutine. generateStep
+  // resumes it with a deadline, fxyieldpoint yields back once the deadline
+  // passed. The coroutine is dropped when the output is cached, the step
+  // restarts from scratch when its inputs changed.
+
+  struct GenerateStep {
+    GenerateStep*       next;
+    CodeCacheKey        key;
+    bool                lit;        // key.lights follows the light set
+    const LightConfig*  lights;     // NULL for setGeneratorLights
+    LuaState            thread;     // NULL when not started
+    int                 threadRef;  // registry reference keeping thread alive
+    unsigned long long  deadline;
+  };
 
-  inline size_t System::idGetSubName( size_t id, const char* what, int i, char* buffer, size_t buffersize )
+  static int luaYieldPoint(LuaState L)
+  {
+    GenerateStep* step = *(GenerateStep**)lua_touserdata(L,lua_upvalueindex(1));
+    // synchronous generation may call it as well
+    if (step && step->thread == L && getNanoseconds() >= step->deadline){
+      return lua_yield(L,0);
+    }
+    return 0;
+  }
+
+  static void releaseStep(LuaState L, GenerateStep* step)
+  {
+    if (step->thread && L){
+      luaL_unref(L,LUA_REGISTRYINDEX,step->threadRef);
+    }
+    step->thread    = NULL;
+    step->threadRef = LUA_NOREF;
+  }
+
+  void System::restartSteps( const size_t* techs, size_t numTechs )
   {
+    for (GenerateStep* step = m_steps; step; step = step->next){
+      bool affected = techs == NULL;
+      for (size_t i = 0; i < numTechs && !affected; i++){
+        affected = techs[i] == step->key.tech;
+      }
+      if (affected){
+        releaseStep(m_luaState,step);
+      }
+    }
+  }
+
+  StepID System::techniqueGenerateBegin( TechID tech, GeneratorType gentype, int i )
+  {
+    return techniqueGenerateBegin(tech,gentype,i,NULL);
+  }
+
+  StepID System::techniqueGenerateBegin( TechID tech, GeneratorType gentype, int i, LightConfigID lights )
+  {
+    GenerateStep* step = new GenerateStep;
+    step->key.tech    = (size_t)tech;
+    step->key.codeidx = i;
+    step->key.gentype = gentype;
+    step->lights      = (const LightConfig*)lights;
+    step->key.lights  = getLightsKey(tech,step->lights);
+    step->lit         = step->key.lights != 0;
+    step->thread      = NULL;
+    step->threadRef   = LUA_NOREF;
+    step->deadline    = 0;
+    step->next        = m_steps;
+    m_steps = step;
+    // one hit or miss per step, the slices only probe
+    m_codeCache->find(step->key);
+
+    return (StepID)step;
+  }
+
+  error System::generateStep( StepID stepid, unsigned int budgetMicroseconds, bool* done )
+  {
+    GenerateStep* step = (GenerateStep*)stepid;
     LuaState L = m_luaState;
-    LuaStateObjOperation idop(L,id);
-    lua_getfield(L,-1,what);
-    lua_rawgeti (L,-1, i + 1);
-    assert(lua_istable(L,-1));
-    lua_getfield(L,-1,"name");
+    *done = false;
+
+    unsigned int lights = !step->lit ? 0 : step->lights ? step->lights->serial : m_lightsSerial;
+    if (step->key.lights != lights){
+      releaseStep(L,step);
+      step->key.lights = lights;
+    }
+    // also finished by synchronous generation of the same output
+    if (m_codeCache->probe(step->key)){
+      releaseStep(L,step);
+      *done = true;
+      return false;
+    }
+    if (!L){
+      setError("no lua state (image or released by freeze), cannot generate code");
+      return true;
+    }
+
+    int nargs = 0;
+    if (!step->thread){
+      LuaStateObjOperation idop(L,step->key.tech);
+      LuaState thread = lua_newthread(L);
+      lua_getglobal   (thread, "fxcodegen");
+      lua_pushvalue   (L, -2);      // tech
+      lua_xmove       (L, thread, 1);
+      lua_pushinteger (thread, step->key.codeidx + 1);
+      lua_pushinteger (thread, step->key.gentype);
+      step->threadRef = luaL_ref(L,LUA_REGISTRYINDEX);
+      step->thread    = thread;
+      nargs = 3;
+    }
+
+    int gentype = step->key.gentype;
+    LuaState thread = step->thread;
+    unsigned long long begin = getNanoseconds();
+    step->deadline = begin + (unsigned long long)budgetMicroseconds * 1000;
+    int status;
+    {
+      LightsScope scope(L,step->lights);
+      m_stepRunning = step;
+      status = lua_resume(thread,nargs);
+      m_stepRunning = NULL;
+    }
+    m_stats.codegenTime[gentype] += getNanoseconds() - begin;
+
+    if (status == LUA_YIELD){
+      return false;
+    }
+    m_stats.codegenCalls[gentype]++;
+    if (status){
+      // dead coroutine, error message on its stack
+      lua_xmove(thread,L,1);
+      releaseStep(L,step);
+      updateError();
+      return true;
+    }
+    assert(lua_isstring(thread,-1));
 
     size_t sz;
-    const char* str = lua_tolstring(L,-1,&sz);
-    sz = outputString(str,sz,buffer,buffersize);
+    const char* luastr = lua_tolstring(thread,-1,&sz);
+    m_stats.codegenBytes += sz;
+    m_codeCache->insert(step->key,luastr,sz);
+    releaseStep(L,step);
+    *done = true;
 
-    return sz;
+    return false;
   }
 
-  size_t System::techniqueGetCodeName( TechID tech, int i, char* buffer, size_t buffersize )
+  void System::generateEnd( StepID stepid )
   {
-    return idGetSubName((size_t)tech, "code", i, buffer, buffersize);
+    GenerateStep* step = (GenerateStep*)stepid;
+    GenerateStep** link = &m_steps;
+    while (*link != step){
+      assert(*link && "unknown step");
+      link = &(*link)->next;
+    }
+    *link = step->next;
+    releaseStep(m_luaState,step);
+    delete step;
   }
 
-  size_t System::groupGetParameterName( GroupID group, int i, char* buffer, size_t buffersize )
+  // expects fxdependents and its argument on the stack
+  int System::getDependents( int maxoutputs, CodeOutput* outputs )
   {
-    return idGetSubName((size_t)group, "parameter", i, buffer, buffersize);
-  }
+    LuaState L = m_luaState;
+    if (lua_pcall(L,1,1,FXERROR)){
+      updateError();
+      return 0;
+    }
 
-  size_t System::enumGetValueName( EnumID enumtype, int i, char* buffer, size_t buffersize )
-  {
-    return idGetSubName((size_t)enumtype, "parameter", i, buffer, buffersize);;
+    int cnt = (int)lua_objlen(L,-1);
+    for (int i = 0; outputs && i < cnt && i < maxoutputs; i++){
+      lua_rawgeti(L,-1,i + 1);
+      lua_getfield(L,-1,"tech");
+      outputs[i].tech     = (TechID)(size_t)lua_tointeger(L,-1);
+      lua_getfield(L,-2,"code");
+      outputs[i].codeidx  = (int)lua_tointeger(L,-1) - 1;
+      lua_getfield(L,-3,"gen");
+      outputs[i].gentype  = (GeneratorType)lua_tointeger(L,-1);
+      lua_pop(L,4);
+    }
+    return cnt;
   }
 
-#if LUAFXBUILDER_USESTRING
-
-  inline std::string System::idGetSubName( size_t id, const char* what, int i )
+  int System::getDependentCode( const char* filename, int maxoutputs, CodeOutput* outputs )
   {
-    LuaState L = m_luaState;
-    LuaStateObjOperation idop(L,id);
-    lua_getfield(L,-1,what);
-    lua_rawgeti (L,-1, i + 1);
-    assert(lua_istable(L,-1));
-    lua_getfield(L,-1,"name");
-
-    size_t sz;
-    const char* str = lua_tolstring(L,-1,&sz);
+    if (!m_luaState){
+      return 0;
+    }
 
-    return std::string(str,sz);
+    LuaState L = m_luaState;
+    LuaStatePreserve preserve(L);
+    lua_getglobal(L,"fxdependents");
+    lua_pushstring(L,filename);
+    return getDependents(maxoutputs,outputs);
   }
 
-  std::string System::techniqueGetCodeName( TechID tech, int i )
+  int System::getDependentCode( EffectID effect, int maxoutputs, CodeOutput* outputs )
   {
-    return idGetSubName((size_t)tech, "code", i );
-  }
+    if (!m_luaState){
+      return 0;
+    }
 
-  std::string System::groupGetParameterName( GroupID group, int i )
-  {
-    return idGetSubName((size_t)group, "parameter", i );
+    LuaState L = m_luaState;
+    LuaStatePreserve preserve(L);
+    lua_getglobal(L,"fxdependents");
+    lua_rawgeti(L,FXIDS,(int)(size_t)effect);
+    return getDependents(maxoutputs,outputs);
   }
 
-  std::string System::enumGetValueName( EnumID enumtype, int i )
+  static size_t getFileCacheField(LuaState L, const char* field)
   {
-    return idGetSubName((size_t)enumtype, "content", i );
+    lua_getfield(L,-1,field);
+    size_t value = (size_t)lua_tointeger(L,-1);
+    lua_pop(L,1);
+    return value;
   }
 
-
-#endif
-
-  //////////////////////////////////////////////////////////////////////////
-  
-
-  EffectType System::effectGetType( EffectID effect )
+  void System::getFileCacheStats( FileCacheStats* stats )
   {
+    memset(stats,0,sizeof(FileCacheStats));
+    if (!m_luaState){
+      return;
+    }
+
     LuaState L = m_luaState;
-    LuaStateObjOperation idop(L,(size_t)effect);
-    lua_getfield(L, -1, "classenum");
-    assert( lua_isnumber(L,-1) );
-    return (EffectType)lua_tointeger(L,-1);
+    LuaStatePreserve preserve(L);
+    lua_getglobal(L,"fxfilecache");
+    stats->reads    = getFileCacheField(L,"reads");
+    stats->hits     = getFileCacheField(L,"hits");
+    stats->entries  = getFileCacheField(L,"count");
+    stats->bytes    = getFileCacheField(L,"bytes");
   }
 
-  //////////////////////////////////////////////////////////////////////////
-  
-  error System::techniqueGenerateCode( TechID tech, GeneratorType gentype, int i, char* buffer, size_t buffersize, size_t* outsize )
+  void System::resetFileCacheStats()
   {
-    LuaState L = m_luaState;
-    LuaStateObjOperation idop(L,(size_t)tech);
-    lua_getglobal   (L,    "fxcodegen");
-    lua_pushvalue   (L, -2);      // tech
-    lua_pushinteger (L,i + 1);    // codeidx
-    lua_pushinteger (L, gentype); // gentype
-    if ( lua_pcall  (L,3,1,FXERROR) ){
-      updateError();
-      return true;
+    if (!m_luaState){
+      return;
     }
-    assert(lua_isstring(L,-1));
-
-    size_t sz;
-    const char* str = lua_tolstring(L,-1,&sz);
-    sz = outputString(str,sz,buffer,buffersize);
-    *outsize = sz;
 
-    return false;
+    LuaState L = m_luaState;
+    LuaStatePreserve preserve(L);
+    lua_getglobal(L,"fxfilecache");
+    lua_pushinteger(L,0);
+    lua_setfield(L,-2,"reads");
+    lua_pushinteger(L,0);
+    lua_setfield(L,-2,"hits");
+  }
+  void System::getStats( SystemStats* stats )
+  {
+    *stats = m_stats;
+    stats->luaHeapBytes = m_luaState ? getLuaHeapBytes(m_luaState) : 0;
   }
 
-#if LUAFXBUILDER_USESTRING
-  error System::techniqueGenerateCode( TechID tech, GeneratorType gentype, int i, std::string& buffer )
+  void System::resetStats()
   {
-    LuaState L = m_luaState;
-    LuaStateObjOperation idop(L,(size_t)tech);
-    lua_getglobal   (L,    "fxcodegen");
-    lua_pushvalue   (L, -2);      // tech
-    lua_pushinteger (L,i + 1);    // codeidx
-    lua_pushinteger (L, gentype); // gentype
-    if ( lua_pcall  (L,3,1,FXERROR) ){
-      updateError();
-      return true;
+    memset(&m_stats,0,sizeof(m_stats));
+    if (!m_luaState){
+      return;
     }
-    assert(lua_isstring(L,-1));
 
-    size_t sz;
-    const char* str = lua_tolstring(L,-1,&sz);
-    buffer = std::string(str,sz);
+    LuaState L = m_luaState;
+    LuaStatePreserve preserve(L);
+    lua_getglobal(L,"fxfiles");
+    lua_getfield(L,-1,"entries");
+    lua_pushnil(L);
+    while (lua_next(L,-2)){
+      lua_pushnil(L);
+      lua_setfield(L,-2,"loads");
+      lua_pushnil(L);
+      lua_setfield(L,-2,"time");
+      lua_pop(L,1);
+    }
+  }
 
-    return false;
+  void System::getLibraryFileStats( int i, LibraryFileStats* stats )
+  {
+    LuaState L = m_luaState;
+    LuaStatePreserve preserve(L);
+    lua_getglobal(L,"fxfiles");
+    lua_getfield(L,-1,"list");
+    lua_rawgeti(L,-1,i + 1);
+    assert(lua_isstring(L,-1) && "illegal index");
+    lua_getfield(L,-3,"entries");
+    lua_pushvalue(L,-2);
+    lua_rawget(L,-2);
+    lua_getfield(L,-1,"loads");
+    stats->loads = (size_t)lua_tointeger(L,-1);
+    lua_getfield(L,-2,"time");
+    stats->time = (unsigned long long)lua_tonumber(L,-1);
   }
-#endif
+
 
   bool System::techniqueHasLighting( TechID tech )
   {
+    if (m_frozen){
+      return m_frozen->getTechnique(tech).lighting != 0;
+    }
+
     LuaState L = m_luaState;
     LuaStateObjOperation idop(L,(size_t)tech);
     lua_getfield(L, -1, "lighting");
@@ -911,6 +4350,10 @@ namespace luafxbuilder
 
   bool System::techniqueHasOption( TechID tech, const char* name )
   {
+    if (m_frozen){
+      return findOption(tech,m_names->find(name)) != NULL;
+    }
+
     LuaState L = m_luaState;
     LuaStateObjOperation idop(L,(size_t)tech);
     lua_getfield(L,-1, "option");
@@ -918,6 +4361,20 @@ namespace luafxbuilder
     return lua_isnil(L,-1) ? false : true;
   }
 
+  inline const SnapshotOption* System::findOption( TechID tech, unsigned int name )
+  {
+    const SnapshotTechnique& technique = m_frozen->getTechnique(tech);
+    int idx = Snapshot::lookup(m_frozen->optionLookup,technique.optionFirst,technique.optionCount,name);
+    return idx < 0 ? NULL : &m_frozen->options[technique.optionFirst + idx];
+  }
+
+  inline const SnapshotParameter& System::findParameter( GroupID group, int i )
+  {
+    const SnapshotGroup& grp = m_frozen->getGroup(group);
+    assert(i >= 0 && i < (int)grp.parameterCount && "illegal index");
+    return m_frozen->parameters[grp.parameterFirst + i];
+  }
+
   static inline void getOption(LuaState L, const char* name, int type){
     lua_getfield(L,-1, "option");
     lua_getfield(L,-1, name);
@@ -926,6 +4383,15 @@ namespace luafxbuilder
 
   size_t System::techniqueGetOptionString( TechID tech, const char* name, char* buffer, size_t buffersize )
   {
+    if (m_frozen){
+      const SnapshotOption* option = findOption(tech,m_names->find(name));
+      assert(option && option->type == LUA_TSTRING);
+      if (!option || option->type != LUA_TSTRING){
+        return 0;
+      }
+      return nameGet(option->string,buffer,buffersize);
+    }
+
     LuaState L = m_luaState;
     LuaStateObjOperation idop(L,(size_t)tech);
     getOption(L,name,LUA_TSTRING);
@@ -941,6 +4407,15 @@ namespace luafxbuilder
 
   std::string System::techniqueGetOptionString( TechID tech, const char* name )
   {
+    if (m_frozen){
+      const SnapshotOption* option = findOption(tech,m_names->find(name));
+      assert(option && option->type == LUA_TSTRING);
+      if (!option || option->type != LUA_TSTRING){
+        return std::string();
+      }
+      return nameGet(option->string);
+    }
+
     LuaState L = m_luaState;
     LuaStateObjOperation idop(L,(size_t)tech);
     getOption(L,name,LUA_TSTRING);
@@ -955,6 +4430,15 @@ namespace luafxbuilder
 
   bool System::techniqueGetOptionBool( TechID tech, const char* name )
   {
+    if (m_frozen){
+      const SnapshotOption* option = findOption(tech,m_names->find(name));
+      assert(option && option->type == LUA_TBOOLEAN);
+      if (!option || option->type != LUA_TBOOLEAN){
+        return false;
+      }
+      return option->boolean != 0;
+    }
+
     LuaState L = m_luaState;
     LuaStateObjOperation idop(L,(size_t)tech);
     getOption(L,name,LUA_TBOOLEAN);
@@ -963,6 +4447,15 @@ namespace luafxbuilder
 
   int System::techniqueGetOptionInteger( TechID tech, const char* name )
   {
+    if (m_frozen){
+      const SnapshotOption* option = findOption(tech,m_names->find(name));
+      assert(option && option->type == LUA_TNUMBER);
+      if (!option || option->type != LUA_TNUMBER){
+        return 0;
+      }
+      return (int)option->number;
+    }
+
     LuaState L = m_luaState;
     LuaStateObjOperation idop(L,(size_t)tech);
     getOption(L,name,LUA_TNUMBER);
@@ -971,17 +4464,112 @@ namespace luafxbuilder
 
   float System::techniqueGetOptionFloat( TechID tech, const char* name )
   {
+    if (m_frozen){
+      const SnapshotOption* option = findOption(tech,m_names->find(name));
+      assert(option && option->type == LUA_TNUMBER);
+      if (!option || option->type != LUA_TNUMBER){
+        return 0.0f;
+      }
+      return (float)option->number;
+    }
+
     LuaState L = m_luaState;
     LuaStateObjOperation idop(L,(size_t)tech);
     getOption(L,name,LUA_TNUMBER);
     return (float)lua_tonumber(L,-1);
   }
 
+  bool System::techniqueHasOption( TechID tech, NameID name )
+  {
+    if (m_frozen){
+      return findOption(tech,(unsigned int)(size_t)name) != NULL;
+    }
+    return name ? techniqueHasOption(tech,m_names->getString((unsigned int)(size_t)name)) : false;
+  }
+
+  size_t System::techniqueGetOptionString( TechID tech, NameID name, char* buffer, size_t buffersize )
+  {
+    if (m_frozen){
+      const SnapshotOption* option = findOption(tech,(unsigned int)(size_t)name);
+      assert(option && option->type == LUA_TSTRING);
+      if (!option || option->type != LUA_TSTRING){
+        return 0;
+      }
+      return nameGet(option->string,buffer,buffersize);
+    }
+    return techniqueGetOptionString(tech,m_names->getString((unsigned int)(size_t)name),buffer,buffersize);
+  }
+
+#if LUAFXBUILDER_USESTRING
+
+  std::string System::techniqueGetOptionString( TechID tech, NameID name )
+  {
+    if (m_frozen){
+      const SnapshotOption* option = findOption(tech,(unsigned int)(size_t)name);
+      assert(option && option->type == LUA_TSTRING);
+      if (!option || option->type != LUA_TSTRING){
+        return std::string();
+      }
+      return nameGet(option->string);
+    }
+    return techniqueGetOptionString(tech,m_names->getString((unsigned int)(size_t)name));
+  }
+
+#endif
+
+  bool System::techniqueGetOptionBool( TechID tech, NameID name )
+  {
+    if (m_frozen){
+      const SnapshotOption* option = findOption(tech,(unsigned int)(size_t)name);
+      assert(option && option->type == LUA_TBOOLEAN);
+      if (!option || option->type != LUA_TBOOLEAN){
+        return false;
+      }
+      return option->boolean != 0;
+    }
+    return techniqueGetOptionBool(tech,m_names->getString((unsigned int)(size_t)name));
+  }
+
+  int System::techniqueGetOptionInteger( TechID tech, NameID name )
+  {
+    if (m_frozen){
+      const SnapshotOption* option = findOption(tech,(unsigned int)(size_t)name);
+      assert(option && option->type == LUA_TNUMBER);
+      if (!option || option->type != LUA_TNUMBER){
+        return 0;
+      }
+      return (int)option->number;
+    }
+    return techniqueGetOptionInteger(tech,m_names->getString((unsigned int)(size_t)name));
+  }
+
+  float System::techniqueGetOptionFloat( TechID tech, NameID name )
+  {
+    if (m_frozen){
+      const SnapshotOption* option = findOption(tech,(unsigned int)(size_t)name);
+      assert(option && option->type == LUA_TNUMBER);
+      if (!option || option->type != LUA_TNUMBER){
+        return 0.0f;
+      }
+      return (float)option->number;
+    }
+    return techniqueGetOptionFloat(tech,m_names->getString((unsigned int)(size_t)name));
+  }
+
   //////////////////////////////////////////////////////////////////////////
 
 
   void System::groupGetParameterInfo( GroupID group, int i, ParameterInfo *info )
   {
+    if (m_frozen){
+      const SnapshotParameter& param = findParameter(group,i);
+      info->type        = (ParameterType)param.type;
+      info->arraySize   = param.arraySize;
+      info->defaultSize = param.valueSize;
+      info->reference   = param.reference;
+      return;
+    }
+
     LuaState L = m_luaState;
     LuaStateObjOperation idop(L,(size_t)group);
     lua_getfield(L,-1,"parameter");
@@ -1004,6 +4592,15 @@ namespace luafxbuilder
 
   size_t System::groupGetParameterValue( GroupID group, int i, size_t buffersize, void* buffer )
   {
+    if (m_frozen){
+      const SnapshotParameter& param = findParameter(group,i);
+      assert(buffersize >= param.valueSize);
+      if (param.valueSize){
+        memcpy(buffer,&m_frozen->values[param.valueOffset],param.valueSize);
+      }
+      return param.valueSize;
+    }
+
     LuaState L = m_luaState;
     LuaStateObjOperation idop(L,(size_t)group);
     lua_getfield(L,-1,"parameter");
@@ -1079,12 +4676,71 @@ namespace luafxbuilder
 
   StorageType System::groupGenerateStorage( GroupID group, GeneratorType gentype, int bufferelements, ParameterStorage* buffer )
   {
+    if (m_frozen){
+      const SnapshotStorage& storage = m_frozen->getStorage(group,gentype);
+      for (unsigned int i = 0; i < storage.entryCount && (int)i < bufferelements; i++){
+        const SnapshotStorageEntry& entry = m_frozen->storageEntries[storage.entryFirst + i];
+        buffer[i].size    = entry.size;
+        buffer[i].offset  = entry.offset;
+        buffer[i].stride  = entry.stride;
+        buffer[i].element = entry.element;
+        buffer[i].align   = entry.align;
+      }
+      return (StorageType)storage.type;
+    }
+
+    int count = groupGetParameterCount(group);
+    std::vector<LayoutParameter> params(count);
+    for (int i = 0; i < count; i++){
+      ParameterInfo info;
+      groupGetParameterInfo(group,i,&info);
+      params[i].type      = info.type;
+      params[i].arraySize = info.arraySize;
+    }
+
+    StorageType stype;
+    std::vector<ParameterStorage> storage;
+    if (layoutGenerateStorage(gentype,groupGetType(group),count ? &params[0] : NULL,count,stype,storage)){
+      return groupGenerateStorageLua(group,gentype,bufferelements,buffer);
+    }
+
+#if FXBUILDER_USESTORAGECHECK
+    {
+      std::vector<ParameterStorage> check(count + 1);
+      StorageType ctype = groupGenerateStorageLua(group,gentype,count + 1,&check[0]);
+      assert(ctype == stype);
+      for (int i = 0; i <= count; i++){
+        assert(check[i].size    == storage[i].size &&
+               check[i].offset  == storage[i].offset &&
+               check[i].stride  == storage[i].stride &&
+               check[i].element == storage[i].element &&
+               check[i].align   == storage[i].align);
+      }
+    }
+#endif
+
+    for (int i = 0; i <= count && i < bufferelements; i++){
+      buffer[i] = storage[i];
+    }
+    return stype;
+  }
+
+  StorageType System::groupGenerateStorageLua( GroupID group, GeneratorType gentype, int bufferelements, ParameterStorage* buffer )
+  {
+    if (!m_luaState){
+      return STORAGE_NONE;
+    }
+
     LuaState L = m_luaState;
     LuaStateObjOperation idop(L,(size_t)group);
     lua_getglobal   (L,    "fxgroupstore");
     lua_pushvalue   (L,-2);
     lua_pushinteger (L, gentype);
-    if ( lua_pcall  (L,2,3,FXERROR) ){
+    unsigned long long begin = getNanoseconds();
+    int status = lua_pcall(L,2,3,FXERROR);
+    m_stats.groupStoreCalls++;
+    m_stats.groupStoreTime += getNanoseconds() - begin;
+    if (status){
       updateError();
       assert(0 && "storage computation failed");
       return STORAGE_NONE;
@@ -1124,8 +4780,56 @@ namespace luafxbuilder
     return (StorageType)lua_tointeger(L,-3);
   }
 
+  size_t System::groupBuildDefaultBlock( GroupID group, GeneratorType gentype, size_t buffersize, void* buffer )
+  {
+    const std::vector<unsigned char>* block = m_defaultBlocks->find((size_t)group,gentype);
+    if (!block){
+      std::vector<unsigned char>* baked = m_defaultBlocks->insert((size_t)group,gentype);
+      int count = groupGetParameterCount(group);
+      if (!count){
+        return 0;
+      }
+      std::vector<ParameterStorage> storage(count + 1);
+      groupGenerateStorage(group,gentype,count + 1,&storage[0]);
+      baked->resize(storage[count].size,0);
+
+      std::vector<unsigned char> values;
+      for (int i = 0; i < count; i++){
+        const ParameterStorage& store = storage[i];
+        ParameterInfo info;
+        groupGetParameterInfo(group,i,&info);
+        // textures are referenced by name, their handles come from the renderer
+        if (!store.size || !store.stride || !info.defaultSize ||
+            (info.type >= PARAMETER_SAMPLER_1D && info.type <= PARAMETER_IMAGE_BUFFER))
+        {
+          continue;
+        }
+        values.resize(info.defaultSize);
+        groupGetParameterValue(group,i,values.size(),&values[0]);
+
+        // one chunk per array element and matrix column, values are tight
+        size_t chunks = store.size / store.stride;
+        for (size_t c = 0; c < chunks && (c + 1) * store.element <= values.size(); c++){
+          memcpy(&(*baked)[store.offset + c * store.stride],&values[c * store.element],store.element);
+        }
+      }
+      block = baked;
+    }
+
+    if (buffer && !block->empty()){
+      memcpy(buffer,&(*block)[0],std::min(buffersize,block->size()));
+      return std::min(buffersize,block->size());
+    }
+    return block->size();
+  }
+
   size_t System::groupGenerateStorageName( GroupID group, GeneratorType gentype, char* buffer, size_t buffersize )
   {
+    if (m_frozen){
+      unsigned int name = m_frozen->getStorage(group,gentype).name;
+      return name == NameTable::INVALID ? 0 : nameGet(name,buffer,buffersize);
+    }
+
     LuaState L = m_luaState;
     LuaStateObjOperation idop(L,(size_t)group);
     lua_getglobal   (L,    "fxgroupstorename");
@@ -1147,6 +4851,10 @@ namespace luafxbuilder
 #if LUAFXBUILDER_USESTRING
   std::string System::groupGenerateStorageName( GroupID group, GeneratorType gentype )
   {
+    if (m_frozen){
+      return nameGet(m_frozen->getStorage(group,gentype).name);
+    }
+
     LuaState L = m_luaState;
     LuaStateObjOperation idop(L,(size_t)group);
     lua_getglobal   (L, "fxgroupstorename");
@@ -1169,6 +4877,10 @@ namespace luafxbuilder
 
   GroupType System::groupGetType( GroupID group )
   {
+    if (m_frozen){
+      return (GroupType)m_frozen->getGroup(group).type;
+    }
+
     LuaState L = m_luaState;
     LuaStateObjOperation idop(L,(size_t)group);
     lua_getfield(L,-1,"modetype");
@@ -1176,33 +4888,131 @@ namespace luafxbuilder
   }
 
 
-  error System::setGeneratorLights( int numLights, EffectID* lights, int* lightsMax  )
+  // validates the set and pushes {effects, max, cache} if there is a lua state
+  bool System::pushLights( int numLights, EffectID* lights, int* lightsMax, unsigned int* serial )
   {
     for (int i = 0; i < numLights; i++){
       if (  effectGetType(lights[i]) != EFFECT_LIGHT ){
         assert(0 && "illegal effectid, lights required");
-        return false;
+        return true;
       }
     }
+    *serial = m_lightSets->intern(numLights,lights,lightsMax);
+    if (!m_luaState){
+      return false;
+    }
     
     LuaState L = m_luaState;
-    lua_newtable(L); // 1 effects {}
-    lua_newtable(L); // 2 max     {}
+    lua_createtable(L,0,3); // 1 lights  {}
+    lua_newtable(L);        // 2 effects {}
+    lua_newtable(L);        // 3 max     {}
     for (int i = 0; i < numLights; i++){
       LuaStateObjOperation idop(L,(size_t)lights[i]);
-                                            // 3 effect
-      lua_rawseti     (L,-3,i+1);           // 2  fxlights.effects[i] = effect
-      lua_pushinteger (L,  lightsMax[i]);   // 3 max
-      lua_rawseti     (L,-2,i+1);           // 2  fxlights.max[i] = max
+                                            // 4 effect
+      lua_rawseti     (L,-3,i+1);           // 3  effects[i] = effect
+      lua_pushinteger (L,  lightsMax[i]);   // 4 max
+      lua_rawseti     (L,-2,i+1);           // 3  max[i] = max
+    }
+    lua_setfield  (L,-3,"max");             // 2  lights.max = 3
+    lua_setfield  (L,-2,"effects");         // 1  lights.effects = 2
+    lua_newtable  (L);                      // 2 cache {}
+    lua_setfield  (L,-2,"cache");           // 1  lights.cache = 2
+
+    return false;
+  }
+
+  error System::setGeneratorLights( int numLights, EffectID* lights, int* lightsMax  )
+  {
+    unsigned int serial;
+    if (pushLights(numLights,lights,lightsMax,&serial)){
+      return true;
+    }
+    m_lightsSerial = serial;
+    unsigned int released = m_lightSets->makeRecent(serial);
+    if (released){
+      releaseLights(released);
     }
-    lua_setfield  (L,FXLIGHTS,"max");       // 1  fxlights.max = 2
-    lua_setfield  (L,FXLIGHTS,"effects");   // 0  fxlights.effects = 1
+    if (!m_luaState){
+      return false;
+    }
+    
+    // FXLIGHTS keeps its table, only the content is replaced
+    LuaState L = m_luaState;
+    lua_getfield  (L,-1,"effects");
+    lua_setfield  (L,FXLIGHTS,"effects");
+    lua_getfield  (L,-1,"max");
+    lua_setfield  (L,FXLIGHTS,"max");
+    lua_getfield  (L,-1,"cache");
+    lua_setfield  (L,FXLIGHTS,"cache");
+    lua_pop       (L,1);
 
     return false;
   }
 
+  LightConfigID System::createLightConfig( int numLights, EffectID* lights, int* lightsMax )
+  {
+    unsigned int serial;
+    if (pushLights(numLights,lights,lightsMax,&serial)){
+      return NULL;
+    }
+
+    LightConfig* config = new LightConfig;
+    config->serial = serial;
+    config->ref  = LUA_NOREF;
+    if (m_luaState){
+      LuaState L = m_luaState;
+      lua_getglobal (L,"fxlightconfigs");
+      lua_insert    (L,-2);
+      config->ref = luaL_ref(L,-2);
+      lua_pop       (L,1);
+    }
+    config->next = m_lightConfigs;
+    m_lightConfigs = config;
+
+    return (LightConfigID)config;
+  }
+
+  void System::destroyLightConfig( LightConfigID configid )
+  {
+    LightConfig* config = (LightConfig*)configid;
+    LightConfig** link = &m_lightConfigs;
+    while (*link != config){
+      assert(*link && "unknown light config");
+      link = &(*link)->next;
+    }
+    *link = config->next;
+
+    if (m_luaState && config->ref != LUA_NOREF){
+      LuaState L = m_luaState;
+      lua_getglobal (L,"fxlightconfigs");
+      luaL_unref    (L,-1,config->ref);
+      lua_pop       (L,1);
+    }
+    releaseLights(config->serial);
+    delete config;
+  }
+
+  void System::releaseLights( unsigned int serial )
+  {
+    if (!m_lightSets->release(serial)){
+      return;
+    }
+    // the serial is reused by the next new set
+    m_codeCache->eraseLights(serial);
+    m_segmentCache->eraseLights(serial);
+    for (GenerateStep* step = m_steps; step; step = step->next){
+      if (step->key.lights == serial){
+        releaseStep(m_luaState,step);
+      }
+    }
+  }
+
   int System::getEnumCount()
   {
+    if (m_frozen){
+      return (int)m_frozen->enums.size();
+    }
+
     LuaState L = m_luaState;
     LuaStatePreserve preserve(L);
     lua_getfield(L,FXUSERENUMS,"count");
@@ -1212,6 +5022,11 @@ namespace luafxbuilder
 
   EnumID System::getEnum( const char* name )
   {
+    if (m_frozen){
+      int idx = Snapshot::lookup(m_frozen->enumLookup,m_names->find(name));
+      return idx < 0 ? 0 : (EnumID)(size_t)m_frozen->enumIDs[idx];
+    }
+
     LuaState L = m_luaState;
     LuaStatePreserve preserve(L);
     lua_getfield(L,FXUSERENUMS,"enums");
@@ -1228,6 +5043,10 @@ namespace luafxbuilder
 
   EnumID System::getEnum( int i )
   {
+    if (m_frozen){
+      return (i < 0 || i >= (int)m_frozen->enums.size()) ? 0 : (EnumID)(size_t)m_frozen->enumIDs[i];
+    }
+
     LuaState L = m_luaState;
     LuaStatePreserve preserve(L);
     lua_getfield(L,FXUSERENUMS,"enums");
@@ -1246,6 +5065,11 @@ namespace luafxbuilder
 
   EnumID System::getEnumFromValueName( const char* name )
   {
+    if (m_frozen){
+      int idx = Snapshot::lookup(m_frozen->enumValueLookup,m_names->find(name));
+      return idx < 0 ? 0 : (EnumID)(size_t)m_frozen->enumIDs[idx];
+    }
+
     LuaState L = m_luaState;
     LuaStatePreserve preserve(L);
     lua_getfield(L,FXUSERENUMS,"values");
@@ -1264,6 +5088,10 @@ namespace luafxbuilder
 
   int System::enumGetValueCount( EnumID enumtype )
   {
+    if (m_frozen){
+      return m_frozen->getEnum(enumtype).valueCount;
+    }
+
     LuaState L = m_luaState;
     LuaStateObjOperation op(L,(size_t)enumtype);
     lua_getfield(L,-1,"count");
@@ -1273,6 +5101,15 @@ namespace luafxbuilder
 
   int System::enumGetValueIndex( EnumID enumtype, const char* valuename )
   {
+    if (m_frozen){
+      const SnapshotEnum& enm = m_frozen->getEnum(enumtype);
+      unsigned int key = m_names->find(valuename);
+      for (unsigned int i = 0; key && i < enm.valueCount; i++){
+        if (m_frozen->enumValues[enm.valueFirst + i].name == key) return i;
+      }
+      return -1;
+    }
+
     LuaState L = m_luaState;
     LuaStateObjOperation op(L,(size_t)enumtype);
     lua_getfield(L,-1,"content");
@@ -1286,6 +5123,12 @@ namespace luafxbuilder
 
   int System::enumGetValue( EnumID enumtype, int i )
   {
+    if (m_frozen){
+      const SnapshotEnum& enm = m_frozen->getEnum(enumtype);
+      assert(i >= 0 && i < (int)enm.valueCount && "illegal index");
+      return m_frozen->enumValues[enm.valueFirst + i].value;
+    }
+
     LuaState L = m_luaState;
     LuaStateObjOperation op(L,(size_t)enumtype);
     lua_getfield(L,-1,"content");
@@ -0,0 +1,258 @@
+/*
+    Copyright (c) 2012, NVIDIA CORPORATION. All rights reserved.
+    Copyright (c) 2012, Christoph Kubisch. All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions
+    are met:
+     * Redistributions of source code must retain the above copyright
+       notice, this list of conditions and the following disclaimer.
+     * Neither the name of NVIDIA CORPORATION nor the names of its
+       contributors may be used to endorse or promote products derived
+       from this software without specific prior written permission.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ``AS IS'' AND ANY
+    EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+    PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+    CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+    EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+    PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+    PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+    OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+    (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+    OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+    Contact: Christoph Kubisch ckubisch@nvidia.com 
+*/
+
+#include <luafxbuilder/luafxbuilder_alloc.h>
+
+#include <vector>
+
+#include <stdlib.h>
+#include <string.h>
+
+namespace luafxbuilder
+{
+  // lua's small objects: strings and tables start at 20-40 bytes, closures,
+  // upvalues and short arrays stay well below 512
+  static const size_t s_classSizes[] = {16,32,48,64,80,96,112,128,160,192,224,256,320,384,448,512};
+
+  enum {
+    NUM_CLASSES     = sizeof(s_classSizes) / sizeof(s_classSizes[0]),
+    MAX_CLASS_SIZE  = 512,
+    PAGE_SIZE       = 64 * 1024,
+  };
+
+  struct AllocBlock {
+    AllocBlock*   next;
+  };
+
+  struct AllocState {
+    bool                pooled;
+    size_t              limit;
+    AllocatorStats      stats;
+    AllocBlock*         freelist[NUM_CLASSES];
+    AllocBlock*         reserve[NUM_CLASSES];   // shrinks out of malloc blocks
+    unsigned char       classOf[MAX_CLASS_SIZE / 16 + 1];  // by size in 16 byte steps
+    std::vector<void*>  pages;
+  };
+
+  // -1 for blocks served by malloc
+  static inline int sizeClass(const AllocState* state, size_t size)
+  {
+    if (!state->pooled || size > MAX_CLASS_SIZE){
+      return -1;
+    }
+    return state->classOf[(size + 15) / 16];
+  }
+
+  static void* allocBlock(AllocState* state, int cls, size_t size)
+  {
+    if (cls < 0){
+      return malloc(size);
+    }
+
+    AllocBlock* block = state->freelist[cls];
+    if (!block){
+      char* page = (char*)malloc(PAGE_SIZE);
+      if (!page){
+        return NULL;
+      }
+      state->pages.push_back(page);
+      state->stats.reserved += PAGE_SIZE;
+
+      size_t blocksize = s_classSizes[cls];
+      size_t count = PAGE_SIZE / blocksize;
+      for (size_t i = 0; i < count; i++){
+        AllocBlock* entry = (AllocBlock*)(page + i * blocksize);
+        entry->next = block;
+        block = entry;
+      }
+    }
+    state->freelist[cls] = block->next;
+    return block;
+  }
+
+  static void freeBlock(AllocState* state, int cls, void* ptr)
+  {
+    if (cls < 0){
+      free(ptr);
+      return;
+    }
+
+    AllocBlock* block = (AllocBlock*)ptr;
+    if (!state->reserve[cls]){
+      state->reserve[cls] = block;
+      return;
+    }
+    block->next = state->freelist[cls];
+    state->freelist[cls] = block;
+  }
+
+  error PoolAllocator::init( size_t limit, bool pooled )
+  {
+    m_state = new AllocState;
+    m_state->pooled = pooled;
+    m_state->limit  = limit;
+    memset(&m_state->stats,0,sizeof(AllocatorStats));
+    memset(m_state->freelist,0,sizeof(m_state->freelist));
+    memset(m_state->reserve,0,sizeof(m_state->reserve));
+
+    int cls = 0;
+    for (size_t i = 0; i <= MAX_CLASS_SIZE / 16; i++){
+      while (s_classSizes[cls] < i * 16){
+        cls++;
+      }
+      m_state->classOf[i] = (unsigned char)cls;
+    }
+
+    // one block per class, so a malloc block can always shrink into a class
+    if (pooled){
+      size_t size = 0;
+      for (int i = 0; i < NUM_CLASSES; i++){
+        size += s_classSizes[i];
+      }
+      char* page = (char*)malloc(size);
+      if (!page){
+        delete m_state;
+        m_state = NULL;
+        return true;
+      }
+      m_state->pages.push_back(page);
+      m_state->stats.reserved += size;
+      for (int i = 0; i < NUM_CLASSES; i++){
+        m_state->reserve[i] = (AllocBlock*)page;
+        page += s_classSizes[i];
+      }
+    }
+    return false;
+  }
+
+  void PoolAllocator::deinit()
+  {
+    if (!m_state){
+      return;
+    }
+    for (size_t i = 0; i < m_state->pages.size(); i++){
+      free(m_state->pages[i]);
+    }
+    delete m_state;
+    m_state = NULL;
+  }
+
+  void PoolAllocator::setLimit( size_t limit )
+  {
+    m_state->limit = limit;
+  }
+
+  void PoolAllocator::getStats( AllocatorStats* stats )
+  {
+    *stats = m_state->stats;
+  }
+
+  void PoolAllocator::resetStats()
+  {
+    AllocatorStats& stats = m_state->stats;
+    stats.allocs    = 0;
+    stats.frees     = 0;
+    stats.reallocs  = 0;
+    stats.failures  = 0;
+    stats.peak      = stats.current;
+  }
+
+  void* PoolAllocator::alloc( void* ud, void* ptr, size_t osize, size_t nsize )
+  {
+    AllocState* state = ((PoolAllocator*)ud)->m_state;
+    AllocatorStats& stats = state->stats;
+    if (!ptr){
+      osize = 0;
+    }
+
+    if (nsize == 0){
+      if (ptr){
+        freeBlock(state,sizeClass(state,osize),ptr);
+        stats.frees++;
+        stats.current -= osize;
+        stats.large   -= osize > MAX_CLASS_SIZE ? 1 : 0;
+      }
+      return NULL;
+    }
+
+    // lua expects shrinking to always succeed
+    if (nsize > osize && state->limit && stats.current - osize + nsize > state->limit){
+      stats.failures++;
+      return NULL;
+    }
+
+    int ncls = sizeClass(state,nsize);
+    void* block;
+    if (!ptr){
+      block = allocBlock(state,ncls,nsize);
+      if (!block){
+        stats.failures++;
+        return NULL;
+      }
+      stats.allocs++;
+    }
+    else{
+      int ocls = sizeClass(state,osize);
+      if (ocls >= 0 && ocls == ncls){
+        block = ptr;
+      }
+      else if (ocls < 0 && ncls < 0){
+        block = realloc(ptr,nsize);
+      }
+      else{
+        block = allocBlock(state,ncls,nsize);
+        if (!block && ocls < 0){
+          block = state->reserve[ncls];
+          state->reserve[ncls] = NULL;
+        }
+        if (block){
+          memcpy(block,ptr,osize < nsize ? osize : nsize);
+          freeBlock(state,ocls,ptr);
+        }
+      }
+      if (!block){
+        // a malloc block must not end up in a free list
+        if (nsize > osize || ocls < 0){
+          stats.failures++;
+          return NULL;
+        }
+        // the old block is large enough to serve the smaller class
+        block = ptr;
+      }
+      stats.reallocs++;
+      stats.large -= osize > MAX_CLASS_SIZE ? 1 : 0;
+    }
+
+    stats.current += nsize - osize;
+    stats.large   += nsize > MAX_CLASS_SIZE ? 1 : 0;
+    if (stats.current > stats.peak){
+      stats.peak = stats.current;
+    }
+    return block;
+  }
+}
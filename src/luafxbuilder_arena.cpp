@@ -0,0 +1,247 @@
+/*
+    Copyright (c) 2012, NVIDIA CORPORATION. All rights reserved.
+    Copyright (c) 2012, Christoph Kubisch. All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions
+    are met:
+     * Redistributions of source code must retain the above copyright
+       notice, this list of conditions and the following disclaimer.
+     * Neither the name of NVIDIA CORPORATION nor the names of its
+       contributors may be used to endorse or promote products derived
+       from this software without specific prior written permission.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ``AS IS'' AND ANY
+    EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+    PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+    CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+    EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+    PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+    PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+    OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+    (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+    OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+    Contact: Christoph Kubisch ckubisch@nvidia.com 
+*/
+
+#include <luafxbuilder/luafxbuilder_arena.h>
+
+#include <algorithm>
+
+#include <assert.h>
+#include <string.h>
+
+namespace luafxbuilder
+{
+  // default and smallest capacity after growing
+  static const int MIN_CAPACITY = 64;
+
+  error InstanceArena::init( System& system, GroupID group, GeneratorType gentype, int capacity )
+  {
+    int count = system.groupGetParameterCount(group);
+    m_storage.resize(count + 1);
+    m_storageType = system.groupGenerateStorage(group,gentype,count + 1,&m_storage[0]);
+    m_stride      = m_storage[count].stride;
+    m_capacity    = 0;
+    m_count       = 0;
+    m_grown       = false;
+    bool indexed = m_storageType == STORAGE_UNIFORMBUFFER_INDEXED ||
+                   m_storageType == STORAGE_STORAGEBUFFER_INDEXED ||
+                   m_storageType == STORAGE_NVLOADBUFFER_INDEXED;
+    if (!indexed || !m_stride){
+      m_storage.clear();
+      return true;
+    }
+
+    m_defaults.resize(m_stride,0);
+    system.groupBuildDefaultBlock(group,gentype,m_defaults.size(),&m_defaults[0]);
+
+    grow(capacity > 0 ? capacity : MIN_CAPACITY);
+    m_grown = false;
+    return false;
+  }
+
+  void InstanceArena::deinit()
+  {
+    m_storage.clear();
+    m_defaults.clear();
+    m_data.clear();
+    m_free.clear();
+    m_used.clear();
+    m_dirty.clear();
+    m_dirtyList.clear();
+    m_stride    = 0;
+    m_capacity  = 0;
+    m_count     = 0;
+  }
+
+  void InstanceArena::grow( int capacity )
+  {
+    int old = m_capacity;
+    m_data.resize(m_stride * capacity,0);
+    m_used.resize(capacity,0);
+    Dirty clean = {0,0};
+    m_dirty.resize(capacity,clean);
+    m_capacity  = capacity;
+    m_grown     = true;
+
+    // lowest indices are handed out first
+    for (int i = capacity - 1; i >= old; i--){
+      m_free.push_back(i);
+    }
+  }
+
+  StorageType InstanceArena::getStorageType()
+  {
+    return m_storageType;
+  }
+
+  size_t InstanceArena::getStride()
+  {
+    return m_stride;
+  }
+
+  int InstanceArena::getParameterCount()
+  {
+    return m_storage.empty() ? 0 : (int)m_storage.size() - 1;
+  }
+
+  int InstanceArena::getCapacity()
+  {
+    return m_capacity;
+  }
+
+  int InstanceArena::getCount()
+  {
+    return m_count;
+  }
+
+  int InstanceArena::allocInstance()
+  {
+    if (m_storage.empty()){
+      return -1;
+    }
+    if (m_free.empty()){
+      grow(std::max(m_capacity * 2, (int)MIN_CAPACITY));
+    }
+    int instance = m_free.back();
+    m_free.pop_back();
+    m_used[instance] = 1;
+    m_count++;
+
+    memcpy(&m_data[m_stride * instance],&m_defaults[0],m_stride);
+    markDirty(instance,0,m_stride);
+    return instance;
+  }
+
+  void InstanceArena::freeInstance( int instance )
+  {
+    assert(instance >= 0 && instance < m_capacity && m_used[instance] && "illegal instance");
+    m_used[instance] = 0;
+    m_count--;
+    m_free.push_back(instance);
+  }
+
+  void InstanceArena::setParameter( int instance, int param, const void* data, size_t datasize )
+  {
+    assert(instance >= 0 && instance < m_capacity && m_used[instance] && "illegal instance");
+    assert(param >= 0 && param < getParameterCount() && "illegal parameter");
+    const ParameterStorage& store = m_storage[param];
+    if (!store.size || !store.stride){
+      return;
+    }
+
+    // one chunk per array element and matrix column
+    unsigned char*        dst = &m_data[m_stride * instance + store.offset];
+    const unsigned char*  src = (const unsigned char*)data;
+    size_t chunks = store.size / store.stride;
+    for (size_t c = 0; c < chunks && (c + 1) * store.element <= datasize; c++){
+      memcpy(dst + c * store.stride, src + c * store.element, store.element);
+    }
+    markDirty(instance,store.offset,store.size);
+  }
+
+  void* InstanceArena::getInstanceData( int instance )
+  {
+    assert(instance >= 0 && instance < m_capacity && "illegal instance");
+    return &m_data[m_stride * instance];
+  }
+
+  void InstanceArena::markDirty( int instance, size_t offset, size_t size )
+  {
+    assert(offset + size <= m_stride);
+    if (!size){
+      return;
+    }
+    Dirty& dirty = m_dirty[instance];
+    if (dirty.begin == dirty.end){
+      dirty.begin = offset;
+      dirty.end   = offset + size;
+      m_dirtyList.push_back(instance);
+    }
+    else{
+      dirty.begin = std::min(dirty.begin,offset);
+      dirty.end   = std::max(dirty.end,offset + size);
+    }
+  }
+
+  const void* InstanceArena::getData()
+  {
+    return m_data.empty() ? NULL : &m_data[0];
+  }
+
+  size_t InstanceArena::getDataSize()
+  {
+    return m_data.size();
+  }
+
+  bool InstanceArena::hasGrown()
+  {
+    return m_grown;
+  }
+
+  int InstanceArena::getUploadRanges( UploadRange* ranges, int maxranges, size_t mergeGap )
+  {
+    std::sort(m_dirtyList.begin(),m_dirtyList.end());
+
+    int num = 0;
+    UploadRange current = {0,0};
+    for (size_t i = 0; i < m_dirtyList.size(); i++){
+      int instance = m_dirtyList[i];
+      const Dirty& dirty = m_dirty[instance];
+      size_t begin = m_stride * instance + dirty.begin;
+      size_t end   = m_stride * instance + dirty.end;
+
+      if (current.size && begin <= current.offset + current.size + mergeGap){
+        current.size = std::max(current.offset + current.size, end) - current.offset;
+        continue;
+      }
+      if (current.size){
+        if (ranges && num < maxranges) ranges[num] = current;
+        num++;
+      }
+      current.offset  = begin;
+      current.size    = end - begin;
+    }
+    if (current.size){
+      if (ranges && num < maxranges) ranges[num] = current;
+      num++;
+    }
+
+    return ranges ? std::min(num,maxranges) : num;
+  }
+
+  void InstanceArena::clearDirty()
+  {
+    for (size_t i = 0; i < m_dirtyList.size(); i++){
+      Dirty& dirty = m_dirty[m_dirtyList[i]];
+      dirty.begin = 0;
+      dirty.end   = 0;
+    }
+    m_dirtyList.clear();
+    m_grown = false;
+  }
+}
+
@@ -0,0 +1,598 @@
+/*
+    Copyright (c) 2012, NVIDIA CORPORATION. All rights reserved.
+    Copyright (c) 2012, Christoph Kubisch. All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions
+    are met:
+     * Redistributions of source code must retain the above copyright
+       notice, this list of conditions and the following disclaimer.
+     * Neither the name of NVIDIA CORPORATION nor the names of its
+       contributors may be used to endorse or promote products derived
+       from this software without specific prior written permission.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ``AS IS'' AND ANY
+    EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+    PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+    CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+    EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+    PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+    PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+    OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+    (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+    OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+    Contact: Christoph Kubisch ckubisch@nvidia.com 
+*/
+
+#include <luafxbuilder/luafxbuilder_draw.h>
+
+#include <algorithm>
+
+#include <assert.h>
+#include <string.h>
+
+namespace luafxbuilder
+{
+  enum {
+    DRAW_TUPLE = DRAW_MAXGROUPS * 2 + 2, // program, geometry and material bases, world
+  };
+
+  static inline unsigned int hashInts(const int* values, int count)
+  {
+    unsigned int h = 2166136261u;
+    for (int i = 0; i < count; i++){
+      h = (h ^ (unsigned int)values[i]) * 16777619u;
+    }
+    return h ^ (h >> 15);
+  }
+
+  static inline unsigned int hashPair(size_t a, size_t b)
+  {
+    unsigned long long h = ((unsigned long long)a * 0x9E3779B97F4A7C15ULL) ^ (unsigned long long)b;
+    h = (h ^ (h >> 29)) * 0xBF58476D1CE4E5B9ULL;
+    return (unsigned int)(h ^ (h >> 32));
+  }
+
+  static inline unsigned long long hashBytes(unsigned long long h, const char* data, size_t size)
+  {
+    for (size_t i = 0; i < size; i++){
+      h = (h ^ (unsigned char)data[i]) * 0x100000001B3ULL;
+    }
+    return h;
+  }
+
+  // dense id of a non-zero value, slots of the hash table hold id + 1
+  static unsigned int getDenseId(std::vector<unsigned long long>& values, std::vector<unsigned int>& ids,
+    unsigned int& count, unsigned long long value)
+  {
+    size_t mask = ids.size() - 1;
+    size_t slot = hashPair((size_t)value,(size_t)(value >> 32)) & mask;
+    while (ids[slot]){
+      if (values[slot] == value) return ids[slot] - 1;
+      slot = (slot + 1) & mask;
+    }
+    values[slot] = value;
+    ids[slot]    = ++count;
+
+    if (count * 2 > ids.size()){
+      std::vector<unsigned long long> newValues(values.size() * 2, 0);
+      std::vector<unsigned int>       newIds(ids.size() * 2, 0);
+      mask = newIds.size() - 1;
+      for (size_t i = 0; i < ids.size(); i++){
+        if (!ids[i]) continue;
+        size_t s = hashPair((size_t)values[i],(size_t)(values[i] >> 32)) & mask;
+        while (newIds[s]) s = (s + 1) & mask;
+        newValues[s]  = values[i];
+        newIds[s]     = ids[i];
+      }
+      values.swap(newValues);
+      ids.swap(newIds);
+    }
+    return count - 1;
+  }
+
+  //////////////////////////////////////////////////////////////////////////
+
+  error SortKeyTable::init( System& system )
+  {
+    m_system      = &system;
+    m_numPrograms = 0;
+    m_numBindings = 0;
+    for (int i = 0; i < NUM_GENERERATORS; i++){
+      m_keys[i].clear();
+    }
+    m_programs.assign(64, 0);
+    m_programIds.assign(64, 0);
+    m_bindings.assign(64, 0);
+    m_bindingIds.assign(64, 0);
+    return false;
+  }
+
+  void SortKeyTable::deinit()
+  {
+    m_system = NULL;
+    for (int i = 0; i < NUM_GENERERATORS; i++){
+      std::vector<SortKey>().swap(m_keys[i]);
+    }
+    std::vector<unsigned long long>().swap(m_programs);
+    std::vector<unsigned int>().swap(m_programIds);
+    std::vector<unsigned long long>().swap(m_bindings);
+    std::vector<unsigned int>().swap(m_bindingIds);
+  }
+
+  error SortKeyTable::getKey( TechID tech, GeneratorType gentype, SortKey* key )
+  {
+      // all bits set is never a key, user bits stay zero
+    const SortKey unset = ~0ULL;
+    size_t idx = (size_t)tech;
+    std::vector<SortKey>& keys = m_keys[gentype];
+    if (idx < keys.size() && keys[idx] != unset){
+      *key = keys[idx];
+      return false;
+    }
+
+    EffectID effect = m_system->techniqueGetEffect(tech);
+    if (!effect) return true;
+
+      // program from the content of all outputs
+    unsigned long long program = 0xcbf29ce484222325ULL;
+    int codes = m_system->techniqueGetCodeCount(tech);
+    for (int i = 0; i < codes; i++){
+      CodeHash hash;
+      if (m_system->techniqueGenerateCodeHash(tech,gentype,i,&hash,NULL)) return true;
+      program = (program ^ hash) * 0x100000001B3ULL;
+      program ^= program >> 31;
+    }
+
+      // storage names of shared groups, storage types of instanced groups
+    unsigned long long binding  = 0xcbf29ce484222325ULL;
+    unsigned int       storages = 0;
+    std::vector<char>  name;
+    int groups = m_system->effectGetGroupCount(effect);
+    for (int i = 0; i < groups; i++){
+      GroupID group = m_system->effectGetGroup(effect,i);
+      if (m_system->groupGetType(group) == GROUP_INSTANCED){
+        storages |= 1 << m_system->groupGenerateStorage(group,gentype,0,NULL);
+      }
+      else {
+        size_t size = m_system->groupGenerateStorageName(group,gentype,NULL,0);
+        name.resize(size + 1);
+        size = m_system->groupGenerateStorageName(group,gentype,&name[0],size);
+        binding = hashBytes(binding,&name[0],size);
+        binding = (binding ^ ';') * 0x100000001B3ULL;
+      }
+    }
+
+    unsigned int programId = getDenseId(m_programs,m_programIds,m_numPrograms,program ? program : 1);
+    unsigned int bindingId = getDenseId(m_bindings,m_bindingIds,m_numBindings,binding ? binding : 1);
+    if (programId >> (SORTKEY_STORAGE_SHIFT - SORTKEY_PROGRAM_SHIFT) ||
+        bindingId >> (SORTKEY_PROGRAM_SHIFT - SORTKEY_BINDING_SHIFT))
+    {
+      return true;
+    }
+
+    if (idx >= keys.size()){
+      keys.resize(idx + 1, unset);
+    }
+    keys[idx] = ((SortKey)storages  << SORTKEY_STORAGE_SHIFT) |
+                ((SortKey)programId << SORTKEY_PROGRAM_SHIFT) |
+                ((SortKey)bindingId << SORTKEY_BINDING_SHIFT);
+    *key = keys[idx];
+    return false;
+  }
+
+  int SortKeyTable::getProgramCount()
+  {
+    return (int)m_numPrograms;
+  }
+
+  int SortKeyTable::getBindingCount()
+  {
+    return (int)m_numBindings;
+  }
+
+  //////////////////////////////////////////////////////////////////////////
+
+  void RadixSorter::sort( const SortKey* keys, int count )
+  {
+    m_keys.assign(keys,keys + count);
+    m_order.resize(count);
+    for (int i = 0; i < count; i++){
+      m_order[i] = i;
+    }
+    if (count < 2) return;
+
+    unsigned int histograms[8][256];
+    memset(histograms,0,sizeof(histograms));
+    for (int i = 0; i < count; i++){
+      SortKey key = keys[i];
+      for (int d = 0; d < 8; d++){
+        histograms[d][(key >> (d * 8)) & 0xFF]++;
+      }
+    }
+
+    m_keysTemp.resize(count);
+    m_orderTemp.resize(count);
+    for (int d = 0; d < 8; d++){
+      unsigned int* histogram = histograms[d];
+      int shift = d * 8;
+      if (histogram[(keys[0] >> shift) & 0xFF] == (unsigned int)count) continue;
+
+      unsigned int offset = 0;
+      for (int b = 0; b < 256; b++){
+        unsigned int num = histogram[b];
+        histogram[b] = offset;
+        offset += num;
+      }
+      const SortKey*      srcKeys = &m_keys[0];
+      const unsigned int* srcVals = &m_order[0];
+      SortKey*            dstKeys = &m_keysTemp[0];
+      unsigned int*       dstVals = &m_orderTemp[0];
+      for (int i = 0; i < count; i++){
+        unsigned int pos = histogram[(srcKeys[i] >> shift) & 0xFF]++;
+        dstKeys[pos] = srcKeys[i];
+        dstVals[pos] = srcVals[i];
+      }
+      m_keys.swap(m_keysTemp);
+      m_order.swap(m_orderTemp);
+    }
+  }
+
+  void RadixSorter::deinit()
+  {
+    std::vector<SortKey>().swap(m_keys);
+    std::vector<SortKey>().swap(m_keysTemp);
+    std::vector<unsigned int>().swap(m_order);
+    std::vector<unsigned int>().swap(m_orderTemp);
+  }
+
+  int RadixSorter::getCount()
+  {
+    return (int)m_keys.size();
+  }
+
+  const SortKey* RadixSorter::getKeys()
+  {
+    return m_keys.empty() ? NULL : &m_keys[0];
+  }
+
+  const unsigned int* RadixSorter::getOrder()
+  {
+    return m_order.empty() ? NULL : &m_order[0];
+  }
+
+  //////////////////////////////////////////////////////////////////////////
+
+  static inline void resolveBases(const DrawTechInfo& info, const int* instances, int* bases)
+  {
+    for (int i = 0; i < DRAW_MAXGROUPS; i++){
+      bases[i] = instances[i] & info.baseMasks[i];
+    }
+  }
+
+  static inline void resolveStreams(const DrawTechInfo& info, const int* instances, int* streams)
+  {
+    streams[0] = instances[info.streamGroups[0]] & info.streamMasks[0];
+    streams[1] = instances[info.streamGroups[1]] & info.streamMasks[1];
+  }
+
+  inline bool DrawBatcher::isPrepared( TechID tech )
+  {
+    size_t idx = (size_t)tech;
+    return idx < m_techs.size() && m_techs[idx].valid;
+  }
+
+  error DrawBatcher::init( System& system, GeneratorType gentype )
+  {
+    m_system      = &system;
+    m_gentype     = gentype;
+    m_numPrograms = 0;
+    m_techs.clear();
+    m_programs.assign(2 * 64, 0);
+    m_programIds.assign(64, 0);
+    m_programBatches.clear();
+    m_tuples.clear();
+    m_tupleSlots.assign(64, 0);
+    return false;
+  }
+
+  void DrawBatcher::deinit()
+  {
+    m_system = NULL;
+    std::vector<DrawTechInfo>().swap(m_techs);
+    std::vector<unsigned long long>().swap(m_programs);
+    std::vector<unsigned int>().swap(m_programIds);
+    std::vector<int>().swap(m_tuples);
+    std::vector<unsigned int>().swap(m_tupleSlots);
+    std::vector<unsigned int>().swap(m_programBatches);
+    std::vector<unsigned int>().swap(m_drawBatches);
+    std::vector<unsigned int>().swap(m_batchFirst);
+    std::vector<unsigned int>().swap(m_batchOffsets);
+    std::vector<SortKey>().swap(m_keys);
+    m_sorter.deinit();
+    std::vector<DrawCommand>().swap(m_commands);
+    std::vector<DrawIndices>().swap(m_indices);
+    std::vector<DrawBatch>().swap(m_batches);
+  }
+
+  error DrawBatcher::prepareTech( TechID tech )
+  {
+    size_t idx = (size_t)tech;
+    if (!idx) return true;
+    if (idx >= m_techs.size()){
+      DrawTechInfo empty;
+      memset(&empty,0,sizeof(empty));
+      m_techs.resize(idx + 1, empty);
+    }
+    DrawTechInfo& info = m_techs[idx];
+    if (info.valid) return false;
+    memset(&info,0,sizeof(info));
+
+    EffectID effect = m_system->techniqueGetEffect(tech);
+    if (!effect) return true;
+
+    int count     = m_system->effectGetGroupCount(effect);
+    int instanced = 0;
+    int streams   = 0;
+      // world matrices are uniforms
+    info.bound    = m_gentype == GENERATOR_GLSL_UNIFORM;
+    for (int i = 0; i < count; i++){
+      GroupID group = m_system->effectGetGroup(effect,i);
+      if (m_system->groupGetType(group) != GROUP_INSTANCED) continue;
+      if (instanced == DRAW_MAXGROUPS) return true;
+
+      switch (m_system->groupGenerateStorage(group,m_gentype,0,NULL)){
+      case STORAGE_UNIFORMBUFFER_INDEXED:
+          // arrays of GENERATOR_UBO_MAXGROUPS, the batch binds the window
+        if (streams == 2) return true;
+        info.bound = true;
+        info.baseMasks[instanced]     = ~(GENERATOR_UBO_MAXGROUPS - 1);
+        info.streamGroups[streams]    = instanced;
+        info.streamMasks[streams++]   = GENERATOR_UBO_MAXGROUPS - 1;
+        break;
+      case STORAGE_STORAGEBUFFER_INDEXED:
+      case STORAGE_NVLOADBUFFER_INDEXED:
+          // generators only index buffered groups
+        if (streams == 2) return true;
+        info.streamGroups[streams]    = instanced;
+        info.streamMasks[streams++]   = ~0;
+        break;
+      case STORAGE_NONE:
+        return true;
+      default:
+          // uniforms, the batch binds the instance
+        info.bound = true;
+        info.baseMasks[instanced]     = ~0;
+        break;
+      }
+      instanced++;
+    }
+    info.valid = true;
+    return false;
+  }
+
+  unsigned int DrawBatcher::getProgram( TechID geometry, TechID material )
+  {
+    size_t mask = m_programIds.size() - 1;
+    size_t slot = hashPair((size_t)geometry,(size_t)material) & mask;
+    unsigned long long geo = (size_t)geometry;
+    unsigned long long mat = (size_t)material;
+    while (m_programs[slot * 2]){
+      if (m_programs[slot * 2] == geo && m_programs[slot * 2 + 1] == mat){
+        return m_programIds[slot];
+      }
+      slot = (slot + 1) & mask;
+    }
+    m_programs[slot * 2]      = geo;
+    m_programs[slot * 2 + 1]  = mat;
+    m_programIds[slot]        = m_numPrograms++;
+
+    if (m_numPrograms * 2 > m_programIds.size()){
+      std::vector<unsigned long long> programs(m_programs.size() * 2, 0);
+      std::vector<unsigned int>       ids(m_programIds.size() * 2, 0);
+      mask = ids.size() - 1;
+      for (size_t i = 0; i < m_programIds.size(); i++){
+        if (!m_programs[i * 2]) continue;
+        size_t s = hashPair((size_t)m_programs[i * 2],(size_t)m_programs[i * 2 + 1]) & mask;
+        while (programs[s * 2]) s = (s + 1) & mask;
+        programs[s * 2]     = m_programs[i * 2];
+        programs[s * 2 + 1] = m_programs[i * 2 + 1];
+        ids[s] = m_programIds[i];
+      }
+      m_programs.swap(programs);
+      m_programIds.swap(ids);
+    }
+    return m_numPrograms - 1;
+  }
+
+  unsigned int DrawBatcher::addBatch( unsigned int program, unsigned int draw )
+  {
+    unsigned int batch = (unsigned int)m_batchFirst.size();
+    m_batchFirst.push_back(draw);
+    m_batchOffsets.push_back(0);
+    m_keys.push_back(((SortKey)program << 32) | batch);
+    return batch;
+  }
+
+  unsigned int DrawBatcher::getBatch( const int* tuple, unsigned int draw )
+  {
+      // entries are the tuple followed by the batch, slots hold entry + 1
+    const size_t stride = DRAW_TUPLE + 1;
+    size_t mask = m_tupleSlots.size() - 1;
+    size_t slot = hashInts(tuple,DRAW_TUPLE) & mask;
+    while (m_tupleSlots[slot]){
+      const int* entry = &m_tuples[(m_tupleSlots[slot] - 1) * stride];
+      if (memcmp(entry,tuple,sizeof(int) * DRAW_TUPLE) == 0){
+        return (unsigned int)entry[DRAW_TUPLE];
+      }
+      slot = (slot + 1) & mask;
+    }
+    unsigned int batch = addBatch((unsigned int)tuple[0],draw);
+    m_tuples.insert(m_tuples.end(),tuple,tuple + DRAW_TUPLE);
+    m_tuples.push_back((int)batch);
+    unsigned int entries = (unsigned int)(m_tuples.size() / stride);
+    m_tupleSlots[slot] = entries;
+
+    if (entries * 2 > m_tupleSlots.size()){
+      m_tupleSlots.assign(m_tupleSlots.size() * 2, 0);
+      mask = m_tupleSlots.size() - 1;
+      for (unsigned int i = 0; i < entries; i++){
+        size_t s = hashInts(&m_tuples[i * stride],DRAW_TUPLE) & mask;
+        while (m_tupleSlots[s]) s = (s + 1) & mask;
+        m_tupleSlots[s] = i + 1;
+      }
+    }
+    return batch;
+  }
+
+  error DrawBatcher::build( const DrawInput* draws, int numDraws )
+  {
+    m_batches.clear();
+    m_batchFirst.clear();
+    m_batchOffsets.clear();
+    m_keys.clear();
+    if (!m_tuples.empty()){
+      std::fill(m_tupleSlots.begin(),m_tupleSlots.end(),0);
+      m_tuples.clear();
+    }
+      // hold batch + 1 of programs without bindings
+    std::fill(m_programBatches.begin(),m_programBatches.end(),0);
+    m_drawBatches.resize(numDraws);
+
+      // assign batches in draw order, consecutive draws of the same state
+      // skip the lookups. Generators with world matrix uniforms only merge
+      // consecutive draws.
+    bool                uniforms = m_gentype == GENERATOR_GLSL_UNIFORM;
+    const DrawTechInfo* geo = NULL;
+    const DrawTechInfo* mat = NULL;
+    unsigned int        program = 0;
+    unsigned int        batch   = 0;
+    bool                bound   = false;
+    int                 tuple[DRAW_TUPLE];
+    int                 lastTuple[DRAW_TUPLE];
+    unsigned int*       drawBatches = numDraws ? &m_drawBatches[0] : NULL;
+    for (int i = 0; i < numDraws; i++){
+      const DrawInput& draw = draws[i];
+      bool same = i > 0 && draw.geometry == draws[i - 1].geometry && draw.material == draws[i - 1].material;
+      if (!same){
+        if ((!isPrepared(draw.geometry) && prepareTech(draw.geometry)) ||
+            (!isPrepared(draw.material) && prepareTech(draw.material))){
+          m_commands.clear();
+          m_indices.clear();
+          m_drawBatches.clear();
+          m_batchFirst.clear();
+          m_batchOffsets.clear();
+          m_keys.clear();
+          return true;
+        }
+        geo     = &m_techs[(size_t)draw.geometry];
+        mat     = &m_techs[(size_t)draw.material];
+        bound   = geo->bound || mat->bound;
+        program = getProgram(draw.geometry,draw.material);
+        if (program >= m_programBatches.size()){
+          m_programBatches.resize(program + 1, 0);
+        }
+      }
+
+      if (!bound){
+        if (!same){
+          unsigned int& slot = m_programBatches[program];
+          if (!slot) slot = addBatch(program,i) + 1;
+          batch = slot - 1;
+        }
+      }
+      else {
+        tuple[0] = (int)program;
+        resolveBases(*geo,draw.geometryInstances,tuple + 1);
+        resolveBases(*mat,draw.materialInstances,tuple + 1 + DRAW_MAXGROUPS);
+        tuple[DRAW_TUPLE - 1] = uniforms ? draw.world : -1;
+        if (!same || memcmp(tuple,lastTuple,sizeof(tuple))){
+          batch = uniforms ? addBatch(program,i) : getBatch(tuple,i);
+          memcpy(lastTuple,tuple,sizeof(tuple));
+        }
+      }
+      drawBatches[i] = batch;
+    }
+
+    unsigned int* offsets = m_batchFirst.empty() ? NULL : &m_batchOffsets[0];
+    for (int i = 0; i < numDraws; i++){
+      offsets[drawBatches[i]]++;
+    }
+
+      // batches of a program are adjacent, in order of their first draw
+    int numBatches = (int)m_keys.size();
+    m_sorter.sort(numBatches ? &m_keys[0] : NULL,numBatches);
+    const unsigned int* order = m_sorter.getOrder();
+    m_batches.resize(numBatches);
+    unsigned int offset = 0;
+    for (int i = 0; i < numBatches; i++){
+      unsigned int      cur   = order[i];
+      unsigned int      count = m_batchOffsets[cur];
+      const DrawInput&  draw  = draws[m_batchFirst[cur]];
+      DrawBatch&        out   = m_batches[i];
+      out.geometry      = draw.geometry;
+      out.material      = draw.material;
+      out.firstCommand  = (int)offset;
+      out.numCommands   = (int)count;
+      resolveBases(m_techs[(size_t)draw.geometry],draw.geometryInstances,out.geometryBase);
+      resolveBases(m_techs[(size_t)draw.material],draw.materialInstances,out.materialBase);
+      out.world         = uniforms ? draw.world : -1;
+      m_batchOffsets[cur] = offset;
+      offset += count;
+    }
+
+      // scatter draws to their batch, reads stay sequential
+    m_commands.resize(numDraws);
+    m_indices.resize(numDraws);
+    DrawCommand*  commands = numDraws ? &m_commands[0] : NULL;
+    DrawIndices*  indices  = numDraws ? &m_indices[0] : NULL;
+    const DrawTechInfo* techs = m_techs.empty() ? NULL : &m_techs[0];
+    for (int i = 0; i < numDraws; i++){
+      const DrawInput& draw = draws[i];
+      geo = techs + (size_t)draw.geometry;
+      mat = techs + (size_t)draw.material;
+      unsigned int pos = offsets[drawBatches[i]]++;
+
+      DrawCommand& cmd  = commands[pos];
+      cmd.count         = draw.count;
+      cmd.instanceCount = 1;
+      cmd.firstIndex    = draw.firstIndex;
+      cmd.baseVertex    = draw.baseVertex;
+      cmd.baseInstance  = pos;
+
+      DrawIndices& idx  = indices[pos];
+      idx.world         = draw.world;
+      resolveStreams(*geo,draw.geometryInstances,idx.geometryGroups);
+      resolveStreams(*mat,draw.materialInstances,idx.materialGroups);
+    }
+
+    return false;
+  }
+
+  int DrawBatcher::getBatchCount()
+  {
+    return (int)m_batches.size();
+  }
+
+  const DrawBatch* DrawBatcher::getBatches()
+  {
+    return m_batches.empty() ? NULL : &m_batches[0];
+  }
+
+  int DrawBatcher::getCommandCount()
+  {
+    return (int)m_commands.size();
+  }
+
+  const DrawCommand* DrawBatcher::getCommands()
+  {
+    return m_commands.empty() ? NULL : &m_commands[0];
+  }
+
+  const DrawIndices* DrawBatcher::getIndices()
+  {
+    return m_indices.empty() ? NULL : &m_indices[0];
+  }
+}
@@ -0,0 +1,310 @@
+/*
+    Copyright (c) 2012, NVIDIA CORPORATION. All rights reserved.
+    Copyright (c) 2012, Christoph Kubisch. All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions
+    are met:
+     * Redistributions of source code must retain the above copyright
+       notice, this list of conditions and the following disclaimer.
+     * Neither the name of NVIDIA CORPORATION nor the names of its
+       contributors may be used to endorse or promote products derived
+       from this software without specific prior written permission.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ``AS IS'' AND ANY
+    EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+    PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+    CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+    EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+    PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+    PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+    OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+    (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+    OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+    Contact: Christoph Kubisch ckubisch@nvidia.com 
+*/
+
+#include <luafxbuilder/luafxbuilder_pool.h>
+#include "luafxbuilder_thread.h"
+
+#include <vector>
+#include <map>
+
+#include <assert.h>
+#include <string.h>
+#include <stdlib.h>
+
+namespace luafxbuilder
+{
+  enum PoolTask {
+    POOLTASK_INIT,
+    POOLTASK_FILE,
+    POOLTASK_STRING,
+    POOLTASK_GENERATE,
+  };
+
+  struct PoolWorker {
+    System        system;
+    Thread        thread;
+    int           index;
+    error         failed;
+
+    // task arguments, shared by all workers of a run
+    PoolTask      task;
+    const char*   str;
+    size_t        strSize;
+    CodeJob*      jobs;
+    PoolWorker*   workers;
+    int           numWorkers;
+
+    // remaining job range, other workers steal from its end
+    Mutex         mutex;
+    int           begin;
+    int           end;
+    int           failedJob;
+    std::vector<char> failedError;
+
+    bool popJob(int& job)
+    {
+      MutexLock lock(mutex);
+      if (begin < end){
+        job = begin++;
+        return true;
+      }
+      return false;
+    }
+
+    bool stealJob(int& job)
+    {
+      for (int i = 1; i < numWorkers; i++){
+        PoolWorker& victim = workers[(index + i) % numWorkers];
+        int first;
+        int last;
+        {
+          MutexLock lock(victim.mutex);
+          int left = victim.end - victim.begin;
+          if (left <= 0) continue;
+          last  = victim.end;
+          first = last - (left + 1) / 2;
+          victim.end = first;
+        }
+        
+        job = first;
+        MutexLock lock(mutex);
+        begin = first + 1;
+        end   = last;
+        return true;
+      }
+      return false;
+    }
+
+    void generate()
+    {
+      int job;
+      while (popJob(job) || stealJob(job)){
+        CodeJob& cj = jobs[job];
+        cj.failed = system.generateCode(cj.tech,cj.gentype,cj.codeidx,NULL,&cj.code,&cj.codeSize,&cj.hash);
+        if (cj.failed){
+          cj.code     = NULL;
+          cj.codeSize = 0;
+          cj.hash     = 0;
+          // keep the error of the lowest job, independent of scheduling
+          if (failedJob < 0 || job < failedJob){
+            failedJob = job;
+            failed    = true;
+            failedError.resize(system.getLastErrorString(NULL,0) + 1);
+            system.getLastErrorString(&failedError[0],failedError.size());
+          }
+        }
+      }
+    }
+
+    void run()
+    {
+      switch (task){
+      case POOLTASK_INIT:
+        failed = system.init(str);
+        break;
+      case POOLTASK_FILE:
+        failed = system.addLibraryFile(str);
+        break;
+      case POOLTASK_STRING:
+        failed = system.addLibraryString(str,strSize);
+        break;
+      case POOLTASK_GENERATE:
+        generate();
+        break;
+      }
+    }
+
+    static void entry(void* self)
+    {
+      ((PoolWorker*)self)->run();
+    }
+  };
+
+  static PoolWorker* runWorkers(PoolWorker* workers, int numWorkers, PoolTask task, const char* str, size_t strSize, CodeJob* jobs, int numJobs)
+  {
+    for (int i = 0; i < numWorkers; i++){
+      PoolWorker& worker = workers[i];
+      worker.index      = i;
+      worker.failed     = false;
+      worker.task       = task;
+      worker.str        = str;
+      worker.strSize    = strSize;
+      worker.jobs       = jobs;
+      worker.workers    = workers;
+      worker.numWorkers = numWorkers;
+      worker.begin      = (int)(((size_t)numJobs * i) / numWorkers);
+      worker.end        = (int)(((size_t)numJobs * (i + 1)) / numWorkers);
+      worker.failedJob  = -1;
+    }
+
+    // first worker runs on the calling thread
+    for (int i = 1; i < numWorkers; i++){
+      // without a thread the other workers steal all its jobs
+      if (workers[i].thread.start(PoolWorker::entry,&workers[i]) && task != POOLTASK_GENERATE){
+        workers[i].run();
+      }
+    }
+    workers[0].run();
+    for (int i = 1; i < numWorkers; i++){
+      workers[i].thread.join();
+    }
+
+    PoolWorker* failed = NULL;
+    for (int i = 0; i < numWorkers; i++){
+      PoolWorker& worker = workers[i];
+      if (!worker.failed) continue;
+      if (!failed || (task == POOLTASK_GENERATE && worker.failedJob < failed->failedJob)){
+        failed = &worker;
+      }
+    }
+    return failed;
+  }
+
+  void SystemPool::setError( const char* str, size_t size )
+  {
+    m_lastError = (char*) realloc(m_lastError,size + 1);
+    memcpy(m_lastError,str,size);
+    m_lastError[size] = 0;
+    m_lastErrorSize = size;
+  }
+
+  error SystemPool::setSystemError( System& sys )
+  {
+    size_t size = sys.getLastErrorString(NULL,0);
+    m_lastError = (char*) realloc(m_lastError,size + 1);
+    sys.getLastErrorString(m_lastError,size);
+    m_lastError[size] = 0;
+    m_lastErrorSize = size;
+    return true;
+  }
+
+  size_t SystemPool::getLastErrorString( char* buffer, size_t buffersize )
+  {
+    if (buffer) {
+      size_t written = buffersize > m_lastErrorSize ? m_lastErrorSize : buffersize;
+      memcpy(buffer,m_lastError,written);
+      return written;
+    }
+    else{
+      return m_lastErrorSize;
+    }
+  }
+
+#if LUAFXBUILDER_USESTRING
+  std::string SystemPool::getLastErrorString()
+  {
+    return std::string(m_lastError ? m_lastError : "", m_lastErrorSize);
+  }
+#endif
+
+  error SystemPool::init( const char* processorFile, int numWorkers )
+  {
+    assert(numWorkers > 0);
+    m_lastError     = NULL;
+    m_lastErrorSize = 0;
+    m_numWorkers    = numWorkers;
+    m_workers       = new PoolWorker[numWorkers];
+
+    PoolWorker* failed = runWorkers(m_workers,m_numWorkers,POOLTASK_INIT,processorFile,0,NULL,0);
+    return failed ? setSystemError(failed->system) : false;
+  }
+
+  void SystemPool::deinit()
+  {
+    for (int i = 0; i < m_numWorkers; i++){
+      m_workers[i].system.deinit();
+    }
+    delete [] m_workers;
+    m_workers     = NULL;
+    m_numWorkers  = 0;
+
+    free(m_lastError);
+    m_lastError     = NULL;
+    m_lastErrorSize = 0;
+  }
+
+  error SystemPool::addLibraryFile( const char* filename )
+  {
+    PoolWorker* failed = runWorkers(m_workers,m_numWorkers,POOLTASK_FILE,filename,strlen(filename),NULL,0);
+    return failed ? setSystemError(failed->system) : false;
+  }
+
+  error SystemPool::addLibraryString( const char* buffer, size_t buffersize )
+  {
+    PoolWorker* failed = runWorkers(m_workers,m_numWorkers,POOLTASK_STRING,buffer,buffersize,NULL,0);
+    return failed ? setSystemError(failed->system) : false;
+  }
+
+  error SystemPool::setGeneratorLights( int numLights, EffectID* lights, int *lightsMax )
+  {
+    // ids are identical in all workers
+    for (int i = 0; i < m_numWorkers; i++){
+      if (m_workers[i].system.setGeneratorLights(numLights,lights,lightsMax)){
+        const char* msg = "illegal effectid, lights required";
+        setError(msg,strlen(msg));
+        return true;
+      }
+    }
+    return false;
+  }
+
+  System* SystemPool::getSystem()
+  {
+    return &m_workers[0].system;
+  }
+
+  int SystemPool::getWorkerCount()
+  {
+    return m_numWorkers;
+  }
+
+  error SystemPool::generate( CodeJob* jobs, int numJobs )
+  {
+    PoolWorker* failed = runWorkers(m_workers,m_numWorkers,POOLTASK_GENERATE,NULL,0,jobs,numJobs);
+    if (failed){
+      setError(&failed->failedError[0],failed->failedError.size() - 1);
+      return true;
+    }
+
+    // workers cache their own strings, identical code of several workers
+    // shares the string of the first job
+    std::map<CodeHash,int> first;
+    for (int i = 0; i < numJobs; i++){
+      CodeJob& job = jobs[i];
+      std::pair<std::map<CodeHash,int>::iterator,bool> found = first.insert(std::make_pair(job.hash,i));
+      const CodeJob& other = jobs[found.first->second];
+      if (!found.second && other.code != job.code &&
+          other.codeSize == job.codeSize && memcmp(other.code,job.code,job.codeSize) == 0)
+      {
+        job.code = other.code;
+      }
+    }
+    return false;
+  }
+}
+
@@ -0,0 +1,344 @@
+/*
+    Copyright (c) 2012, NVIDIA CORPORATION. All rights reserved.
+    Copyright (c) 2012, Christoph Kubisch. All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions
+    are met:
+     * Redistributions of source code must retain the above copyright
+       notice, this list of conditions and the following disclaimer.
+     * Neither the name of NVIDIA CORPORATION nor the names of its
+       contributors may be used to endorse or promote products derived
+       from this software without specific prior written permission.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ``AS IS'' AND ANY
+    EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+    PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+    CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+    EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+    PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+    PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+    OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+    (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+    OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+    Contact: Christoph Kubisch ckubisch@nvidia.com 
+*/
+
+#include <luafxbuilder/luafxbuilder_service.h>
+#include "luafxbuilder_thread.h"
+
+#include <vector>
+#include <algorithm>
+
+#include <assert.h>
+#include <string.h>
+
+namespace luafxbuilder
+{
+  struct CodeRequest {
+    CodeRequest*        next;       // queue link
+    volatile long       status;
+    volatile long       refs;       // caller and service
+    TechID              tech;
+    GeneratorType       gentype;
+    int                 codeidx;
+    int                 priority;
+    unsigned long long  sequence;
+    CodeCallback        callback;
+    void*               userdata;
+
+    const char*         code;
+    size_t              codeSize;
+    CodeHash            hash;
+    std::vector<char>   error;
+    Signal              finished;   // manual reset, set with the final status
+
+    CodeRequest() : finished(true) {}
+  };
+
+  static void unrefRequest(CodeRequest* request)
+  {
+    if (atomicDecrement(&request->refs) == 0){
+      delete request;
+    }
+  }
+
+  // max heap, higher priority first, then request order
+  static bool lessRequest(const CodeRequest* a, const CodeRequest* b)
+  {
+    return a->priority < b->priority || (a->priority == b->priority && a->sequence > b->sequence);
+  }
+
+  struct ServiceWorker {
+    System            system;
+    Thread            thread;
+    Signal            wakeup;
+    bool              running;
+    void* volatile    queue;      // stack of requests, pushed by any thread
+    volatile long     pending;
+    volatile long     stopping;
+
+    // generator thread only
+    std::vector<CodeRequest*> heap;
+    unsigned long long        sequence;
+
+    void push(CodeRequest* request)
+    {
+      void* head = NULL;
+      for (;;){
+        request->next = (CodeRequest*)head;
+        void* cur = atomicCompareExchangePointer(&queue,request,head);
+        if (cur == head) break;
+        head = cur;
+      }
+    }
+
+    // moves the whole stack into the heap, oldest first
+    void drain()
+    {
+      CodeRequest* list = (CodeRequest*)atomicExchangePointer(&queue,NULL);
+      CodeRequest* fifo = NULL;
+      while (list){
+        CodeRequest* next = list->next;
+        list->next = fifo;
+        fifo = list;
+        list = next;
+      }
+      while (fifo){
+        CodeRequest* next = fifo->next;
+        fifo->sequence = sequence++;
+        heap.push_back(fifo);
+        std::push_heap(heap.begin(),heap.end(),lessRequest);
+        fifo = next;
+      }
+    }
+
+    bool cancel(CodeRequest* request)
+    {
+      if (atomicCompareExchange(&request->status,REQUEST_CANCELLED,REQUEST_PENDING) == REQUEST_PENDING){
+        atomicDecrement(&pending);
+        request->finished.notify();
+        return true;
+      }
+      return false;
+    }
+
+    void process(CodeRequest* request)
+    {
+      if (atomicCompareExchange(&request->status,REQUEST_RUNNING,REQUEST_PENDING) != REQUEST_PENDING){
+        // cancelled
+        unrefRequest(request);
+        return;
+      }
+      atomicDecrement(&pending);
+
+      const char* code;
+      size_t      codeSize;
+      CodeHash    hash;
+      if (system.techniqueGenerateCodeView(request->tech,request->gentype,request->codeidx,&code,&codeSize) ||
+          system.techniqueGenerateCodeHash(request->tech,request->gentype,request->codeidx,&hash,NULL))
+      {
+        request->error.resize(system.getLastErrorString(NULL,0) + 1);
+        system.getLastErrorString(&request->error[0],request->error.size());
+        request->error[request->error.size() - 1] = 0;
+        atomicExchange(&request->status,REQUEST_FAILED);
+      }
+      else {
+        request->code     = code;
+        request->codeSize = codeSize;
+        request->hash     = hash;
+        atomicExchange(&request->status,REQUEST_DONE);
+      }
+
+      if (request->callback){
+        request->callback(request,request->userdata);
+      }
+      request->finished.notify();
+      unrefRequest(request);
+    }
+
+    void run()
+    {
+      for (;;){
+        drain();
+        if (atomicLoad(&stopping)){
+          for (size_t i = 0; i < heap.size(); i++){
+            cancel(heap[i]);
+            unrefRequest(heap[i]);
+          }
+          heap.clear();
+          break;
+        }
+        if (heap.empty()){
+          wakeup.wait();
+          continue;
+        }
+        std::pop_heap(heap.begin(),heap.end(),lessRequest);
+        CodeRequest* request = heap.back();
+        heap.pop_back();
+        process(request);
+      }
+    }
+
+    static void entry(void* self)
+    {
+      ((ServiceWorker*)self)->run();
+    }
+  };
+
+  error CodeService::init( const char* processorFile )
+  {
+    m_worker = new ServiceWorker;
+    m_worker->running   = false;
+    m_worker->queue     = NULL;
+    m_worker->pending   = 0;
+    m_worker->stopping  = 0;
+    m_worker->sequence  = 0;
+    return m_worker->system.init(processorFile);
+  }
+
+  void CodeService::deinit()
+  {
+    stop();
+    // requests added while stopped
+    m_worker->drain();
+    for (size_t i = 0; i < m_worker->heap.size(); i++){
+      m_worker->cancel(m_worker->heap[i]);
+      unrefRequest(m_worker->heap[i]);
+    }
+    m_worker->heap.clear();
+    m_worker->system.deinit();
+    delete m_worker;
+    m_worker = NULL;
+  }
+
+  System* CodeService::getSystem()
+  {
+    assert(!m_worker->running);
+    return &m_worker->system;
+  }
+
+  error CodeService::start()
+  {
+    if (m_worker->running) return false;
+    m_worker->stopping = 0;
+    if (m_worker->thread.start(ServiceWorker::entry,m_worker)){
+      return true;
+    }
+    m_worker->running = true;
+    return false;
+  }
+
+  void CodeService::stop()
+  {
+    if (!m_worker->running) return;
+    atomicExchange(&m_worker->stopping,1);
+    m_worker->wakeup.notify();
+    m_worker->thread.join();
+    m_worker->running = false;
+  }
+
+  bool CodeService::isRunning()
+  {
+    return m_worker->running;
+  }
+
+  CodeRequest* CodeService::request( TechID tech, GeneratorType gentype, int codeidx, int priority, CodeCallback callback, void* userdata )
+  {
+    CodeRequest* request = new CodeRequest;
+    request->next     = NULL;
+    request->status   = REQUEST_PENDING;
+    request->refs     = 2;
+    request->tech     = tech;
+    request->gentype  = gentype;
+    request->codeidx  = codeidx;
+    request->priority = priority;
+    request->sequence = 0;
+    request->callback = callback;
+    request->userdata = userdata;
+    request->code     = NULL;
+    request->codeSize = 0;
+    request->hash     = 0;
+
+    atomicIncrement(&m_worker->pending);
+    m_worker->push(request);
+    m_worker->wakeup.notify();
+    return request;
+  }
+
+  bool CodeService::cancel( CodeRequest* request )
+  {
+    // the generator thread drops it when dequeued
+    return m_worker->cancel(request);
+  }
+
+  void CodeService::release( CodeRequest* request )
+  {
+    unrefRequest(request);
+  }
+
+  RequestStatus CodeService::getStatus( CodeRequest* request )
+  {
+    return (RequestStatus)atomicLoad(&request->status);
+  }
+
+  RequestStatus CodeService::wait( CodeRequest* request )
+  {
+    request->finished.wait();
+    return getStatus(request);
+  }
+
+  int CodeService::getPendingCount()
+  {
+    return (int)atomicLoad(&m_worker->pending);
+  }
+
+  const char* CodeService::getCode( CodeRequest* request, size_t* size )
+  {
+    if (getStatus(request) != REQUEST_DONE){
+      if (size) *size = 0;
+      return NULL;
+    }
+    if (size) *size = request->codeSize;
+    return request->code;
+  }
+
+  CodeHash CodeService::getHash( CodeRequest* request )
+  {
+    return getStatus(request) == REQUEST_DONE ? request->hash : 0;
+  }
+
+  size_t CodeService::getError( CodeRequest* request, char* buffer, size_t buffersize )
+  {
+    if (getStatus(request) != REQUEST_FAILED) return 0;
+    size_t size = request->error.size() - 1;
+    if (buffer){
+      size_t written = buffersize > size ? size : buffersize;
+      memcpy(buffer,&request->error[0],written);
+      return written;
+    }
+    return size;
+  }
+
+  TechID CodeService::getTechnique( CodeRequest* request )
+  {
+    return request->tech;
+  }
+
+  GeneratorType CodeService::getGenerator( CodeRequest* request )
+  {
+    return request->gentype;
+  }
+
+  int CodeService::getCodeIndex( CodeRequest* request )
+  {
+    return request->codeidx;
+  }
+
+  int CodeService::getPriority( CodeRequest* request )
+  {
+    return request->priority;
+  }
+}
@@ -0,0 +1,277 @@
+/*
+    Copyright (c) 2012, NVIDIA CORPORATION. All rights reserved.
+    Copyright (c) 2012, Christoph Kubisch. All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions
+    are met:
+     * Redistributions of source code must retain the above copyright
+       notice, this list of conditions and the following disclaimer.
+     * Neither the name of NVIDIA CORPORATION nor the names of its
+       contributors may be used to endorse or promote products derived
+       from this software without specific prior written permission.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ``AS IS'' AND ANY
+    EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+    PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+    CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+    EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+    PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+    PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+    OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+    (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+    OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+    Contact: Christoph Kubisch ckubisch@nvidia.com 
+*/
+
+#ifndef LUAFXBUILDER_THREAD_H_
+#define LUAFXBUILDER_THREAD_H_
+
+// minimal threading primitives, VS2008 has no std::thread
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <pthread.h>
+#include <sys/time.h>
+#include <errno.h>
+#endif
+
+namespace luafxbuilder
+{
+  typedef void (*ThreadFunc)(void* arg);
+
+  class Mutex {
+  private:
+#ifdef _WIN32
+    CRITICAL_SECTION  m_cs;
+#else
+    pthread_mutex_t   m_mutex;
+#endif
+    Mutex(const Mutex&);
+    Mutex& operator=(const Mutex&);
+
+  public:
+#ifdef _WIN32
+    Mutex()       { InitializeCriticalSection(&m_cs); }
+    ~Mutex()      { DeleteCriticalSection(&m_cs); }
+    void lock()   { EnterCriticalSection(&m_cs); }
+    void unlock() { LeaveCriticalSection(&m_cs); }
+#else
+    Mutex()       { pthread_mutex_init(&m_mutex,NULL); }
+    ~Mutex()      { pthread_mutex_destroy(&m_mutex); }
+    void lock()   { pthread_mutex_lock(&m_mutex); }
+    void unlock() { pthread_mutex_unlock(&m_mutex); }
+#endif
+  };
+
+  class MutexLock {
+  private:
+    Mutex&  m_mutex;
+    MutexLock(const MutexLock&);
+    MutexLock& operator=(const MutexLock&);
+
+  public:
+    MutexLock(Mutex& mutex) : m_mutex(mutex) { m_mutex.lock(); }
+    ~MutexLock()  { m_mutex.unlock(); }
+  };
+
+  // interlocked operations with full barriers
+
+#ifdef _WIN32
+  inline long atomicIncrement(volatile long* value)   { return InterlockedIncrement(value); }
+  inline long atomicDecrement(volatile long* value)   { return InterlockedDecrement(value); }
+  inline long atomicLoad(volatile long* value)        { return InterlockedCompareExchange(value,0,0); }
+  inline long atomicExchange(volatile long* value, long exchange)   { return InterlockedExchange(value,exchange); }
+    // returns the previous value
+  inline long atomicCompareExchange(volatile long* value, long exchange, long comparand)
+  {
+    return InterlockedCompareExchange(value,exchange,comparand);
+  }
+  inline void* atomicExchangePointer(void* volatile* ptr, void* exchange)
+  {
+    return InterlockedExchangePointer(ptr,exchange);
+  }
+  inline void* atomicCompareExchangePointer(void* volatile* ptr, void* exchange, void* comparand)
+  {
+    return InterlockedCompareExchangePointer(ptr,exchange,comparand);
+  }
+#else
+  inline long atomicIncrement(volatile long* value)   { return __sync_add_and_fetch(value,1); }
+  inline long atomicDecrement(volatile long* value)   { return __sync_sub_and_fetch(value,1); }
+  inline long atomicLoad(volatile long* value)        { return __sync_fetch_and_add(value,0); }
+    // loops start with a guess, the first compare returns the actual value
+  inline long atomicExchange(volatile long* value, long exchange)
+  {
+    long prev = 0;
+    long cur;
+    while ((cur = __sync_val_compare_and_swap(value,prev,exchange)) != prev){
+      prev = cur;
+    }
+    return prev;
+  }
+  inline long atomicCompareExchange(volatile long* value, long exchange, long comparand)
+  {
+    return __sync_val_compare_and_swap(value,comparand,exchange);
+  }
+  inline void* atomicExchangePointer(void* volatile* ptr, void* exchange)
+  {
+    void* prev = NULL;
+    void* cur;
+    while ((cur = __sync_val_compare_and_swap(ptr,prev,exchange)) != prev){
+      prev = cur;
+    }
+    return prev;
+  }
+  inline void* atomicCompareExchangePointer(void* volatile* ptr, void* exchange, void* comparand)
+  {
+    return __sync_val_compare_and_swap(ptr,comparand,exchange);
+  }
+#endif
+
+  // auto reset event, a notify without a waiter wakes the next wait.
+  // A manual reset event stays set and wakes all waiters.
+  class Signal {
+  private:
+#ifdef _WIN32
+    HANDLE            m_event;
+#else
+    pthread_mutex_t   m_mutex;
+    pthread_cond_t    m_cond;
+    bool              m_set;
+    bool              m_manual;
+#endif
+    Signal(const Signal&);
+    Signal& operator=(const Signal&);
+
+  public:
+#ifdef _WIN32
+    Signal(bool manualReset = false)  { m_event = CreateEvent(NULL,manualReset ? TRUE : FALSE,FALSE,NULL); }
+    ~Signal()       { CloseHandle(m_event); }
+    void notify()   { SetEvent(m_event); }
+    void wait()     { WaitForSingleObject(m_event,INFINITE); }
+      // returns false on timeout
+    bool wait(unsigned int milliseconds)
+    {
+      return WaitForSingleObject(m_event,milliseconds) == WAIT_OBJECT_0;
+    }
+#else
+    Signal(bool manualReset = false) : m_set(false), m_manual(manualReset)
+    {
+      pthread_mutex_init(&m_mutex,NULL);
+      pthread_cond_init(&m_cond,NULL);
+    }
+    ~Signal()
+    {
+      pthread_cond_destroy(&m_cond);
+      pthread_mutex_destroy(&m_mutex);
+    }
+    void notify()
+    {
+      pthread_mutex_lock(&m_mutex);
+      m_set = true;
+      if (m_manual){
+        pthread_cond_broadcast(&m_cond);
+      }
+      else{
+        pthread_cond_signal(&m_cond);
+      }
+      pthread_mutex_unlock(&m_mutex);
+    }
+    void wait()
+    {
+      pthread_mutex_lock(&m_mutex);
+      while (!m_set){
+        pthread_cond_wait(&m_cond,&m_mutex);
+      }
+      m_set = m_manual;
+      pthread_mutex_unlock(&m_mutex);
+    }
+    bool wait(unsigned int milliseconds)
+    {
+      struct timeval  now;
+      struct timespec until;
+      gettimeofday(&now,NULL);
+      unsigned long long usec = (unsigned long long)now.tv_usec + (unsigned long long)milliseconds * 1000;
+      until.tv_sec  = now.tv_sec + (time_t)(usec / 1000000);
+      until.tv_nsec = (long)(usec % 1000000) * 1000;
+
+      pthread_mutex_lock(&m_mutex);
+      int status = 0;
+      while (!m_set && status != ETIMEDOUT){
+        status = pthread_cond_timedwait(&m_cond,&m_mutex,&until);
+      }
+      bool set = m_set;
+      m_set = set && m_manual;
+      pthread_mutex_unlock(&m_mutex);
+      return set;
+    }
+#endif
+  };
+
+  class Thread {
+  private:
+    ThreadFunc  m_func;
+    void*       m_arg;
+    bool        m_running;
+#ifdef _WIN32
+    HANDLE      m_handle;
+
+    static DWORD WINAPI entry(LPVOID self)
+    {
+      Thread* thread = (Thread*)self;
+      thread->m_func(thread->m_arg);
+      return 0;
+    }
+#else
+    pthread_t   m_handle;
+
+    static void* entry(void* self)
+    {
+      Thread* thread = (Thread*)self;
+      thread->m_func(thread->m_arg);
+      return NULL;
+    }
+#endif
+    Thread(const Thread&);
+    Thread& operator=(const Thread&);
+
+  public:
+    Thread() : m_func(NULL), m_arg(NULL), m_running(false) {}
+    ~Thread() { join(); }
+
+    // returns true on error
+    bool start(ThreadFunc func, void* arg)
+    {
+      if (m_running) return true;
+      m_func = func;
+      m_arg  = arg;
+#ifdef _WIN32
+      m_handle  = CreateThread(NULL,0,entry,this,0,NULL);
+      m_running = m_handle != NULL;
+#else
+      m_running = pthread_create(&m_handle,NULL,entry,this) == 0;
+#endif
+      return !m_running;
+    }
+
+    void join()
+    {
+      if (!m_running) return;
+#ifdef _WIN32
+      WaitForSingleObject(m_handle,INFINITE);
+      CloseHandle(m_handle);
+#else
+      pthread_join(m_handle,NULL);
+#endif
+      m_running = false;
+    }
+  };
+}
+
+#endif
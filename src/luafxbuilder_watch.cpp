@@ -0,0 +1,223 @@
+/*
+    Copyright (c) 2012, NVIDIA CORPORATION. All rights reserved.
+    Copyright (c) 2012, Christoph Kubisch. All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions
+    are met:
+     * Redistributions of source code must retain the above copyright
+       notice, this list of conditions and the following disclaimer.
+     * Neither the name of NVIDIA CORPORATION nor the names of its
+       contributors may be used to endorse or promote products derived
+       from this software without specific prior written permission.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ``AS IS'' AND ANY
+    EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+    PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+    CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+    EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+    PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+    PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+    OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+    (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+    OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+    Contact: Christoph Kubisch ckubisch@nvidia.com 
+*/
+
+#include <luafxbuilder/luafxbuilder_watch.h>
+
+#include <string>
+#include <algorithm>
+
+#include <assert.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#ifdef __linux__
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
+namespace luafxbuilder
+{
+  struct WatchFile {
+    std::string   name;
+    std::string   base;       // name within the watched directory
+    int           watch;      // inotify descriptor of the directory, -1 if polled
+    long long     time;
+    long long     size;
+    bool          modified;
+  };
+
+  struct WatchState {
+    int                     notify;   // inotify instance, -1 when polling
+    std::vector<WatchFile>  files;
+  };
+
+  // returns true if time or size differ from the last call
+  static bool updateStamp(WatchFile& file)
+  {
+    long long time = -1;
+    long long size = -1;
+#ifdef _WIN32
+    struct _stat64 st;
+    if (_stat64(file.name.c_str(),&st) == 0){
+      time = (long long)st.st_mtime;
+      size = (long long)st.st_size;
+    }
+#else
+    struct stat st;
+    if (stat(file.name.c_str(),&st) == 0){
+#ifdef __linux__
+      time = (long long)st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+#else
+      time = (long long)st.st_mtime;
+#endif
+      size = (long long)st.st_size;
+    }
+#endif
+    bool changed = time != file.time || size != file.size;
+    file.time = time;
+    file.size = size;
+    return changed;
+  }
+
+  void LibraryWatcher::updateFiles()
+  {
+    WatchState& state = *m_state;
+
+    // the file list of a System only grows
+    int cnt = m_system->getLibraryFileCount();
+    for (int i = (int)state.files.size(); i < cnt; i++){
+      WatchFile file;
+      file.name.resize(m_system->getLibraryFileName(i,NULL,0));
+      if (!file.name.empty()){
+        m_system->getLibraryFileName(i,&file.name[0],file.name.size());
+      }
+      file.watch    = -1;
+      file.time     = -1;
+      file.size     = -1;
+      file.modified = false;
+      updateStamp(file);
+
+      size_t sep = file.name.find_last_of("/\\");
+      std::string dir = sep == std::string::npos ? std::string(".") : 
+                        sep == 0 ? file.name.substr(0,1) : file.name.substr(0,sep);
+      file.base = sep == std::string::npos ? file.name : file.name.substr(sep + 1);
+#ifdef __linux__
+      if (state.notify >= 0){
+        // watching the directory also catches editors that save by renaming
+        file.watch = inotify_add_watch(state.notify,dir.c_str(),IN_CLOSE_WRITE | IN_MOVED_TO);
+      }
+#endif
+      state.files.push_back(file);
+    }
+  }
+
+  error LibraryWatcher::init( System& system, bool forcePolling )
+  {
+    m_system = &system;
+    m_state  = new WatchState;
+    m_state->notify = -1;
+#ifdef __linux__
+    if (!forcePolling){
+      m_state->notify = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    }
+#endif
+    m_changed.clear();
+    updateFiles();
+    return false;
+  }
+
+  void LibraryWatcher::deinit()
+  {
+#ifdef __linux__
+    if (m_state && m_state->notify >= 0){
+      close(m_state->notify);
+    }
+#endif
+    delete m_state;
+    m_state   = NULL;
+    m_system  = NULL;
+    m_changed.clear();
+  }
+
+  bool LibraryWatcher::isPolling()
+  {
+    return m_state->notify < 0;
+  }
+
+  error LibraryWatcher::poll( int* numReloaded )
+  {
+    WatchState& state = *m_state;
+    m_changed.clear();
+    *numReloaded = 0;
+
+#ifdef __linux__
+    if (state.notify >= 0){
+      char buffer[4096] __attribute__ ((aligned(__alignof__(struct inotify_event))));
+      ssize_t len;
+      while ((len = read(state.notify,buffer,sizeof(buffer))) > 0){
+        const struct inotify_event* event;
+        for (char* ptr = buffer; ptr < buffer + len; ptr += sizeof(struct inotify_event) + event->len){
+          event = (const struct inotify_event*)ptr;
+          if (!event->len) continue;
+          for (size_t i = 0; i < state.files.size(); i++){
+            WatchFile& file = state.files[i];
+            if (file.watch == event->wd && file.base == event->name){
+              file.modified = true;
+            }
+          }
+        }
+      }
+    }
+#endif
+
+    for (size_t i = 0; i < state.files.size(); i++){
+      WatchFile& file = state.files[i];
+      if (file.watch < 0 && updateStamp(file)){
+        file.modified = true;
+      }
+    }
+
+    error failed = false;
+    for (size_t i = 0; i < state.files.size() && !failed; i++){
+      WatchFile& file = state.files[i];
+      if (!file.modified){
+        continue;
+      }
+      file.modified = false;
+
+      failed = m_system->reloadLibraryFile(file.name.c_str());
+      if (!failed){
+        int cnt = m_system->getReloadedTechniqueCount();
+        for (int t = 0; t < cnt; t++){
+          m_changed.push_back(m_system->getReloadedTechnique(t));
+        }
+        (*numReloaded)++;
+      }
+    }
+
+    std::sort(m_changed.begin(),m_changed.end());
+    m_changed.erase(std::unique(m_changed.begin(),m_changed.end()),m_changed.end());
+
+    // reloads may have added FILE or dofile dependencies
+    updateFiles();
+
+    return failed;
+  }
+
+  int LibraryWatcher::getChangedTechniqueCount()
+  {
+    return (int)m_changed.size();
+  }
+
+  TechID LibraryWatcher::getChangedTechnique( int i )
+  {
+    assert(i >= 0 && i < (int)m_changed.size() && "illegal index");
+    return m_changed[i];
+  }
+}
+
@@ -0,0 +1,146 @@
+--[[
+    Copyright (c) 2012, NVIDIA CORPORATION. All rights reserved.
+    Copyright (c) 2012, Christoph Kubisch. All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions
+    are met:
+     * Redistributions of source code must retain the above copyright
+       notice, this list of conditions and the following disclaimer.
+     * Neither the name of NVIDIA CORPORATION nor the names of its
+       contributors may be used to endorse or promote products derived
+       from this software without specific prior written permission.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ``AS IS'' AND ANY
+    EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+    PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+    CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+    EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+    PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+    PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+    OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+    (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+    OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+    Contact: Christoph Kubisch ckubisch@nvidia.com 
+]]
+
+
+-- Compares two revisions of the code generators on test/testfx.luafx.
+-- Each revision generates every technique/code/generator permutation into
+-- a dump file and reports its timing, compare then diffs two dumps byte by
+-- byte. Run from the repository root:
+--
+--   git archive <old revision> lua | tar -x -C /tmp/old
+--   lua test/fxgencompare.lua dump /tmp/old/lua /tmp/old.dump 20
+--   lua test/fxgencompare.lua dump lua /tmp/new.dump 20
+--   lua test/fxgencompare.lua compare /tmp/old.dump /tmp/new.dump
+--
+-- The optional repeat count regenerates all permutations that many times
+-- for the timing, the optional light count repeats the library lights to
+-- grow the lit outputs. Each dump runs in its own lua process so both
+-- generator sets start from a fresh state.
+
+local mode = arg and arg[1]
+
+local function readdump(filename)
+  local f = assert(io.open(filename,"rb"))
+  local data = f:read("*a")
+  f:close()
+  
+  local outputs = {}
+  local names   = {}
+  local pos     = 1
+  while (pos <= #data) do
+    local name,size,start = data:match("^([^\n]*)\n(%d+)\n()",pos)
+    assert(name, "corrupt dump "..filename)
+    size = tonumber(size)
+    outputs[name] = data:sub(start,start+size-1)
+    names[#names+1] = name
+    pos = start + size
+  end
+  return outputs,names
+end
+
+if (mode == "dump") then
+  local luadir   = arg[2]
+  local filename = arg[3]
+  local repeats  = tonumber(arg[4] or 1)
+  local lights   = tonumber(arg[5] or 0)
+  
+  dofile(luadir.."/fxlibprocessor.lua")
+  fxfile("test/testfx.luafx")
+  -- the lights repeat to reach the requested count, for large outputs
+  local numLights = math.max(lights, #fxlib.light.effects)
+  for i = 1,numLights do
+    fxlights.effects[i] = fxlib.light.effects[(i-1) % #fxlib.light.effects + 1]
+    fxlights.max[i]     = 16
+  end
+  
+  -- sorted, so both revisions walk the same order
+  local gens = {}
+  for gen in pairs(fxgenerators) do gens[#gens+1] = gen end
+  table.sort(gens)
+  local perms = {}
+  local classes = {}
+  for t in pairs(fxlib) do classes[#classes+1] = t end
+  table.sort(classes)
+  for _,t in ipairs(classes) do
+    for _,eff in ipairs(fxlib[t].effects) do
+      local techs = {}
+      for tname in pairs(eff.technique) do
+        if (type(tname) == "string") then techs[#techs+1] = tname end
+      end
+      table.sort(techs)
+      for _,tname in ipairs(techs) do
+        local tech = eff.technique[tname]
+        for c,code in ipairs(tech.code) do
+          for _,gen in ipairs(gens) do
+            perms[#perms+1] = {tech, c, gen, eff.class.."_"..eff.name.."_"..tname.."_"..code.name.."_"..gen}
+          end
+        end
+      end
+    end
+  end
+  
+  local outputs = {}
+  local begin = os.clock()
+  for r = 1,repeats do
+    for i,p in ipairs(perms) do
+      outputs[i] = fxcodegen(p[1],p[2],p[3])
+    end
+  end
+  local time = os.clock() - begin
+  
+  local f = assert(io.open(filename,"wb"))
+  local bytes = 0
+  for i,p in ipairs(perms) do
+    f:write(p[4],"\n",#outputs[i],"\n",outputs[i])
+    bytes = bytes + #outputs[i]
+  end
+  f:close()
+  
+  print(string.format("%s: %d permutations, %d lights, %d bytes, %d repeats, %.3f ms per pass",
+    luadir, #perms, numLights, bytes, repeats, time * 1000 / repeats))
+  
+elseif (mode == "compare") then
+  local old,names = readdump(arg[2])
+  local new,newnames = readdump(arg[3])
+  local differ = 0
+  for _,name in ipairs(names) do
+    if (old[name] ~= new[name]) then
+      differ = differ + 1
+      print("differs: "..name)
+    end
+  end
+  local added = #newnames - #names
+  print(string.format("compare: %d permutations, %d differ, %d added", #names, differ, added))
+  if (differ > 0) then
+    os.exit(1)
+  end
+  
+else
+  print("usage: lua test/fxgencompare.lua dump <luadir> <dumpfile> [repeats] [lights]")
+  print("       lua test/fxgencompare.lua compare <olddump> <newdump>")
+end
@@ -0,0 +1,1194 @@
+/*
+    Copyright (c) 2012, NVIDIA CORPORATION. All rights reserved.
+    Copyright (c) 2012, Christoph Kubisch. All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions
+    are met:
+     * Redistributions of source code must retain the above copyright
+       notice, this list of conditions and the following disclaimer.
+     * Neither the name of NVIDIA CORPORATION nor the names of its
+       contributors may be used to endorse or promote products derived
+       from this software without specific prior written permission.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ``AS IS'' AND ANY
+    EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+    PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+    CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+    EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+    PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+    PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+    OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+    (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+    OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+    Contact: Christoph Kubisch ckubisch@nvidia.com 
+*/
+
+#include <luafxbuilder/luafxbuilder.h>
+#include <luafxbuilder/luafxbuilder_alloc.h>
+#include <luafxbuilder/luafxbuilder_draw.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <time.h>
+#endif
+
+using namespace luafxbuilder;
+
+static double getMicroseconds()
+{
+#ifdef _WIN32
+  static LARGE_INTEGER frequency;
+  if (!frequency.QuadPart){
+    QueryPerformanceFrequency(&frequency);
+  }
+  LARGE_INTEGER counter;
+  QueryPerformanceCounter(&counter);
+  return double(counter.QuadPart) * 1000000.0 / double(frequency.QuadPart);
+#else
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC,&ts);
+  return double(ts.tv_sec) * 1000000.0 + double(ts.tv_nsec) / 1000.0;
+#endif
+}
+
+//////////////////////////////////////////////////////////////////////////
+// Results, printed as text and optionally written as json
+
+struct BenchValue {
+  const char* name;
+  double      value;
+};
+
+struct BenchResult {
+  std::string             name;
+  double                  ms;
+  double                  count;    // items processed
+  const char*             unit;     // what an item is
+  std::vector<BenchValue> values;
+};
+
+static std::vector<BenchResult> s_results;
+static bool                     s_quiet = false;
+
+static BenchResult& addResult(const char* name, double ms, double count, const char* unit)
+{
+  BenchResult result;
+  result.name  = name;
+  result.ms    = ms;
+  result.count = count;
+  result.unit  = unit;
+  s_results.push_back(result);
+  return s_results.back();
+}
+
+static void addValue(BenchResult& result, const char* name, double value)
+{
+  BenchValue entry;
+  entry.name  = name;
+  entry.value = value;
+  result.values.push_back(entry);
+}
+
+// counts stay exact, timings keep their fraction
+static const char* valueFormat(double value)
+{
+  return value == floor(value) ? "%.0f" : "%.6g";
+}
+
+static void printResult(const BenchResult& result)
+{
+  if (s_quiet) return;
+
+  printf("%-28s %12.3f ms", result.name.c_str(), result.ms);
+  if (result.count){
+    printf(" %10.0f %-10s %12.1f ns/item", result.count, result.unit, result.ms * 1000000.0 / result.count);
+  }
+  for (size_t i = 0; i < result.values.size(); i++){
+    printf(" %s ", result.values[i].name);
+    printf(valueFormat(result.values[i].value), result.values[i].value);
+  }
+  printf("\n");
+}
+
+static void writeJsonString(FILE* file, const char* str)
+{
+  fputc('"',file);
+  for (; *str; str++){
+    unsigned char c = (unsigned char)*str;
+    if (c == '"' || c == '\\'){
+      fprintf(file,"\\%c",c);
+    }
+    else if (c < 0x20){
+      fprintf(file,"\\u%04x",c);
+    }
+    else{
+      fputc(c,file);
+    }
+  }
+  fputc('"',file);
+}
+
+//////////////////////////////////////////////////////////////////////////
+// Synthetic library
+//
+// Materials with configurable groups, parameters and techniques, plus the
+// lights, FILE includes, enum, global and geometry they reference. The
+// output only depends on the config, so runs are comparable.
+
+struct SynthConfig {
+  int           effects;
+  int           groups;
+  int           params;
+  int           techniques;
+  int           files;
+  int           lights;
+  unsigned int  seed;
+};
+
+struct SynthType {
+  const char* type;
+  const char* array;
+  const char* value;
+};
+
+static const SynthType s_synthTypes[] = {
+  {"float",               "",     " {1}"},
+  {"vec2",                "",     " {0.5}"},
+  {"vec3",                "",     " {0.25}"},
+  {"vec4",                "",     " {1}"},
+  {"mat4",                "",     ""},
+  {"int",                 "",     " {2}"},
+  {"ivec4",               "",     " {1}"},
+  {"bool",                "",     " {true}"},
+  {"float",               "[4]",  ""},
+  {"vec4",                "[2]",  ""},
+  {"enum[\"synthblend\"]","",     " {\"SYNTH_MUL\"}"},
+};
+
+static unsigned int synthRandom(unsigned int& state)
+{
+  state = state * 1664525u + 1013904223u;
+  return state >> 8;
+}
+
+static std::string synthIncludeName(const char* library, int i)
+{
+  std::string name(library);
+  size_t dot = name.rfind('.');
+  if (dot != std::string::npos) name.resize(dot);
+  char suffix[32];
+  sprintf(suffix,"_%d.glsl",i);
+  return name + suffix;
+}
+
+// returns true on error
+static bool writeSynthLibrary(const char* library, const SynthConfig& config)
+{
+  for (int i = 0; i < config.files; i++){
+    FILE* file = fopen(synthIncludeName(library,i).c_str(),"wb");
+    if (!file) return true;
+    fprintf(file,
+      "vec4 synth_include(vec4 color)\n"
+      "{\n"
+      "  return color * %d.0 / %d.0;\n"
+      "}\n", i + 1, config.files);
+    fclose(file);
+  }
+
+  FILE* file = fopen(library,"wb");
+  if (!file) return true;
+
+  fprintf(file,
+    "--// generated by luafxbench, %d effects %d groups %d params %d techniques %d files %d lights seed %u\n\n",
+    config.effects, config.groups, config.params, config.techniques, config.files, config.lights, config.seed);
+
+  fprintf(file,
+    "EnumDef \"synthblend\" {\n"
+    "  \"SYNTH_ADD\",\n"
+    "  \"SYNTH_MUL\",\n"
+    "}\n\n"
+    "Global \"synthglobal\" {\n"
+    "  Group \"frame\" (shared) {\n"
+    "    float \"time\" {0},\n"
+    "    vec4  \"viewport\" {1},\n"
+    "  },\n"
+    "}\n\n"
+    "Geometry \"synthgeo\" {\n"
+    "  Technique \"GLSL::PosNormalUV\" {\n"
+    "    Code \"VertexShader\" {\n"
+    "      HEADER \"GLSL\",\n"
+    "      STRING {[=[\n"
+    "        layout(location = 0) in vec4 attrPosition;\n"
+    "        void main(void)\n"
+    "        {\n"
+    "          SYS_ATTRIBUTES();\n"
+    "          gl_Position = sys_ViewProjMatrix * (sys_WorldMatrix * attrPosition);\n"
+    "        }\n"
+    "      ]=]},\n"
+    "    },\n"
+    "  },\n"
+    "}\n\n");
+
+  // alternate the two light signatures of the forward generators
+  for (int l = 0; l < config.lights; l++){
+    bool directional = (l % 2) == 0;
+    fprintf(file,
+      "Light \"synthlight%d\" {\n"
+      "  Group \"instance\" (instanced) {\n"
+      "    vec3 \"synthlight%d_intensity\",\n"
+      "    vec3 \"synthlight%d_vector\",\n"
+      "  },\n"
+      "  Technique \"GLSL::forward\" {\n"
+      "    Code \"%s\" {\n"
+      "      STRING {[=[\n", l, l, l, directional ? "Directional" : "Ambient");
+    if (directional){
+      fprintf(file,
+        "        void light_synthlight%d( int sys_Light, in vec3 pos, out vec3 wi, out vec3 radiance)\n"
+        "        {\n"
+        "          wi = normalize(synthlight%d_vector - pos);\n"
+        "          radiance = synthlight%d_intensity;\n"
+        "        }\n", l, l, l);
+    }
+    else{
+      fprintf(file,
+        "        void light_synthlight%d( int sys_Light, in float glossiness, in vec3 dir, out vec3 radiance)\n"
+        "        {\n"
+        "          radiance = synthlight%d_intensity * max(0,dot(dir,synthlight%d_vector));\n"
+        "        }\n", l, l, l);
+    }
+    fprintf(file,
+      "      ]=]},\n"
+      "    },\n"
+      "  },\n"
+      "}\n\n");
+  }
+
+  unsigned int state = config.seed;
+  int numTypes = (int)(sizeof(s_synthTypes) / sizeof(s_synthTypes[0]));
+
+  for (int e = 0; e < config.effects; e++){
+    fprintf(file,
+      "Material \"synth%d\" {\n"
+      "  GlobalGroup \"synthglobal\" \"frame\",\n", e);
+
+    for (int g = 0; g < config.groups; g++){
+      // generated shaders index two instanced buffers per effect (GRP ivec2)
+      fprintf(file,"  Group \"group%d\" (%s) {\n", g, g < 2 ? "instanced" : "shared");
+      for (int p = 0; p < config.params; p++){
+        const SynthType& type = s_synthTypes[synthRandom(state) % numTypes];
+        fprintf(file,"    %s \"g%dp%d%s\"%s,\n", type.type, g, p, type.array, type.value);
+      }
+      fprintf(file,"  },\n");
+    }
+
+    for (int t = 0; t < config.techniques; t++){
+      if (t == 0){
+        fprintf(file,"  Technique \"GLSL::forward\" {\n");
+      }
+      else{
+        fprintf(file,"  Technique \"GLSL::variant%d\" {\n", t);
+      }
+      fprintf(file,
+        "    Options {\n"
+        "      istransparent = %s,\n"
+        "      GeometryTechnique = \"GLSL::PosNormalUV\",\n"
+        "      synthIndex = %d,\n"
+        "    },\n"
+        "    Code \"FragmentShader\" {\n"
+        "      HEADER \"GLSL\",\n", (synthRandom(state) % 4) == 0 ? "true" : "false", t);
+      if (config.lights > 0){
+        fprintf(file,"      LIGHTS \"GLSL::forward\" \"Directional\",\n");
+      }
+      if (config.lights > 1){
+        fprintf(file,"      LIGHTS \"GLSL::forward\" \"Ambient\",\n");
+      }
+      if (config.files > 0){
+        std::string include = synthIncludeName(library,(e + t) % config.files);
+        size_t slash = include.find_last_of("/\\");
+        fprintf(file,"      FILE {\"%s\"},\n", include.c_str() + (slash == std::string::npos ? 0 : slash + 1));
+      }
+      fprintf(file,
+        "      STRING {[=[\n"
+        "        layout(location = 0, index = 0) out vec4 outColor;\n"
+        "        void main() {\n"
+        "          vec4 result = vec4(%d.0 / 255.0);\n", (int)(synthRandom(state) % 256));
+      if (config.lights > 0){
+        fprintf(file,
+          "          SYS_LIGHT_LOOP (\"Directional\"){\n"
+          "            vec3 wIncident;\n"
+          "            vec3 intensity;\n"
+          "            SYS_LIGHT(vec3(0),wIncident,intensity);\n"
+          "            result += vec4(intensity,1);\n"
+          "          }\n");
+      }
+      if (config.lights > 1){
+        fprintf(file,
+          "          SYS_LIGHT_LOOP (\"Ambient\"){\n"
+          "            vec3 intensity;\n"
+          "            SYS_LIGHT(1,vec3(0,1,0),intensity);\n"
+          "            result += vec4(intensity,1);\n"
+          "          }\n");
+      }
+      fprintf(file,
+        "          outColor = %s;\n"
+        "        }\n"
+        "      ]=]},\n"
+        "    },\n"
+        "  },\n", config.files > 0 ? "synth_include(result)" : "result");
+    }
+    fprintf(file,"}\n\n");
+  }
+
+  bool failed = ferror(file) != 0;
+  fclose(file);
+  return failed;
+}
+
+//////////////////////////////////////////////////////////////////////////
+// Scenarios
+
+// touches every read-only accessor the way a renderer
+// does while building its draw lists, returns number of queries
+static size_t iterateMetadata(System &effectlib)
+{
+  size_t queries = 0;
+  char   name[256];
+  char   value[256];
+
+  for (int t = 0; t < NUM_EFFECTS; t++){
+    int ecnt = effectlib.getEffectCount((EffectType)t);
+    queries++;
+    for (int e = 0; e < ecnt; e++){
+      EffectID effect = effectlib.getEffect((EffectType)t,e);
+      effectlib.effectGetType(effect);
+      effectlib.effectGetName(effect,name,sizeof(name));
+      queries += 3;
+
+      int gcnt = effectlib.effectGetGroupCount(effect);
+      queries++;
+      for (int g = 0; g < gcnt; g++){
+        GroupID group = effectlib.effectGetGroup(effect,g);
+        effectlib.groupGetType(group);
+        effectlib.groupGetEffect(group);
+        size_t sz = effectlib.groupGetName(group,name,sizeof(name)-1);
+        name[sz] = 0;
+        effectlib.effectGetGroupIndex(effect,name);
+        queries += 5;
+
+        int pcnt = effectlib.groupGetParameterCount(group);
+        queries++;
+        for (int p = 0; p < pcnt; p++){
+          ParameterInfo info;
+          effectlib.groupGetParameterInfo(group,p,&info);
+          sz = effectlib.groupGetParameterName(group,p,name,sizeof(name)-1);
+          name[sz] = 0;
+          effectlib.groupGetParameterIndex(group,name);
+          queries += 3;
+          if (info.defaultSize && info.defaultSize <= sizeof(value)){
+            effectlib.groupGetParameterValue(group,p,sizeof(value),value);
+            queries++;
+          }
+        }
+      }
+
+      int tcnt = effectlib.effectGetTechniqueCount(effect);
+      queries++;
+      for (int i = 0; i < tcnt; i++){
+        TechID tech = effectlib.effectGetTechnique(effect,i);
+        effectlib.techniqueGetEffect(tech);
+        effectlib.techniqueHasLighting(tech);
+        effectlib.techniqueHasOption(tech,"GeometryTechnique");
+        effectlib.techniqueGetName(tech,name,sizeof(name));
+        queries += 5;
+
+        int ccnt = effectlib.techniqueGetCodeCount(tech);
+        queries++;
+        for (int c = 0; c < ccnt; c++){
+          size_t sz = effectlib.techniqueGetCodeName(tech,c,name,sizeof(name)-1);
+          name[sz] = 0;
+          effectlib.techniqueGetCodeIndex(tech,name);
+          queries += 2;
+        }
+      }
+    }
+  }
+
+  int ncnt = effectlib.getEnumCount();
+  queries++;
+  for (int n = 0; n < ncnt; n++){
+    EnumID enumtype = effectlib.getEnum(n);
+    int vcnt = effectlib.enumGetValueCount(enumtype);
+    queries += 2;
+    for (int v = 0; v < vcnt; v++){
+      effectlib.enumGetValue(enumtype,v);
+      queries++;
+    }
+  }
+
+  return queries;
+}
+
+static void benchMetadata(System &effectlib, const char* what, int iterations)
+{
+  size_t queries = 0;
+  double begin = getMicroseconds();
+  for (int i = 0; i < iterations; i++){
+    queries += iterateMetadata(effectlib);
+  }
+  double end = getMicroseconds();
+
+  BenchResult& result = addResult(what, (end - begin) / 1000.0, double(queries), "queries");
+  addValue(result, "iterations", iterations);
+  printResult(result);
+}
+
+// resolves every parameter of every group by name, once through
+// strings and once through interned handles
+struct LookupEntry {
+  GroupID     group;
+  std::string name;
+  NameID      handle;
+};
+
+static void collectLookups(System &effectlib, std::vector<LookupEntry> &entries)
+{
+  for (int t = 0; t < NUM_EFFECTS; t++){
+    int ecnt = effectlib.getEffectCount((EffectType)t);
+    for (int e = 0; e < ecnt; e++){
+      EffectID effect = effectlib.getEffect((EffectType)t,e);
+      int gcnt = effectlib.effectGetGroupCount(effect);
+      for (int g = 0; g < gcnt; g++){
+        GroupID group = effectlib.effectGetGroup(effect,g);
+        int pcnt = effectlib.groupGetParameterCount(group);
+        for (int p = 0; p < pcnt; p++){
+          LookupEntry entry;
+          entry.group  = group;
+          entry.name   = effectlib.groupGetParameterName(group,p);
+          entry.handle = effectlib.internName(entry.name.c_str());
+          entries.push_back(entry);
+        }
+      }
+    }
+  }
+}
+
+static void benchLookups(System &effectlib, const std::vector<LookupEntry> &entries, const char* what, bool handles, int iterations)
+{
+  if (entries.empty()) return;
+
+  int found = 0;
+  double begin = getMicroseconds();
+  for (int i = 0; i < iterations; i++){
+    for (size_t n = 0; n < entries.size(); n++){
+      const LookupEntry& entry = entries[n];
+      int idx = handles ? effectlib.groupGetParameterIndex(entry.group,entry.handle) :
+                          effectlib.groupGetParameterIndex(entry.group,entry.name.c_str());
+      found += idx >= 0 ? 1 : 0;
+    }
+  }
+  double end = getMicroseconds();
+
+  BenchResult& result = addResult(what, (end - begin) / 1000.0, double(iterations) * double(entries.size()), "lookups");
+  addValue(result, "found", found);
+  printResult(result);
+}
+
+// storage layout of every group for every generator
+static void benchStorage(System &effectlib, const char* what, int iterations)
+{
+  std::vector<GroupID> groups;
+  size_t maxparams = 0;
+  for (int t = 0; t < NUM_EFFECTS; t++){
+    int ecnt = effectlib.getEffectCount((EffectType)t);
+    for (int e = 0; e < ecnt; e++){
+      EffectID effect = effectlib.getEffect((EffectType)t,e);
+      int gcnt = effectlib.effectGetGroupCount(effect);
+      for (int g = 0; g < gcnt; g++){
+        GroupID group = effectlib.effectGetGroup(effect,g);
+        size_t pcnt = (size_t)effectlib.groupGetParameterCount(group);
+        maxparams = pcnt > maxparams ? pcnt : maxparams;
+        groups.push_back(group);
+      }
+    }
+  }
+  if (groups.empty()) return;
+
+  std::vector<ParameterStorage> storage(maxparams + 1);
+  size_t bytes = 0;
+  double begin = getMicroseconds();
+  for (int i = 0; i < iterations; i++){
+    for (size_t n = 0; n < groups.size(); n++){
+      int pcnt = effectlib.groupGetParameterCount(groups[n]);
+      for (int g = 0; g < NUM_GENERERATORS; g++){
+        effectlib.groupGenerateStorage(groups[n],(GeneratorType)g,pcnt + 1,&storage[0]);
+        bytes += storage[pcnt].size;
+      }
+    }
+  }
+  double end = getMicroseconds();
+
+  BenchResult& result = addResult(what, (end - begin) / 1000.0, double(iterations) * double(groups.size()) * NUM_GENERERATORS, "layouts");
+  addValue(result, "bytes", double(bytes));
+  printResult(result);
+}
+
+// scene of random draws sorted into multi draw indirect batches
+static void benchDraws(System &effectlib, const char* what, GeneratorType gentype, int numDraws, int iterations)
+{
+  std::vector<TechID> techs[2];
+  EffectType types[2] = {EFFECT_GEOMETRY, EFFECT_MATERIAL};
+  for (int t = 0; t < 2; t++){
+    int ecnt = effectlib.getEffectCount(types[t]);
+    for (int e = 0; e < ecnt; e++){
+      EffectID effect = effectlib.getEffect(types[t],e);
+      int tcnt = effectlib.effectGetTechniqueCount(effect);
+      for (int i = 0; i < tcnt; i++){
+        techs[t].push_back(effectlib.effectGetTechnique(effect,i));
+      }
+    }
+  }
+  if (techs[0].empty() || techs[1].empty() || numDraws <= 0) return;
+
+  unsigned int state = 1;
+  std::vector<DrawInput> draws(numDraws);
+  for (int i = 0; i < numDraws; i++){
+    DrawInput& draw = draws[i];
+    draw.geometry   = techs[0][synthRandom(state) % techs[0].size()];
+    draw.material   = techs[1][synthRandom(state) % techs[1].size()];
+    draw.world      = i;
+    for (int g = 0; g < DRAW_MAXGROUPS; g++){
+      draw.geometryInstances[g] = i % 4096;
+      draw.materialInstances[g] = (int)(synthRandom(state) % 1024);
+    }
+    draw.count      = 36;
+    draw.firstIndex = 0;
+    draw.baseVertex = 0;
+  }
+
+  DrawBatcher batcher;
+  batcher.init(effectlib,gentype);
+  // first build fills the technique cache
+  if (batcher.build(&draws[0],numDraws)){
+    printf("%s: build error\n",what);
+    batcher.deinit();
+    return;
+  }
+
+  // best build is less sensitive to other load
+  double best  = 0;
+  double begin = getMicroseconds();
+  for (int i = 0; i < iterations; i++){
+    double start = getMicroseconds();
+    batcher.build(&draws[0],numDraws);
+    double time  = getMicroseconds() - start;
+    best = i == 0 || time < best ? time : best;
+  }
+  double end = getMicroseconds();
+
+  BenchResult& result = addResult(what, (end - begin) / 1000.0, double(iterations) * double(numDraws), "draws");
+  addValue(result, "msPerBuild", (end - begin) / 1000.0 / double(iterations));
+  addValue(result, "msBest", best / 1000.0);
+  addValue(result, "batches", double(batcher.getBatchCount()));
+  printResult(result);
+
+  batcher.deinit();
+}
+
+// keys of all techniques, then draws sorted by them
+static void benchSortKeys(System &effectlib, const char* what, int numDraws, int iterations)
+{
+  std::vector<TechID> techs;
+  for (int t = 0; t < NUM_EFFECTS; t++){
+    int ecnt = effectlib.getEffectCount((EffectType)t);
+    for (int e = 0; e < ecnt; e++){
+      EffectID effect = effectlib.getEffect((EffectType)t,e);
+      int tcnt = effectlib.effectGetTechniqueCount(effect);
+      for (int i = 0; i < tcnt; i++){
+        techs.push_back(effectlib.effectGetTechnique(effect,i));
+      }
+    }
+  }
+  if (techs.empty() || numDraws <= 0) return;
+
+  SortKeyTable table;
+  table.init(effectlib);
+  std::vector<SortKey> techKeys(techs.size());
+  double begin = getMicroseconds();
+  for (size_t i = 0; i < techs.size(); i++){
+    table.getKey(techs[i],GENERATOR_GLSL_UBOSSBOTEX,&techKeys[i]);
+  }
+  double end = getMicroseconds();
+  double keysMs = (end - begin) / 1000.0;
+
+  unsigned int state = 1;
+  std::vector<SortKey> keys(numDraws);
+  for (int i = 0; i < numDraws; i++){
+    keys[i] = techKeys[synthRandom(state) % techKeys.size()] | (synthRandom(state) & 0xFF);
+  }
+
+  RadixSorter sorter;
+  double best = 0;
+  begin = getMicroseconds();
+  for (int i = 0; i < iterations; i++){
+    double start = getMicroseconds();
+    sorter.sort(&keys[0],numDraws);
+    double time  = getMicroseconds() - start;
+    best = i == 0 || time < best ? time : best;
+  }
+  end = getMicroseconds();
+
+  BenchResult& result = addResult(what, (end - begin) / 1000.0, double(iterations) * double(numDraws), "keys");
+  addValue(result, "msPerSort", (end - begin) / 1000.0 / double(iterations));
+  addValue(result, "msBest", best / 1000.0);
+  addValue(result, "techniqueKeysMs", keysMs);
+  addValue(result, "programs", double(table.getProgramCount()));
+  addValue(result, "bindings", double(table.getBindingCount()));
+  printResult(result);
+
+  sorter.deinit();
+  table.deinit();
+}
+
+static size_t generateAll(System &effectlib, GeneratorType gentype, size_t* outputs)
+{
+  size_t bytes = 0;
+  for (int t = 0; t < NUM_EFFECTS; t++){
+    int ecnt = effectlib.getEffectCount((EffectType)t);
+    for (int e = 0; e < ecnt; e++){
+      EffectID effect = effectlib.getEffect((EffectType)t,e);
+      int tcnt = effectlib.effectGetTechniqueCount(effect);
+      for (int i = 0; i < tcnt; i++){
+        TechID tech = effectlib.effectGetTechnique(effect,i);
+        int ccnt = effectlib.techniqueGetCodeCount(tech);
+        for (int c = 0; c < ccnt; c++){
+          const char* code;
+          size_t      codesize;
+          if (!effectlib.techniqueGenerateCodeView(tech,gentype,c,&code,&codesize)){
+            bytes += codesize;
+            (*outputs)++;
+          }
+        }
+      }
+    }
+  }
+  return bytes;
+}
+
+static void benchCodegen(System &effectlib, const char* what, GeneratorType gentype)
+{
+  SystemStats before;
+  effectlib.getStats(&before);
+  size_t outputs = 0;
+  double begin = getMicroseconds();
+  size_t bytes = generateAll(effectlib,gentype,&outputs);
+  double end = getMicroseconds();
+
+  CodeCacheStats stats;
+  effectlib.getCodeCacheStats(&stats);
+  FileCacheStats files;
+  effectlib.getFileCacheStats(&files);
+
+  BenchResult& result = addResult(what, (end - begin) / 1000.0, double(outputs), "outputs");
+  addValue(result, "bytes",       double(bytes));
+  addValue(result, "hits",        double(stats.hits));
+  addValue(result, "misses",      double(stats.misses));
+  addValue(result, "unique",      double(stats.unique));
+  addValue(result, "uniqueBytes", double(stats.uniqueBytes));
+  addValue(result, "fileReads",   double(files.reads));
+  addValue(result, "fileHits",    double(files.hits));
+
+  // time spent inside fxcodegen, the rest is cache and api overhead
+  SystemStats system;
+  effectlib.getStats(&system);
+  addValue(result, "luaUs",       double((system.codegenTime[gentype] - before.codegenTime[gentype]) / 1000));
+  addValue(result, "luaHeapBytes",double(system.luaHeapBytes));
+  printResult(result);
+
+  effectlib.resetCodeCacheStats();
+  effectlib.resetFileCacheStats();
+}
+
+static void benchCodegenAll(System &effectlib, const char* what)
+{
+  size_t outputs = 0;
+  size_t bytes   = 0;
+  double begin = getMicroseconds();
+  for (int g = 0; g < NUM_GENERERATORS; g++){
+    bytes += generateAll(effectlib,(GeneratorType)g,&outputs);
+  }
+  double end = getMicroseconds();
+
+  CodeCacheStats stats;
+  effectlib.getCodeCacheStats(&stats);
+  BenchResult& result = addResult(what, (end - begin) / 1000.0, double(outputs), "outputs");
+  addValue(result, "bytes",       double(bytes));
+  addValue(result, "hits",        double(stats.hits));
+  addValue(result, "misses",      double(stats.misses));
+  printResult(result);
+
+  effectlib.resetCodeCacheStats();
+}
+
+// cold generation spread over steps, the longest step shows the bound per frame
+static void benchCodegenSliced(System &effectlib, const char* what, GeneratorType gentype, unsigned int budgetUs)
+{
+  effectlib.clearCodeCache();
+
+  std::vector<StepID> steps;
+  for (int t = 0; t < NUM_EFFECTS; t++){
+    int ecnt = effectlib.getEffectCount((EffectType)t);
+    for (int e = 0; e < ecnt; e++){
+      EffectID effect = effectlib.getEffect((EffectType)t,e);
+      int tcnt = effectlib.effectGetTechniqueCount(effect);
+      for (int i = 0; i < tcnt; i++){
+        TechID tech = effectlib.effectGetTechnique(effect,i);
+        int ccnt = effectlib.techniqueGetCodeCount(tech);
+        for (int c = 0; c < ccnt; c++){
+          steps.push_back(effectlib.techniqueGenerateBegin(tech,gentype,c));
+        }
+      }
+    }
+  }
+
+  size_t calls   = 0;
+  size_t errors  = 0;
+  double longest = 0;
+  double begin = getMicroseconds();
+  for (size_t i = 0; i < steps.size(); i++){
+    bool done = false;
+    while (!done){
+      double stepBegin = getMicroseconds();
+      bool failed = effectlib.generateStep(steps[i],budgetUs,&done);
+      longest = std::max(longest,getMicroseconds() - stepBegin);
+      calls++;
+      if (failed){
+        errors++;
+        break;
+      }
+    }
+    effectlib.generateEnd(steps[i]);
+  }
+  double end = getMicroseconds();
+
+  BenchResult& result = addResult(what, (end - begin) / 1000.0, double(steps.size()), "outputs");
+  addValue(result, "budgetUs",    double(budgetUs));
+  addValue(result, "steps",       double(calls));
+  addValue(result, "longestUs",   longest);
+  addValue(result, "errors",      double(errors));
+  printResult(result);
+
+  effectlib.resetCodeCacheStats();
+  effectlib.resetFileCacheStats();
+}
+
+// all codes and generators of each technique per call against one call per output, both cold
+static void benchProgram(System &effectlib, const char* what)
+{
+  GeneratorType gentypes[NUM_GENERERATORS];
+  for (int g = 0; g < NUM_GENERERATORS; g++){
+    gentypes[g] = (GeneratorType)g;
+  }
+
+  effectlib.clearCodeCache();
+  size_t outputs = 0;
+  double begin = getMicroseconds();
+  for (int g = 0; g < NUM_GENERERATORS; g++){
+    generateAll(effectlib,(GeneratorType)g,&outputs);
+  }
+  double perCall = getMicroseconds() - begin;
+
+  effectlib.clearCodeCache();
+  size_t programs = 0;
+  size_t errors   = 0;
+  std::vector<ProgramCode> codes;
+  begin = getMicroseconds();
+  for (int t = 0; t < NUM_EFFECTS; t++){
+    int ecnt = effectlib.getEffectCount((EffectType)t);
+    for (int e = 0; e < ecnt; e++){
+      EffectID effect = effectlib.getEffect((EffectType)t,e);
+      int tcnt = effectlib.effectGetTechniqueCount(effect);
+      for (int i = 0; i < tcnt; i++){
+        TechID tech = effectlib.effectGetTechnique(effect,i);
+        codes.resize(NUM_GENERERATORS * effectlib.techniqueGetCodeCount(tech) + 1);
+        errors += effectlib.techniqueGenerateProgram(tech,NUM_GENERERATORS,gentypes,&codes[0]) ? 1 : 0;
+        programs++;
+      }
+    }
+  }
+  double end = getMicroseconds();
+
+  BenchResult& result = addResult(what, (end - begin) / 1000.0, double(outputs), "outputs");
+  addValue(result, "programs",    double(programs));
+  addValue(result, "perCallMs",   perCall / 1000.0);
+  addValue(result, "errors",      double(errors));
+  printResult(result);
+
+  effectlib.resetCodeCacheStats();
+  effectlib.resetFileCacheStats();
+}
+
+// memory of segmented outputs, bytes as referenced against interned segments
+static void benchSegments(System &effectlib, const char* what)
+{
+  effectlib.clearCodeCache();
+  size_t outputs  = 0;
+  size_t segments = 0;
+  size_t errors   = 0;
+  double begin = getMicroseconds();
+  for (int g = 0; g < NUM_GENERERATORS; g++){
+    for (int t = 0; t < NUM_EFFECTS; t++){
+      int ecnt = effectlib.getEffectCount((EffectType)t);
+      for (int e = 0; e < ecnt; e++){
+        EffectID effect = effectlib.getEffect((EffectType)t,e);
+        int tcnt = effectlib.effectGetTechniqueCount(effect);
+        for (int i = 0; i < tcnt; i++){
+          TechID tech = effectlib.effectGetTechnique(effect,i);
+          int ccnt = effectlib.techniqueGetCodeCount(tech);
+          for (int c = 0; c < ccnt; c++){
+            SegmentedCode code;
+            if (effectlib.techniqueGenerateSegments(tech,(GeneratorType)g,c,&code)){
+              errors++;
+              continue;
+            }
+            segments += code.count;
+            outputs++;
+          }
+        }
+      }
+    }
+  }
+  double end = getMicroseconds();
+
+  CodeCacheStats stats;
+  effectlib.getSegmentCacheStats(&stats);
+  BenchResult& result = addResult(what, (end - begin) / 1000.0, double(outputs), "outputs");
+  addValue(result, "segments",    double(segments));
+  addValue(result, "bytes",       double(stats.bytes));
+  addValue(result, "unique",      double(stats.unique));
+  addValue(result, "uniqueBytes", double(stats.uniqueBytes));
+  addValue(result, "errors",      double(errors));
+  printResult(result);
+
+  effectlib.resetCodeCacheStats();
+  effectlib.resetFileCacheStats();
+}
+
+// deferred, forward and shadow style passes with different light sets, each
+// material is prepared for all passes. Switched through setGeneratorLights or
+// with one config per pass
+static void benchLightPasses(System &effectlib, const char* what, bool configs, std::vector<EffectID>& lights, std::vector<int>& lightsMax, int rounds)
+{
+  const int numPasses = 3;
+  int numLights[numPasses];
+  LightConfigID passConfigs[numPasses];
+  for (int p = 0; p < numPasses; p++){
+    numLights[p]   = (int)lights.size() >> p;
+    passConfigs[p] = configs ? effectlib.createLightConfig(numLights[p], numLights[p] ? &lights[0] : NULL, numLights[p] ? &lightsMax[0] : NULL) : NULL;
+  }
+
+  effectlib.clearCodeCache();
+  SystemStats before;
+  effectlib.getStats(&before);
+  size_t outputs = 0;
+  size_t errors  = 0;
+  double begin = getMicroseconds();
+  for (int r = 0; r < rounds; r++){
+    int ecnt = effectlib.getEffectCount(EFFECT_MATERIAL);
+    for (int e = 0; e < ecnt; e++){
+      TechID tech = effectlib.effectGetTechnique(effectlib.getEffect(EFFECT_MATERIAL,e),0);
+      for (int p = 0; p < numPasses; p++){
+        if (!configs){
+          effectlib.setGeneratorLights(numLights[p], numLights[p] ? &lights[0] : NULL, numLights[p] ? &lightsMax[0] : NULL);
+        }
+        const char* code;
+        size_t      codesize;
+        if (configs ? effectlib.techniqueGenerateCodeView(tech,GENERATOR_GLSL_UBO,0,passConfigs[p],&code,&codesize)
+                    : effectlib.techniqueGenerateCodeView(tech,GENERATOR_GLSL_UBO,0,&code,&codesize))
+        {
+          errors++;
+          continue;
+        }
+        outputs++;
+      }
+    }
+  }
+  double end = getMicroseconds();
+  SystemStats after;
+  effectlib.getStats(&after);
+
+  BenchResult& result = addResult(what, (end - begin) / 1000.0, double(outputs), "outputs");
+  addValue(result, "codegenCalls", double(after.codegenCalls[GENERATOR_GLSL_UBO] - before.codegenCalls[GENERATOR_GLSL_UBO]));
+  addValue(result, "errors",       double(errors));
+  printResult(result);
+
+  for (int p = 0; p < numPasses; p++){
+    if (passConfigs[p]){
+      effectlib.destroyLightConfig(passConfigs[p]);
+    }
+  }
+  effectlib.setGeneratorLights((int)lights.size(), lights.empty() ? NULL : &lights[0], lights.empty() ? NULL : &lightsMax[0]);
+  effectlib.resetCodeCacheStats();
+}
+
+static bool writeJson(const char* filename, const char* library, const SynthConfig* synth)
+{
+  bool   tostdout = strcmp(filename,"-") == 0;
+  FILE*  file = tostdout ? stdout : fopen(filename,"wb");
+  if (!file) return true;
+
+  fprintf(file,"{\n  \"library\": ");
+  writeJsonString(file,library);
+  fprintf(file,",\n");
+  if (synth){
+    fprintf(file,"  \"synth\": {\"effects\": %d, \"groups\": %d, \"params\": %d, \"techniques\": %d, \"files\": %d, \"lights\": %d, \"seed\": %u},\n",
+      synth->effects, synth->groups, synth->params, synth->techniques, synth->files, synth->lights, synth->seed);
+  }
+  fprintf(file,"  \"results\": [\n");
+  for (size_t i = 0; i < s_results.size(); i++){
+    const BenchResult& result = s_results[i];
+    fprintf(file,"    {\"name\": ");
+    writeJsonString(file,result.name.c_str());
+    fprintf(file,", \"ms\": %.6f", result.ms);
+    if (result.count){
+      fprintf(file,", \"count\": %.0f, \"unit\": \"%s\", \"nsPerItem\": %.3f",
+        result.count, result.unit, result.ms * 1000000.0 / result.count);
+    }
+    for (size_t v = 0; v < result.values.size(); v++){
+      fprintf(file,", \"%s\": ", result.values[v].name);
+      fprintf(file,valueFormat(result.values[v].value), result.values[v].value);
+    }
+    fprintf(file,"}%s\n", i + 1 < s_results.size() ? "," : "");
+  }
+  fprintf(file,"  ]\n}\n");
+
+  bool failed = ferror(file) != 0;
+  if (!tostdout) fclose(file);
+  return failed;
+}
+
+static void printUsage()
+{
+  printf(
+    "usage: luafxbench [library] [iterations] [options]\n"
+    "  -json <file>        write results as json, \"-\" for stdout\n"
+    "  -synth <file>       write a synthetic library to file and benchmark it\n"
+    "  -effects <n>        synthetic materials           (1000)\n"
+    "  -groups <n>         groups per material           (3)\n"
+    "  -params <n>         parameters per group          (8)\n"
+    "  -techniques <n>     techniques per material       (2)\n"
+    "  -files <n>          shared FILE includes          (4)\n"
+    "  -lights <n>         lights                        (4)\n"
+    "  -seed <n>           parameter type selection      (1)\n"
+    "  -draws <n>          draws for the batch builder  (100000)\n"
+    "  -alloc <mode>       lua allocator: system, counted (malloc with accounting) or pooled\n");
+}
+
+int main(int argc, char **argv)
+{
+  const char* processor  = "../lua/fxlibprocessor.lua";
+  const char* library    = "../test/testfx.luafx";
+  const char* json       = NULL;
+  const char* synthfile  = NULL;
+  const char* allocmode  = "system";
+  int         iterations = -1;
+  int         numDraws   = 100000;
+
+  SynthConfig synth;
+  synth.effects    = 1000;
+  synth.groups     = 3;
+  synth.params     = 8;
+  synth.techniques = 2;
+  synth.files      = 4;
+  synth.lights     = 4;
+  synth.seed       = 1;
+
+  int positional = 0;
+  for (int i = 1; i < argc; i++){
+    const char* arg   = argv[i];
+    const char* value = i + 1 < argc ? argv[i + 1] : NULL;
+    if (arg[0] != '-' || !arg[1]){
+      if      (positional == 0) library    = arg;
+      else if (positional == 1) iterations = atoi(arg);
+      positional++;
+      continue;
+    }
+    if (!value){
+      printUsage();
+      return EXIT_FAILURE;
+    }
+    i++;
+    if      (!strcmp(arg,"-json"))        json             = value;
+    else if (!strcmp(arg,"-synth"))       synthfile        = value;
+    else if (!strcmp(arg,"-effects"))     synth.effects    = atoi(value);
+    else if (!strcmp(arg,"-groups"))      synth.groups     = atoi(value);
+    else if (!strcmp(arg,"-params"))      synth.params     = atoi(value);
+    else if (!strcmp(arg,"-techniques"))  synth.techniques = atoi(value);
+    else if (!strcmp(arg,"-files"))       synth.files      = atoi(value);
+    else if (!strcmp(arg,"-lights"))      synth.lights     = atoi(value);
+    else if (!strcmp(arg,"-seed"))        synth.seed       = (unsigned int)atoi(value);
+    else if (!strcmp(arg,"-draws"))       numDraws         = atoi(value);
+    else if (!strcmp(arg,"-alloc"))       allocmode        = value;
+    else {
+      printUsage();
+      return EXIT_FAILURE;
+    }
+  }
+  s_quiet = json && !strcmp(json,"-");
+
+  if (synthfile){
+    library = synthfile;
+    if (writeSynthLibrary(library,synth)){
+      printf("error: could not write %s\n",library);
+      return EXIT_FAILURE;
+    }
+  }
+  if (iterations < 0){
+    // large libraries take long enough per pass
+    iterations = synthfile ? 10 : 10000;
+  }
+
+  bool pooled  = !strcmp(allocmode,"pooled");
+  bool counted = !strcmp(allocmode,"counted");
+  if (!pooled && !counted && strcmp(allocmode,"system")){
+    printUsage();
+    return EXIT_FAILURE;
+  }
+  PoolAllocator allocator;
+  if (pooled || counted){
+    allocator.init(0,pooled);
+  }
+
+  System effectLib;
+
+  double begin = getMicroseconds();
+  if (pooled || counted ? effectLib.init(processor,PoolAllocator::alloc,&allocator) : effectLib.init(processor))
+  {
+    std::string error = effectLib.getLastErrorString();
+    printf("error:%s\n",error.c_str());
+    return EXIT_FAILURE;
+  }
+  double end = getMicroseconds();
+  BenchResult& init = addResult("init", (end - begin) / 1000.0, 0, "");
+
+  begin = getMicroseconds();
+  if (effectLib.addLibraryFile(library))
+  {
+    std::string error = effectLib.getLastErrorString();
+    printf("error:%s\n",error.c_str());
+    return EXIT_FAILURE;
+  }
+  end = getMicroseconds();
+
+  int numEffects = 0;
+  int numTechniques = 0;
+  for (int t = 0; t < NUM_EFFECTS; t++){
+    int ecnt = effectLib.getEffectCount((EffectType)t);
+    numEffects += ecnt;
+    for (int e = 0; e < ecnt; e++){
+      numTechniques += effectLib.effectGetTechniqueCount(effectLib.getEffect((EffectType)t,e));
+    }
+  }
+
+  if (!s_quiet){
+    printf("library: %s, allocator: %s\n",library,allocmode);
+  }
+  printResult(init);
+  BenchResult& load = addResult("addLibraryFile", (end - begin) / 1000.0, double(numEffects), "effects");
+  addValue(load, "techniques", numTechniques);
+  printResult(load);
+
+  benchMetadata(effectLib, "metadata lua", iterations);
+
+  std::vector<LookupEntry> lookups;
+  collectLookups(effectLib, lookups);
+  benchLookups(effectLib, lookups, "lookup lua string", false, iterations / 10 + 1);
+  benchStorage(effectLib, "storage lua", 1);
+
+  // codegen follows, so lua and the FILE sources stay
+  size_t reclaimed;
+  begin = getMicroseconds();
+  effectLib.freeze(FREEZE_COLLECT,&reclaimed);
+  end = getMicroseconds();
+  BenchResult& freeze = addResult("freeze", (end - begin) / 1000.0, 0, "");
+  addValue(freeze, "reclaimedBytes", double(reclaimed));
+  printResult(freeze);
+
+  benchMetadata(effectLib, "metadata frozen", iterations);
+  benchLookups(effectLib, lookups, "lookup frozen string", false, iterations);
+  benchLookups(effectLib, lookups, "lookup frozen handle", true, iterations);
+  benchStorage(effectLib, "storage frozen", iterations);
+
+  for (int g = 0; g < NUM_GENERERATORS; g++){
+    std::string what = std::string("draw batches ") + GeneratorType_toString((GeneratorType)g);
+    benchDraws(effectLib, what.c_str(), (GeneratorType)g, numDraws, 20);
+  }
+
+  int numLights = effectLib.getEffectCount(EFFECT_LIGHT);
+  std::vector<EffectID> lights;
+  std::vector<int>      lightsMax;
+  for (int i = 0; i < numLights; i++){
+    lights.push_back(effectLib.getEffect(EFFECT_LIGHT,i));
+    lightsMax.push_back(16);
+  }
+  effectLib.setGeneratorLights(numLights, numLights ? &lights[0] : NULL, numLights ? &lightsMax[0] : NULL);
+
+  for (int g = 0; g < NUM_GENERERATORS; g++){
+    std::string what = std::string("codegen cold ") + GeneratorType_toString((GeneratorType)g);
+    benchCodegen(effectLib, what.c_str(), (GeneratorType)g);
+  }
+  benchCodegenAll(effectLib, "codegen cached");
+  benchCodegenSliced(effectLib, "codegen sliced 500us", GENERATOR_GLSL_UBO, 500);
+  benchProgram(effectLib, "codegen program");
+  benchSegments(effectLib, "codegen segmented");
+  benchLightPasses(effectLib, "codegen light passes switched", false, lights, lightsMax, 10);
+  benchLightPasses(effectLib, "codegen light passes configs", true, lights, lightsMax, 10);
+  benchSortKeys(effectLib, "sort keys", numDraws, 20);
+
+  SystemStats stats;
+  effectLib.getStats(&stats);
+  BenchResult& totals = addResult("totals", 0, 0, "");
+  addValue(totals, "libraryUs",     double(stats.libraryTime / 1000));
+  addValue(totals, "groupStoreCalls",double(stats.groupStoreCalls));
+  addValue(totals, "groupStoreUs",  double(stats.groupStoreTime / 1000));
+  addValue(totals, "luaErrors",     double(stats.luaErrors));
+  addValue(totals, "luaHeapBytes",  double(stats.luaHeapBytes));
+  printResult(totals);
+
+  if (pooled || counted){
+    AllocatorStats alloc;
+    allocator.getStats(&alloc);
+    BenchResult& result = addResult(pooled ? "allocator pooled" : "allocator counted", 0, 0, "");
+    addValue(result, "allocs",    double(alloc.allocs));
+    addValue(result, "frees",     double(alloc.frees));
+    addValue(result, "reallocs",  double(alloc.reallocs));
+    addValue(result, "current",   double(alloc.current));
+    addValue(result, "peak",      double(alloc.peak));
+    addValue(result, "reserved",  double(alloc.reserved));
+    addValue(result, "large",     double(alloc.large));
+    printResult(result);
+  }
+
+  effectLib.deinit();
+  if (pooled || counted){
+    allocator.deinit();
+  }
+
+  if (json && writeJson(json,library,synthfile ? &synth : NULL)){
+    printf("error: could not write %s\n",json);
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
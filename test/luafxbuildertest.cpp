@@ -27,12 +27,35 @@
 */
 
 #include <luafxbuilder/luafxbuilder.h>
+#include <luafxbuilder/luafxbuilder_pool.h>
+#include <luafxbuilder/luafxbuilder_arena.h>
+#include <luafxbuilder/luafxbuilder_watch.h>
+#include <luafxbuilder/luafxbuilder_alloc.h>
+#include <luafxbuilder/luafxbuilder_draw.h>
+#include <luafxbuilder/luafxbuilder_service.h>
+
+#include <vector>
+#include <algorithm>
 
 
 using namespace luafxbuilder;
 
 
 
+// loads the test library into a System of the test, returns true after
+// printing the error, sys is deinitialized then
+bool initTestSystem(System &sys, const char* test, const char* libraryFile = "../test/testfx.luafx", AllocFunc alloc = NULL, void* allocud = NULL)
+{
+  if (sys.init("../lua/fxlibprocessor.lua",alloc,allocud) ||
+      sys.addLibraryFile(libraryFile))
+  {
+    printf("%s error:%s\n",test,sys.getLastErrorString().c_str());
+    sys.deinit();
+    return true;
+  }
+  return false;
+}
+
 void printGroup(System &effectlib, GroupID group)
 {
   printf("  Group: %s\n", effectlib.groupGetName(group).c_str());
@@ -43,6 +66,11 @@ void printGroup(System &effectlib, GroupID group)
     printf("   Parameter: %s %s %d %d\n", effectlib.groupGetParameterName(group,p).c_str(),
         ParameterType_toString(info.type), (int)info.arraySize, (int)info.defaultSize);
   }
+  printf("   DefaultBlock:");
+  for (int g = 0; g < NUM_GENERERATORS; g++){
+    printf(" %d", (int)effectlib.groupBuildDefaultBlock(group,(GeneratorType)g,0,NULL));
+  }
+  printf("\n");
 }
 
 void printTechique(System &effectlib, TechID tech)
@@ -54,13 +82,14 @@ void printTechique(System &effectlib, TechID tech)
     for (int g = 0; g < NUM_GENERERATORS; g++){
       GeneratorType gtype = (GeneratorType)g;
       printf("    Generator: %s\n",GeneratorType_toString(gtype));
-      std::string codegen;
+      const char* codegen;
+      size_t      codesize;
       
-      if (effectlib.techniqueGenerateCode(tech,gtype,i,codegen)){
+      if (effectlib.techniqueGenerateCodeView(tech,gtype,i,&codegen,&codesize)){
         printf("ERROR: %s\n", effectlib.getLastErrorString().c_str());
       }
       else{
-        printf("%s\n",codegen.c_str());
+        printf("%.*s\n",(int)codesize,codegen);
       }
     }
   }
@@ -81,6 +110,18 @@ void printEffect(System &effectlib, EffectID effect)
   }
 }
 
+void printLib(System &effectlib)
+{
+  for (int t = 0; t < NUM_EFFECTS; t++){
+    printf("EffectType: %s\n",EffectType_toString((EffectType)t));
+    int ecnt = effectlib.getEffectCount((EffectType)t);
+    for (int e = 0; e < ecnt; e++){
+      EffectID effect  = effectlib.getEffect((EffectType)t,e);
+      printEffect(effectlib,effect);
+    }
+  }
+}
+
 void testLib(System &effectlib)
 {
   const char* inmemory = ""
@@ -98,15 +139,1331 @@ void testLib(System &effectlib)
   if (1){
     printf("ITERATE ALL\n");
     printf("-----------\n");
+    printLib(effectlib);
+  }
+
+  if (1){
+    // output must match the one above
+    effectlib.freeze();
+    printf("ITERATE ALL FROZEN\n");
+    printf("------------------\n");
+    printLib(effectlib);
+    effectlib.unfreeze();
+  }
+}
+
+void testStorage(System &effectlib)
+{
+  // native layout rules against the lua ones, trailing entry is the struct
+  int groups     = 0;
+  int arrays     = 0;
+  int mismatches = 0;
+  for (int t = 0; t < NUM_EFFECTS; t++){
+    for (int e = 0; e < effectlib.getEffectCount((EffectType)t); e++){
+      EffectID effect = effectlib.getEffect((EffectType)t,e);
+      for (int g = 0; g < effectlib.effectGetGroupCount(effect); g++){
+        GroupID group = effectlib.effectGetGroup(effect,g);
+        int pcnt = effectlib.groupGetParameterCount(group);
+        for (int p = 0; p < pcnt; p++){
+          ParameterInfo info;
+          effectlib.groupGetParameterInfo(group,p,&info);
+          arrays += info.arraySize ? 1 : 0;
+        }
+        std::vector<ParameterStorage> native(pcnt + 1);
+        std::vector<ParameterStorage> lua(pcnt + 1);
+        for (int gen = 0; gen < NUM_GENERERATORS; gen++){
+          GeneratorType gentype = (GeneratorType)gen;
+          mismatches += effectlib.groupGenerateStorage(group,gentype,pcnt + 1,&native[0]) !=
+                        effectlib.groupGenerateStorageLua(group,gentype,pcnt + 1,&lua[0]) ? 1 : 0;
+          for (int p = 0; p <= pcnt; p++){
+            mismatches += native[p].size    != lua[p].size    ||
+                          native[p].offset  != lua[p].offset  ||
+                          native[p].stride  != lua[p].stride  ||
+                          native[p].element != lua[p].element ||
+                          native[p].align   != lua[p].align ? 1 : 0;
+          }
+        }
+        groups++;
+      }
+    }
+  }
+  printf("STORAGE %d groups, %d array parameters, mismatches: %d\n", groups, arrays, mismatches);
+}
+
+void testImage(System &effectlib)
+{
+  if (effectlib.saveImage("testfx.luafximg")){
+    printf("image error:%s\n",effectlib.getLastErrorString().c_str());
+    return;
+  }
+  effectlib.unfreeze();
+
+  System imagelib;
+  if (imagelib.initFromImage("testfx.luafximg")){
+    printf("image error:%s\n",imagelib.getLastErrorString().c_str());
+    imagelib.deinit();
+    return;
+  }
+
+  // metadata and storage must match the lua state
+  int mismatches = 0;
+  for (int t = 0; t < NUM_EFFECTS; t++){
+    int ecnt = effectlib.getEffectCount((EffectType)t);
+    mismatches += ecnt != imagelib.getEffectCount((EffectType)t);
+    for (int e = 0; e < ecnt; e++){
+      EffectID effect = effectlib.getEffect((EffectType)t,e);
+      mismatches += effectlib.effectGetName(effect) != imagelib.effectGetName(effect);
+      int gcnt = effectlib.effectGetGroupCount(effect);
+      for (int g = 0; g < gcnt; g++){
+        GroupID group = effectlib.effectGetGroup(effect,g);
+        int pcnt = effectlib.groupGetParameterCount(group);
+        std::vector<ParameterStorage> storeA(pcnt + 1);
+        std::vector<ParameterStorage> storeB(pcnt + 1);
+        for (int gen = 0; gen < NUM_GENERERATORS; gen++){
+          GeneratorType gentype = (GeneratorType)gen;
+          mismatches += effectlib.groupGenerateStorage(group,gentype,pcnt + 1,&storeA[0]) != 
+                        imagelib.groupGenerateStorage(group,gentype,pcnt + 1,&storeB[0]);
+          mismatches += effectlib.groupGenerateStorageName(group,gentype) != 
+                        imagelib.groupGenerateStorageName(group,gentype);
+          for (int p = 0; p <= pcnt; p++){
+            mismatches += storeA[p].offset != storeB[p].offset || storeA[p].size != storeB[p].size;
+          }
+        }
+      }
+    }
+  }
+  printf("IMAGE mismatches: %d\n",mismatches);
+
+  imagelib.deinit();
+
+  // overwrite each word of the image, accepted images must stay readable
+  std::vector<unsigned char> data;
+  FILE* file = fopen("testfx.luafximg","rb");
+  if (file){
+    unsigned char buffer[4096];
+    size_t read;
+    while ((read = fread(buffer,1,sizeof(buffer),file)) > 0){
+      data.insert(data.end(),buffer,buffer + read);
+    }
+    fclose(file);
+  }
+  int rejected = 0;
+  int words    = 0;
+  for (size_t pos = 0; pos + 4 <= data.size(); pos += 4, words++){
+    std::vector<unsigned char> corrupt = data;
+    memset(&corrupt[pos],0xff,4);
+    file = fopen("testfx_corrupt.luafximg","wb");
+    if (!file){
+      break;
+    }
+    fwrite(&corrupt[0],1,corrupt.size(),file);
+    fclose(file);
+
+    System sys;
+    if (sys.initFromImage("testfx_corrupt.luafximg")){
+      rejected++;
+      sys.deinit();
+      continue;
+    }
     for (int t = 0; t < NUM_EFFECTS; t++){
-      printf("EffectType: %s\n",EffectType_toString((EffectType)t));
-      int ecnt = effectlib.getEffectCount((EffectType)t);
-      for (int e = 0; e < ecnt; e++){
-        EffectID effect  = effectlib.getEffect((EffectType)t,e);
-        printEffect(effectlib,effect);
+      for (int e = 0; e < sys.getEffectCount((EffectType)t); e++){
+        EffectID effect = sys.getEffect((EffectType)t,e);
+        sys.getEffect((EffectType)t,sys.effectGetName(effect).c_str());
+        for (int g = 0; g < sys.effectGetGroupCount(effect); g++){
+          GroupID group = sys.effectGetGroup(effect,g);
+          sys.effectGetGroup(effect,sys.groupGetName(group).c_str());
+          sys.groupGetEffect(group);
+          for (int p = 0; p < sys.groupGetParameterCount(group); p++){
+            ParameterInfo info;
+            unsigned char value[256];
+            sys.groupGetParameterIndex(group,sys.groupGetParameterName(group,p).c_str());
+            sys.groupGetParameterInfo(group,p,&info);
+            sys.groupGetParameterValue(group,p,sizeof(value),value);
+          }
+          for (int gen = 0; gen < NUM_GENERERATORS; gen++){
+            std::vector<ParameterStorage> storage(sys.groupGetParameterCount(group) + 1);
+            sys.groupGenerateStorage(group,(GeneratorType)gen,(int)storage.size(),&storage[0]);
+            sys.groupGenerateStorageName(group,(GeneratorType)gen);
+          }
+        }
+        for (int i = 0; i < sys.effectGetTechniqueCount(effect); i++){
+          TechID tech = sys.effectGetTechnique(effect,i);
+          sys.effectGetTechnique(effect,sys.techniqueGetName(tech).c_str());
+          sys.techniqueGetEffect(tech);
+          if (sys.techniqueHasOption(tech,"GeometryTechnique")){
+            sys.techniqueGetOptionString(tech,"GeometryTechnique");
+          }
+          for (int c = 0; c < sys.techniqueGetCodeCount(tech); c++){
+            sys.techniqueGetCodeIndex(tech,sys.techniqueGetCodeName(tech,c).c_str());
+          }
+        }
+      }
+    }
+    for (int i = 0; i < sys.getEnumCount(); i++){
+      EnumID enumtype = sys.getEnum(i);
+      sys.getEnum(sys.enumGetName(enumtype).c_str());
+      for (int v = 0; v < sys.enumGetValueCount(enumtype); v++){
+        sys.getEnumFromValueName(sys.enumGetValueName(enumtype,v).c_str());
+      }
+    }
+    sys.deinit();
+  }
+  remove("testfx_corrupt.luafximg");
+  printf("IMAGE corrupt %d words, %d rejected\n",words,rejected);
+}
+
+void testArena(System &effectlib)
+{
+  // first instanced group of a material
+  GroupID group = 0;
+  int ecnt = effectlib.getEffectCount(EFFECT_MATERIAL);
+  for (int e = 0; e < ecnt && !group; e++){
+    EffectID effect = effectlib.getEffect(EFFECT_MATERIAL,e);
+    int gcnt = effectlib.effectGetGroupCount(effect);
+    for (int g = 0; g < gcnt && !group; g++){
+      GroupID cur = effectlib.effectGetGroup(effect,g);
+      if (effectlib.groupGetType(cur) == GROUP_INSTANCED && effectlib.groupGetParameterCount(cur)){
+        group = cur;
+      }
+    }
+  }
+  if (!group) return;
+
+  InstanceArena arena;
+  if (arena.init(effectlib,group,GENERATOR_GLSL_UBO,4)){
+    printf("arena error\n");
+    return;
+  }
+
+  int instances[8];
+  for (int i = 0; i < 8; i++){
+    instances[i] = arena.allocInstance();
+  }
+  arena.clearDirty();
+  arena.freeInstance(instances[3]);
+  int reused = arena.allocInstance();
+
+  // a full mat4 array worth of zeros
+  std::vector<unsigned char> value(sizeof(float) * 16 * 8,0);
+  arena.setParameter(instances[5],0,&value[0],value.size());
+  arena.setParameter(instances[6],0,&value[0],value.size());
+
+  printf("ARENA %s stride %d capacity %d count %d reused %d ranges %d merged %d\n",
+    effectlib.groupGetName(group).c_str(), (int)arena.getStride(), arena.getCapacity(), arena.getCount(),
+    reused == instances[3], arena.getUploadRanges(NULL,0,0), arena.getUploadRanges(NULL,0,arena.getStride()));
+
+  arena.deinit();
+  int released = arena.allocInstance();
+
+  // only indexed storage, not plain uniforms or shared groups
+  GroupID shared = effectlib.effectGetGroup(effectlib.getEffect(EFFECT_GLOBAL,0),0);
+  bool uniform   = arena.init(effectlib,group,GENERATOR_GLSL_UNIFORM,4);
+  bool global    = arena.init(effectlib,shared,GENERATOR_GLSL_UBO,4);
+  printf("ARENA after deinit %d, uniform %s, shared %s\n", released,
+    uniform ? "rejected" : "accepted", global ? "rejected" : "accepted");
+}
+
+void testDraw(System &effectlib)
+{
+  // every geometry technique with every material technique
+  std::vector<TechID> techs[2];
+  EffectType types[2] = {EFFECT_GEOMETRY, EFFECT_MATERIAL};
+  for (int t = 0; t < 2; t++){
+    int ecnt = effectlib.getEffectCount(types[t]);
+    for (int e = 0; e < ecnt; e++){
+      EffectID effect = effectlib.getEffect(types[t],e);
+      int tcnt = effectlib.effectGetTechniqueCount(effect);
+      for (int i = 0; i < tcnt; i++){
+        techs[t].push_back(effectlib.effectGetTechnique(effect,i));
+      }
+    }
+  }
+  if (techs[0].empty() || techs[1].empty()) return;
+
+  std::vector<DrawInput> draws(256);
+  for (size_t i = 0; i < draws.size(); i++){
+    DrawInput& draw = draws[i];
+    draw.geometry   = techs[0][i % techs[0].size()];
+    draw.material   = techs[1][(i / 3) % techs[1].size()];
+    draw.world      = (int)(i % 7);
+    for (int g = 0; g < DRAW_MAXGROUPS; g++){
+      draw.geometryInstances[g] = (int)((i * 5 + g) % 40);
+      draw.materialInstances[g] = (int)((i * 11 + g) % 70);
+    }
+    draw.count      = 36;
+    draw.firstIndex = (unsigned int)i * 36;
+    draw.baseVertex = 0;
+  }
+
+  for (int gen = 0; gen < NUM_GENERERATORS; gen++){
+    DrawBatcher batcher;
+    batcher.init(effectlib,(GeneratorType)gen);
+    if (batcher.build(&draws[0],(int)draws.size())){
+      printf("DRAW %s error\n",GeneratorType_toString((GeneratorType)gen));
+      continue;
+    }
+
+    // batches cover all commands in order and share techniques
+    int errors = 0;
+    int next = 0;
+    const DrawBatch*    batches  = batcher.getBatches();
+    const DrawCommand*  commands = batcher.getCommands();
+    const DrawIndices*  indices  = batcher.getIndices();
+    std::vector<int>    seen(draws.size(),0);
+    for (int b = 0; b < batcher.getBatchCount(); b++){
+      const DrawBatch& batch = batches[b];
+      errors += batch.firstCommand != next;
+      next += batch.numCommands;
+      for (int c = batch.firstCommand; c < batch.firstCommand + batch.numCommands; c++){
+        errors += commands[c].baseInstance != (unsigned int)c;
+        errors += commands[c].instanceCount != 1;
+        int d = (int)commands[c].firstIndex / 36;
+        seen[d]++;
+        errors += draws[d].geometry != batch.geometry || draws[d].material != batch.material;
+        errors += indices[c].world != draws[d].world;
+        if (gen == GENERATOR_GLSL_UBO){
+          errors += indices[c].geometryGroups[0] >= GENERATOR_UBO_MAXGROUPS ||
+                    indices[c].materialGroups[0] >= GENERATOR_UBO_MAXGROUPS;
+        }
+      }
+    }
+    if (gen == GENERATOR_GLSL_UBO){
+        // the indices stay within the arrays the generator declares
+      char define[64];
+      std::string code;
+      sprintf(define,"#define MAXGROUPS %d\n",GENERATOR_UBO_MAXGROUPS);
+      effectlib.techniqueGenerateCode(draws[0].geometry,GENERATOR_GLSL_UBO,0,code);
+      errors += code.find(define) == std::string::npos;
+    }
+    errors += next != batcher.getCommandCount();
+    for (size_t i = 0; i < seen.size(); i++){
+      errors += seen[i] != 1;
+    }
+    printf("DRAW %s draws %d batches %d errors %d\n",GeneratorType_toString((GeneratorType)gen),
+      batcher.getCommandCount(), batcher.getBatchCount(), errors);
+
+    batcher.deinit();
+  }
+}
+
+static bool lessSortKey(const std::pair<SortKey,unsigned int>& a, const std::pair<SortKey,unsigned int>& b)
+{
+  return a.first < b.first;
+}
+
+void testSortKeys(System &effectlib)
+{
+  std::vector<TechID> techs;
+  for (int t = 0; t < NUM_EFFECTS; t++){
+    int ecnt = effectlib.getEffectCount((EffectType)t);
+    for (int e = 0; e < ecnt; e++){
+      EffectID effect = effectlib.getEffect((EffectType)t,e);
+      int tcnt = effectlib.effectGetTechniqueCount(effect);
+      for (int i = 0; i < tcnt; i++){
+        techs.push_back(effectlib.effectGetTechnique(effect,i));
       }
     }
   }
+
+  SortKeyTable table;
+  table.init(effectlib);
+  for (int gen = 0; gen < NUM_GENERERATORS; gen++){
+    GeneratorType gentype = (GeneratorType)gen;
+    std::vector<SortKey> keys(techs.size());
+    int errors = 0;
+    for (size_t i = 0; i < techs.size(); i++){
+      errors += table.getKey(techs[i],gentype,&keys[i]);
+    }
+
+    // same program field means identical code
+    int mismatches = 0;
+    for (size_t a = 0; a < techs.size(); a++){
+      for (size_t b = a + 1; b < techs.size(); b++){
+        SortKey mask = 0xFFFFFFULL << SORTKEY_PROGRAM_SHIFT;
+        if ((keys[a] & mask) != (keys[b] & mask)) continue;
+        int codes = effectlib.techniqueGetCodeCount(techs[a]);
+        mismatches += codes != effectlib.techniqueGetCodeCount(techs[b]);
+        for (int c = 0; c < codes && c < effectlib.techniqueGetCodeCount(techs[b]); c++){
+          CodeHash hashA;
+          CodeHash hashB;
+          effectlib.techniqueGenerateCodeHash(techs[a],gentype,c,&hashA,NULL);
+          effectlib.techniqueGenerateCodeHash(techs[b],gentype,c,&hashB,NULL);
+          mismatches += hashA != hashB;
+        }
+      }
+    }
+    printf("SORTKEY %s %d techniques, errors %d, mismatches: %d\n",GeneratorType_toString(gentype),
+      (int)techs.size(), errors, mismatches);
+  }
+  printf("SORTKEY %d programs %d bindings\n",table.getProgramCount(),table.getBindingCount());
+  table.deinit();
+
+  // radix sort must match a stable sort
+  std::vector<SortKey> keys(5000);
+  std::vector<std::pair<SortKey,unsigned int> > pairs(keys.size());
+  unsigned int state = 1;
+  for (size_t i = 0; i < keys.size(); i++){
+    state = state * 1664525 + 1013904223;
+    keys[i]  = ((SortKey)(state >> 28) << 40) | (i % 3 ? (state >> 8) & 0xFFF : 0);
+    pairs[i] = std::make_pair(keys[i],(unsigned int)i);
+  }
+  std::stable_sort(pairs.begin(),pairs.end(),lessSortKey);
+  RadixSorter sorter;
+  sorter.sort(&keys[0],(int)keys.size());
+  int mismatches = sorter.getCount() != (int)keys.size();
+  for (size_t i = 0; i < keys.size(); i++){
+    mismatches += sorter.getKeys()[i] != pairs[i].first || sorter.getOrder()[i] != pairs[i].second;
+  }
+  sorter.deinit();
+  printf("SORTKEY radix sort mismatches: %d\n",mismatches);
+}
+
+struct ServiceOrder {
+  CodeService*      service;
+  std::vector<int>  priorities;   // appended on the generator thread
+};
+
+static void serviceCallback(CodeRequest* request, void* userdata)
+{
+  ServiceOrder* order = (ServiceOrder*)userdata;
+  order->priorities.push_back(order->service->getPriority(request));
+}
+
+void testService(System &effectlib)
+{
+  CodeService service;
+  if (service.init("../lua/fxlibprocessor.lua") ||
+      service.getSystem()->addLibraryFile("../test/testfx.luafx"))
+  {
+    printf("service error:%s\n",service.getSystem()->getLastErrorString().c_str());
+    service.deinit();
+    return;
+  }
+
+  // requests queue up while stopped, priorities decide the order on start
+  std::vector<CodeRequest*> requests;
+  std::vector<int>          priorities;
+  ServiceOrder              order;
+  order.service = &service;
+  for (int t = 0; t < NUM_EFFECTS; t++){
+    int ecnt = effectlib.getEffectCount((EffectType)t);
+    for (int e = 0; e < ecnt; e++){
+      EffectID effect = effectlib.getEffect((EffectType)t,e);
+      int tcnt = effectlib.effectGetTechniqueCount(effect);
+      for (int i = 0; i < tcnt; i++){
+        TechID tech = effectlib.effectGetTechnique(effect,i);
+        int ccnt = effectlib.techniqueGetCodeCount(tech);
+        for (int c = 0; c < ccnt; c++){
+          int priority = (int)(requests.size() * 7) % 5;
+          requests.push_back(service.request(tech,GENERATOR_GLSL_UBO,c,priority,serviceCallback,&order));
+          priorities.push_back(priority);
+        }
+      }
+    }
+  }
+
+  int cancelled = 0;
+  for (size_t i = 0; i < requests.size(); i += 4){
+    cancelled += service.cancel(requests[i]);
+  }
+  int pending = service.getPendingCount();
+  service.start();
+
+  int mismatches = 0;
+  int done = 0;
+  for (size_t i = 0; i < requests.size(); i++){
+    RequestStatus status = service.wait(requests[i]);
+    if (status == REQUEST_CANCELLED) continue;
+    done += status == REQUEST_DONE;
+
+    std::string codegen;
+    effectlib.techniqueGenerateCode(service.getTechnique(requests[i]),GENERATOR_GLSL_UBO,service.getCodeIndex(requests[i]),codegen);
+    size_t size;
+    const char* code = service.getCode(requests[i],&size);
+    mismatches += !code || codegen != std::string(code,size);
+  }
+  service.stop();
+
+  // callbacks ran in priority order
+  int reordered = 0;
+  std::vector<int> sorted;
+  for (size_t i = 0; i < requests.size(); i++){
+    if (service.getStatus(requests[i]) != REQUEST_CANCELLED) sorted.push_back(priorities[i]);
+  }
+  std::stable_sort(sorted.begin(),sorted.end(),std::greater<int>());
+  reordered += order.priorities != sorted;
+
+  for (size_t i = 0; i < requests.size(); i++){
+    // the final status stays signalled for later waits
+    mismatches += service.wait(requests[i]) != service.getStatus(requests[i]);
+    service.release(requests[i]);
+  }
+  printf("SERVICE %d requests, %d cancelled, %d pending, %d done, %d callbacks, mismatches: %d\n",
+    (int)requests.size(), cancelled, pending, done, (int)order.priorities.size(), mismatches + reordered);
+
+  service.deinit();
+}
+
+void testProgram(System &effectlib)
+{
+  System sys;
+  if (initTestSystem(sys,"program")){
+    return;
+  }
+
+  GeneratorType gentypes[NUM_GENERERATORS];
+  for (int g = 0; g < NUM_GENERERATORS; g++){
+    gentypes[g] = (GeneratorType)g;
+  }
+
+  int programs   = 0;
+  int outputs    = 0;
+  int errors     = 0;
+  int mismatches = 0;
+  std::vector<ProgramCode> codes;
+  for (int t = 0; t < NUM_EFFECTS; t++){
+    for (int e = 0; e < sys.getEffectCount((EffectType)t); e++){
+      EffectID effect = sys.getEffect((EffectType)t,e);
+      for (int i = 0; i < sys.effectGetTechniqueCount(effect); i++){
+        TechID tech = sys.effectGetTechnique(effect,i);
+        int numCodes = sys.techniqueGetCodeCount(tech);
+        codes.resize(NUM_GENERERATORS * numCodes + 1);
+        if (sys.techniqueGenerateProgram(tech,NUM_GENERERATORS,gentypes,&codes[0])){
+          errors++;
+          continue;
+        }
+        for (int c = 0; c < NUM_GENERERATORS * numCodes; c++){
+          std::string reference;
+          effectlib.techniqueGenerateCode(tech,codes[c].gentype,codes[c].codeidx,reference);
+          mismatches += codes[c].codeidx != c % numCodes || !codes[c].code ||
+                        reference != std::string(codes[c].code,codes[c].codesize) ? 1 : 0;
+        }
+        programs++;
+        outputs += NUM_GENERERATORS * numCodes;
+      }
+    }
+  }
+
+  // served from the cache
+  SystemStats before;
+  SystemStats after;
+  sys.getStats(&before);
+  TechID tech = sys.effectGetTechnique(sys.getEffect(EFFECT_MATERIAL,0),0);
+  sys.techniqueGenerateProgram(tech,NUM_GENERERATORS,gentypes,&codes[0]);
+  sys.getStats(&after);
+
+  printf("PROGRAM %d programs, %d outputs, %d errors, cached %s, mismatches: %d\n", programs, outputs, errors,
+    before.codegenCalls[GENERATOR_GLSL_UBO] == after.codegenCalls[GENERATOR_GLSL_UBO] ? "ok" : "regenerated", mismatches);
+  sys.deinit();
+}
+
+void testSegments(System &effectlib)
+{
+  System sys;
+  if (initTestSystem(sys,"segments")){
+    return;
+  }
+
+  int outputs    = 0;
+  int errors     = 0;
+  int mismatches = 0;
+  for (int e = 0; e < sys.getEffectCount(EFFECT_MATERIAL); e++){
+    TechID tech = sys.effectGetTechnique(sys.getEffect(EFFECT_MATERIAL,e),0);
+    for (int g = 0; g < NUM_GENERERATORS; g++){
+      for (int c = 0; c < sys.techniqueGetCodeCount(tech); c++){
+        SegmentedCode code;
+        if (sys.techniqueGenerateSegments(tech,(GeneratorType)g,c,&code)){
+          errors++;
+          continue;
+        }
+        std::string joined;
+        for (int i = 0; i < code.count; i++){
+          joined.append(code.strings[i],code.lengths[i]);
+          mismatches += strlen(code.strings[i]) != (size_t)code.lengths[i] ? 1 : 0;
+        }
+        std::string reference;
+        CodeHash    hash;
+        effectlib.techniqueGenerateCode(tech,(GeneratorType)g,c,reference);
+        effectlib.techniqueGenerateCodeHash(tech,(GeneratorType)g,c,&hash,NULL);
+        mismatches += joined != reference || joined.size() != code.size || hash != code.hash ? 1 : 0;
+        outputs++;
+      }
+    }
+  }
+
+  CodeCacheStats stats;
+  sys.getSegmentCacheStats(&stats);
+  printf("SEGMENTS %d outputs, %d errors, shared %s, mismatches: %d\n", outputs, errors,
+    stats.uniqueBytes < stats.bytes ? "ok" : "none", mismatches);
+
+  sys.clearCodeCache();
+  sys.getSegmentCacheStats(&stats);
+  printf("SEGMENTS after clear %d entries %d segments %d bytes\n",(int)stats.entries,(int)stats.unique,(int)stats.uniqueBytes);
+  sys.deinit();
+}
+
+void testLights()
+{
+  System sys;
+  System ref;
+  if (initTestSystem(sys,"lights")){
+    return;
+  }
+  if (initTestSystem(ref,"lights")){
+    sys.deinit();
+    return;
+  }
+
+  // all lights, and only the first one with a different max
+  int numLights = sys.getEffectCount(EFFECT_LIGHT);
+  std::vector<EffectID> lights[2];
+  std::vector<EffectID> refLights[2];
+  std::vector<int>      lightsMax[2];
+  for (int i = 0; i < numLights; i++){
+    for (int s = 0; s < 2; s++){
+      if (s == 1 && i > 0) continue;
+      lights[s].push_back(sys.getEffect(EFFECT_LIGHT,i));
+      refLights[s].push_back(ref.getEffect(EFFECT_LIGHT,i));
+      lightsMax[s].push_back(s == 0 ? 4 : 8);
+    }
+  }
+  LightConfigID configs[2];
+  for (int s = 0; s < 2; s++){
+    int num = (int)lights[s].size();
+    configs[s] = sys.createLightConfig(num, num ? &lights[s][0] : NULL, num ? &lightsMax[s][0] : NULL);
+  }
+
+  std::vector<TechID> techs;
+  std::vector<TechID> refTechs;
+  for (int e = 0; e < sys.getEffectCount(EFFECT_MATERIAL); e++){
+    TechID tech = sys.effectGetTechnique(sys.getEffect(EFFECT_MATERIAL,e),0);
+    if (sys.techniqueHasLighting(tech)){
+      techs.push_back(tech);
+      refTechs.push_back(ref.effectGetTechnique(ref.getEffect(EFFECT_MATERIAL,e),0));
+    }
+  }
+
+  int outputs    = 0;
+  int errors     = 0;
+  int mismatches = 0;
+  int different  = 0;
+  for (int s = 0; s < 2; s++){
+    int num = (int)refLights[s].size();
+    ref.setGeneratorLights(num, num ? &refLights[s][0] : NULL, num ? &lightsMax[s][0] : NULL);
+    for (size_t t = 0; t < techs.size(); t++){
+      for (int g = 0; g < NUM_GENERERATORS; g++){
+        const char* code;
+        size_t      codesize;
+        if (sys.techniqueGenerateCodeView(techs[t],(GeneratorType)g,0,configs[s],&code,&codesize)){
+          errors++;
+          continue;
+        }
+        std::string reference;
+        ref.techniqueGenerateCode(refTechs[t],(GeneratorType)g,0,reference);
+        mismatches += reference != std::string(code,codesize) ? 1 : 0;
+        if (s == 1){
+          const char* other;
+          size_t      othersize;
+          sys.techniqueGenerateCodeView(techs[t],(GeneratorType)g,0,configs[0],&other,&othersize);
+          different += std::string(code,codesize) != std::string(other,othersize) ? 1 : 0;
+        }
+        outputs++;
+      }
+    }
+  }
+
+  // switching configurations is served from the cache
+  SystemStats before;
+  SystemStats after;
+  sys.getStats(&before);
+  for (size_t t = 0; t < techs.size(); t++){
+    for (int s = 0; s < 2; s++){
+      const char* code;
+      size_t      codesize;
+      sys.techniqueGenerateCodeView(techs[t],GENERATOR_GLSL_UBO,0,configs[s],&code,&codesize);
+    }
+  }
+  sys.getStats(&after);
+  bool cached = before.codegenCalls[GENERATOR_GLSL_UBO] == after.codegenCalls[GENERATOR_GLSL_UBO];
+
+  // the other entry points honor the configuration
+  if (!techs.empty()){
+    TechID tech = techs.back();
+    sys.clearCodeCache();
+    StepID step = sys.techniqueGenerateBegin(tech,GENERATOR_GLSL_UBO,0,configs[1]);
+    bool done = false;
+    while (!done && !sys.generateStep(step,0,&done));
+    sys.generateEnd(step);
+    SegmentedCode segments;
+    std::vector<ProgramCode> program(sys.techniqueGetCodeCount(tech));
+    GeneratorType gentype = GENERATOR_GLSL_UBO;
+    sys.techniqueGenerateSegments(tech,GENERATOR_GLSL_UBO,0,configs[1],&segments);
+    sys.techniqueGenerateProgram(tech,configs[1],1,&gentype,&program[0]);
+    const char* code;
+    size_t      codesize;
+    sys.techniqueGenerateCodeView(tech,GENERATOR_GLSL_UBO,0,configs[1],&code,&codesize);
+    std::string joined;
+    for (int i = 0; i < segments.count; i++){
+      joined.append(segments.strings[i],segments.lengths[i]);
+    }
+    std::string reference;
+    ref.techniqueGenerateCode(refTechs.back(),GENERATOR_GLSL_UBO,0,reference);
+    mismatches += reference != std::string(code,codesize) || reference != joined ||
+                  reference != std::string(program[0].code,program[0].codesize) ? 1 : 0;
+  }
+
+  // default lights stay untouched by the configurations
+  std::string plain;
+  std::string refplain;
+  if (!techs.empty()){
+    ref.setGeneratorLights(0,NULL,NULL);
+    sys.techniqueGenerateCode(techs[0],GENERATOR_GLSL_UBO,0,plain);
+    ref.techniqueGenerateCode(refTechs[0],GENERATOR_GLSL_UBO,0,refplain);
+  }
+  mismatches += plain != refplain ? 1 : 0;
+
+  // only the code of the last 4 sets of setGeneratorLights stays cached
+  CodeCacheStats recent;
+  recent.entries = 0;
+  for (int m = 1; m <= 6 && !techs.empty() && numLights; m++){
+    ref.setGeneratorLights(1,&refLights[1][0],&m);
+    ref.techniqueGenerateCode(refTechs[0],GENERATOR_GLSL_UBO,0,refplain);
+    ref.getCodeCacheStats(&recent);
+  }
+  mismatches += !techs.empty() && numLights && recent.entries != 4 ? 1 : 0;
+
+  printf("LIGHTS %d techniques, %d outputs, %d errors, %d differ, cached %s, recent %d entries, mismatches: %d\n", (int)techs.size(), outputs, errors,
+    different, cached ? "ok" : "regenerated", (int)recent.entries, mismatches);
+
+  sys.destroyLightConfig(configs[0]);
+  sys.destroyLightConfig(configs[1]);
+  ref.deinit();
+  sys.deinit();
+}
+
+void testDedup()
+{
+  System sys;
+  if (initTestSystem(sys,"dedup")){
+    return;
+  }
+  if (sys.addLibraryFile("../test/testdedupfx.luafx")){
+    printf("dedup error:%s\n",sys.getLastErrorString().c_str());
+    sys.deinit();
+    return;
+  }
+
+  // the vertex shader of the lit dedup technique does not read the lights,
+  // every light set generates byte-identical code under its own cache key
+  TechID    tech = sys.effectGetTechnique(sys.getEffect(EFFECT_MATERIAL,"dedup"),0);
+  EffectID  lights[2] = {sys.getEffect(EFFECT_LIGHT,0), sys.getEffect(EFFECT_LIGHT,1)};
+  int       lightsMax[2] = {4,4};
+
+  const char* code[2];
+  size_t      codesize[2];
+  CodeHash    hash[2];
+  CodeOutput  canonical[2];
+  int mismatches = 0;
+  for (int i = 0; i < 2; i++){
+    sys.setGeneratorLights(1,&lights[i],&lightsMax[i]);
+    if (sys.techniqueGenerateCodeView(tech,GENERATOR_GLSL_UBO,0,&code[i],&codesize[i]) ||
+        sys.techniqueGenerateCodeHash(tech,GENERATOR_GLSL_UBO,0,&hash[i],&canonical[i]))
+    {
+      printf("dedup error:%s\n",sys.getLastErrorString().c_str());
+      sys.deinit();
+      return;
+    }
+    // the first light set generated it, both keys report it as canonical
+    if (canonical[i].tech != tech || canonical[i].gentype != GENERATOR_GLSL_UBO || canonical[i].codeidx != 0){
+      mismatches++;
+    }
+  }
+  CodeCacheStats stats;
+  sys.getCodeCacheStats(&stats);
+  std::string original(code[0],codesize[0]);
+  int shared = code[0] == code[1] && hash[0] == hash[1] ? 1 : 0;
+  if (!shared || stats.entries != 2 || stats.unique != 1){
+    mismatches++;
+  }
+
+  // erasing the canonical key must promote the other user of the string
+  sys.clearCodeCache();
+  sys.setGeneratorLights(0,NULL,NULL);
+  // fresh light sets, setGeneratorLights keeps the ones above recent
+  int           configMax[2] = {2,2};
+  LightConfigID configs[2];
+  for (int i = 0; i < 2; i++){
+    configs[i] = sys.createLightConfig(1,&lights[i],&configMax[i]);
+    sys.techniqueGenerateCodeView(tech,GENERATOR_GLSL_UBO,0,configs[i],&code[i],&codesize[i]);
+  }
+  SystemStats before;
+  sys.getStats(&before);
+  sys.destroyLightConfig(configs[0]);
+  CodeCacheStats erased;
+  sys.getCodeCacheStats(&erased);
+
+  const char* survivor = NULL;
+  size_t      survivorsize = 0;
+  CodeHash    survivorhash = 0;
+  CodeOutput  survivorcanonical;
+  bool failed = sys.techniqueGenerateCodeView(tech,GENERATOR_GLSL_UBO,0,configs[1],&survivor,&survivorsize) ||
+                sys.techniqueGenerateCodeHash(tech,GENERATOR_GLSL_UBO,0,configs[1],&survivorhash,&survivorcanonical);
+  SystemStats after;
+  sys.getStats(&after);
+  bool promoted = !failed && survivor == code[1] && survivorhash == hash[0] &&
+                  survivorcanonical.tech == tech && survivorcanonical.codeidx == 0 &&
+                  std::string(survivor,survivorsize) == original &&
+                  before.codegenCalls[GENERATOR_GLSL_UBO] == after.codegenCalls[GENERATOR_GLSL_UBO];
+  if (!promoted || erased.entries != 1 || erased.unique != 1){
+    mismatches++;
+  }
+
+  sys.destroyLightConfig(configs[1]);
+  CodeCacheStats released;
+  sys.getCodeCacheStats(&released);
+  if (released.entries != 0 || released.unique != 0){
+    mismatches++;
+  }
+
+  printf("DEDUP lights %d entries %d unique %d shared, canonical %s, released %d entries, mismatches: %d\n",
+    (int)stats.entries,(int)stats.unique,shared, promoted ? "promoted" : "lost", (int)released.entries, mismatches);
+
+  sys.deinit();
+}
+
+void testStep(System &effectlib)
+{
+  System sys;
+  if (initTestSystem(sys,"step")){
+    return;
+  }
+
+  // interleave all outputs with zero budget, each step advances one code block
+  std::vector<StepID>   steps;
+  std::vector<TechID>   techs;
+  for (int e = 0; e < sys.getEffectCount(EFFECT_MATERIAL); e++){
+    TechID tech = sys.effectGetTechnique(sys.getEffect(EFFECT_MATERIAL,e),0);
+    for (int g = 0; g < NUM_GENERERATORS; g++){
+      steps.push_back(sys.techniqueGenerateBegin(tech,(GeneratorType)g,0));
+      techs.push_back(tech);
+    }
+  }
+  // one miss per step, slices do not count
+  CodeCacheStats begun;
+  sys.getCodeCacheStats(&begun);
+
+  int calls  = 0;
+  int errors = 0;
+  int open   = (int)steps.size();
+  while (open){
+    open = 0;
+    for (size_t i = 0; i < steps.size(); i++){
+      bool done;
+      errors += sys.generateStep(steps[i],0,&done) ? 1 : 0;
+      open   += done ? 0 : 1;
+      calls++;
+    }
+    // restarts in flight steps
+    if (calls == (int)steps.size() * 2){
+      sys.clearCodeCache();
+    }
+    // synchronous generation while steps are suspended
+    if (calls == (int)steps.size() * 3){
+      std::string codegen;
+      sys.techniqueGenerateCode(techs[0],GENERATOR_GLSL_UBO,0,codegen);
+    }
+  }
+  CodeCacheStats sliced;
+  sys.getCodeCacheStats(&sliced);
+
+  int mismatches = begun.misses != steps.size() || sliced.misses != begun.misses + 1 ? 1 : 0;
+  for (size_t i = 0; i < steps.size(); i++){
+    const char* code;
+    size_t      size;
+    std::string reference;
+    effectlib.techniqueGenerateCode(techs[i],(GeneratorType)(i % NUM_GENERERATORS),0,reference);
+    mismatches += sys.techniqueGenerateCodeView(techs[i],(GeneratorType)(i % NUM_GENERERATORS),0,&code,&size) ||
+                  reference != std::string(code,size) ? 1 : 0;
+  }
+  CodeOutput outputs[64];
+  int dependents = sys.getDependentCode("../test/testfx.luafx",64,outputs);
+
+  printf("STEP %d outputs, %s, %d errors, dependents %d, mismatches: %d\n",(int)steps.size(),
+    calls > (int)steps.size() * 3 ? "sliced" : "not sliced", errors, dependents, mismatches);
+
+  for (size_t i = 0; i < steps.size(); i++){
+    sys.generateEnd(steps[i]);
+  }
+  // ends with a suspended coroutine
+  StepID step = sys.techniqueGenerateBegin(techs[0],GENERATOR_GLSL_UBOSSBOTEX,0);
+  bool done;
+  sys.clearCodeCache();
+  sys.generateStep(step,0,&done);
+  printf("STEP suspended %s\n",done ? "no" : "yes");
+  sys.deinit();
+}
+
+void testAlloc(System &effectlib)
+{
+  PoolAllocator allocator;
+  allocator.init(0,true);
+
+  System sys;
+  if (initTestSystem(sys,"alloc","../test/testfx.luafx",PoolAllocator::alloc,&allocator)){
+    allocator.deinit();
+    return;
+  }
+
+  // ids match effectlib, both loaded the same file
+  int mismatches = 0;
+  for (int e = 0; e < sys.getEffectCount(EFFECT_MATERIAL); e++){
+    EffectID effect = sys.getEffect(EFFECT_MATERIAL,e);
+    TechID tech = sys.effectGetTechnique(effect,0);
+    for (int g = 0; g < NUM_GENERERATORS; g++){
+      std::string codegen;
+      std::string reference;
+      sys.techniqueGenerateCode(tech,(GeneratorType)g,0,codegen);
+      effectlib.techniqueGenerateCode(tech,(GeneratorType)g,0,reference);
+      mismatches += codegen != reference ? 1 : 0;
+    }
+  }
+
+  AllocatorStats stats;
+  allocator.getStats(&stats);
+  printf("ALLOC pooled %s, peak %s, mismatches: %d\n", stats.allocs && stats.reserved ? "ok" : "missing",
+    stats.peak >= stats.current ? "ok" : "wrong", mismatches);
+  sys.deinit();
+
+  allocator.getStats(&stats);
+  printf("ALLOC after deinit current %d\n",(int)stats.current);
+
+  // the limit turns into lua memory errors
+  allocator.resetStats();
+  allocator.setLimit(64 * 1024);
+  if (sys.init("../lua/fxlibprocessor.lua",PoolAllocator::alloc,&allocator)){
+    allocator.getStats(&stats);
+    printf("ALLOC limit error %s, failures %s\n", sys.getLastErrorString(NULL,0) ? "ok" : "missing",
+      stats.failures ? "ok" : "missing");
+  }
+  sys.deinit();
+  allocator.deinit();
+}
+
+void testFreeze(System &effectlib)
+{
+  System sys;
+  if (initTestSystem(sys,"freeze")){
+    return;
+  }
+
+  // normals reads a FILE source
+  EffectID normals = sys.getEffect(EFFECT_MATERIAL,"normals");
+  TechID   tech    = sys.effectGetTechnique(normals,0);
+  std::string reference;
+  sys.techniqueGenerateCode(tech,GENERATOR_GLSL_UBO,0,reference);
+
+  size_t reclaimed;
+  sys.freeze(FREEZE_COLLECT | FREEZE_STOPGC | FREEZE_DROPFILES,&reclaimed);
+  FileCacheStats files;
+  sys.getFileCacheStats(&files);
+  SystemStats before;
+  sys.getStats(&before);
+  std::string name = sys.effectGetName(normals);
+  SystemStats after;
+  sys.getStats(&after);
+  printf("FREEZE stopgc reclaimed %s, file entries %d, query heap growth %d\n", reclaimed ? "ok" : "missing",
+    (int)files.entries, (int)(after.luaHeapBytes - before.luaHeapBytes));
+
+  // generating while stopped still works, files are read again
+  std::string codegen;
+  sys.clearCodeCache();
+  sys.techniqueGenerateCode(tech,GENERATOR_GLSL_UBO,0,codegen);
+  sys.getFileCacheStats(&files);
+  printf("FREEZE stopgc codegen %s, file reads %d, collected %s\n", codegen == reference ? "ok" : "mismatch",
+    (int)files.reads, sys.collectGarbage() ? "ok" : "missing");
+
+  // without lua only cached code and the snapshot remain
+  sys.freeze(FREEZE_RELEASELUA,&reclaimed);
+  const char* code;
+  size_t      codesize;
+  bool cached   = !sys.techniqueGenerateCodeView(tech,GENERATOR_GLSL_UBO,0,&code,&codesize) &&
+                  std::string(code,codesize) == reference;
+  bool uncached = !sys.techniqueGenerateCodeView(tech,GENERATOR_GLSL_UNIFORM,0,&code,&codesize);
+  bool added    = !sys.addLibraryString("",0);
+  int  materials = sys.getEffectCount(EFFECT_MATERIAL);
+  printf("FREEZE release reclaimed %s, frozen %d, cached %d, uncached %d, added %d, materials %s\n", 
+    reclaimed ? "ok" : "missing", sys.isFrozen(), cached, uncached, added,
+    materials == effectlib.getEffectCount(EFFECT_MATERIAL) ? "ok" : "mismatch");
+
+  sys.deinit();
+}
+
+void testPool(System &effectlib)
+{
+  SystemPool pool;
+  if (pool.init("../lua/fxlibprocessor.lua",4) ||
+      pool.addLibraryFile("../test/testfx.luafx"))
+  {
+    printf("pool error:%s\n",pool.getLastErrorString().c_str());
+    pool.deinit();
+    return;
+  }
+
+  // ids are assigned in load order, so they are valid in effectlib as well
+  System* sys = pool.getSystem();
+  std::vector<CodeJob> jobs;
+  for (int t = 0; t < NUM_EFFECTS; t++){
+    int ecnt = sys->getEffectCount((EffectType)t);
+    for (int e = 0; e < ecnt; e++){
+      EffectID effect = sys->getEffect((EffectType)t,e);
+      int tcnt = sys->effectGetTechniqueCount(effect);
+      for (int i = 0; i < tcnt; i++){
+        TechID tech = sys->effectGetTechnique(effect,i);
+        int ccnt = sys->techniqueGetCodeCount(tech);
+        for (int c = 0; c < ccnt; c++){
+          for (int g = 0; g < NUM_GENERERATORS; g++){
+            CodeJob job;
+            job.tech    = tech;
+            job.gentype = (GeneratorType)g;
+            job.codeidx = c;
+            jobs.push_back(job);
+          }
+        }
+      }
+    }
+  }
+
+  // repeated jobs run on other workers, they still share the string
+  size_t numUnique = jobs.size();
+  for (size_t i = 0; i < numUnique && i < 8; i++){
+    jobs.push_back(jobs[i]);
+  }
+
+  printf("POOL %d jobs %d workers\n",(int)jobs.size(),pool.getWorkerCount());
+  printf("-----------\n");
+  if (!jobs.empty() && pool.generate(&jobs[0],(int)jobs.size())){
+    printf("pool error:%s\n",pool.getLastErrorString().c_str());
+  }
+  int mismatches = 0;
+  for (size_t i = numUnique; i < jobs.size(); i++){
+    mismatches += !jobs[i].failed && jobs[i].code != jobs[i - numUnique].code ? 1 : 0;
+  }
+  for (size_t i = 0; i < jobs.size(); i++){
+    std::string codegen;
+    CodeHash hash = 0;
+    bool failed = effectlib.techniqueGenerateCode(jobs[i].tech,jobs[i].gentype,jobs[i].codeidx,codegen) ||
+                  effectlib.techniqueGenerateCodeHash(jobs[i].tech,jobs[i].gentype,jobs[i].codeidx,&hash,NULL);
+    if (failed != jobs[i].failed || 
+        (!failed && (codegen != std::string(jobs[i].code,jobs[i].codeSize) || hash != jobs[i].hash)))
+    {
+      mismatches++;
+    }
+  }
+  printf("mismatches: %d\n",mismatches);
+
+  // identical code shares one string, the canonical output generated it first
+  CodeCacheStats stats;
+  effectlib.getCodeCacheStats(&stats);
+  int shared = 0;
+  for (size_t i = 0; i < jobs.size(); i++){
+    CodeHash   hash;
+    CodeOutput canonical;
+    const char* code;
+    size_t      codesize;
+    if (jobs[i].failed ||
+        effectlib.techniqueGenerateCodeHash(jobs[i].tech,jobs[i].gentype,jobs[i].codeidx,&hash,&canonical) ||
+        effectlib.techniqueGenerateCodeView(canonical.tech,canonical.gentype,canonical.codeidx,&code,&codesize))
+    {
+      continue;
+    }
+    if (canonical.tech != jobs[i].tech || canonical.gentype != jobs[i].gentype || canonical.codeidx != jobs[i].codeidx){
+      shared++;
+      if (std::string(code,codesize) != std::string(jobs[i].code,jobs[i].codeSize)){
+        mismatches++;
+      }
+    }
+  }
+  printf("DEDUP %d entries %d unique %d shared, mismatches: %d\n",(int)stats.entries,(int)stats.unique,shared,mismatches);
+
+  pool.deinit();
+}
+
+void testDependencies(System &effectlib)
+{
+  // testLib generated all code, query what a change would invalidate
+  int fcnt = effectlib.getLibraryFileCount();
+  for (int i = 0; i < fcnt; i++){
+    std::string filename = effectlib.getLibraryFileName(i);
+    int cnt = effectlib.getDependentCode(filename.c_str(),0,NULL);
+    std::vector<CodeOutput> outputs(cnt + 1);
+    effectlib.getDependentCode(filename.c_str(),cnt,&outputs[0]);
+    printf("DEPENDENCIES %s: %d outputs\n",filename.c_str(),cnt);
+    for (int o = 0; o < cnt && o < 4; o++){
+      printf("  %s %s %s\n",effectlib.techniqueGetName(outputs[o].tech).c_str(),
+        effectlib.techniqueGetCodeName(outputs[o].tech,outputs[o].codeidx).c_str(),
+        GeneratorType_toString(outputs[o].gentype));
+    }
+  }
+
+  for (int t = 0; t < NUM_EFFECTS; t++){
+    if (t == EFFECT_MATERIAL) continue;
+    int ecnt = effectlib.getEffectCount((EffectType)t);
+    for (int e = 0; e < ecnt; e++){
+      EffectID effect = effectlib.getEffect((EffectType)t,e);
+      printf("DEPENDENCIES %s %s: %d outputs\n",EffectType_toString((EffectType)t),
+        effectlib.effectGetName(effect).c_str(),effectlib.getDependentCode(effect,0,NULL));
+    }
+  }
+}
+
+static void collectIds(System &effectlib, std::vector<std::string>& names, std::vector<size_t>& ids)
+{
+  for (int t = 0; t < NUM_EFFECTS; t++){
+    int ecnt = effectlib.getEffectCount((EffectType)t);
+    for (int e = 0; e < ecnt; e++){
+      EffectID effect = effectlib.getEffect((EffectType)t,e);
+      std::string name = effectlib.effectGetName(effect);
+      names.push_back(name);
+      ids.push_back((size_t)effect);
+      int gcnt = effectlib.effectGetGroupCount(effect);
+      for (int g = 0; g < gcnt; g++){
+        GroupID group = effectlib.effectGetGroup(effect,g);
+        names.push_back(name + "/" + effectlib.groupGetName(group));
+        ids.push_back((size_t)group);
+      }
+      int tcnt = effectlib.effectGetTechniqueCount(effect);
+      for (int i = 0; i < tcnt; i++){
+        TechID tech = effectlib.effectGetTechnique(effect,i);
+        names.push_back(name + "/" + effectlib.techniqueGetName(tech));
+        ids.push_back((size_t)tech);
+      }
+    }
+  }
+}
+
+void testReload(System &effectlib)
+{
+  std::vector<std::string> namesA;
+  std::vector<std::string> namesB;
+  std::vector<size_t>      idsA;
+  std::vector<size_t>      idsB;
+
+  collectIds(effectlib,namesA,idsA);
+  if (effectlib.reloadLibraryFile("../test/testfx.luafx")){
+    printf("reload error:%s\n",effectlib.getLastErrorString().c_str());
+    return;
+  }
+  collectIds(effectlib,namesB,idsB);
+
+  // ids must survive the reload
+  int mismatches = namesA != namesB || idsA != idsB;
+  printf("RELOAD %d techniques, mismatches: %d\n",effectlib.getReloadedTechniqueCount(),mismatches);
+
+  // FILE sources only affect the techniques using them
+  int fcnt = effectlib.getLibraryFileCount();
+  for (int i = 0; i < fcnt; i++){
+    std::string filename = effectlib.getLibraryFileName(i);
+    if (effectlib.reloadLibraryFile(filename.c_str())){
+      printf("reload error:%s\n",effectlib.getLastErrorString().c_str());
+      continue;
+    }
+    printf("RELOAD %s: %d techniques\n",filename.c_str(),effectlib.getReloadedTechniqueCount());
+  }
+
+  // nothing modified since loading
+  LibraryWatcher watcher;
+  watcher.init(effectlib,false);
+  int reloaded;
+  if (watcher.poll(&reloaded)){
+    printf("watch error:%s\n",effectlib.getLastErrorString().c_str());
+  }
+  printf("WATCH %s reloaded: %d\n",watcher.isPolling() ? "polling" : "notify",reloaded);
+  watcher.deinit();
+}
+
+// copies a file, replacing the first occurrence of from by to, and appends
+static bool writeFile(const char* src, const char* dst, const char* from, const char* to, const char* append)
+{
+  std::string content;
+  FILE* in = fopen(src,"rb");
+  if (!in) return true;
+  char buffer[4096];
+  size_t read;
+  while ((read = fread(buffer,1,sizeof(buffer),in)) > 0){
+    content.append(buffer,read);
+  }
+  fclose(in);
+
+  size_t pos = from ? content.find(from) : std::string::npos;
+  if (pos != std::string::npos){
+    content.replace(pos,strlen(from),to);
+  }
+  content += append;
+
+  FILE* out = fopen(dst,"wb");
+  if (!out) return true;
+  fwrite(content.data(),1,content.size(),out);
+  fclose(out);
+  return false;
+}
+
+// lit code for the sky light, through setGeneratorLights and a configuration
+static void generateSky(System &sys, std::string& code, std::string& configcode)
+{
+  EffectID sky    = sys.getEffect(EFFECT_LIGHT,"sky");
+  int      skyMax = 4;
+  TechID   tech   = sys.effectGetTechnique(sys.getEffect(EFFECT_MATERIAL,"ambilit"),0);
+  sys.setGeneratorLights(1,&sky,&skyMax);
+  LightConfigID config = sys.createLightConfig(1,&sky,&skyMax);
+  const char* view;
+  size_t      viewsize;
+  sys.techniqueGenerateCode(tech,GENERATOR_GLSL_UBO,0,code);
+  if (!sys.techniqueGenerateCodeView(tech,GENERATOR_GLSL_UBO,0,config,&view,&viewsize)){
+    configcode.assign(view,viewsize);
+  }
+  sys.destroyLightConfig(config);
+}
+
+void testReloadLights()
+{
+  // the sky light of another file uses the reloaded global group
+  if (writeFile("../test/testlightglobalfx.luafx","./lightglobalfx.luafx",NULL,NULL,"")){
+    printf("reload lights error: copy failed\n");
+    return;
+  }
+  System sys;
+  if (initTestSystem(sys,"reload lights")){
+    return;
+  }
+  if (sys.addLibraryFile("./lightglobalfx.luafx") ||
+      sys.addLibraryFile("../test/testlightfx.luafx"))
+  {
+    printf("reload lights error:%s\n",sys.getLastErrorString().c_str());
+    sys.deinit();
+    return;
+  }
+  EffectID sky    = sys.getEffect(EFFECT_LIGHT,"sky");
+  int      skyMax = 4;
+  TechID   tech   = sys.effectGetTechnique(sys.getEffect(EFFECT_MATERIAL,"ambilit"),0);
+  // the configuration keeps its light set and lua cache alive over the reload
+  LightConfigID config = sys.createLightConfig(1,&sky,&skyMax);
+  std::string before;
+  std::string beforeconfig;
+  generateSky(sys,before,beforeconfig);
+
+  writeFile("../test/testlightglobalfx.luafx","./lightglobalfx.luafx","vec3 \"horizon\",","vec3 \"horizon\",\n    vec3 \"nadir\",","");
+  if (sys.reloadLibraryFile("./lightglobalfx.luafx")){
+    printf("reload lights error:%s\n",sys.getLastErrorString().c_str());
+    sys.destroyLightConfig(config);
+    sys.deinit();
+    return;
+  }
+  bool changed = false;
+  for (int i = 0; i < sys.getReloadedTechniqueCount(); i++){
+    changed |= sys.getReloadedTechnique(i) == tech;
+  }
+  std::string after;
+  std::string afterconfig;
+  generateSky(sys,after,afterconfig);
+
+  // a fresh system loading the edited file
+  System ref;
+  std::string reference;
+  std::string referenceconfig;
+  if (initTestSystem(ref,"reload lights")){
+    sys.destroyLightConfig(config);
+    sys.deinit();
+    return;
+  }
+  if (ref.addLibraryFile("./lightglobalfx.luafx") ||
+      ref.addLibraryFile("../test/testlightfx.luafx"))
+  {
+    printf("reload lights error:%s\n",ref.getLastErrorString().c_str());
+  }
+  generateSky(ref,reference,referenceconfig);
+
+  int mismatches = !changed || before == after || after != reference || afterconfig != referenceconfig ? 1 : 0;
+  printf("RELOAD lights global %s, mismatches: %d\n",changed ? "changed" : "unchanged",mismatches);
+
+  sys.destroyLightConfig(config);
+  ref.deinit();
+  sys.deinit();
+}
+
+void testWatch()
+{
+  // edits a copy of the library and its FILE source, once per detection mode
+  for (int mode = 0; mode < 2; mode++){
+    if (writeFile("../test/testfx.luafx","./watchfx.luafx","testfx_normals.glsl","watchfx_normals.glsl","") ||
+        writeFile("../test/testfx_normals.glsl","./watchfx_normals.glsl",NULL,NULL,""))
+    {
+      printf("watch error: copy failed\n");
+      return;
+    }
+
+    System sys;
+    if (initTestSystem(sys,"watch","./watchfx.luafx")){
+      return;
+    }
+    TechID normals = sys.effectGetTechnique(sys.getEffect(EFFECT_MATERIAL,"normals"),0);
+
+    LibraryWatcher watcher;
+    watcher.init(sys,mode == 1);
+
+    // the size changes as well, coarse timestamps still see the edit
+    int reloadedFile;
+    writeFile("../test/testfx_normals.glsl","./watchfx_normals.glsl",NULL,NULL,"\n// edited\n");
+    bool fileError = watcher.poll(&reloadedFile);
+    bool fileTechs = watcher.getChangedTechniqueCount() == 1 && watcher.getChangedTechnique(0) == normals;
+
+    int reloadedLib;
+    writeFile("../test/testfx.luafx","./watchfx.luafx","testfx_normals.glsl","watchfx_normals.glsl","\n--// edited\n");
+    bool libError = watcher.poll(&reloadedLib);
+    int  libTechs = watcher.getChangedTechniqueCount();
+
+    int reloadedNone;
+    watcher.poll(&reloadedNone);
+
+    printf("WATCH %s file %s reloaded %d, normals %s, library %s reloaded %d, %d techniques, unchanged %d\n",
+      watcher.isPolling() ? "polling" : "notify", fileError ? "error" : "ok", reloadedFile, fileTechs ? "ok" : "mismatch",
+      libError ? "error" : "ok", reloadedLib, libTechs, reloadedNone);
+
+    watcher.deinit();
+    sys.deinit();
+  }
+  remove("./watchfx.luafx");
+  remove("./watchfx_normals.glsl");
+}
+
+void testStats(System &effectlib)
+{
+  SystemStats stats;
+  effectlib.getStats(&stats);
+  int codegenCalls = 0;
+  for (int g = 0; g < NUM_GENERERATORS; g++){
+    codegenCalls += (int)stats.codegenCalls[g];
+  }
+  printf("STATS %d library loads, %d codegen calls, %d bytes, %d groupstore calls, %d errors, heap %s\n",
+    (int)stats.libraryLoads, codegenCalls, (int)stats.codegenBytes, (int)stats.groupStoreCalls, 
+    (int)stats.luaErrors, stats.luaHeapBytes ? "ok" : "missing");
+
+  LibraryFileStats filestats;
+  effectlib.getLibraryFileStats(0,&filestats);
+  printf("STATS %s: %d loads, time %s\n", effectlib.getLibraryFileName(0).c_str(), 
+    (int)filestats.loads, filestats.time ? "ok" : "missing");
+
+  // errors are counted, the message is zero terminated
+  effectlib.resetStats();
+  if (effectlib.addLibraryString("error('stats test')",strlen("error('stats test')"))){
+    std::string error = effectlib.getLastErrorString();
+    effectlib.getStats(&stats);
+    printf("STATS error %d, length %s\n",(int)stats.luaErrors,
+      error.size() == effectlib.getLastErrorString(NULL,0) ? "ok" : "mismatch");
+  }
+  effectlib.resetStats();
+  effectlib.getStats(&stats);
+  effectlib.getLibraryFileStats(0,&filestats);
+  printf("STATS reset %d loads, %d errors, %d file loads\n",(int)stats.libraryLoads,(int)stats.luaErrors,(int)filestats.loads);
 }
 
 int main(int argc, char **argv)
@@ -129,6 +1486,25 @@ int main(int argc, char **argv)
   }
 
   testLib(effectLib);
+  testStorage(effectLib);
+  testDependencies(effectLib);
+  testArena(effectLib);
+  testDraw(effectLib);
+  testSortKeys(effectLib);
+  testAlloc(effectLib);
+  testFreeze(effectLib);
+  testPool(effectLib);
+  testService(effectLib);
+  testDedup();
+  testStep(effectLib);
+  testProgram(effectLib);
+  testSegments(effectLib);
+  testLights();
+  testImage(effectLib);
+  testReload(effectLib);
+  testWatch();
+  testReloadLights();
+  testStats(effectLib);
 
   return EXIT_SUCCESS;
 }